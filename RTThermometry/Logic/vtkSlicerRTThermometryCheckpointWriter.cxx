@@ -0,0 +1,339 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// RTThermometry Logic includes
+#include "vtkSlicerRTThermometryCheckpointWriter.h"
+
+// VTK includes
+#include <vtkConditionVariable.h>
+#include <vtkMutexLock.h>
+#include <vtkObjectFactory.h>
+#include <vtk_zlib.h>
+#ifdef _WIN32
+#include <vtkWindows.h>
+#endif
+
+// STD includes
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+//----------------------------------------------------------------------------
+vtkStandardNewMacro(vtkSlicerRTThermometryCheckpointWriter);
+
+const char* vtkSlicerRTThermometryCheckpointWriter::FileMagic = "RTTHCKP1";
+
+namespace
+{
+
+//----------------------------------------------------------------------------
+vtkTypeUInt32 ComputeChecksum(const std::vector<char>& payload)
+{
+  uLong checksum = adler32(0L, Z_NULL, 0);
+  // adler32() takes the length as a 32-bit integer
+  const size_t chunkSize = 1 << 30;
+  for (size_t offset = 0; offset < payload.size(); offset += chunkSize)
+    {
+    size_t length = std::min(chunkSize, payload.size() - offset);
+    checksum = adler32(checksum, reinterpret_cast<const Bytef*>(&payload[offset]),
+                       static_cast<uInt>(length));
+    }
+  return static_cast<vtkTypeUInt32>(checksum);
+}
+
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerRTThermometryCheckpointWriter::vtkSlicerRTThermometryCheckpointWriter()
+{
+  this->Threader = vtkMultiThreader::New();
+  this->WriterThreadID = -1;
+  this->Lock = vtkMutexLock::New();
+  this->CheckpointQueued = vtkConditionVariable::New();
+  this->Pending = false;
+  this->PendingTimestamp = 0.0;
+  this->StopWriter = false;
+  this->NumberOfCheckpoints = 0;
+  this->LastCheckpointTime = -1.0;
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerRTThermometryCheckpointWriter::~vtkSlicerRTThermometryCheckpointWriter()
+{
+  this->Close();
+
+  this->CheckpointQueued->Delete();
+  this->Lock->Delete();
+  this->Threader->Delete();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerRTThermometryCheckpointWriter::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+
+  os << indent << "FileName: " << this->FileName << "\n";
+  os << indent << "NumberOfCheckpoints: " << this->GetNumberOfCheckpoints() << "\n";
+  os << indent << "LastCheckpointTime: " << this->GetLastCheckpointTime() << "\n";
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerRTThermometryCheckpointWriter::Open(const char* fileName)
+{
+  if (!fileName || !*fileName)
+    {
+    return false;
+    }
+
+  this->Close();
+
+  this->FileName = fileName;
+  this->Pending = false;
+  this->StopWriter = false;
+  this->NumberOfCheckpoints = 0;
+  this->LastCheckpointTime = -1.0;
+  this->WriterThreadID = this->Threader->SpawnThread(
+    vtkSlicerRTThermometryCheckpointWriter::WriterThread, this);
+  return true;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerRTThermometryCheckpointWriter::Close()
+{
+  if (!this->IsOpen())
+    {
+    return;
+    }
+
+  // Let the writer finish the pending checkpoint, then wait for it
+  this->Lock->Lock();
+  this->StopWriter = true;
+  this->CheckpointQueued->Broadcast();
+  this->Lock->Unlock();
+  this->Threader->TerminateThread(this->WriterThreadID);
+  this->WriterThreadID = -1;
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerRTThermometryCheckpointWriter::IsOpen()
+{
+  return this->WriterThreadID >= 0;
+}
+
+//----------------------------------------------------------------------------
+const char* vtkSlicerRTThermometryCheckpointWriter::GetFileName()
+{
+  return this->FileName.c_str();
+}
+
+//----------------------------------------------------------------------------
+std::vector<char>* vtkSlicerRTThermometryCheckpointWriter::BeginCheckpoint()
+{
+  if (!this->IsOpen())
+    {
+    return NULL;
+    }
+
+  this->Lock->Lock();
+  bool pending = this->Pending;
+  this->Lock->Unlock();
+  return pending ? NULL : &this->Payload;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerRTThermometryCheckpointWriter::CommitCheckpoint(double timestamp)
+{
+  if (!this->IsOpen())
+    {
+    return;
+    }
+
+  this->Lock->Lock();
+  this->Pending = true;
+  this->PendingTimestamp = timestamp;
+  this->CheckpointQueued->Signal();
+  this->Lock->Unlock();
+}
+
+//----------------------------------------------------------------------------
+vtkIdType vtkSlicerRTThermometryCheckpointWriter::GetNumberOfCheckpoints()
+{
+  this->Lock->Lock();
+  vtkIdType count = this->NumberOfCheckpoints;
+  this->Lock->Unlock();
+  return count;
+}
+
+//----------------------------------------------------------------------------
+double vtkSlicerRTThermometryCheckpointWriter::GetLastCheckpointTime()
+{
+  this->Lock->Lock();
+  double time = this->LastCheckpointTime;
+  this->Lock->Unlock();
+  return time;
+}
+
+//----------------------------------------------------------------------------
+VTK_THREAD_RETURN_TYPE vtkSlicerRTThermometryCheckpointWriter::WriterThread(void* arg)
+{
+  vtkMultiThreader::ThreadInfo* info = static_cast<vtkMultiThreader::ThreadInfo*>(arg);
+  static_cast<vtkSlicerRTThermometryCheckpointWriter*>(info->UserData)->WriteCheckpoints();
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerRTThermometryCheckpointWriter::WriteCheckpoints()
+{
+  while (true)
+    {
+    this->Lock->Lock();
+    while (!this->Pending && !this->StopWriter)
+      {
+      this->CheckpointQueued->Wait(this->Lock);
+      }
+    if (!this->Pending)
+      {
+      // Stopped, nothing left to write
+      this->Lock->Unlock();
+      break;
+      }
+    this->Lock->Unlock();
+
+    bool written = this->WriteCheckpoint();
+
+    this->Lock->Lock();
+    if (written)
+      {
+      this->NumberOfCheckpoints++;
+      this->LastCheckpointTime = this->PendingTimestamp;
+      }
+    this->Pending = false;
+    this->Lock->Unlock();
+    }
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerRTThermometryCheckpointWriter::WriteCheckpoint()
+{
+  Header header;
+  memcpy(header.Magic, FileMagic, 8);
+  header.Version = CheckpointVersion;
+  header.Checksum = ComputeChecksum(this->Payload);
+  header.PayloadSize = this->Payload.size();
+  header.Timestamp = this->PendingTimestamp;
+
+  std::string temporaryFileName = this->FileName + ".tmp";
+  std::ofstream file(temporaryFileName.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!file.is_open())
+    {
+    vtkErrorMacro("WriteCheckpoint: Cannot create " << temporaryFileName);
+    return false;
+    }
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  if (!this->Payload.empty())
+    {
+    file.write(&this->Payload[0], static_cast<std::streamsize>(this->Payload.size()));
+    }
+  file.close();
+  if (file.fail())
+    {
+    vtkErrorMacro("WriteCheckpoint: Cannot write " << temporaryFileName);
+    remove(temporaryFileName.c_str());
+    return false;
+    }
+
+  // Replace the previous checkpoint in one step, there is always a complete
+  // checkpoint on disk. rename() does not replace an existing file on
+  // Windows.
+#ifdef _WIN32
+  bool replaced = MoveFileExA(temporaryFileName.c_str(), this->FileName.c_str(),
+                              MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+  bool replaced = rename(temporaryFileName.c_str(), this->FileName.c_str()) == 0;
+#endif
+  if (!replaced)
+    {
+    vtkErrorMacro("WriteCheckpoint: Cannot replace " << this->FileName);
+    return false;
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerRTThermometryCheckpointWriter::ReadCheckpoint(const char* fileName,
+                                                            std::vector<char>& payload,
+                                                            double* timestamp)
+{
+  if (!fileName)
+    {
+    return false;
+    }
+
+  std::ifstream file(fileName, std::ios::in | std::ios::binary);
+  std::string temporaryFileName = std::string(fileName) + ".tmp";
+  if (!file.is_open())
+    {
+    // Left by an interrupted replacement: used if it is complete and valid
+    file.open(temporaryFileName.c_str(), std::ios::in | std::ios::binary);
+    if (!file.is_open())
+      {
+      vtkGenericWarningMacro("ReadCheckpoint: Cannot open " << fileName);
+      return false;
+      }
+    vtkGenericWarningMacro("ReadCheckpoint: " << fileName << " is missing, reading "
+                           << temporaryFileName);
+    fileName = temporaryFileName.c_str();
+    }
+  file.seekg(0, std::ios::end);
+  vtkTypeUInt64 fileSize = static_cast<vtkTypeUInt64>(file.tellg());
+  file.seekg(0, std::ios::beg);
+
+  Header header;
+  if (fileSize < sizeof(header) ||
+      !file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+      memcmp(header.Magic, FileMagic, 8) != 0)
+    {
+    vtkGenericWarningMacro("ReadCheckpoint: " << fileName << " is not a checkpoint file");
+    return false;
+    }
+  if (header.Version != CheckpointVersion)
+    {
+    vtkGenericWarningMacro("ReadCheckpoint: " << fileName << " has version " << header.Version
+                           << ", expected " << CheckpointVersion);
+    return false;
+    }
+  if (header.PayloadSize != fileSize - sizeof(header))
+    {
+    vtkGenericWarningMacro("ReadCheckpoint: " << fileName << " is truncated");
+    return false;
+    }
+
+  payload.resize(static_cast<size_t>(header.PayloadSize));
+  if ((!payload.empty() && !file.read(&payload[0], static_cast<std::streamsize>(payload.size()))) ||
+      ComputeChecksum(payload) != header.Checksum)
+    {
+    vtkGenericWarningMacro("ReadCheckpoint: " << fileName << " is corrupted");
+    return false;
+    }
+
+  if (timestamp)
+    {
+    *timestamp = header.Timestamp;
+    }
+  return true;
+}
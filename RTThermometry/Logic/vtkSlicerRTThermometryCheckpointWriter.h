@@ -0,0 +1,132 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME vtkSlicerRTThermometryCheckpointWriter - session checkpoint file writer
+// .SECTION Description
+// This class writes snapshots of the thermometry pipeline state to a
+// checkpoint file from a background thread. The caller fills the snapshot
+// buffer returned by BeginCheckpoint() (a plain copy, whose capacity is
+// kept between checkpoints) and commits it; checksum and disk writes happen
+// on the writer thread. While a checkpoint is being written no new one can
+// be started, so a slow disk delays checkpoints instead of the frames.
+//
+// Each checkpoint is written to a temporary file that then replaces the
+// checkpoint file, so that a crash during a write leaves the previous
+// checkpoint intact. See vtkSlicerRTThermometryLogic::ResumeFromCheckpoint().
+
+#ifndef __vtkSlicerRTThermometryCheckpointWriter_h
+#define __vtkSlicerRTThermometryCheckpointWriter_h
+
+// VTK includes
+#include <vtkMultiThreader.h>
+#include <vtkObject.h>
+
+// STD includes
+#include <string>
+#include <vector>
+
+#include "vtkSlicerRTThermometryModuleLogicExport.h"
+
+class vtkConditionVariable;
+class vtkMutexLock;
+
+/// \ingroup Slicer_QtModules_ExtensionTemplate
+class VTK_SLICER_RTTHERMOMETRY_MODULE_LOGIC_EXPORT vtkSlicerRTThermometryCheckpointWriter :
+  public vtkObject
+{
+public:
+
+  static vtkSlicerRTThermometryCheckpointWriter *New();
+  vtkTypeMacro(vtkSlicerRTThermometryCheckpointWriter, vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  /// On-disk layout, in native byte order:
+  ///   Header, then PayloadSize bytes of checkpoint data
+  struct Header
+    {
+    char          Magic[8];
+    vtkTypeUInt32 Version;
+    vtkTypeUInt32 Checksum; // Adler-32 of the payload
+    vtkTypeUInt64 PayloadSize;
+    double        Timestamp;
+    };
+
+  static const char* FileMagic;
+
+  /// Version of the payload layout written by the logic
+  enum { CheckpointVersion = 2 };
+
+  /// Set the checkpoint file and start the writer thread.
+  bool Open(const char* fileName);
+
+  /// Write the pending checkpoint, then stop the writer thread. The
+  /// checkpoint file is kept.
+  void Close();
+
+  bool IsOpen();
+  const char* GetFileName();
+
+  /// Buffer to fill with the next checkpoint payload, or NULL if the
+  /// writer is closed or still writing the previous checkpoint.
+  std::vector<char>* BeginCheckpoint();
+
+  /// Queue the buffer returned by BeginCheckpoint(). Timestamp is in
+  /// seconds.
+  void CommitCheckpoint(double timestamp);
+
+  /// Checkpoints written to disk since Open(), and time of the last one
+  /// (-1 if none)
+  vtkIdType GetNumberOfCheckpoints();
+  double GetLastCheckpointTime();
+
+  /// Read the payload of a checkpoint file. If the file is missing, the
+  /// temporary file of an interrupted write (fileName.tmp) is read instead.
+  /// Return false if the file is missing, truncated, corrupted or of
+  /// another version.
+  static bool ReadCheckpoint(const char* fileName, std::vector<char>& payload,
+                             double* timestamp = NULL);
+
+protected:
+  vtkSlicerRTThermometryCheckpointWriter();
+  virtual ~vtkSlicerRTThermometryCheckpointWriter();
+
+  static VTK_THREAD_RETURN_TYPE WriterThread(void* arg);
+  void WriteCheckpoints();
+  bool WriteCheckpoint();
+
+  std::string FileName;
+  std::vector<char> Payload;
+
+  // Shared with the writer thread, protected by Lock. The payload belongs
+  // to the writer thread while Pending is set.
+  vtkMultiThreader* Threader;
+  int WriterThreadID;
+  vtkMutexLock* Lock;
+  vtkConditionVariable* CheckpointQueued;
+  bool Pending;
+  double PendingTimestamp;
+  bool StopWriter;
+  vtkIdType NumberOfCheckpoints;
+  double LastCheckpointTime;
+
+private:
+
+  vtkSlicerRTThermometryCheckpointWriter(const vtkSlicerRTThermometryCheckpointWriter&); // Not implemented
+  void operator=(const vtkSlicerRTThermometryCheckpointWriter&);                         // Not implemented
+};
+
+#endif
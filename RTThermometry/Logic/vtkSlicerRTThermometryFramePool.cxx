@@ -0,0 +1,160 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// RTThermometry Logic includes
+#include "vtkSlicerRTThermometryFramePool.h"
+
+// VTK includes
+#include <vtkImageData.h>
+#include <vtkObjectFactory.h>
+#include <vtkPointData.h>
+#include <vtkVersion.h>
+
+//----------------------------------------------------------------------------
+vtkStandardNewMacro(vtkSlicerRTThermometryFramePool);
+
+//----------------------------------------------------------------------------
+vtkSlicerRTThermometryFramePool::vtkSlicerRTThermometryFramePool()
+{
+  this->MaximumNumberOfBuffers = 8;
+  this->NumberOfAllocations = 0;
+  this->NumberOfReuses = 0;
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerRTThermometryFramePool::~vtkSlicerRTThermometryFramePool()
+{
+  this->Clear();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerRTThermometryFramePool::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+
+  os << indent << "MaximumNumberOfBuffers: " << this->MaximumNumberOfBuffers << "\n";
+  os << indent << "IdleBuffers: " << this->IdleBuffers.size()
+     << " (" << this->GetIdleMemorySize() << " KiB)\n";
+  os << indent << "NumberOfAllocations: " << this->NumberOfAllocations << "\n";
+  os << indent << "NumberOfReuses: " << this->NumberOfReuses << "\n";
+}
+
+//----------------------------------------------------------------------------
+vtkImageData* vtkSlicerRTThermometryFramePool::Acquire(const int extent[6], int scalarType)
+{
+  // Most recently released first, its pages are the most likely resident
+  for (std::deque<Buffer>::reverse_iterator it = this->IdleBuffers.rbegin();
+       it != this->IdleBuffers.rend(); ++it)
+    {
+    if (it->ScalarType != scalarType ||
+        it->Extent[0] != extent[0] || it->Extent[1] != extent[1] ||
+        it->Extent[2] != extent[2] || it->Extent[3] != extent[3] ||
+        it->Extent[4] != extent[4] || it->Extent[5] != extent[5])
+      {
+      continue;
+      }
+    vtkImageData* image = it->Image;
+    this->IdleBuffers.erase(--it.base());
+    image->Modified();
+    this->NumberOfReuses++;
+    return image;
+    }
+
+  vtkImageData* image = vtkImageData::New();
+  image->SetExtent(extent[0], extent[1], extent[2], extent[3], extent[4], extent[5]);
+#if VTK_MAJOR_VERSION <= 5
+  image->SetScalarType(scalarType);
+  image->SetNumberOfScalarComponents(1);
+  image->AllocateScalars();
+#else
+  image->AllocateScalars(scalarType, 1);
+#endif
+  this->NumberOfAllocations++;
+  return image;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerRTThermometryFramePool::Release(vtkImageData* image)
+{
+  if (!image)
+    {
+    return;
+    }
+  if (image->GetReferenceCount() > 1 || !image->GetPointData()->GetScalars() ||
+      this->MaximumNumberOfBuffers == 0)
+    {
+    image->Delete();
+    return;
+    }
+
+  Buffer buffer;
+  image->GetExtent(buffer.Extent);
+  buffer.ScalarType = image->GetScalarType();
+  buffer.Image = image;
+  this->IdleBuffers.push_back(buffer);
+  this->Trim();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerRTThermometryFramePool::SetMaximumNumberOfBuffers(int maximum)
+{
+  maximum = maximum < 0 ? 0 : maximum;
+  if (maximum == this->MaximumNumberOfBuffers)
+    {
+    return;
+    }
+  this->MaximumNumberOfBuffers = maximum;
+  this->Trim();
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerRTThermometryFramePool::GetNumberOfIdleBuffers()
+{
+  return static_cast<int>(this->IdleBuffers.size());
+}
+
+//----------------------------------------------------------------------------
+unsigned long vtkSlicerRTThermometryFramePool::GetIdleMemorySize()
+{
+  unsigned long size = 0;
+  for (size_t i = 0; i < this->IdleBuffers.size(); ++i)
+    {
+    size += this->IdleBuffers[i].Image->GetActualMemorySize();
+    }
+  return size;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerRTThermometryFramePool::Clear()
+{
+  for (size_t i = 0; i < this->IdleBuffers.size(); ++i)
+    {
+    this->IdleBuffers[i].Image->Delete();
+    }
+  this->IdleBuffers.clear();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerRTThermometryFramePool::Trim()
+{
+  while (this->IdleBuffers.size() > static_cast<size_t>(this->MaximumNumberOfBuffers))
+    {
+    this->IdleBuffers.front().Image->Delete();
+    this->IdleBuffers.pop_front();
+    }
+}
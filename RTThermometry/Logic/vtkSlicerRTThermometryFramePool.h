@@ -0,0 +1,98 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME vtkSlicerRTThermometryFramePool - recycled per-frame image buffers
+// .SECTION Description
+// This class keeps the image buffers released by the thermometry pipeline
+// (evicted temperature images, phase history of a previous baseline) and
+// hands them out again for frames of the same extent and scalar type, so
+// that the steady state does not allocate, fault in or free frame memory.
+
+#ifndef __vtkSlicerRTThermometryFramePool_h
+#define __vtkSlicerRTThermometryFramePool_h
+
+// VTK includes
+#include <vtkObject.h>
+
+// STD includes
+#include <deque>
+
+#include "vtkSlicerRTThermometryModuleLogicExport.h"
+
+class vtkImageData;
+
+/// \ingroup Slicer_QtModules_ExtensionTemplate
+class VTK_SLICER_RTTHERMOMETRY_MODULE_LOGIC_EXPORT vtkSlicerRTThermometryFramePool :
+  public vtkObject
+{
+public:
+
+  static vtkSlicerRTThermometryFramePool *New();
+  vtkTypeMacro(vtkSlicerRTThermometryFramePool, vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  /// Image with scalars allocated for an extent and scalar type, recycled
+  /// if possible. Content is undefined. The caller owns the reference, to
+  /// give back with Release() (or Delete()).
+  vtkImageData* Acquire(const int extent[6], int scalarType);
+
+  /// Give an image back to the pool. Images still referenced elsewhere
+  /// (e.g. displayed) are only unreferenced.
+  void Release(vtkImageData* image);
+
+  /// Maximum number of idle buffers kept (8 by default). The least
+  /// recently released ones are freed beyond it.
+  void SetMaximumNumberOfBuffers(int maximum);
+  vtkGetMacro(MaximumNumberOfBuffers, int);
+
+  int GetNumberOfIdleBuffers();
+  /// Memory held by idle buffers, in kibibytes
+  unsigned long GetIdleMemorySize();
+
+  /// Buffers allocated and recycled by Acquire()
+  vtkGetMacro(NumberOfAllocations, vtkIdType);
+  vtkGetMacro(NumberOfReuses, vtkIdType);
+
+  /// Free the idle buffers.
+  void Clear();
+
+protected:
+  vtkSlicerRTThermometryFramePool();
+  virtual ~vtkSlicerRTThermometryFramePool();
+
+  void Trim();
+
+  struct Buffer
+  {
+    int           Extent[6];
+    int           ScalarType;
+    vtkImageData* Image;
+  };
+  // Least recently released first
+  std::deque<Buffer> IdleBuffers;
+
+  int MaximumNumberOfBuffers;
+  vtkIdType NumberOfAllocations;
+  vtkIdType NumberOfReuses;
+
+private:
+
+  vtkSlicerRTThermometryFramePool(const vtkSlicerRTThermometryFramePool&); // Not implemented
+  void operator=(const vtkSlicerRTThermometryFramePool&);                  // Not implemented
+};
+
+#endif
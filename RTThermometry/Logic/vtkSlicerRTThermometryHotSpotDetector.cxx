@@ -0,0 +1,506 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// RTThermometry Logic includes
+#include "vtkSlicerRTThermometryHotSpotDetector.h"
+
+// VTK includes
+#include <vtkImageData.h>
+#include <vtkObjectFactory.h>
+
+// STD includes
+#include <algorithm>
+
+//----------------------------------------------------------------------------
+vtkStandardNewMacro(vtkSlicerRTThermometryHotSpotDetector);
+
+namespace
+{
+
+enum Passes
+{
+  LabelSlabs = 0,
+  FindRoots,
+  NumberRegions,
+  AccumulateRegions
+};
+
+} // end of anonymous namespace
+
+//----------------------------------------------------------------------------
+vtkSlicerRTThermometryHotSpotDetector::vtkSlicerRTThermometryHotSpotDetector()
+{
+  this->Threshold = 50.0;
+  this->MinimumNumberOfVoxels = 1;
+  this->NumberOfThreads = vtkMultiThreader::GetGlobalDefaultNumberOfThreads();
+  this->Threader = vtkMultiThreader::New();
+  this->Pass = LabelSlabs;
+  this->Temperature = NULL;
+  this->TemperatureScalarType = VTK_DOUBLE;
+  this->Dimensions[0] = this->Dimensions[1] = this->Dimensions[2] = 0;
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerRTThermometryHotSpotDetector::~vtkSlicerRTThermometryHotSpotDetector()
+{
+  this->Threader->Delete();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerRTThermometryHotSpotDetector::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+
+  os << indent << "Threshold: " << this->Threshold << "\n";
+  os << indent << "MinimumNumberOfVoxels: " << this->MinimumNumberOfVoxels << "\n";
+  os << indent << "NumberOfThreads: " << this->NumberOfThreads << "\n";
+  os << indent << "HotSpots: " << this->HotSpots.size() << "\n";
+  for (size_t hotSpot = 0; hotSpot < this->HotSpots.size(); ++hotSpot)
+    {
+    const HotSpot& spot = this->HotSpots[hotSpot];
+    os << indent.GetNextIndent() << hotSpot << ": centroid ("
+       << spot.Centroid[0] << ", " << spot.Centroid[1] << ", " << spot.Centroid[2]
+       << "), peak " << spot.Peak << ", " << spot.Volume << " mL\n";
+    }
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerRTThermometryHotSpotDetector::Detect(vtkImageData* temperature, const double spacing[3])
+{
+  this->HotSpots.clear();
+  if (!temperature ||
+      (temperature->GetScalarType() != VTK_FLOAT && temperature->GetScalarType() != VTK_DOUBLE))
+    {
+    vtkErrorMacro("Detect: Temperature image of float or double scalars expected");
+    return 0;
+    }
+
+  temperature->GetDimensions(this->Dimensions);
+  vtkIdType numberOfVoxels = temperature->GetNumberOfPoints();
+  vtkIdType numberOfRows = static_cast<vtkIdType>(this->Dimensions[1]) * this->Dimensions[2];
+  if (numberOfVoxels <= 0)
+    {
+    return 0;
+    }
+  this->Temperature = temperature->GetScalarPointer();
+  this->TemperatureScalarType = temperature->GetScalarType();
+  this->Parent.resize(numberOfVoxels);
+  this->Roots.resize(numberOfVoxels);
+
+  // Slabs of whole rows, one per thread
+  int numberOfSlabs = static_cast<int>(std::min<vtkIdType>(this->NumberOfThreads, numberOfRows));
+  this->SlabBegins.resize(numberOfSlabs + 1);
+  for (int slab = 0; slab <= numberOfSlabs; ++slab)
+    {
+    this->SlabBegins[slab] = numberOfRows * slab / numberOfSlabs * this->Dimensions[0];
+    }
+  this->RegionOffsets.assign(numberOfSlabs + 1, 0);
+  this->ForeignRegions.resize(numberOfSlabs);
+
+  this->Threader->SetNumberOfThreads(numberOfSlabs);
+  this->Threader->SetSingleMethod(ThreadedExecute, this);
+
+  this->Pass = LabelSlabs;
+  this->Threader->SingleMethodExecute();
+
+  // Join the trees of neighbors across slab boundaries: only the first
+  // slice of a slab has neighbors in the previous slabs
+  vtkIdType rowSize = this->Dimensions[0];
+  vtkIdType sliceSize = rowSize * this->Dimensions[1];
+  const vtkIdType* parent = &this->Parent[0];
+  for (int slab = 1; slab < numberOfSlabs; ++slab)
+    {
+    vtkIdType begin = this->SlabBegins[slab];
+    vtkIdType end = std::min(begin + sliceSize, this->SlabBegins[slab + 1]);
+    for (vtkIdType voxel = begin; voxel < end; ++voxel)
+      {
+      if (parent[voxel] < 0)
+        {
+        continue;
+        }
+      if (voxel - rowSize < begin && voxel % sliceSize >= rowSize && parent[voxel - rowSize] >= 0)
+        {
+        this->Union(voxel, voxel - rowSize);
+        }
+      if (voxel >= sliceSize && parent[voxel - sliceSize] >= 0)
+        {
+        this->Union(voxel, voxel - sliceSize);
+        }
+      }
+    }
+
+  this->Pass = FindRoots;
+  this->Threader->SingleMethodExecute();
+
+  // Regions are numbered in the order of their root voxel
+  for (int slab = 0; slab < numberOfSlabs; ++slab)
+    {
+    this->RegionOffsets[slab + 1] += this->RegionOffsets[slab];
+    }
+  this->Regions.resize(this->RegionOffsets[numberOfSlabs]);
+
+  this->Pass = NumberRegions;
+  this->Threader->SingleMethodExecute();
+  this->Pass = AccumulateRegions;
+  this->Threader->SingleMethodExecute();
+
+  for (int slab = 1; slab < numberOfSlabs; ++slab)
+    {
+    std::map<vtkIdType, Region>& foreignRegions = this->ForeignRegions[slab];
+    for (std::map<vtkIdType, Region>::const_iterator it = foreignRegions.begin();
+         it != foreignRegions.end(); ++it)
+      {
+      MergeRegion(this->Regions[it->first], it->second);
+      }
+    }
+
+  int extent[6];
+  temperature->GetExtent(extent);
+  double voxelVolume = spacing[0] * spacing[1] * spacing[2] / 1000.0;
+  for (size_t index = 0; index < this->Regions.size(); ++index)
+    {
+    const Region& region = this->Regions[index];
+    if (region.NumberOfVoxels < this->MinimumNumberOfVoxels)
+      {
+      continue;
+      }
+    HotSpot spot;
+    for (int axis = 0; axis < 3; ++axis)
+      {
+      spot.Centroid[axis] = extent[2*axis] + region.Sum[axis] / region.NumberOfVoxels;
+      }
+    spot.PeakPosition[0] = extent[0] + static_cast<int>(region.PeakVoxel % rowSize);
+    spot.PeakPosition[1] = extent[2] + static_cast<int>(region.PeakVoxel % sliceSize / rowSize);
+    spot.PeakPosition[2] = extent[4] + static_cast<int>(region.PeakVoxel / sliceSize);
+    spot.Peak = region.Peak;
+    spot.Volume = region.NumberOfVoxels * voxelVolume;
+    spot.NumberOfVoxels = region.NumberOfVoxels;
+    this->HotSpots.push_back(spot);
+    }
+  std::stable_sort(this->HotSpots.begin(), this->HotSpots.end(), IsHotter);
+
+  this->Temperature = NULL;
+  this->Modified();
+  return static_cast<int>(this->HotSpots.size());
+}
+
+//----------------------------------------------------------------------------
+VTK_THREAD_RETURN_TYPE vtkSlicerRTThermometryHotSpotDetector::ThreadedExecute(void* arg)
+{
+  vtkMultiThreader::ThreadInfo* info = static_cast<vtkMultiThreader::ThreadInfo*>(arg);
+  vtkSlicerRTThermometryHotSpotDetector* self =
+    static_cast<vtkSlicerRTThermometryHotSpotDetector*>(info->UserData);
+  self->ExecutePass(info->ThreadID);
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerRTThermometryHotSpotDetector::ExecutePass(int slab)
+{
+  vtkIdType begin = this->SlabBegins[slab];
+  vtkIdType end = this->SlabBegins[slab + 1];
+  vtkIdType rowSize = this->Dimensions[0];
+  vtkIdType sliceSize = rowSize * this->Dimensions[1];
+  vtkIdType* parent = &this->Parent[0];
+  vtkIdType* roots = &this->Roots[0];
+
+  switch (this->Pass)
+    {
+    case LabelSlabs:
+      if (this->TemperatureScalarType == VTK_FLOAT)
+        {
+        this->LabelSlab(static_cast<const float*>(this->Temperature), begin, end);
+        }
+      else
+        {
+        this->LabelSlab(static_cast<const double*>(this->Temperature), begin, end);
+        }
+      break;
+
+    case FindRoots:
+      {
+      // The forest is complete: read only, other slabs are walked too
+      vtkIdType numberOfRoots = 0;
+      for (vtkIdType voxel = begin; voxel < end; ++voxel)
+        {
+        vtkIdType root = parent[voxel];
+        if (root >= 0)
+          {
+          while (parent[root] != root)
+            {
+            root = parent[root];
+            }
+          numberOfRoots += root == voxel ? 1 : 0;
+          }
+        roots[voxel] = root;
+        }
+      this->RegionOffsets[slab + 1] = numberOfRoots;
+      break;
+      }
+
+    case NumberRegions:
+      {
+      vtkIdType region = this->RegionOffsets[slab];
+      for (vtkIdType voxel = begin; voxel < end; ++voxel)
+        {
+        if (roots[voxel] != voxel)
+          {
+          continue;
+          }
+        Region& newRegion = this->Regions[region];
+        newRegion.NumberOfVoxels = 0;
+        newRegion.Sum[0] = newRegion.Sum[1] = newRegion.Sum[2] = 0.0;
+        newRegion.Peak = -VTK_DOUBLE_MAX;
+        newRegion.PeakVoxel = voxel;
+        parent[voxel] = region++;
+        }
+      this->ForeignRegions[slab].clear();
+      break;
+      }
+
+    case AccumulateRegions:
+      {
+      // Regions rooted in this slab are only accumulated by this thread,
+      // the others are merged once all threads are done
+      vtkIdType firstRegion = this->RegionOffsets[slab];
+      std::map<vtkIdType, Region>& foreignRegions = this->ForeignRegions[slab];
+      vtkIdType cachedIndex = -1;
+      Region* region = NULL;
+      for (vtkIdType row = begin; row < end; row += rowSize)
+        {
+        double j = static_cast<double>(row % sliceSize / rowSize);
+        double k = static_cast<double>(row / sliceSize);
+        for (vtkIdType i = 0; i < rowSize; ++i)
+          {
+          vtkIdType voxel = row + i;
+          if (roots[voxel] < 0)
+            {
+            continue;
+            }
+          vtkIdType index = parent[roots[voxel]];
+          if (index != cachedIndex)
+            {
+            if (index >= firstRegion)
+              {
+              region = &this->Regions[index];
+              }
+            else
+              {
+              std::map<vtkIdType, Region>::iterator it = foreignRegions.find(index);
+              if (it == foreignRegions.end())
+                {
+                Region newRegion;
+                newRegion.NumberOfVoxels = 0;
+                newRegion.Sum[0] = newRegion.Sum[1] = newRegion.Sum[2] = 0.0;
+                newRegion.Peak = -VTK_DOUBLE_MAX;
+                newRegion.PeakVoxel = voxel;
+                it = foreignRegions.insert(std::make_pair(index, newRegion)).first;
+                }
+              region = &it->second;
+              }
+            cachedIndex = index;
+            }
+          region->NumberOfVoxels++;
+          region->Sum[0] += static_cast<double>(i);
+          region->Sum[1] += j;
+          region->Sum[2] += k;
+          double value = this->GetTemperature(voxel);
+          if (value > region->Peak)
+            {
+            region->Peak = value;
+            region->PeakVoxel = voxel;
+            }
+          }
+        }
+      break;
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+template <class Real>
+void vtkSlicerRTThermometryHotSpotDetector::LabelSlab(const Real* temperature,
+                                                      vtkIdType begin, vtkIdType end)
+{
+  vtkIdType rowSize = this->Dimensions[0];
+  vtkIdType sliceSize = rowSize * this->Dimensions[1];
+  vtkIdType* parent = &this->Parent[0];
+
+  // Neighbors outside of the slab are joined afterwards
+  double threshold = this->Threshold;
+  for (vtkIdType row = begin; row < end; row += rowSize)
+    {
+    bool previousRow = row - rowSize >= begin && row % sliceSize != 0;
+    bool previousSlice = row - sliceSize >= begin;
+    const Real* rowTemperature = temperature + row;
+    for (vtkIdType i = 0; i < rowSize; ++i)
+      {
+      vtkIdType voxel = row + i;
+      if (!(rowTemperature[i] > threshold))
+        {
+        parent[voxel] = -1;
+        continue;
+        }
+      parent[voxel] = voxel;
+      if (i > 0 && parent[voxel - 1] >= 0)
+        {
+        this->Union(voxel, voxel - 1);
+        }
+      if (previousRow && parent[voxel - rowSize] >= 0)
+        {
+        this->Union(voxel, voxel - rowSize);
+        }
+      if (previousSlice && parent[voxel - sliceSize] >= 0)
+        {
+        this->Union(voxel, voxel - sliceSize);
+        }
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+double vtkSlicerRTThermometryHotSpotDetector::GetTemperature(vtkIdType voxel)
+{
+  if (this->TemperatureScalarType == VTK_FLOAT)
+    {
+    return static_cast<const float*>(this->Temperature)[voxel];
+    }
+  return static_cast<const double*>(this->Temperature)[voxel];
+}
+
+//----------------------------------------------------------------------------
+vtkIdType vtkSlicerRTThermometryHotSpotDetector::Find(vtkIdType voxel)
+{
+  // Path halving
+  vtkIdType* parent = &this->Parent[0];
+  while (parent[voxel] != voxel)
+    {
+    parent[voxel] = parent[parent[voxel]];
+    voxel = parent[voxel];
+    }
+  return voxel;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerRTThermometryHotSpotDetector::Union(vtkIdType first, vtkIdType second)
+{
+  // The lowest voxel of a region is its root, so that trees built in a
+  // slab stay in the slab
+  vtkIdType firstRoot = this->Find(first);
+  vtkIdType secondRoot = this->Find(second);
+  if (firstRoot < secondRoot)
+    {
+    this->Parent[secondRoot] = firstRoot;
+    }
+  else if (secondRoot < firstRoot)
+    {
+    this->Parent[firstRoot] = secondRoot;
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerRTThermometryHotSpotDetector::MergeRegion(Region& region, const Region& other)
+{
+  region.NumberOfVoxels += other.NumberOfVoxels;
+  for (int axis = 0; axis < 3; ++axis)
+    {
+    region.Sum[axis] += other.Sum[axis];
+    }
+  if (other.Peak > region.Peak ||
+      (other.Peak == region.Peak && other.PeakVoxel < region.PeakVoxel))
+    {
+    region.Peak = other.Peak;
+    region.PeakVoxel = other.PeakVoxel;
+    }
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerRTThermometryHotSpotDetector::IsHotter(const HotSpot& first, const HotSpot& second)
+{
+  return first.Peak > second.Peak;
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerRTThermometryHotSpotDetector::GetNumberOfHotSpots()
+{
+  return static_cast<int>(this->HotSpots.size());
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerRTThermometryHotSpotDetector::GetHotSpotCentroid(int hotSpot, double ijk[3])
+{
+  if (hotSpot < 0 || hotSpot >= this->GetNumberOfHotSpots())
+    {
+    return false;
+    }
+  for (int axis = 0; axis < 3; ++axis)
+    {
+    ijk[axis] = this->HotSpots[hotSpot].Centroid[axis];
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerRTThermometryHotSpotDetector::GetHotSpotPeakPosition(int hotSpot, int ijk[3])
+{
+  if (hotSpot < 0 || hotSpot >= this->GetNumberOfHotSpots())
+    {
+    return false;
+    }
+  for (int axis = 0; axis < 3; ++axis)
+    {
+    ijk[axis] = this->HotSpots[hotSpot].PeakPosition[axis];
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+double vtkSlicerRTThermometryHotSpotDetector::GetHotSpotPeak(int hotSpot)
+{
+  if (hotSpot < 0 || hotSpot >= this->GetNumberOfHotSpots())
+    {
+    return 0.0;
+    }
+  return this->HotSpots[hotSpot].Peak;
+}
+
+//----------------------------------------------------------------------------
+double vtkSlicerRTThermometryHotSpotDetector::GetHotSpotVolume(int hotSpot)
+{
+  if (hotSpot < 0 || hotSpot >= this->GetNumberOfHotSpots())
+    {
+    return 0.0;
+    }
+  return this->HotSpots[hotSpot].Volume;
+}
+
+//----------------------------------------------------------------------------
+vtkIdType vtkSlicerRTThermometryHotSpotDetector::GetHotSpotNumberOfVoxels(int hotSpot)
+{
+  if (hotSpot < 0 || hotSpot >= this->GetNumberOfHotSpots())
+    {
+    return 0;
+    }
+  return this->HotSpots[hotSpot].NumberOfVoxels;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerRTThermometryHotSpotDetector::Clear()
+{
+  this->HotSpots.clear();
+  this->Modified();
+}
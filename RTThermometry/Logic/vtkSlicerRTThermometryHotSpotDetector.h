@@ -0,0 +1,138 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME vtkSlicerRTThermometryHotSpotDetector - connected regions above a temperature
+// .SECTION Description
+// This class labels the 6-connected regions of a temperature image above a
+// threshold and reports the centroid, volume and peak of each one. Labeling
+// is a union-find over slabs of rows processed in parallel, whose trees are
+// then joined across the slab boundaries, so a frame is labeled in a few
+// passes over the image whatever the shape of the regions.
+
+#ifndef __vtkSlicerRTThermometryHotSpotDetector_h
+#define __vtkSlicerRTThermometryHotSpotDetector_h
+
+// VTK includes
+#include <vtkMultiThreader.h>
+#include <vtkObject.h>
+
+// STD includes
+#include <map>
+#include <vector>
+
+#include "vtkSlicerRTThermometryModuleLogicExport.h"
+
+class vtkImageData;
+
+/// \ingroup Slicer_QtModules_ExtensionTemplate
+class VTK_SLICER_RTTHERMOMETRY_MODULE_LOGIC_EXPORT vtkSlicerRTThermometryHotSpotDetector :
+  public vtkObject
+{
+public:
+
+  static vtkSlicerRTThermometryHotSpotDetector *New();
+  vtkTypeMacro(vtkSlicerRTThermometryHotSpotDetector, vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  /// Voxels strictly above the threshold (50 C by default) form hot spots
+  vtkSetMacro(Threshold, double);
+  vtkGetMacro(Threshold, double);
+
+  /// Regions smaller than this number of voxels (1 by default) are ignored
+  vtkSetClampMacro(MinimumNumberOfVoxels, int, 1, VTK_INT_MAX);
+  vtkGetMacro(MinimumNumberOfVoxels, int);
+
+  /// Number of threads labeling the image
+  vtkSetClampMacro(NumberOfThreads, int, 1, VTK_MAX_THREADS);
+  vtkGetMacro(NumberOfThreads, int);
+
+  /// Label a temperature image (float or double scalars). The spacing of the
+  /// acquisition gives the volumes, the image extent the voxel indices.
+  /// Return the number of hot spots, sorted by decreasing peak.
+  int Detect(vtkImageData* temperature, const double spacing[3]);
+
+  /// Hot spots of the last detection. Centroids and peak positions are
+  /// voxel indices in the extent of the image, volumes are in mL.
+  int GetNumberOfHotSpots();
+  bool GetHotSpotCentroid(int hotSpot, double ijk[3]);
+  bool GetHotSpotPeakPosition(int hotSpot, int ijk[3]);
+  double GetHotSpotPeak(int hotSpot);
+  double GetHotSpotVolume(int hotSpot);
+  vtkIdType GetHotSpotNumberOfVoxels(int hotSpot);
+
+  /// Forget the hot spots of the last detection.
+  void Clear();
+
+protected:
+  vtkSlicerRTThermometryHotSpotDetector();
+  virtual ~vtkSlicerRTThermometryHotSpotDetector();
+
+  struct Region
+  {
+    vtkIdType NumberOfVoxels;
+    double    Sum[3];
+    double    Peak;
+    vtkIdType PeakVoxel;
+  };
+  static void MergeRegion(Region& region, const Region& other);
+
+  static VTK_THREAD_RETURN_TYPE ThreadedExecute(void* arg);
+  void ExecutePass(int slab);
+  template <class Real>
+  void LabelSlab(const Real* temperature, vtkIdType begin, vtkIdType end);
+  double GetTemperature(vtkIdType voxel);
+  vtkIdType Find(vtkIdType voxel);
+  void Union(vtkIdType first, vtkIdType second);
+
+  double Threshold;
+  int MinimumNumberOfVoxels;
+  int NumberOfThreads;
+  vtkMultiThreader* Threader;
+
+  // Labeling state, kept between frames to avoid reallocations. Parent is
+  // the union-find forest (-1 below threshold), then the region of every
+  // root; Roots is the root of every voxel once the forest is complete.
+  int Pass;
+  const void* Temperature;
+  int TemperatureScalarType;
+  int Dimensions[3];
+  std::vector<vtkIdType> Parent;
+  std::vector<vtkIdType> Roots;
+  std::vector<vtkIdType> SlabBegins;
+  std::vector<vtkIdType> RegionOffsets;
+  std::vector<Region> Regions;
+  // Per thread, regions rooted in an earlier slab
+  std::vector<std::map<vtkIdType, Region> > ForeignRegions;
+
+  struct HotSpot
+  {
+    double    Centroid[3];
+    int       PeakPosition[3];
+    double    Peak;
+    double    Volume;
+    vtkIdType NumberOfVoxels;
+  };
+  std::vector<HotSpot> HotSpots;
+  static bool IsHotter(const HotSpot& first, const HotSpot& second);
+
+private:
+
+  vtkSlicerRTThermometryHotSpotDetector(const vtkSlicerRTThermometryHotSpotDetector&); // Not implemented
+  void operator=(const vtkSlicerRTThermometryHotSpotDetector&);                        // Not implemented
+};
+
+#endif
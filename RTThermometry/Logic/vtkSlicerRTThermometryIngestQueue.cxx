@@ -0,0 +1,218 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// RTThermometry Logic includes
+#include "vtkSlicerRTThermometryFramePool.h"
+#include "vtkSlicerRTThermometryIngestQueue.h"
+#include "vtkSlicerRTThermometryProfiler.h"
+
+// VTK includes
+#include <vtkImageData.h>
+#include <vtkObjectFactory.h>
+#include <vtkPointData.h>
+#include <vtkTimerLog.h>
+
+// STD includes
+#include <cstring>
+
+//----------------------------------------------------------------------------
+vtkStandardNewMacro(vtkSlicerRTThermometryIngestQueue);
+
+//----------------------------------------------------------------------------
+vtkSlicerRTThermometryIngestQueue::vtkSlicerRTThermometryIngestQueue()
+{
+  this->MaximumDepth = 2;
+  this->DropPolicy = DropOldest;
+  this->LateFrameThreshold = 0.5;
+  this->FramePool = NULL;
+  this->Profiler = NULL;
+  this->ResetCounters();
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerRTThermometryIngestQueue::~vtkSlicerRTThermometryIngestQueue()
+{
+  this->Clear();
+  this->SetFramePool(NULL);
+  this->SetProfiler(NULL);
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerRTThermometryIngestQueue::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+
+  os << indent << "MaximumDepth: " << this->MaximumDepth << "\n";
+  os << indent << "DropPolicy: " << (this->DropPolicy == DropOldest ? "DropOldest" : "DropNewest") << "\n";
+  os << indent << "LateFrameThreshold: " << this->LateFrameThreshold << "\n";
+  os << indent << "Depth: " << this->Frames.size() << "\n";
+  os << indent << "NumberOfReceivedFrames: " << this->NumberOfReceivedFrames << "\n";
+  os << indent << "NumberOfDroppedFrames: " << this->NumberOfDroppedFrames << "\n";
+  os << indent << "NumberOfLateFrames: " << this->NumberOfLateFrames << "\n";
+}
+
+//----------------------------------------------------------------------------
+vtkCxxSetObjectMacro(vtkSlicerRTThermometryIngestQueue, FramePool, vtkSlicerRTThermometryFramePool);
+vtkCxxSetObjectMacro(vtkSlicerRTThermometryIngestQueue, Profiler, vtkSlicerRTThermometryProfiler);
+
+//----------------------------------------------------------------------------
+void vtkSlicerRTThermometryIngestQueue::SetMaximumDepth(int depth)
+{
+  depth = depth < 1 ? 1 : depth;
+  if (depth == this->MaximumDepth)
+    {
+    return;
+    }
+  this->MaximumDepth = depth;
+  // Frames beyond the new depth are dropped as by a full queue
+  while (static_cast<int>(this->Frames.size()) > this->MaximumDepth)
+    {
+    if (this->DropPolicy == DropOldest)
+      {
+      this->Drop(this->Frames.front().Image);
+      this->Frames.pop_front();
+      }
+    else
+      {
+      this->Drop(this->Frames.back().Image);
+      this->Frames.pop_back();
+      }
+    }
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerRTThermometryIngestQueue::Push(vtkImageData* image, double arrivalTime)
+{
+  if (!image || !image->GetPointData()->GetScalars())
+    {
+    return false;
+    }
+
+  this->NumberOfReceivedFrames++;
+  if (static_cast<int>(this->Frames.size()) >= this->MaximumDepth)
+    {
+    if (this->DropPolicy == DropNewest)
+      {
+      this->Drop(NULL);
+      return false;
+      }
+    this->Drop(this->Frames.front().Image);
+    this->Frames.pop_front();
+    }
+
+  QueuedFrame frame;
+  frame.ArrivalTime = arrivalTime;
+  if (this->FramePool && image->GetNumberOfScalarComponents() == 1)
+    {
+    frame.Image = this->FramePool->Acquire(image->GetExtent(), image->GetScalarType());
+    memcpy(frame.Image->GetScalarPointer(), image->GetScalarPointer(),
+           static_cast<size_t>(image->GetNumberOfPoints()) * image->GetScalarSize());
+    frame.Image->SetSpacing(image->GetSpacing());
+    frame.Image->SetOrigin(image->GetOrigin());
+    }
+  else
+    {
+    frame.Image = vtkImageData::New();
+    frame.Image->DeepCopy(image);
+    }
+  this->Frames.push_back(frame);
+  return true;
+}
+
+//----------------------------------------------------------------------------
+vtkImageData* vtkSlicerRTThermometryIngestQueue::Pop(double* arrivalTime)
+{
+  if (this->Frames.empty())
+    {
+    return NULL;
+    }
+
+  QueuedFrame frame = this->Frames.front();
+  this->Frames.pop_front();
+  if (arrivalTime)
+    {
+    *arrivalTime = frame.ArrivalTime;
+    }
+  if (vtkTimerLog::GetUniversalTime() - frame.ArrivalTime > this->LateFrameThreshold)
+    {
+    this->NumberOfLateFrames++;
+    if (this->Profiler)
+      {
+      this->Profiler->IncrementCounter(vtkSlicerRTThermometryProfiler::LateFrames);
+      }
+    }
+  return frame.Image;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerRTThermometryIngestQueue::Release(vtkImageData* image)
+{
+  if (!image)
+    {
+    return;
+    }
+  if (this->FramePool)
+    {
+    this->FramePool->Release(image);
+    }
+  else
+    {
+    image->Delete();
+    }
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerRTThermometryIngestQueue::GetDepth()
+{
+  return static_cast<int>(this->Frames.size());
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerRTThermometryIngestQueue::IsEmpty()
+{
+  return this->Frames.empty();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerRTThermometryIngestQueue::Clear()
+{
+  for (size_t i = 0; i < this->Frames.size(); ++i)
+    {
+    this->Release(this->Frames[i].Image);
+    }
+  this->Frames.clear();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerRTThermometryIngestQueue::ResetCounters()
+{
+  this->NumberOfReceivedFrames = 0;
+  this->NumberOfDroppedFrames = 0;
+  this->NumberOfLateFrames = 0;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerRTThermometryIngestQueue::Drop(vtkImageData* image)
+{
+  this->Release(image);
+  this->NumberOfDroppedFrames++;
+  if (this->Profiler)
+    {
+    this->Profiler->IncrementCounter(vtkSlicerRTThermometryProfiler::DroppedFrames);
+    }
+}
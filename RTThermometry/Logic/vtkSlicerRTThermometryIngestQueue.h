@@ -0,0 +1,131 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME vtkSlicerRTThermometryIngestQueue - bounded queue of incoming frames
+// .SECTION Description
+// This class decouples the reception of phase frames from their
+// processing. Push() copies the received image into a recycled buffer, so
+// that the receive buffer can be overwritten by the next frame, and the
+// frames are processed later in arrival order. The queue is bounded: when
+// it is full, either the oldest queued frame or the new one is dropped.
+// Dropping frames is safe for the accumulated phase, which is the sum of
+// the differences between processed frames.
+// Frames that waited longer than LateFrameThreshold are counted as late.
+// The queue is meant to be used from a single (GUI) thread.
+
+#ifndef __vtkSlicerRTThermometryIngestQueue_h
+#define __vtkSlicerRTThermometryIngestQueue_h
+
+// VTK includes
+#include <vtkObject.h>
+
+// STD includes
+#include <deque>
+
+#include "vtkSlicerRTThermometryModuleLogicExport.h"
+
+class vtkImageData;
+class vtkSlicerRTThermometryFramePool;
+class vtkSlicerRTThermometryProfiler;
+
+/// \ingroup Slicer_QtModules_ExtensionTemplate
+class VTK_SLICER_RTTHERMOMETRY_MODULE_LOGIC_EXPORT vtkSlicerRTThermometryIngestQueue :
+  public vtkObject
+{
+public:
+
+  static vtkSlicerRTThermometryIngestQueue *New();
+  vtkTypeMacro(vtkSlicerRTThermometryIngestQueue, vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  enum DropPolicies
+    {
+    DropOldest = 0,
+    DropNewest
+    };
+
+  /// Number of frames waiting to be processed before frames are dropped
+  /// (2 by default)
+  void SetMaximumDepth(int depth);
+  vtkGetMacro(MaximumDepth, int);
+  vtkSetClampMacro(DropPolicy, int, DropOldest, DropNewest);
+  vtkGetMacro(DropPolicy, int);
+
+  /// Waiting time, in seconds, above which a frame is late (0.5 by default)
+  vtkSetClampMacro(LateFrameThreshold, double, 0.0, VTK_DOUBLE_MAX);
+  vtkGetMacro(LateFrameThreshold, double);
+
+  /// Buffers of the queued frames. Dropped and processed frames are
+  /// released to it. Optional.
+  void SetFramePool(vtkSlicerRTThermometryFramePool* pool);
+  vtkGetObjectMacro(FramePool, vtkSlicerRTThermometryFramePool);
+
+  /// Dropped and late frames are also counted by the profiler. Optional.
+  void SetProfiler(vtkSlicerRTThermometryProfiler* profiler);
+  vtkGetObjectMacro(Profiler, vtkSlicerRTThermometryProfiler);
+
+  /// Queue a copy of a frame received at arrivalTime (seconds).
+  /// Return false if it was dropped.
+  bool Push(vtkImageData* image, double arrivalTime);
+
+  /// Oldest queued frame, or NULL if the queue is empty. The caller owns
+  /// the reference and gives it back with Release().
+  vtkImageData* Pop(double* arrivalTime);
+  void Release(vtkImageData* image);
+
+  int GetDepth();
+  bool IsEmpty();
+
+  /// Drop the queued frames, without counting them.
+  void Clear();
+
+  /// Frames received, dropped and late since the last ResetCounters()
+  vtkGetMacro(NumberOfReceivedFrames, vtkIdType);
+  vtkGetMacro(NumberOfDroppedFrames, vtkIdType);
+  vtkGetMacro(NumberOfLateFrames, vtkIdType);
+  void ResetCounters();
+
+protected:
+  vtkSlicerRTThermometryIngestQueue();
+  virtual ~vtkSlicerRTThermometryIngestQueue();
+
+  void Drop(vtkImageData* image);
+
+  struct QueuedFrame
+  {
+    vtkImageData* Image;
+    double        ArrivalTime;
+  };
+  std::deque<QueuedFrame> Frames;
+
+  int MaximumDepth;
+  int DropPolicy;
+  double LateFrameThreshold;
+  vtkSlicerRTThermometryFramePool* FramePool;
+  vtkSlicerRTThermometryProfiler* Profiler;
+
+  vtkIdType NumberOfReceivedFrames;
+  vtkIdType NumberOfDroppedFrames;
+  vtkIdType NumberOfLateFrames;
+
+private:
+
+  vtkSlicerRTThermometryIngestQueue(const vtkSlicerRTThermometryIngestQueue&); // Not implemented
+  void operator=(const vtkSlicerRTThermometryIngestQueue&);                    // Not implemented
+};
+
+#endif
@@ -17,67 +17,4926 @@
 
 // RTThermometry Logic includes
 #include "vtkSlicerRTThermometryLogic.h"
+#include "vtkSlicerRTThermometryCheckpointWriter.h"
+#include "vtkSlicerRTThermometryFramePool.h"
+#include "vtkSlicerRTThermometryHotSpotDetector.h"
+#include "vtkSlicerRTThermometryIngestQueue.h"
+#include "vtkSlicerRTThermometryProfiler.h"
+#include "vtkSlicerRTThermometrySessionReader.h"
+#include "vtkSlicerRTThermometrySessionRecorder.h"
 
 // MRML includes
 
 // VTK includes
+#include <vtkImageData.h>
 #include <vtkIntArray.h>
+#include <vtkMarchingCubes.h>
 #include <vtkNew.h>
 #include <vtkObjectFactory.h>
+#include <vtkPointData.h>
+#include <vtkPolyData.h>
+#include <vtkTimerLog.h>
+#include <vtkVersion.h>
 
 // STD includes
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <sstream>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
 
 //----------------------------------------------------------------------------
 vtkStandardNewMacro(vtkSlicerRTThermometryLogic);
 
 //----------------------------------------------------------------------------
-vtkSlicerRTThermometryLogic::vtkSlicerRTThermometryLogic()
+namespace
+{
+
+struct PhaseKernelArgs
+{
+  void*     Previous;
+  void*     Current;
+  void*     Accumulated;
+  void*     Temperature;
+  int       ScalarType;
+  // VTK_FLOAT or VTK_DOUBLE: precision of the conversion into temperature
+  int       TemperatureScalarType;
+  vtkIdType NumberOfVoxels;
+  double    BaseTemperature;
+  double    Factor;
+
+  // Only convert Accumulated into Temperature
+  bool      ConvertOnly;
+
+  // Previous is a fixed reference: Accumulated is set to Current - Previous
+  // and Previous is left untouched
+  bool      FromReference;
+
+  // Optional temperature of each signed accumulated phase value, indexed
+  // from 0 (8 and 16-bit integer phase only)
+  const double* LookupTable;
+
+  // Optional temporal filter. FilterState (one value per voxel) follows the
+  // accumulated phase with gain FilterGain, and its rounded value is
+  // written to Filtered and converted into temperature instead
+  float* FilterState;
+  double FilterGain;
+  void*  Filtered;
+
+  // Optional derived maps updated from each new temperature, selected by
+  // the bits of DerivedMapFlags. FrameInterval is the time since the
+  // previous frame, in seconds.
+  double* DerivedMaps[vtkSlicerRTThermometryLogic::NumberOfDerivedMaps];
+  int     DerivedMapFlags;
+  double  TemperatureThreshold;
+  double  FrameInterval;
+
+  // Voxels of the maximum temperature or thermal dose map crossing the
+  // lethal threshold during the frame are counted in NewlyAblatedVoxels,
+  // one entry per thread. Thresholds of the other criterion are
+  // VTK_DOUBLE_MAX.
+  double     LethalTemperature;
+  double     LethalDose;
+  vtkIdType* NewlyAblatedVoxels;
+
+  // Optional compute mask, as runs of contiguous voxels
+  int              NumberOfRuns;
+  const vtkIdType* RunBegins;
+  const vtkIdType* RunEnds;
+  const vtkIdType* RunOffsets;
+  vtkIdType        NumberOfMaskedVoxels;
+};
+
+//----------------------------------------------------------------------------
+// Integer phase differences, and the accumulated phase, are signed: a
+// decrease of an unsigned phase wraps to a negative difference, as with
+// signed phase images. The signed type has the width of the phase type,
+// so accumulated images keep the scalar type of the phase images and are
+// read through it.
+template <class T> struct SignedPhase { typedef T Type; };
+template <> struct SignedPhase<char> { typedef signed char Type; };
+template <> struct SignedPhase<unsigned char> { typedef signed char Type; };
+template <> struct SignedPhase<unsigned short> { typedef short Type; };
+template <> struct SignedPhase<unsigned int> { typedef int Type; };
+template <> struct SignedPhase<unsigned long> { typedef long Type; };
+#if defined(VTK_TYPE_USE_LONG_LONG)
+template <> struct SignedPhase<unsigned long long> { typedef long long Type; };
+#endif
+#if defined(VTK_TYPE_USE___INT64)
+template <> struct SignedPhase<unsigned __int64> { typedef __int64 Type; };
+#endif
+
+//----------------------------------------------------------------------------
+template <class T>
+typename SignedPhase<T>::Type PhaseDifference(T current, T previous)
 {
+  return static_cast<typename SignedPhase<T>::Type>(current - previous);
 }
 
 //----------------------------------------------------------------------------
-vtkSlicerRTThermometryLogic::~vtkSlicerRTThermometryLogic()
+template <class T>
+T RoundPhase(double value)
 {
+  if (!std::numeric_limits<T>::is_integer)
+    {
+    return static_cast<T>(value);
+    }
+  value = floor(value + 0.5);
+  if (value < static_cast<double>(std::numeric_limits<T>::min()))
+    {
+    return std::numeric_limits<T>::min();
+    }
+  if (value > static_cast<double>(std::numeric_limits<T>::max()))
+    {
+    return std::numeric_limits<T>::max();
+    }
+  return static_cast<T>(value);
 }
 
 //----------------------------------------------------------------------------
-void vtkSlicerRTThermometryLogic::PrintSelf(ostream& os, vtkIndent indent)
+// Fused phase kernel. In one pass per voxel, the phase is updated, filtered
+// over time, converted into temperature and every enabled derived map is
+// updated. Each step is a policy and the derived maps are compile-time
+// flags, so disabled features are not part of the instantiated loop.
+
+// Phase update: accumulate the frame difference, take the difference with
+// a fixed reference, or only read the accumulated phase
+struct AccumulatePolicy
 {
-  this->Superclass::PrintSelf(os, indent);
+  template <class T, class S>
+  static S Update(T* previous, const T* current, S* accumulated, vtkIdType i)
+  {
+    accumulated[i] = static_cast<S>(accumulated[i] + PhaseDifference(current[i], previous[i]));
+    previous[i] = current[i];
+    return accumulated[i];
+  }
+};
+
+struct ReferencePolicy
+{
+  template <class T, class S>
+  static S Update(T* previous, const T* current, S* accumulated, vtkIdType i)
+  {
+    accumulated[i] = PhaseDifference(current[i], previous[i]);
+    return accumulated[i];
+  }
+};
+
+struct ConvertOnlyPolicy
+{
+  template <class T, class S>
+  static S Update(T*, const T*, S* accumulated, vtkIdType i)
+  {
+    return accumulated[i];
+  }
+};
+
+// Temporal filter: the state follows the phase, its rounded value is kept
+// in the history and converted instead
+struct NoFilterPolicy
+{
+  template <class T>
+  static T Apply(T value, float*, T*, double, vtkIdType)
+  {
+    return value;
+  }
+};
+
+struct TemporalFilterPolicy
+{
+  template <class T>
+  static T Apply(T value, float* state, T* filtered, double gain, vtkIdType i)
+  {
+    state[i] += static_cast<float>(gain * (value - state[i]));
+    T result = RoundPhase<T>(state[i]);
+    filtered[i] = result;
+    return result;
+  }
+};
+
+// Conversion of the signed accumulated phase into temperature, computed in
+// the precision Real of the temperature images (float or double)
+struct ArithmeticConversionPolicy
+{
+  template <class T, class Real>
+  static Real Convert(T value, const double*, Real baseTemperature, Real factor)
+  {
+    return baseTemperature + static_cast<Real>(value) * factor;
+  }
+};
+
+struct LookupTableConversionPolicy
+{
+  template <class T, class Real>
+  static Real Convert(T value, const double* table, Real, Real)
+  {
+    return static_cast<Real>(table[static_cast<int>(value)]);
+  }
+};
+
+enum DerivedMapFlags
+{
+  MaximumTemperatureFlag = 1 << vtkSlicerRTThermometryLogic::MaximumTemperatureMap,
+  TimeAboveThresholdFlag = 1 << vtkSlicerRTThermometryLogic::TimeAboveThresholdMap,
+  ThermalDoseFlag = 1 << vtkSlicerRTThermometryLogic::ThermalDoseMap,
+  AllDerivedMapFlags = MaximumTemperatureFlag | TimeAboveThresholdFlag | ThermalDoseFlag
+};
+
+//----------------------------------------------------------------------------
+template <class T, class Real, class UpdatePolicy, class FilterPolicy, class ConversionPolicy, int Maps>
+vtkIdType FusedPhaseKernelExecute(PhaseKernelArgs* args, vtkIdType begin, vtkIdType end)
+{
+  typedef typename SignedPhase<T>::Type S;
+  T* previous = static_cast<T*>(args->Previous);
+  const T* current = static_cast<const T*>(args->Current);
+  S* accumulated = static_cast<S*>(args->Accumulated);
+  S* filtered = static_cast<S*>(args->Filtered);
+  float* state = args->FilterState;
+  double gain = args->FilterGain;
+  Real* temperature = static_cast<Real*>(args->Temperature);
+  const double* table = args->LookupTable;
+  Real baseTemperature = static_cast<Real>(args->BaseTemperature);
+  Real factor = static_cast<Real>(args->Factor);
+
+  double* maximum = args->DerivedMaps[vtkSlicerRTThermometryLogic::MaximumTemperatureMap];
+  double* timeAbove = args->DerivedMaps[vtkSlicerRTThermometryLogic::TimeAboveThresholdMap];
+  double* dose = args->DerivedMaps[vtkSlicerRTThermometryLogic::ThermalDoseMap];
+  double threshold = args->TemperatureThreshold;
+  double interval = args->FrameInterval;
+  double lethalTemperature = args->LethalTemperature;
+  double lethalDose = args->LethalDose;
+  vtkIdType newlyAblated = 0;
+  // CEM43: R^(43 - T) minutes per minute, R = 0.5 above 43 degrees and
+  // 0.25 below, written as powers of 2
+  double doseScale = interval / 60.0;
+  const double ln2 = 0.69314718055994530942;
+
+  for (vtkIdType i = begin; i < end; ++i)
+    {
+    S value = FilterPolicy::Apply(UpdatePolicy::Update(previous, current, accumulated, i),
+                                  state, filtered, gain, i);
+    Real t = ConversionPolicy::Convert(value, table, baseTemperature, factor);
+    temperature[i] = t;
+
+    // Both maps only increase: a voxel crosses the lethal threshold once
+    if ((Maps & MaximumTemperatureFlag) && t > maximum[i])
+      {
+      newlyAblated += (maximum[i] < lethalTemperature && t >= lethalTemperature) ? 1 : 0;
+      maximum[i] = t;
+      }
+    if ((Maps & TimeAboveThresholdFlag) && t >= threshold)
+      {
+      timeAbove[i] += interval;
+      }
+    if (Maps & ThermalDoseFlag)
+      {
+      double exponent = t >= 43.0 ? t - 43.0 : 2.0 * (t - 43.0);
+      double before = dose[i];
+      dose[i] += doseScale * exp(ln2 * exponent);
+      newlyAblated += (before < lethalDose && dose[i] >= lethalDose) ? 1 : 0;
+      }
+    }
+  return newlyAblated;
 }
 
-//---------------------------------------------------------------------------
-void vtkSlicerRTThermometryLogic::SetMRMLSceneInternal(vtkMRMLScene * newScene)
+//----------------------------------------------------------------------------
+template <class T, class Real, class UpdatePolicy, class FilterPolicy, class ConversionPolicy>
+vtkIdType DispatchDerivedMaps(PhaseKernelArgs* args, vtkIdType begin, vtkIdType end)
 {
-  vtkNew<vtkIntArray> events;
-  events->InsertNextValue(vtkMRMLScene::NodeAddedEvent);
-  events->InsertNextValue(vtkMRMLScene::NodeRemovedEvent);
-  events->InsertNextValue(vtkMRMLScene::EndBatchProcessEvent);
-  this->SetAndObserveMRMLSceneEventsInternal(newScene, events.GetPointer());
+  switch (args->DerivedMapFlags & AllDerivedMapFlags)
+    {
+    case 0:
+      return FusedPhaseKernelExecute<T, Real, UpdatePolicy, FilterPolicy, ConversionPolicy, 0>(args, begin, end);
+    case 1:
+      return FusedPhaseKernelExecute<T, Real, UpdatePolicy, FilterPolicy, ConversionPolicy, 1>(args, begin, end);
+    case 2:
+      return FusedPhaseKernelExecute<T, Real, UpdatePolicy, FilterPolicy, ConversionPolicy, 2>(args, begin, end);
+    case 3:
+      return FusedPhaseKernelExecute<T, Real, UpdatePolicy, FilterPolicy, ConversionPolicy, 3>(args, begin, end);
+    case 4:
+      return FusedPhaseKernelExecute<T, Real, UpdatePolicy, FilterPolicy, ConversionPolicy, 4>(args, begin, end);
+    case 5:
+      return FusedPhaseKernelExecute<T, Real, UpdatePolicy, FilterPolicy, ConversionPolicy, 5>(args, begin, end);
+    case 6:
+      return FusedPhaseKernelExecute<T, Real, UpdatePolicy, FilterPolicy, ConversionPolicy, 6>(args, begin, end);
+    case 7:
+      return FusedPhaseKernelExecute<T, Real, UpdatePolicy, FilterPolicy, ConversionPolicy, 7>(args, begin, end);
+    }
+  return 0;
 }
 
-//-----------------------------------------------------------------------------
-void vtkSlicerRTThermometryLogic::RegisterNodes()
+//----------------------------------------------------------------------------
+template <class T, class Real, class UpdatePolicy, class ConversionPolicy>
+vtkIdType DispatchFilter(PhaseKernelArgs* args, vtkIdType begin, vtkIdType end)
 {
-  assert(this->GetMRMLScene() != 0);
+  if (args->FilterState)
+    {
+    return DispatchDerivedMaps<T, Real, UpdatePolicy, TemporalFilterPolicy, ConversionPolicy>(args, begin, end);
+    }
+  return DispatchDerivedMaps<T, Real, UpdatePolicy, NoFilterPolicy, ConversionPolicy>(args, begin, end);
 }
 
-//---------------------------------------------------------------------------
-void vtkSlicerRTThermometryLogic::UpdateFromMRMLScene()
+//----------------------------------------------------------------------------
+template <class T, class Real, class ConversionPolicy>
+vtkIdType DispatchUpdate(PhaseKernelArgs* args, vtkIdType begin, vtkIdType end)
 {
-  assert(this->GetMRMLScene() != 0);
+  if (args->ConvertOnly)
+    {
+    return FusedPhaseKernelExecute<T, Real, ConvertOnlyPolicy, NoFilterPolicy, ConversionPolicy, 0>(args, begin, end);
+    }
+  else if (args->FromReference)
+    {
+    return DispatchFilter<T, Real, ReferencePolicy, ConversionPolicy>(args, begin, end);
+    }
+  return DispatchFilter<T, Real, AccumulatePolicy, ConversionPolicy>(args, begin, end);
 }
 
-//---------------------------------------------------------------------------
-void vtkSlicerRTThermometryLogic
-::OnMRMLSceneNodeAdded(vtkMRMLNode* vtkNotUsed(node))
+//----------------------------------------------------------------------------
+// Precision policy: the kernel of one temperature precision. Member
+// templates have a single template parameter, for vtkTemplateMacro.
+template <class Real>
+struct PhaseKernelPrecision
+{
+  template <class T>
+  static vtkIdType DispatchArithmeticConversion(PhaseKernelArgs* args, vtkIdType begin, vtkIdType end)
+  {
+    return DispatchUpdate<T, Real, ArithmeticConversionPolicy>(args, begin, end);
+  }
+
+  template <class T>
+  static vtkIdType DispatchLookupTableConversion(PhaseKernelArgs* args, vtkIdType begin, vtkIdType end)
+  {
+    return DispatchUpdate<T, Real, LookupTableConversionPolicy>(args, begin, end);
+  }
+
+  static vtkIdType Execute(PhaseKernelArgs* args, vtkIdType begin, vtkIdType end);
+};
+
+//----------------------------------------------------------------------------
+template <class T>
+void InitializeFilterExecute(const T* accumulated, float* state, vtkIdType numberOfVoxels)
 {
+  const typename SignedPhase<T>::Type* phase =
+    reinterpret_cast<const typename SignedPhase<T>::Type*>(accumulated);
+  for (vtkIdType i = 0; i < numberOfVoxels; ++i)
+    {
+    state[i] = static_cast<float>(phase[i]);
+    }
 }
 
-//---------------------------------------------------------------------------
-void vtkSlicerRTThermometryLogic
-::OnMRMLSceneNodeRemoved(vtkMRMLNode* vtkNotUsed(node))
+//----------------------------------------------------------------------------
+template <class T>
+void BuildLookupTableExecute(std::vector<double>& table, double baseTemperature,
+                             double factor, double quantization, bool singlePrecision)
+{
+  // Same expression and precision as ArithmeticConversionPolicy, so that
+  // both conversions match
+  int minimum = std::numeric_limits<T>::min();
+  int maximum = std::numeric_limits<T>::max();
+  table.resize(maximum - minimum + 1);
+  for (int value = minimum; value <= maximum; ++value)
+    {
+    double temperature = singlePrecision ?
+      ArithmeticConversionPolicy::Convert(static_cast<T>(value), NULL, static_cast<float>(baseTemperature),
+                                          static_cast<float>(factor)) :
+      ArithmeticConversionPolicy::Convert(static_cast<T>(value), NULL, baseTemperature, factor);
+    if (quantization > 0.0)
+      {
+      temperature = floor(temperature / quantization + 0.5) * quantization;
+      }
+    table[value - minimum] = temperature;
+    }
+}
+
+//----------------------------------------------------------------------------
+// Return the number of newly ablated voxels
+template <class Real>
+vtkIdType PhaseKernelPrecision<Real>::Execute(PhaseKernelArgs* args, vtkIdType begin, vtkIdType end)
+{
+  vtkIdType newlyAblated = 0;
+  if (!args->LookupTable)
+    {
+    switch (args->ScalarType)
+      {
+      vtkTemplateMacro(newlyAblated = DispatchArithmeticConversion<VTK_TT>(args, begin, end));
+      }
+    return newlyAblated;
+    }
+
+  switch (args->ScalarType)
+    {
+    case VTK_CHAR:
+      newlyAblated = DispatchLookupTableConversion<char>(args, begin, end);
+      break;
+    case VTK_SIGNED_CHAR:
+      newlyAblated = DispatchLookupTableConversion<signed char>(args, begin, end);
+      break;
+    case VTK_UNSIGNED_CHAR:
+      newlyAblated = DispatchLookupTableConversion<unsigned char>(args, begin, end);
+      break;
+    case VTK_SHORT:
+      newlyAblated = DispatchLookupTableConversion<short>(args, begin, end);
+      break;
+    case VTK_UNSIGNED_SHORT:
+      newlyAblated = DispatchLookupTableConversion<unsigned short>(args, begin, end);
+      break;
+    }
+  return newlyAblated;
+}
+
+//----------------------------------------------------------------------------
+vtkIdType PhaseKernelRangeExecute(PhaseKernelArgs* args, vtkIdType begin, vtkIdType end)
+{
+  if (args->TemperatureScalarType == VTK_FLOAT)
+    {
+    return PhaseKernelPrecision<float>::Execute(args, begin, end);
+    }
+  return PhaseKernelPrecision<double>::Execute(args, begin, end);
+}
+
+//----------------------------------------------------------------------------
+VTK_THREAD_RETURN_TYPE PhaseKernelThreadedExecute(void* arg)
+{
+  vtkMultiThreader::ThreadInfo* info = static_cast<vtkMultiThreader::ThreadInfo*>(arg);
+  PhaseKernelArgs* args = static_cast<PhaseKernelArgs*>(info->UserData);
+
+  if (args->NumberOfRuns == 0)
+    {
+    // Buffers are contiguous: split them in one chunk of voxels per thread
+    vtkIdType chunk = args->NumberOfVoxels / info->NumberOfThreads;
+    vtkIdType begin = info->ThreadID * chunk;
+    vtkIdType end = (info->ThreadID == info->NumberOfThreads - 1) ?
+      args->NumberOfVoxels : begin + chunk;
+    vtkIdType newlyAblated = PhaseKernelRangeExecute(args, begin, end);
+    if (args->NewlyAblatedVoxels)
+      {
+      args->NewlyAblatedVoxels[info->ThreadID] = newlyAblated;
+      }
+    return VTK_THREAD_RETURN_VALUE;
+    }
+
+  // Masked: split the masked voxels evenly, then walk the runs they cover
+  vtkIdType chunk = args->NumberOfMaskedVoxels / info->NumberOfThreads;
+  vtkIdType first = info->ThreadID * chunk;
+  vtkIdType last = (info->ThreadID == info->NumberOfThreads - 1) ?
+    args->NumberOfMaskedVoxels : first + chunk;
+  int run = static_cast<int>(std::upper_bound(args->RunOffsets,
+                                              args->RunOffsets + args->NumberOfRuns,
+                                              first) - args->RunOffsets) - 1;
+  vtkIdType newlyAblated = 0;
+  for (; run < args->NumberOfRuns && args->RunOffsets[run] < last; ++run)
+    {
+    vtkIdType begin = args->RunBegins[run];
+    vtkIdType end = args->RunEnds[run];
+    if (args->RunOffsets[run] < first)
+      {
+      begin += first - args->RunOffsets[run];
+      }
+    if (args->RunOffsets[run] + (end - args->RunBegins[run]) > last)
+      {
+      end = args->RunBegins[run] + (last - args->RunOffsets[run]);
+      }
+    newlyAblated += PhaseKernelRangeExecute(args, begin, end);
+    }
+  if (args->NewlyAblatedVoxels)
+    {
+    args->NewlyAblatedVoxels[info->ThreadID] = newlyAblated;
+    }
+
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+//----------------------------------------------------------------------------
+// Progressive preview: the phase kernel and the conversion applied to one
+// voxel per block, without writing the pipeline state. The temporal filter
+// state is read and not updated; before the first filtered frame it starts
+// from the accumulated phase, as in the kernel.
+struct PreviewArgs
+{
+  const void*          Previous;
+  const void*          Current;
+  const void*          Accumulated;
+  bool                 FromReference;
+  const float*         FilterState;
+  bool                 FilterFromAccumulated;
+  double               FilterGain;
+  int                  ScalarType;
+  int                  TemperatureScalarType;
+  const double*        LookupTable;
+  double               BaseTemperature;
+  double               Factor;
+  const unsigned char* Mask;
+  int                  Dimensions[3];
+  int                  Step[3];
+  int                  PreviewDimensions[3];
+  double*              Preview;
+};
+
+//----------------------------------------------------------------------------
+// Conversion of the fused kernel, in the precision of the temperature
+// images. The preview is stored in double precision.
+template <class Real, class T>
+Real ConvertPreviewValue(T value, const PreviewArgs* args)
+{
+  Real baseTemperature = static_cast<Real>(args->BaseTemperature);
+  Real factor = static_cast<Real>(args->Factor);
+  return args->LookupTable ?
+    LookupTableConversionPolicy::Convert(value, args->LookupTable, baseTemperature, factor) :
+    ArithmeticConversionPolicy::Convert(value, args->LookupTable, baseTemperature, factor);
+}
+
+//----------------------------------------------------------------------------
+template <class T>
+void PreviewExecute(PreviewArgs* args, int firstRow, int lastRow)
+{
+  typedef typename SignedPhase<T>::Type S;
+  const T* previous = static_cast<const T*>(args->Previous);
+  const T* current = static_cast<const T*>(args->Current);
+  const S* accumulated = static_cast<const S*>(args->Accumulated);
+  const float* state = args->FilterState;
+  const int* step = args->Step;
+  const int* dimensions = args->Dimensions;
+
+  for (int row = firstRow; row < lastRow; ++row)
+    {
+    int j = row % args->PreviewDimensions[1];
+    int k = row / args->PreviewDimensions[1];
+    vtkIdType voxel = ((static_cast<vtkIdType>(k * step[2] + step[2] / 2) * dimensions[1] +
+                        j * step[1] + step[1] / 2) * dimensions[0]) + step[0] / 2;
+    double* preview = args->Preview + static_cast<vtkIdType>(row) * args->PreviewDimensions[0];
+    for (int i = 0; i < args->PreviewDimensions[0]; ++i, voxel += step[0])
+      {
+      if (args->Mask && !args->Mask[voxel])
+        {
+        preview[i] = 0.0;
+        continue;
+        }
+      // Same expressions as the policies of the fused kernel
+      S value = PhaseDifference(current[voxel], previous[voxel]);
+      if (!args->FromReference)
+        {
+        value = static_cast<S>(accumulated[voxel] + value);
+        }
+      if (state || args->FilterFromAccumulated)
+        {
+        float previousState = state ? state[voxel] : static_cast<float>(accumulated[voxel]);
+        float filtered = previousState + static_cast<float>(args->FilterGain * (value - previousState));
+        value = RoundPhase<S>(filtered);
+        }
+      preview[i] = args->TemperatureScalarType == VTK_FLOAT ?
+        ConvertPreviewValue<float>(value, args) : ConvertPreviewValue<double>(value, args);
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+VTK_THREAD_RETURN_TYPE PreviewThreadedExecute(void* arg)
+{
+  vtkMultiThreader::ThreadInfo* info = static_cast<vtkMultiThreader::ThreadInfo*>(arg);
+  PreviewArgs* args = static_cast<PreviewArgs*>(info->UserData);
+
+  int numberOfRows = args->PreviewDimensions[1] * args->PreviewDimensions[2];
+  int chunk = numberOfRows / info->NumberOfThreads;
+  int firstRow = info->ThreadID * chunk;
+  int lastRow = (info->ThreadID == info->NumberOfThreads - 1) ? numberOfRows : firstRow + chunk;
+  switch (args->ScalarType)
+    {
+    vtkTemplateMacro(PreviewExecute<VTK_TT>(args, firstRow, lastRow));
+    }
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+//----------------------------------------------------------------------------
+// Separable spatial smoothing, one pass per axis. Lines along the axis are
+// processed in blocks of adjacent lines so that strided passes read and
+// write whole cache lines; borders are replicated.
+enum { SmoothBlockWidth = 32 };
+
+struct SmoothArgs
+{
+  void*         Image;
+  int           ScalarType; // VTK_FLOAT or VTK_DOUBLE
+  double*       Weights;
+  int           Dimensions[3];
+  int           Axis;
+  const double* Kernel;
+  int           Radius;
+  double*       Scratch;
+  vtkIdType     ScratchSize;
+};
+
+//----------------------------------------------------------------------------
+// Lines are copied to the scratch buffer and filtered in double precision
+template <class Real>
+void SmoothLines(Real* data, vtkIdType stride, int length, int width,
+                 const double* kernel, int radius, double* scratch)
+{
+  for (int n = -radius; n < length + radius; ++n)
+    {
+    const Real* input = data + std::max(0, std::min(n, length - 1)) * stride;
+    double* line = scratch + (n + radius) * width;
+    for (int w = 0; w < width; ++w)
+      {
+      line[w] = input[w];
+      }
+    }
+  for (int n = 0; n < length; ++n)
+    {
+    Real* output = data + n * stride;
+    const double* line = scratch + n * width;
+    for (int w = 0; w < width; ++w)
+      {
+      double sum = 0.0;
+      for (int k = 0; k <= 2 * radius; ++k)
+        {
+        sum += kernel[k] * line[k * width + w];
+        }
+      output[w] = static_cast<Real>(sum);
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+// Normalized convolution: masked voxels are weighted before smoothing and
+// divided by the smoothed weights afterwards
+template <class Real>
+void WeightSmoothedImage(Real* image, const double* weights, vtkIdType numberOfVoxels)
+{
+  for (vtkIdType i = 0; i < numberOfVoxels; ++i)
+    {
+    image[i] *= weights[i];
+    }
+}
+
+//----------------------------------------------------------------------------
+template <class Real>
+void NormalizeSmoothedImage(Real* image, const double* weights, const unsigned char* mask,
+                            vtkIdType numberOfVoxels)
+{
+  for (vtkIdType i = 0; i < numberOfVoxels; ++i)
+    {
+    image[i] = mask[i] ? static_cast<Real>(image[i] / weights[i]) : 0;
+    }
+}
+
+//----------------------------------------------------------------------------
+int GetNumberOfSmoothUnits(const int dimensions[3], int axis)
+{
+  int blocks = (dimensions[0] + SmoothBlockWidth - 1) / SmoothBlockWidth;
+  switch (axis)
+    {
+    case 0: return dimensions[1] * dimensions[2];
+    case 1: return dimensions[2] * blocks;
+    default: return dimensions[1] * blocks;
+    }
+}
+
+//----------------------------------------------------------------------------
+VTK_THREAD_RETURN_TYPE SmoothThreadedExecute(void* arg)
+{
+  vtkMultiThreader::ThreadInfo* info = static_cast<vtkMultiThreader::ThreadInfo*>(arg);
+  SmoothArgs* args = static_cast<SmoothArgs*>(info->UserData);
+
+  const int* dimensions = args->Dimensions;
+  vtkIdType sliceSize = static_cast<vtkIdType>(dimensions[0]) * dimensions[1];
+  int blocks = (dimensions[0] + SmoothBlockWidth - 1) / SmoothBlockWidth;
+  int numberOfUnits = GetNumberOfSmoothUnits(dimensions, args->Axis);
+  int first = static_cast<int>(static_cast<vtkIdType>(numberOfUnits) * info->ThreadID / info->NumberOfThreads);
+  int last = static_cast<int>(static_cast<vtkIdType>(numberOfUnits) * (info->ThreadID + 1) / info->NumberOfThreads);
+  double* scratch = args->Scratch + info->ThreadID * args->ScratchSize;
+  for (int unit = first; unit < last; ++unit)
+    {
+    vtkIdType offset = 0;
+    vtkIdType stride = 1;
+    int length = dimensions[0];
+    int width = 1;
+    if (args->Axis == 0)
+      {
+      offset = static_cast<vtkIdType>(unit) * dimensions[0];
+      }
+    else
+      {
+      int i = (unit % blocks) * SmoothBlockWidth;
+      width = std::min(static_cast<int>(SmoothBlockWidth), dimensions[0] - i);
+      if (args->Axis == 1)
+        {
+        offset = (unit / blocks) * sliceSize + i;
+        stride = dimensions[0];
+        length = dimensions[1];
+        }
+      else
+        {
+        offset = static_cast<vtkIdType>(unit / blocks) * dimensions[0] + i;
+        stride = sliceSize;
+        length = dimensions[2];
+        }
+      }
+    if (args->ScalarType == VTK_FLOAT)
+      {
+      SmoothLines(static_cast<float*>(args->Image) + offset, stride, length, width,
+                  args->Kernel, args->Radius, scratch);
+      }
+    else
+      {
+      SmoothLines(static_cast<double*>(args->Image) + offset, stride, length, width,
+                  args->Kernel, args->Radius, scratch);
+      }
+    if (args->Weights)
+      {
+      SmoothLines(args->Weights + offset, stride, length, width,
+                  args->Kernel, args->Radius, scratch);
+      }
+    }
+
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+//----------------------------------------------------------------------------
+// Session reprocessing. The cumulative phase of every frame is an inclusive
+// scan of the frame differences, computed in two parallel passes over
+// contiguous chunks of frames:
+//  - pass 0: each thread scans its own chunk, starting from zero;
+//  - the carry of each chunk (sum of the previous chunks) is then computed
+//    serially, one voxel buffer per chunk;
+//  - pass 1: each thread adds its carry.
+// Sums are written in place in the phase history, in the signed phase type
+// as in AccumulatePolicy. Temperatures are derived afterwards on demand.
+// The session is scanned in successive chunks of frames, each one starting
+// from the accumulated phase of the previous one (InitialSum).
+struct ReprocessArgs
+{
+  int                  Pass;
+  int                  ScalarType;
+  vtkIdType            NumberOfVoxels;
+  int                  NumberOfDifferences;
+  std::vector<void*>   Phases;
+  std::vector<void*>   Accumulated;
+  const void*          InitialSum;
+  void*                Carry;
+};
+
+// Frames scanned by each thread per chunk: bounds the phase images loaded
+// at once while amortizing the serial carry
+const int ReprocessFramesPerThread = 8;
+
+//----------------------------------------------------------------------------
+void GetDifferenceRange(int threadID, int numberOfThreads, int numberOfDifferences,
+                        int& begin, int& end)
+{
+  begin = static_cast<int>(static_cast<vtkIdType>(numberOfDifferences) * threadID / numberOfThreads);
+  end = static_cast<int>(static_cast<vtkIdType>(numberOfDifferences) * (threadID + 1) / numberOfThreads);
+}
+
+//----------------------------------------------------------------------------
+template <class T>
+void ReprocessScanExecute(ReprocessArgs* args, int begin, int end)
+{
+  typedef typename SignedPhase<T>::Type S;
+  vtkIdType numberOfVoxels = args->NumberOfVoxels;
+  for (int d = begin; d < end; ++d)
+    {
+    const T* previous = static_cast<T*>(args->Phases[d]);
+    const T* current = static_cast<T*>(args->Phases[d + 1]);
+    S* sum = static_cast<S*>(args->Accumulated[d]);
+    if (d == begin)
+      {
+      for (vtkIdType i = 0; i < numberOfVoxels; ++i)
+        {
+        sum[i] = PhaseDifference(current[i], previous[i]);
+        }
+      }
+    else
+      {
+      const S* lastSum = static_cast<S*>(args->Accumulated[d - 1]);
+      for (vtkIdType i = 0; i < numberOfVoxels; ++i)
+        {
+        sum[i] = static_cast<S>(lastSum[i] + PhaseDifference(current[i], previous[i]));
+        }
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+template <class T>
+void ReprocessCarryExecute(ReprocessArgs* args, int numberOfThreads)
+{
+  typedef typename SignedPhase<T>::Type S;
+  vtkIdType numberOfVoxels = args->NumberOfVoxels;
+  S* carry = static_cast<S*>(args->Carry);
+  if (args->InitialSum)
+    {
+    memcpy(carry, args->InitialSum, numberOfVoxels * sizeof(S));
+    }
+  else
+    {
+    memset(carry, 0, numberOfVoxels * sizeof(S));
+    }
+  for (int thread = 1; thread < numberOfThreads; ++thread)
+    {
+    int begin, end;
+    GetDifferenceRange(thread - 1, numberOfThreads, args->NumberOfDifferences, begin, end);
+    const S* previousCarry = carry + (thread - 1) * numberOfVoxels;
+    S* threadCarry = carry + thread * numberOfVoxels;
+    if (begin == end)
+      {
+      memcpy(threadCarry, previousCarry, numberOfVoxels * sizeof(S));
+      continue;
+      }
+    const S* lastSum = static_cast<S*>(args->Accumulated[end - 1]);
+    for (vtkIdType i = 0; i < numberOfVoxels; ++i)
+      {
+      threadCarry[i] = static_cast<S>(previousCarry[i] + lastSum[i]);
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+template <class T>
+void ReprocessAddCarryExecute(ReprocessArgs* args, int threadID, int begin, int end)
+{
+  typedef typename SignedPhase<T>::Type S;
+  vtkIdType numberOfVoxels = args->NumberOfVoxels;
+  const S* carry = static_cast<S*>(args->Carry) + threadID * numberOfVoxels;
+  for (int d = begin; d < end; ++d)
+    {
+    // Partial sums are replaced by the accumulated phase
+    S* accumulated = static_cast<S*>(args->Accumulated[d]);
+    for (vtkIdType i = 0; i < numberOfVoxels; ++i)
+      {
+      accumulated[i] = static_cast<S>(accumulated[i] + carry[i]);
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+VTK_THREAD_RETURN_TYPE ReprocessThreadedExecute(void* arg)
+{
+  vtkMultiThreader::ThreadInfo* info = static_cast<vtkMultiThreader::ThreadInfo*>(arg);
+  ReprocessArgs* args = static_cast<ReprocessArgs*>(info->UserData);
+
+  int begin, end;
+  GetDifferenceRange(info->ThreadID, info->NumberOfThreads,
+                     args->NumberOfDifferences, begin, end);
+
+  switch (args->ScalarType)
+    {
+    vtkTemplateMacro(
+      if (args->Pass == 0)
+        {
+        ReprocessScanExecute<VTK_TT>(args, begin, end);
+        }
+      else
+        {
+        ReprocessAddCarryExecute<VTK_TT>(args, info->ThreadID, begin, end);
+        });
+    }
+
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+//----------------------------------------------------------------------------
+// Label maps select non-zero voxels, magnitude images voxels above threshold
+template <class T>
+void BuildMaskExecute(const T* image, vtkIdType numberOfVoxels, bool labelMap,
+                      double threshold, unsigned char* mask)
+{
+  for (vtkIdType i = 0; i < numberOfVoxels; ++i)
+    {
+    mask[i] = labelMap ? (image[i] != 0) : (image[i] >= threshold);
+    }
+}
+
+//----------------------------------------------------------------------------
+// Maximum and sum of the temperature over runs of contiguous voxels. Each
+// run is reduced in four independent lanes, which the compiler can keep in
+// vector registers.
+template <class Real>
+void ReduceRunsExecute(const Real* temperature, const vtkIdType* begins, const vtkIdType* ends,
+                       size_t numberOfRuns, double& maximum, double& sum)
+{
+  double maximumLanes[4] = { -VTK_DOUBLE_MAX, -VTK_DOUBLE_MAX, -VTK_DOUBLE_MAX, -VTK_DOUBLE_MAX };
+  double sumLanes[4] = { 0.0, 0.0, 0.0, 0.0 };
+  for (size_t run = 0; run < numberOfRuns; ++run)
+    {
+    const Real* t = temperature + begins[run];
+    vtkIdType length = ends[run] - begins[run];
+    vtkIdType i = 0;
+    for (; i + 4 <= length; i += 4)
+      {
+      for (int lane = 0; lane < 4; ++lane)
+        {
+        maximumLanes[lane] = t[i + lane] > maximumLanes[lane] ? t[i + lane] : maximumLanes[lane];
+        sumLanes[lane] += t[i + lane];
+        }
+      }
+    for (; i < length; ++i)
+      {
+      maximumLanes[0] = t[i] > maximumLanes[0] ? t[i] : maximumLanes[0];
+      sumLanes[0] += t[i];
+      }
+    }
+  maximum = std::max(std::max(maximumLanes[0], maximumLanes[1]),
+                     std::max(maximumLanes[2], maximumLanes[3]));
+  sum = (sumLanes[0] + sumLanes[1]) + (sumLanes[2] + sumLanes[3]);
+}
+
+//----------------------------------------------------------------------------
+// Samples of a line profile: weighted sum of the taps of each sample, in
+// the order they were laid out along the line
+template <class Real>
+void GatherLineProfileExecute(const Real* temperature, const vtkIdType* voxels,
+                              const double* weights, const int* offsets,
+                              const double* baseWeights, int numberOfSamples,
+                              double baseTemperature, double* values)
+{
+  for (int sample = 0; sample < numberOfSamples; ++sample)
+    {
+    double value = baseWeights[sample] * baseTemperature;
+    for (int tap = offsets[sample]; tap < offsets[sample + 1]; ++tap)
+      {
+      value += weights[tap] * temperature[voxels[tap]];
+      }
+    values[sample] = value;
+    }
+}
+
+//----------------------------------------------------------------------------
+// Baseline signature: one voxel every step voxels along each axis
+vtkIdType GetSignatureLength(const int dimensions[3], int step)
+{
+  return static_cast<vtkIdType>((dimensions[0] + step - 1) / step) *
+    ((dimensions[1] + step - 1) / step) * ((dimensions[2] + step - 1) / step);
+}
+
+//----------------------------------------------------------------------------
+template <class T>
+void ExtractSignatureExecute(const T* image, const int dimensions[3], int step, float* signature)
+{
+  for (int k = 0; k < dimensions[2]; k += step)
+    {
+    for (int j = 0; j < dimensions[1]; j += step)
+      {
+      const T* row = image + (static_cast<vtkIdType>(k) * dimensions[1] + j) * dimensions[0];
+      for (int i = 0; i < dimensions[0]; i += step)
+        {
+        *signature++ = static_cast<float>(row[i]);
+        }
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+// Background polynomial terms u^a v^b with a + b <= order, ordered by a
+// then b
+int GetNumberOfPolynomialTerms(int order)
+{
+  return (order + 1) * (order + 2) / 2;
+}
+
+//----------------------------------------------------------------------------
+// Fit the background polynomial on the ring of each slice and evaluate it
+// over the slice. coefficients holds the terms followed by order + 1 values.
+template <class T>
+void FitBackgroundExecute(const T* phase, T* background, const int dimensions[3],
+                          const vtkIdType* ring, int ringSize, const double* fitMatrix,
+                          int order, const double origin[2], const double step[2],
+                          double* ringPhase, double* coefficients)
+{
+  int numberOfTerms = GetNumberOfPolynomialTerms(order);
+  double* rowCoefficients = coefficients + numberOfTerms;
+  vtkIdType sliceSize = static_cast<vtkIdType>(dimensions[0]) * dimensions[1];
+  for (int k = 0; k < dimensions[2]; ++k)
+    {
+    const T* slice = phase + k * sliceSize;
+    for (int r = 0; r < ringSize; ++r)
+      {
+      ringPhase[r] = static_cast<double>(slice[ring[r]]);
+      }
+    for (int term = 0; term < numberOfTerms; ++term)
+      {
+      const double* row = fitMatrix + static_cast<vtkIdType>(term) * ringSize;
+      double sum = 0.0;
+      for (int r = 0; r < ringSize; ++r)
+        {
+        sum += row[r] * ringPhase[r];
+        }
+      coefficients[term] = sum;
+      }
+
+    T* output = background + k * sliceSize;
+    for (int j = 0; j < dimensions[1]; ++j)
+      {
+      // Polynomial in u along the row
+      double v = origin[1] + j * step[1];
+      int term = 0;
+      for (int a = 0; a <= order; ++a)
+        {
+        double sum = 0.0;
+        double power = 1.0;
+        for (int b = 0; b <= order - a; ++b, ++term)
+          {
+          sum += coefficients[term] * power;
+          power *= v;
+          }
+        rowCoefficients[a] = sum;
+        }
+      for (int i = 0; i < dimensions[0]; ++i)
+        {
+        double u = origin[0] + i * step[0];
+        double value = rowCoefficients[order];
+        for (int a = order - 1; a >= 0; --a)
+          {
+          value = value * u + rowCoefficients[a];
+          }
+        *output++ = RoundPhase<T>(value);
+        }
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+// Standard deviation of (current - reference) on every step-th voxel of
+// each row and column, all slices
+template <class T>
+double PhaseDeviationExecute(const T* reference, const T* current, const unsigned char* mask,
+                             const int dimensions[3], int step)
+{
+  double sum = 0.0;
+  double sumOfSquares = 0.0;
+  vtkIdType count = 0;
+  for (int k = 0; k < dimensions[2]; ++k)
+    {
+    for (int j = 0; j < dimensions[1]; j += step)
+      {
+      vtkIdType row = (static_cast<vtkIdType>(k) * dimensions[1] + j) * dimensions[0];
+      for (int i = 0; i < dimensions[0]; i += step)
+        {
+        vtkIdType index = row + i;
+        if (mask && !mask[index])
+          {
+          continue;
+          }
+        double difference = PhaseDifference(current[index], reference[index]);
+        sum += difference;
+        sumOfSquares += difference * difference;
+        ++count;
+        }
+      }
+    }
+  if (count < 2)
+    {
+    return 0.0;
+    }
+  double mean = sum / count;
+  double variance = sumOfSquares / count - mean * mean;
+  return variance > 0.0 ? sqrt(variance) : 0.0;
+}
+
+//----------------------------------------------------------------------------
+void AllocateImage(vtkImageData* image, const int extent[6], int scalarType)
 {
+  image->SetExtent(extent[0], extent[1], extent[2], extent[3], extent[4], extent[5]);
+#if VTK_MAJOR_VERSION <= 5
+  image->SetScalarType(scalarType);
+  image->SetNumberOfScalarComponents(1);
+  image->AllocateScalars();
+#else
+  image->AllocateScalars(scalarType, 1);
+#endif
 }
 
+//----------------------------------------------------------------------------
+void ZeroImage(vtkImageData* image)
+{
+  memset(image->GetScalarPointer(), 0x00,
+         image->GetNumberOfPoints() * image->GetScalarSize());
+}
+
+//----------------------------------------------------------------------------
+// Copy the voxels of a sub-extent of source into destination, reallocated
+// with that extent if needed
+void CopyExtent(vtkImageData* source, const int extent[6], vtkImageData* destination)
+{
+  int* destinationExtent = destination->GetExtent();
+  if (!destination->GetScalarPointer() ||
+      destination->GetScalarType() != source->GetScalarType() ||
+      destinationExtent[0] != extent[0] || destinationExtent[1] != extent[1] ||
+      destinationExtent[2] != extent[2] || destinationExtent[3] != extent[3] ||
+      destinationExtent[4] != extent[4] || destinationExtent[5] != extent[5])
+    {
+    AllocateImage(destination, extent, source->GetScalarType());
+    }
+  destination->SetSpacing(source->GetSpacing());
+  destination->SetOrigin(source->GetOrigin());
+
+  int* sourceExtent = source->GetExtent();
+  char* output = static_cast<char*>(destination->GetScalarPointer());
+  if (extent[0] == sourceExtent[0] && extent[1] == sourceExtent[1] &&
+      extent[2] == sourceExtent[2] && extent[3] == sourceExtent[3])
+    {
+    // Whole slices are contiguous
+    size_t sliceSize = static_cast<size_t>(extent[1] - extent[0] + 1) *
+      (extent[3] - extent[2] + 1) * source->GetScalarSize();
+    memcpy(output, source->GetScalarPointer(extent[0], extent[2], extent[4]),
+           sliceSize * (extent[5] - extent[4] + 1));
+    }
+  else
+    {
+    size_t rowSize = static_cast<size_t>(extent[1] - extent[0] + 1) * source->GetScalarSize();
+    for (int k = extent[4]; k <= extent[5]; ++k)
+      {
+      for (int j = extent[2]; j <= extent[3]; ++j)
+        {
+        memcpy(output, source->GetScalarPointer(extent[0], j, k), rowSize);
+        output += rowSize;
+        }
+      }
+    }
+  destination->Modified();
+}
+
+//----------------------------------------------------------------------------
+// Checkpoint payload, in native byte order. Vectors and strings are
+// preceded by their length, images by a presence flag and their geometry.
+class CheckpointOutput
+{
+public:
+  CheckpointOutput(std::vector<char>& buffer)
+    : Buffer(buffer)
+  {
+    // The capacity of the buffer is kept between checkpoints
+    this->Buffer.clear();
+  }
+
+  void WriteBytes(const void* data, size_t size)
+  {
+    const char* bytes = static_cast<const char*>(data);
+    this->Buffer.insert(this->Buffer.end(), bytes, bytes + size);
+  }
+
+  template <class T>
+  void Write(const T& value)
+  {
+    this->WriteBytes(&value, sizeof(T));
+  }
+
+  template <class T>
+  void WriteArray(const T* values, int count)
+  {
+    this->WriteBytes(values, count * sizeof(T));
+  }
+
+  template <class T>
+  void WriteVector(const std::vector<T>& values)
+  {
+    this->Write(static_cast<vtkTypeUInt64>(values.size()));
+    if (!values.empty())
+      {
+      this->WriteBytes(&values[0], values.size() * sizeof(T));
+      }
+  }
+
+  void WriteString(const std::string& value)
+  {
+    this->Write(static_cast<vtkTypeUInt64>(value.size()));
+    this->WriteBytes(value.data(), value.size());
+  }
+
+  void WriteImage(vtkImageData* image)
+  {
+    bool present = image && image->GetScalarPointer();
+    this->Write(present);
+    if (!present)
+      {
+      return;
+      }
+    this->WriteArray(image->GetExtent(), 6);
+    this->WriteArray(image->GetSpacing(), 3);
+    this->WriteArray(image->GetOrigin(), 3);
+    this->Write(image->GetScalarType());
+    this->WriteBytes(image->GetScalarPointer(),
+                     static_cast<size_t>(image->GetNumberOfPoints()) * image->GetScalarSize());
+  }
+
+private:
+  std::vector<char>& Buffer;
+};
+
+//----------------------------------------------------------------------------
+class CheckpointInput
+{
+public:
+  CheckpointInput(const std::vector<char>& buffer, vtkSlicerRTThermometryFramePool* pool)
+    : Buffer(buffer), Position(0), Failed(false), Pool(pool)
+  {
+  }
+
+  bool ReadBytes(void* data, size_t size)
+  {
+    if (this->Failed || size > this->Buffer.size() - this->Position)
+      {
+      this->Failed = true;
+      return false;
+      }
+    if (size > 0)
+      {
+      memcpy(data, &this->Buffer[this->Position], size);
+      }
+    this->Position += size;
+    return true;
+  }
+
+  template <class T>
+  bool Read(T& value)
+  {
+    return this->ReadBytes(&value, sizeof(T));
+  }
+
+  /// Flags are single bytes, anything but 0 or 1 is a corruption
+  bool Read(bool& value)
+  {
+    unsigned char byte = 0;
+    if (!this->ReadBytes(&byte, 1) || byte > 1)
+      {
+      this->Failed = true;
+      return false;
+      }
+    value = byte != 0;
+    return true;
+  }
+
+  template <class T>
+  bool ReadArray(T* values, int count)
+  {
+    return this->ReadBytes(values, count * sizeof(T));
+  }
+
+  template <class T>
+  bool ReadVector(std::vector<T>& values)
+  {
+    vtkTypeUInt64 size = 0;
+    if (!this->Read(size) || size > (this->Buffer.size() - this->Position) / sizeof(T))
+      {
+      this->Failed = true;
+      return false;
+      }
+    values.resize(static_cast<size_t>(size));
+    return values.empty() || this->ReadBytes(&values[0], values.size() * sizeof(T));
+  }
+
+  bool ReadString(std::string& value)
+  {
+    std::vector<char> characters;
+    if (!this->ReadVector(characters))
+      {
+      return false;
+      }
+    value.assign(characters.begin(), characters.end());
+    return true;
+  }
+
+  /// Image acquired from the frame pool, NULL if absent or on error
+  vtkImageData* ReadImage()
+  {
+    bool present = false;
+    int extent[6];
+    double spacing[3];
+    double origin[3];
+    int scalarType = VTK_VOID;
+    if (!this->Read(present) || !present ||
+        !this->ReadArray(extent, 6) || !this->ReadArray(spacing, 3) ||
+        !this->ReadArray(origin, 3) || !this->Read(scalarType))
+      {
+      return NULL;
+      }
+
+    size_t scalarSize = 0;
+    switch (scalarType)
+      {
+      vtkTemplateMacro(scalarSize = sizeof(VTK_TT));
+      }
+    size_t numberOfVoxels = 1;
+    for (int axis = 0; axis < 3; ++axis)
+      {
+      numberOfVoxels *= extent[2*axis+1] >= extent[2*axis] ?
+        static_cast<size_t>(extent[2*axis+1] - extent[2*axis] + 1) : 0;
+      }
+    if (scalarSize == 0 || numberOfVoxels == 0 ||
+        numberOfVoxels > (this->Buffer.size() - this->Position) / scalarSize)
+      {
+      this->Failed = true;
+      return NULL;
+      }
+
+    vtkImageData* image = this->Pool->Acquire(extent, scalarType);
+    image->SetSpacing(spacing);
+    image->SetOrigin(origin);
+    this->ReadBytes(image->GetScalarPointer(), numberOfVoxels * scalarSize);
+    image->Modified();
+    return image;
+  }
+
+  bool IsComplete()
+  {
+    return !this->Failed && this->Position == this->Buffer.size();
+  }
+
+  bool HasFailed()
+  {
+    return this->Failed;
+  }
+
+private:
+  const std::vector<char>& Buffer;
+  size_t Position;
+  bool Failed;
+  vtkSlicerRTThermometryFramePool* Pool;
+};
+
+//----------------------------------------------------------------------------
+// True if a checkpointed image exactly covers extent with the given scalar type
+bool HasCheckpointGeometry(vtkImageData* image, const int extent[6], int scalarType)
+{
+  if (!image || image->GetScalarType() != scalarType)
+    {
+    return false;
+    }
+  int* imageExtent = image->GetExtent();
+  for (int i = 0; i < 6; ++i)
+    {
+    if (imageExtent[i] != extent[i])
+      {
+      return false;
+      }
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+// True if a checkpointed voxel vector holds one value per voxel of dimensions
+bool HasCheckpointDimensions(size_t size, const int dimensions[3])
+{
+  if (dimensions[0] < 0 || dimensions[1] < 0 || dimensions[2] < 0)
+    {
+    return false;
+    }
+  // In double to avoid overflowing with corrupted dimensions
+  return static_cast<double>(dimensions[0]) * dimensions[1] * dimensions[2] ==
+    static_cast<double>(size);
+}
+
+}
+
+//----------------------------------------------------------------------------
+// Checkpoint read and validated before it replaces the state of the logic.
+// Images still held on destruction go back to the frame pool.
+struct vtkSlicerRTThermometryLogic::CheckpointState
+{
+  CheckpointState(vtkSlicerRTThermometryFramePool* pool)
+    : Pool(pool), PreviousPhase(NULL), AccumulatedPhase(NULL), History(NULL)
+  {
+    for (int map = 0; map < NumberOfDerivedMaps; ++map)
+      {
+      this->DerivedMapImages[map] = NULL;
+      }
+  }
+
+  ~CheckpointState()
+  {
+    this->Pool->Release(this->PreviousPhase);
+    this->Pool->Release(this->AccumulatedPhase);
+    this->Pool->Release(this->History);
+    for (size_t i = 0; i < this->BaselineLibrary.size(); ++i)
+      {
+      this->Pool->Release(this->BaselineLibrary[i]);
+      }
+    for (int map = 0; map < NumberOfDerivedMaps; ++map)
+      {
+      this->Pool->Release(this->DerivedMapImages[map]);
+      }
+  }
+
+  vtkSlicerRTThermometryFramePool* Pool;
+
+  // Parameters
+  double EchoTime;
+  double MagneticField;
+  double GyromagneticRatio;
+  double ThermalCoefficient;
+  double ScaleFactor;
+  double BaseTemperature;
+  double TemperatureQuantization;
+  int TemperatureScalarType;
+  int TemporalFilter;
+  double TemporalFilterWeight;
+  double KalmanProcessNoise;
+  double KalmanMeasurementNoise;
+  int SpatialFilter;
+  int SpatialFilterRadius;
+  bool SpatialFilterThroughSlices;
+  double RejectionThreshold;
+  bool DerivedMapEnabled[NumberOfDerivedMaps];
+  double TemperatureThreshold;
+  int AblationCriterion;
+  double LethalDose;
+  double LethalTemperature;
+  bool Referenceless;
+  bool HasBackgroundRing;
+  double BackgroundRingCenter[3];
+  double BackgroundRingRadii[2];
+  int BackgroundPolynomialOrder;
+  int BaselineLibrarySize;
+  int SignatureSubsampling;
+
+  // Geometry and mask
+  bool UseRequestedExtent;
+  int RequestedExtent[6];
+  int ProcessingExtent[6];
+  int AcquisitionDimensions[3];
+  int MaskSourceDimensions[3];
+  std::vector<unsigned char> MaskSourceVoxels;
+
+  // Pipeline state
+  vtkImageData* PreviousPhase;
+  vtkImageData* AccumulatedPhase;
+  bool HasHistory;
+  vtkImageData* History;
+  int ActiveBaselineLibrarySize;
+  std::vector<vtkImageData*> BaselineLibrary;
+  int NumberOfRejectedFrames;
+  std::vector<double> AcceptedDeviations;
+  double KalmanVariance;
+  bool FilterStateValid;
+  std::vector<float> FilterState;
+  double LastFrameTime;
+  double FrameInterval;
+  vtkImageData* DerivedMapImages[NumberOfDerivedMaps];
+
+  // Protection zones and sensors
+  std::vector<ProtectionZone> ProtectionZones;
+  std::vector<CheckpointSensor> CheckpointSensors;
+};
+
+//----------------------------------------------------------------------------
+vtkSlicerRTThermometryLogic::vtkSlicerRTThermometryLogic()
+{
+  this->Profiler = vtkSlicerRTThermometryProfiler::New();
+  this->Recorder = vtkSlicerRTThermometrySessionRecorder::New();
+  this->FramePool = vtkSlicerRTThermometryFramePool::New();
+  this->IngestQueue = vtkSlicerRTThermometryIngestQueue::New();
+  this->IngestQueue->SetFramePool(this->FramePool);
+  this->IngestQueue->SetProfiler(this->Profiler);
+  this->HotSpotDetector = vtkSlicerRTThermometryHotSpotDetector::New();
+  this->CheckpointWriter = vtkSlicerRTThermometryCheckpointWriter::New();
+  this->Threader = vtkMultiThreader::New();
+  this->NumberOfThreads = vtkMultiThreader::GetGlobalDefaultNumberOfThreads();
+
+  this->EchoTime = 0.0;
+  this->MagneticField = 0.0;
+  this->GyromagneticRatio = 0.0;
+  this->ThermalCoefficient = 0.0;
+  this->ScaleFactor = 0.0;
+  this->BaseTemperature = 0.0;
+
+  this->PreviousPhase = NULL;
+  this->CurrentPhase = NULL;
+  this->AccumulatedPhase = NULL;
+  this->TemperatureCacheSize = 16;
+
+  this->TemporalFilter = NoTemporalFilter;
+  this->TemporalFilterWeight = 0.5;
+  this->KalmanProcessNoise = 0.5;
+  this->KalmanMeasurementNoise = 1.0;
+  this->KalmanVariance = 0.0;
+  this->FilterStateValid = false;
+
+  this->SpatialFilter = NoSpatialFilter;
+  this->SpatialFilterRadius = 1;
+  this->SpatialFilterThroughSlices = false;
+  this->SpatialKernelFilter = NoSpatialFilter;
+  this->SpatialKernelRadius = 0;
+
+  this->RejectionThreshold = 0.0;
+  this->MaximumConsecutiveRejections = 8;
+  this->NumberOfRejectedFrames = 0;
+  this->NumberOfConsecutiveRejectedFrames = 0;
+  this->LastFrameDeviation = 0.0;
+
+  for (int map = 0; map < NumberOfDerivedMaps; ++map)
+    {
+    this->DerivedMapEnabled[map] = false;
+    this->DerivedMapImages[map] = NULL;
+    }
+  this->DerivedMapBaseTemperature = this->BaseTemperature;
+  this->DerivedMapFactor = this->GetPhaseToTemperatureFactor();
+  this->TemperatureThreshold = 43.0;
+  this->LastFrameTime = 0.0;
+  this->FrameInterval = 0.0;
+
+  this->AblationCriterion = ThermalDoseAblation;
+  this->LethalDose = 240.0;
+  this->LethalTemperature = 60.0;
+  this->NumberOfAblatedVoxels = 0;
+  this->AblatedVoxelsValid = false;
+  this->AblationSurface = vtkPolyData::New();
+  this->AblationSurfaceValid = false;
+
+  this->HotSpotDetection = false;
+
+  this->ProgressivePreview = false;
+  this->PreviewDownsampling = 2;
+  this->PreviewSafetyCheck = false;
+  this->PreviewImage = NULL;
+  this->PreviewValid = false;
+  for (int axis = 0; axis < 3; ++axis)
+    {
+    this->PreviewStep[axis] = 1;
+    this->PreviewDimensions[axis] = 0;
+    this->PreviewZoneStep[axis] = 0;
+    }
+
+  this->Referenceless = false;
+  this->HasBackgroundRing = false;
+  this->BackgroundRingCenter[0] = this->BackgroundRingCenter[1] = this->BackgroundRingCenter[2] = 0.0;
+  this->BackgroundRingRadii[0] = this->BackgroundRingRadii[1] = 0.0;
+  this->BackgroundPolynomialOrder = 2;
+  this->BackgroundPhase = NULL;
+
+  this->BaselineLibrarySize = 0;
+  this->ActiveBaselineLibrarySize = 0;
+  this->SignatureSubsampling = 4;
+  this->SelectedBaseline = -1;
+
+  this->CheckpointInterval = 10;
+  this->FramesSinceCheckpoint = 0;
+
+  this->ConversionMode = AutomaticConversion;
+#ifdef RTTHERMOMETRY_SINGLE_PRECISION
+  this->TemperaturePrecision = SinglePrecision;
+#else
+  this->TemperaturePrecision = DoublePrecision;
+#endif
+  this->TemperatureScalarType =
+    this->TemperaturePrecision == SinglePrecision ? VTK_FLOAT : VTK_DOUBLE;
+  this->TemperatureQuantization = 0.0;
+  this->LookupTableScalarType = VTK_VOID;
+  this->LookupTableTemperatureType = VTK_VOID;
+  this->LookupTableBaseTemperature = 0.0;
+  this->LookupTableFactor = 0.0;
+  this->LookupTableQuantization = 0.0;
+  this->ResetConversionCalibration();
+
+  this->MaskDimensions[0] = this->MaskDimensions[1] = this->MaskDimensions[2] = 0;
+  this->MaskSourceDimensions[0] = this->MaskSourceDimensions[1] = this->MaskSourceDimensions[2] = 0;
+  this->NumberOfMaskedVoxels = 0;
+
+  this->UseRequestedExtent = false;
+  for (int i = 0; i < 6; ++i)
+    {
+    this->RequestedExtent[i] = 0;
+    this->ProcessingExtent[i] = 0;
+    }
+  this->AcquisitionDimensions[0] = this->AcquisitionDimensions[1] = this->AcquisitionDimensions[2] = 0;
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerRTThermometryLogic::~vtkSlicerRTThermometryLogic()
+{
+  this->ResetBaseline();
+
+  if (this->Threader)
+    {
+    this->Threader->Delete();
+    }
+
+  if (this->Recorder)
+    {
+    this->Recorder->Delete();
+    }
+
+  if (this->IngestQueue)
+    {
+    this->IngestQueue->Delete();
+    }
+
+  if (this->HotSpotDetector)
+    {
+    this->HotSpotDetector->Delete();
+    }
+
+  if (this->CheckpointWriter)
+    {
+    this->CheckpointWriter->Delete();
+    }
+
+  if (this->AblationSurface)
+    {
+    this->AblationSurface->Delete();
+    }
+
+  if (this->PreviewImage)
+    {
+    this->PreviewImage->Delete();
+    }
+
+  if (this->FramePool)
+    {
+    this->FramePool->Delete();
+    }
+
+  if (this->Profiler)
+    {
+    this->Profiler->Delete();
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+
+  os << indent << "EchoTime: " << this->EchoTime << "\n";
+  os << indent << "MagneticField: " << this->MagneticField << "\n";
+  os << indent << "GyromagneticRatio: " << this->GyromagneticRatio << "\n";
+  os << indent << "ThermalCoefficient: " << this->ThermalCoefficient << "\n";
+  os << indent << "ScaleFactor: " << this->ScaleFactor << "\n";
+  os << indent << "BaseTemperature: " << this->BaseTemperature << "\n";
+  os << indent << "NumberOfThreads: " << this->NumberOfThreads << "\n";
+  os << indent << "NumberOfTemperatureImages: " << this->TemperatureImages.size() << "\n";
+  os << indent << "TemperatureCacheSize: " << this->TemperatureCacheSize
+     << " (" << this->TemperatureCacheOrder.size() << " cached)\n";
+  os << indent << "TemporalFilter: " << this->TemporalFilter << "\n";
+  os << indent << "TemporalFilterWeight: " << this->TemporalFilterWeight << "\n";
+  os << indent << "KalmanProcessNoise: " << this->KalmanProcessNoise << "\n";
+  os << indent << "KalmanMeasurementNoise: " << this->KalmanMeasurementNoise << "\n";
+  os << indent << "SpatialFilter: " << this->SpatialFilter << "\n";
+  os << indent << "SpatialFilterRadius: " << this->SpatialFilterRadius << "\n";
+  os << indent << "SpatialFilterThroughSlices: " << this->SpatialFilterThroughSlices << "\n";
+  os << indent << "RejectionThreshold: " << this->RejectionThreshold
+     << " (" << this->NumberOfRejectedFrames << " frames rejected)\n";
+  os << indent << "MaximumConsecutiveRejections: " << this->MaximumConsecutiveRejections << "\n";
+  os << indent << "DerivedMapEnabled: (" << this->DerivedMapEnabled[MaximumTemperatureMap]
+     << ", " << this->DerivedMapEnabled[TimeAboveThresholdMap]
+     << ", " << this->DerivedMapEnabled[ThermalDoseMap] << ")\n";
+  os << indent << "AblationCriterion: " << this->AblationCriterion << "\n";
+  os << indent << "LethalDose: " << this->LethalDose << "\n";
+  os << indent << "LethalTemperature: " << this->LethalTemperature << "\n";
+  os << indent << "NumberOfAblatedVoxels: " << this->NumberOfAblatedVoxels
+     << (this->AblatedVoxelsValid ? "\n" : " (not valid)\n");
+  os << indent << "TemperatureThreshold: " << this->TemperatureThreshold << "\n";
+  os << indent << "ProtectionZones: " << this->ProtectionZones.size() << "\n";
+  for (size_t zone = 0; zone < this->ProtectionZones.size(); ++zone)
+    {
+    const ProtectionZone& protectionZone = this->ProtectionZones[zone];
+    os << indent.GetNextIndent() << protectionZone.Name << ": limit "
+       << protectionZone.Limit << ", " << protectionZone.NumberOfVoxels << " voxels, max "
+       << protectionZone.Maximum << (protectionZone.Alarm ? " (alarm)" : "") << "\n";
+    }
+  os << indent << "LineProfiles: " << this->LineProfiles.size() << "\n";
+  for (size_t profile = 0; profile < this->LineProfiles.size(); ++profile)
+    {
+    const LineProfile& lineProfile = this->LineProfiles[profile];
+    os << indent.GetNextIndent() << lineProfile.Name << ": "
+       << lineProfile.NumberOfSamples << " samples, " << lineProfile.TapVoxels.size()
+       << " taps\n";
+    }
+  os << indent << "FrameInterval: " << this->FrameInterval << "\n";
+  os << indent << "Referenceless: " << this->Referenceless << "\n";
+  os << indent << "BackgroundRing: ";
+  if (this->HasBackgroundRing)
+    {
+    os << "(" << this->BackgroundRingCenter[0] << ", " << this->BackgroundRingCenter[1]
+       << ", " << this->BackgroundRingCenter[2] << "), " << this->BackgroundRingRadii[0]
+       << " to " << this->BackgroundRingRadii[1] << " mm, "
+       << this->RingVoxels.size() << " voxels\n";
+    }
+  else
+    {
+    os << "(none)\n";
+    }
+  os << indent << "BackgroundPolynomialOrder: " << this->BackgroundPolynomialOrder << "\n";
+  os << indent << "BaselineLibrarySize: " << this->BaselineLibrarySize
+     << " (" << this->BaselineLibrary.size() << " captured)\n";
+  os << indent << "SignatureSubsampling: " << this->SignatureSubsampling << "\n";
+  os << indent << "ConversionMode: " << this->ConversionMode << "\n";
+  os << indent << "TemperatureQuantization: " << this->TemperatureQuantization << "\n";
+  os << indent << "ActiveConversion: " << this->ActiveConversion << "\n";
+  os << indent << "TemperaturePrecision: " << this->TemperaturePrecision << "\n";
+  os << indent << "TemperatureScalarType: " << this->TemperatureScalarType << "\n";
+  os << indent << "NumberOfMaskedVoxels: " << this->NumberOfMaskedVoxels
+     << " (" << this->MaskRunBegins.size() << " runs)\n";
+  os << indent << "HotSpotDetection: " << this->HotSpotDetection << "\n";
+  os << indent << "ProgressivePreview: " << this->ProgressivePreview << "\n";
+  os << indent << "PreviewDownsampling: " << this->PreviewDownsampling << "\n";
+  os << indent << "PreviewSafetyCheck: " << this->PreviewSafetyCheck << "\n";
+  os << indent << "CheckpointInterval: " << this->CheckpointInterval << "\n";
+  os << indent << "CheckpointSensors: " << this->CheckpointSensors.size() << "\n";
+  os << indent << "CheckpointWriter:\n";
+  this->CheckpointWriter->PrintSelf(os, indent.GetNextIndent());
+  os << indent << "HotSpotDetector:\n";
+  this->HotSpotDetector->PrintSelf(os, indent.GetNextIndent());
+  os << indent << "IngestQueue:\n";
+  this->IngestQueue->PrintSelf(os, indent.GetNextIndent());
+  os << indent << "FramePool:\n";
+  this->FramePool->PrintSelf(os, indent.GetNextIndent());
+  os << indent << "Profiler:\n";
+  this->Profiler->PrintSelf(os, indent.GetNextIndent());
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::SetMRMLSceneInternal(vtkMRMLScene * newScene)
+{
+  vtkNew<vtkIntArray> events;
+  events->InsertNextValue(vtkMRMLScene::NodeAddedEvent);
+  events->InsertNextValue(vtkMRMLScene::NodeRemovedEvent);
+  events->InsertNextValue(vtkMRMLScene::EndBatchProcessEvent);
+  this->SetAndObserveMRMLSceneEventsInternal(newScene, events.GetPointer());
+}
+
+//-----------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::RegisterNodes()
+{
+  assert(this->GetMRMLScene() != 0);
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::UpdateFromMRMLScene()
+{
+  assert(this->GetMRMLScene() != 0);
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic
+::OnMRMLSceneNodeAdded(vtkMRMLNode* vtkNotUsed(node))
+{
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic
+::OnMRMLSceneNodeRemoved(vtkMRMLNode* vtkNotUsed(node))
+{
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::ResetBaseline()
+{
+  if (this->PreviousPhase)
+    {
+    this->PreviousPhase->Delete();
+    this->PreviousPhase = NULL;
+    }
+
+  if (this->CurrentPhase)
+    {
+    this->CurrentPhase->Delete();
+    this->CurrentPhase = NULL;
+    }
+
+  if (this->AccumulatedPhase)
+    {
+    this->AccumulatedPhase->Delete();
+    this->AccumulatedPhase = NULL;
+    }
+
+  for (unsigned int i = 0; i < this->TemperatureImages.size(); ++i)
+    {
+    this->FramePool->Release(this->TemperatureImages[i].Image);
+    this->FramePool->Release(this->PhaseHistory[i]);
+    }
+  this->TemperatureImages.clear();
+  this->PhaseHistory.clear();
+  this->TemperatureCacheOrder.clear();
+
+  for (size_t i = 0; i < this->BaselineLibrary.size(); ++i)
+    {
+    this->BaselineLibrary[i]->Delete();
+    }
+  this->BaselineLibrary.clear();
+  this->BaselineSignatures.clear();
+  this->ActiveBaselineLibrarySize = 0;
+  this->SelectedBaseline = -1;
+
+  this->NumberOfRejectedFrames = 0;
+  this->NumberOfConsecutiveRejectedFrames = 0;
+  this->LastFrameDeviation = 0.0;
+  this->AcceptedDeviations.clear();
+
+  this->FilterStateValid = false;
+
+  for (int map = 0; map < NumberOfDerivedMaps; ++map)
+    {
+    this->FramePool->Release(this->DerivedMapImages[map]);
+    this->DerivedMapImages[map] = NULL;
+    }
+  this->DerivedMapBaseTemperature = this->BaseTemperature;
+  this->DerivedMapFactor = this->GetPhaseToTemperatureFactor();
+  this->FrameInterval = 0.0;
+  this->InvalidateAblationZone();
+
+  // Zones are kept, their voxels depend on the processing extent
+  for (size_t zone = 0; zone < this->ProtectionZones.size(); ++zone)
+    {
+    this->ProtectionZones[zone].Maximum = this->BaseTemperature;
+    this->ProtectionZones[zone].Mean = this->BaseTemperature;
+    this->ProtectionZones[zone].Alarm = false;
+    }
+  this->CompileProtectionZones();
+  this->CompileLineProfiles();
+  this->HotSpotDetector->Clear();
+  this->PreviewValid = false;
+
+  // The ring is kept, its voxels depend on the processing extent
+  this->RingVoxels.clear();
+  this->BackgroundFitMatrix.clear();
+  if (this->BackgroundPhase)
+    {
+    this->BackgroundPhase->Delete();
+    this->BackgroundPhase = NULL;
+    }
+
+  this->ResetConversionCalibration();
+  this->FramesSinceCheckpoint = 0;
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerRTThermometryLogic::HasBaseline()
+{
+  return this->PreviousPhase != NULL && this->AccumulatedPhase != NULL;
+}
+
+//---------------------------------------------------------------------------
+vtkImageData* vtkSlicerRTThermometryLogic::ProcessPhaseImage(vtkImageData* phaseImage,
+                                                             double acquisitionTime)
+{
+  if (!phaseImage || !phaseImage->GetPointData()->GetScalars())
+    {
+    return NULL;
+    }
+
+  double frameTime = acquisitionTime >= 0.0 ? acquisitionTime : vtkTimerLog::GetUniversalTime();
+
+  if (this->Recorder->IsRecording())
+    {
+    this->Profiler->StartStage(vtkSlicerRTThermometryProfiler::SessionRecord);
+    this->Recorder->RecordFrame(phaseImage, frameTime);
+    this->Profiler->StopStage(vtkSlicerRTThermometryProfiler::SessionRecord);
+    }
+
+  if (!this->HasBaseline())
+    {
+    this->UpdateProcessingExtent(phaseImage);
+
+    this->Profiler->StartStage(vtkSlicerRTThermometryProfiler::IngestCopy);
+    this->PreviousPhase = vtkImageData::New();
+    CopyExtent(phaseImage, this->ProcessingExtent, this->PreviousPhase);
+    this->Profiler->StopStage(vtkSlicerRTThermometryProfiler::IngestCopy);
+
+    this->ActiveBaselineLibrarySize = this->BaselineLibrarySize;
+    if (this->ActiveBaselineLibrarySize > 0)
+      {
+      this->AddLibraryBaseline(this->PreviousPhase);
+      }
+    this->TemperatureScalarType =
+      this->TemperaturePrecision == SinglePrecision ? VTK_FLOAT : VTK_DOUBLE;
+
+    this->AccumulatedPhase = vtkImageData::New();
+    this->AccumulatedPhase->SetSpacing(phaseImage->GetSpacing());
+    this->AccumulatedPhase->SetOrigin(phaseImage->GetOrigin());
+    AllocateImage(this->AccumulatedPhase, this->ProcessingExtent, phaseImage->GetScalarType());
+    ZeroImage(this->AccumulatedPhase);
+    this->CompileMask();
+    this->CompileProtectionZones();
+    this->CompileLineProfiles();
+    this->CompileBackgroundFit();
+    this->DerivedMapBaseTemperature = this->BaseTemperature;
+    this->DerivedMapFactor = this->GetPhaseToTemperatureFactor();
+    this->LastFrameTime = frameTime;
+    this->UpdateCheckpoint(true);
+    return NULL;
+    }
+
+  int dimensions[3];
+  phaseImage->GetDimensions(dimensions);
+  if (dimensions[0] != this->AcquisitionDimensions[0] ||
+      dimensions[1] != this->AcquisitionDimensions[1] ||
+      dimensions[2] != this->AcquisitionDimensions[2] ||
+      phaseImage->GetScalarType() != this->PreviousPhase->GetScalarType())
+    {
+    vtkErrorMacro("ProcessPhaseImage: Image does not match the baseline geometry or scalar type. "
+                  "A new baseline must be set.");
+    return NULL;
+    }
+
+  this->Profiler->StartStage(vtkSlicerRTThermometryProfiler::IngestCopy);
+  if (!this->CurrentPhase)
+    {
+    this->CurrentPhase = vtkImageData::New();
+    }
+  CopyExtent(phaseImage, this->ProcessingExtent, this->CurrentPhase);
+  this->Profiler->StopStage(vtkSlicerRTThermometryProfiler::IngestCopy);
+
+  if (this->IsCapturingBaselineLibrary())
+    {
+    this->AddLibraryBaseline(this->CurrentPhase);
+    this->LastFrameTime = frameTime;
+    this->UpdateCheckpoint(false);
+    return NULL;
+    }
+
+  // Referenceless or with a baseline library, the phase is referenced to
+  // the fitted background or to the closest baseline instead of being
+  // accumulated
+  vtkImageData* reference = this->PreviousPhase;
+  bool fromReference = true;
+  if (this->Referenceless && !this->RingVoxels.empty())
+    {
+    this->Profiler->StartStage(vtkSlicerRTThermometryProfiler::BackgroundFit);
+    this->ComputeBackgroundPhase(this->CurrentPhase);
+    this->Profiler->StopStage(vtkSlicerRTThermometryProfiler::BackgroundFit);
+    reference = this->BackgroundPhase;
+    }
+  else if (this->ActiveBaselineLibrarySize > 0)
+    {
+    this->Profiler->StartStage(vtkSlicerRTThermometryProfiler::BaselineSelection);
+    this->SelectedBaseline = this->SelectLibraryBaseline(this->CurrentPhase);
+    this->Profiler->StopStage(vtkSlicerRTThermometryProfiler::BaselineSelection);
+    reference = this->BaselineLibrary[this->SelectedBaseline];
+    }
+  else
+    {
+    fromReference = false;
+    }
+
+  if (this->RejectionThreshold > 0.0)
+    {
+    this->Profiler->StartStage(vtkSlicerRTThermometryProfiler::QualityCheck);
+    bool rejected = this->IsFrameRejected(reference, this->CurrentPhase);
+    this->Profiler->StopStage(vtkSlicerRTThermometryProfiler::QualityCheck);
+    if (rejected)
+      {
+      this->NumberOfRejectedFrames++;
+      this->Profiler->IncrementCounter(vtkSlicerRTThermometryProfiler::RejectedFrames);
+      return NULL;
+      }
+    }
+
+  // Rejected frames are skipped: the temperature of the next frame is held
+  // over the whole interval
+  this->FrameInterval = std::max(frameTime - this->LastFrameTime, 0.0);
+  this->LastFrameTime = frameTime;
+
+  if (this->ProgressivePreview)
+    {
+    this->Profiler->StartStage(vtkSlicerRTThermometryProfiler::Preview);
+    bool preview = this->ComputePreview(reference, fromReference);
+    if (preview && this->PreviewSafetyCheck && !this->ProtectionZones.empty())
+      {
+      this->CheckPreviewProtectionZones();
+      }
+    this->Profiler->StopStage(vtkSlicerRTThermometryProfiler::Preview);
+    if (preview)
+      {
+      this->InvokeEvent(PreviewReadyEvent, this->PreviewImage);
+      }
+    }
+
+  this->Profiler->StartStage(vtkSlicerRTThermometryProfiler::PhaseKernel);
+  vtkImageData* temperature = this->NewTemperatureImage();
+  this->AllocateDerivedMaps(this->CurrentPhase);
+
+  // Keep the accumulated phase, temperature is derived from it on demand.
+  // The temporal filter writes its phase directly in the history.
+  vtkImageData* history =
+    this->FramePool->Acquire(this->ProcessingExtent, this->AccumulatedPhase->GetScalarType());
+  if (this->TemporalFilter != NoTemporalFilter)
+    {
+    history->SetSpacing(this->AccumulatedPhase->GetSpacing());
+    history->SetOrigin(this->AccumulatedPhase->GetOrigin());
+    if (this->IsMaskApplicable(this->AccumulatedPhase->GetDimensions()))
+      {
+      // Voxels outside of the mask are not written by the kernel
+      ZeroImage(history);
+      }
+    this->RunPhaseKernel(reference, this->CurrentPhase, this->AccumulatedPhase,
+                         temperature, fromReference, history, true);
+    }
+  else
+    {
+    this->RunPhaseKernel(reference, this->CurrentPhase, this->AccumulatedPhase,
+                         temperature, fromReference, NULL, true);
+    CopyExtent(this->AccumulatedPhase, this->ProcessingExtent, history);
+    }
+  this->PhaseHistory.push_back(history);
+
+  CachedTemperature cached;
+  cached.Image = temperature;
+  this->StampTemperature(cached, history->GetScalarType());
+  this->TemperatureImages.push_back(cached);
+  this->TouchTemperatureImage(static_cast<int>(this->TemperatureImages.size()) - 1);
+  this->Profiler->StopStage(vtkSlicerRTThermometryProfiler::PhaseKernel);
+
+  if (this->SpatialFilter != NoSpatialFilter)
+    {
+    this->Profiler->StartStage(vtkSlicerRTThermometryProfiler::SpatialFilter);
+    this->SmoothTemperature(temperature);
+    this->Profiler->StopStage(vtkSlicerRTThermometryProfiler::SpatialFilter);
+    }
+
+  if (!this->ProtectionZones.empty())
+    {
+    this->Profiler->StartStage(vtkSlicerRTThermometryProfiler::SafetyCheck);
+    this->CheckProtectionZones(temperature);
+    this->Profiler->StopStage(vtkSlicerRTThermometryProfiler::SafetyCheck);
+    }
+
+  if (!this->LineProfiles.empty())
+    {
+    this->Profiler->StartStage(vtkSlicerRTThermometryProfiler::LineProfile);
+    this->GatherLineProfiles(temperature);
+    this->Profiler->StopStage(vtkSlicerRTThermometryProfiler::LineProfile);
+    }
+
+  if (this->HotSpotDetection)
+    {
+    this->Profiler->StartStage(vtkSlicerRTThermometryProfiler::HotSpotDetection);
+    this->HotSpotDetector->SetNumberOfThreads(this->NumberOfThreads);
+    this->HotSpotDetector->Detect(temperature, this->AccumulatedPhase->GetSpacing());
+    this->Profiler->StopStage(vtkSlicerRTThermometryProfiler::HotSpotDetection);
+    }
+
+  this->UpdateCheckpoint(false);
+
+  return temperature;
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerRTThermometryLogic::IsFrameRejected(vtkImageData* reference, vtkImageData* current)
+{
+  int dimensions[3];
+  current->GetDimensions(dimensions);
+  const unsigned char* mask = this->NumberOfMaskedVoxels > 0 ? &this->MaskVoxels[0] : NULL;
+  double deviation = 0.0;
+  switch (current->GetScalarType())
+    {
+    vtkTemplateMacro(
+      deviation = PhaseDeviationExecute(static_cast<VTK_TT*>(reference->GetScalarPointer()),
+                                        static_cast<VTK_TT*>(current->GetScalarPointer()),
+                                        mask, dimensions, QualitySubsampling));
+    }
+  this->LastFrameDeviation = deviation;
+
+  if (this->AcceptedDeviations.size() >= QualityMinimumHistory)
+    {
+    this->DeviationScratch.assign(this->AcceptedDeviations.begin(),
+                                  this->AcceptedDeviations.end());
+    std::vector<double>::iterator median =
+      this->DeviationScratch.begin() + this->DeviationScratch.size() / 2;
+    std::nth_element(this->DeviationScratch.begin(), median, this->DeviationScratch.end());
+    if (deviation > this->RejectionThreshold * *median)
+      {
+      if (this->MaximumConsecutiveRejections == 0 ||
+          this->NumberOfConsecutiveRejectedFrames < this->MaximumConsecutiveRejections)
+        {
+        this->NumberOfConsecutiveRejectedFrames++;
+        return true;
+        }
+      // The reference is stale: accept the frame and restart the
+      // deviation history from it
+      vtkWarningMacro("IsFrameRejected: " << this->NumberOfConsecutiveRejectedFrames
+                      << " frames rejected in a row, accepting the frame;"
+                      " a new baseline should be acquired");
+      this->AcceptedDeviations.clear();
+      this->NumberOfConsecutiveRejectedFrames = 0;
+      this->InvokeEvent(RejectionLimitEvent);
+      }
+    }
+
+  this->NumberOfConsecutiveRejectedFrames = 0;
+  this->AcceptedDeviations.push_back(deviation);
+  if (this->AcceptedDeviations.size() > QualityHistoryLength)
+    {
+    this->AcceptedDeviations.pop_front();
+    }
+  return false;
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::SetBackgroundRing(const double center[3],
+                                                    double innerRadius, double outerRadius)
+{
+  if (innerRadius < 0.0 || outerRadius <= innerRadius)
+    {
+    vtkErrorMacro("SetBackgroundRing: Invalid radii " << innerRadius << " and " << outerRadius);
+    return;
+    }
+
+  this->HasBackgroundRing = true;
+  this->BackgroundRingCenter[0] = center[0];
+  this->BackgroundRingCenter[1] = center[1];
+  this->BackgroundRingCenter[2] = center[2];
+  this->BackgroundRingRadii[0] = innerRadius;
+  this->BackgroundRingRadii[1] = outerRadius;
+  this->CompileBackgroundFit();
+  this->Modified();
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::ClearBackgroundRing()
+{
+  this->HasBackgroundRing = false;
+  this->CompileBackgroundFit();
+  this->Modified();
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::SetBackgroundPolynomialOrder(int order)
+{
+  order = std::max(0, std::min(order, 4));
+  if (order == this->BackgroundPolynomialOrder)
+    {
+    return;
+    }
+  this->BackgroundPolynomialOrder = order;
+  this->CompileBackgroundFit();
+  this->Modified();
+}
+
+//---------------------------------------------------------------------------
+int vtkSlicerRTThermometryLogic::GetNumberOfRingVoxels()
+{
+  return static_cast<int>(this->RingVoxels.size());
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::CompileBackgroundFit()
+{
+  this->RingVoxels.clear();
+  this->BackgroundFitMatrix.clear();
+  if (!this->HasBackgroundRing || !this->HasBaseline())
+    {
+    return;
+    }
+
+  // Ring voxels of a slice of the processing extent, with coordinates
+  // normalized by the outer radius
+  double spacing[3];
+  this->PreviousPhase->GetSpacing(spacing);
+  const int* extent = this->ProcessingExtent;
+  int width = extent[1] - extent[0] + 1;
+  double outerRadius = this->BackgroundRingRadii[1];
+  std::vector<double> u;
+  std::vector<double> v;
+  for (int j = extent[2]; j <= extent[3]; ++j)
+    {
+    double y = (j - this->BackgroundRingCenter[1]) * spacing[1];
+    for (int i = extent[0]; i <= extent[1]; ++i)
+      {
+      double x = (i - this->BackgroundRingCenter[0]) * spacing[0];
+      double radius = sqrt(x * x + y * y);
+      if (radius >= this->BackgroundRingRadii[0] && radius <= outerRadius)
+        {
+        this->RingVoxels.push_back(static_cast<vtkIdType>(j - extent[2]) * width + (i - extent[0]));
+        u.push_back(x / outerRadius);
+        v.push_back(y / outerRadius);
+        }
+      }
+    }
+
+  int order = this->BackgroundPolynomialOrder;
+  int numberOfTerms = GetNumberOfPolynomialTerms(order);
+  int ringSize = static_cast<int>(this->RingVoxels.size());
+  if (ringSize < numberOfTerms)
+    {
+    vtkWarningMacro("CompileBackgroundFit: " << ringSize << " ring voxels in the processing "
+                    "extent, at least " << numberOfTerms << " are needed");
+    this->RingVoxels.clear();
+    return;
+    }
+
+  // Design matrix A and normal matrix A^T A
+  std::vector<double> design(static_cast<size_t>(ringSize) * numberOfTerms);
+  for (int r = 0; r < ringSize; ++r)
+    {
+    double* row = &design[static_cast<size_t>(r) * numberOfTerms];
+    int term = 0;
+    double uPower = 1.0;
+    for (int a = 0; a <= order; ++a, uPower *= u[r])
+      {
+      double power = uPower;
+      for (int b = 0; b <= order - a; ++b, ++term, power *= v[r])
+        {
+        row[term] = power;
+        }
+      }
+    }
+  std::vector<double> normal(numberOfTerms * numberOfTerms, 0.0);
+  for (int r = 0; r < ringSize; ++r)
+    {
+    const double* row = &design[static_cast<size_t>(r) * numberOfTerms];
+    for (int p = 0; p < numberOfTerms; ++p)
+      {
+      for (int q = 0; q <= p; ++q)
+        {
+        normal[p * numberOfTerms + q] += row[p] * row[q];
+        }
+      }
+    }
+
+  // Cholesky factorization A^T A = L L^T, in the lower triangle
+  for (int p = 0; p < numberOfTerms; ++p)
+    {
+    for (int q = 0; q <= p; ++q)
+      {
+      double sum = normal[p * numberOfTerms + q];
+      for (int t = 0; t < q; ++t)
+        {
+        sum -= normal[p * numberOfTerms + t] * normal[q * numberOfTerms + t];
+        }
+      if (p != q)
+        {
+        normal[p * numberOfTerms + q] = sum / normal[q * numberOfTerms + q];
+        }
+      else if (sum > 1e-12 * ringSize)
+        {
+        normal[p * numberOfTerms + p] = sqrt(sum);
+        }
+      else
+        {
+        vtkWarningMacro("CompileBackgroundFit: The ring does not constrain a polynomial of order "
+                        << order);
+        this->RingVoxels.clear();
+        return;
+        }
+      }
+    }
+
+  // Solution operator (A^T A)^-1 A^T, one column per ring voxel
+  this->BackgroundFitMatrix.resize(static_cast<size_t>(numberOfTerms) * ringSize);
+  std::vector<double> column(numberOfTerms);
+  for (int r = 0; r < ringSize; ++r)
+    {
+    const double* row = &design[static_cast<size_t>(r) * numberOfTerms];
+    for (int p = 0; p < numberOfTerms; ++p)
+      {
+      double sum = row[p];
+      for (int t = 0; t < p; ++t)
+        {
+        sum -= normal[p * numberOfTerms + t] * column[t];
+        }
+      column[p] = sum / normal[p * numberOfTerms + p];
+      }
+    for (int p = numberOfTerms - 1; p >= 0; --p)
+      {
+      double sum = column[p];
+      for (int t = p + 1; t < numberOfTerms; ++t)
+        {
+        sum -= normal[t * numberOfTerms + p] * column[t];
+        }
+      column[p] = sum / normal[p * numberOfTerms + p];
+      this->BackgroundFitMatrix[static_cast<size_t>(p) * ringSize + r] = column[p];
+      }
+    }
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::ComputeBackgroundPhase(vtkImageData* phase)
+{
+  if (!this->BackgroundPhase)
+    {
+    this->BackgroundPhase = vtkImageData::New();
+    this->BackgroundPhase->SetSpacing(phase->GetSpacing());
+    this->BackgroundPhase->SetOrigin(phase->GetOrigin());
+    AllocateImage(this->BackgroundPhase, this->ProcessingExtent, phase->GetScalarType());
+    }
+
+  double spacing[3];
+  phase->GetSpacing(spacing);
+  double outerRadius = this->BackgroundRingRadii[1];
+  double origin[2] = {
+    (this->ProcessingExtent[0] - this->BackgroundRingCenter[0]) * spacing[0] / outerRadius,
+    (this->ProcessingExtent[2] - this->BackgroundRingCenter[1]) * spacing[1] / outerRadius };
+  double step[2] = { spacing[0] / outerRadius, spacing[1] / outerRadius };
+
+  int dimensions[3];
+  phase->GetDimensions(dimensions);
+  int order = this->BackgroundPolynomialOrder;
+  int ringSize = static_cast<int>(this->RingVoxels.size());
+  this->RingPhase.resize(ringSize);
+  this->BackgroundCoefficients.resize(GetNumberOfPolynomialTerms(order) + order + 1);
+  switch (phase->GetScalarType())
+    {
+    vtkTemplateMacro(
+      FitBackgroundExecute(static_cast<VTK_TT*>(phase->GetScalarPointer()),
+                           static_cast<VTK_TT*>(this->BackgroundPhase->GetScalarPointer()),
+                           dimensions, &this->RingVoxels[0], ringSize,
+                           &this->BackgroundFitMatrix[0], order, origin, step,
+                           &this->RingPhase[0], &this->BackgroundCoefficients[0]));
+    }
+}
+
+//---------------------------------------------------------------------------
+int vtkSlicerRTThermometryLogic::GetNumberOfLibraryBaselines()
+{
+  return static_cast<int>(this->BaselineLibrary.size());
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerRTThermometryLogic::IsCapturingBaselineLibrary()
+{
+  return this->HasBaseline() &&
+    this->GetNumberOfLibraryBaselines() < this->ActiveBaselineLibrarySize;
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::AddLibraryBaseline(vtkImageData* phase)
+{
+  vtkImageData* baseline = vtkImageData::New();
+  CopyExtent(phase, this->ProcessingExtent, baseline);
+  this->BaselineLibrary.push_back(baseline);
+
+  int dimensions[3];
+  baseline->GetDimensions(dimensions);
+  vtkIdType length = GetSignatureLength(dimensions, this->SignatureSubsampling);
+  this->BaselineSignatures.resize(this->BaselineLibrary.size() * length);
+  this->ExtractSignature(baseline, &this->BaselineSignatures[(this->BaselineLibrary.size() - 1) * length]);
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::ExtractSignature(vtkImageData* phase, float* signature)
+{
+  int dimensions[3];
+  phase->GetDimensions(dimensions);
+  switch (phase->GetScalarType())
+    {
+    vtkTemplateMacro(
+      ExtractSignatureExecute(static_cast<VTK_TT*>(phase->GetScalarPointer()),
+                              dimensions, this->SignatureSubsampling, signature));
+    }
+}
+
+//---------------------------------------------------------------------------
+int vtkSlicerRTThermometryLogic::SelectLibraryBaseline(vtkImageData* phase)
+{
+  int dimensions[3];
+  phase->GetDimensions(dimensions);
+  size_t length = static_cast<size_t>(GetSignatureLength(dimensions, this->SignatureSubsampling));
+  this->FrameSignature.resize(length);
+  this->ExtractSignature(phase, &this->FrameSignature[0]);
+
+  // Smallest sum of absolute differences. A baseline is dropped as soon as
+  // its partial sum exceeds the best one.
+  const float* frame = &this->FrameSignature[0];
+  int best = 0;
+  double bestDistance = VTK_DOUBLE_MAX;
+  for (size_t baseline = 0; baseline < this->BaselineLibrary.size(); ++baseline)
+    {
+    const float* signature = &this->BaselineSignatures[baseline * length];
+    double distance = 0.0;
+    for (size_t i = 0; i < length && distance < bestDistance; ++i)
+      {
+      distance += fabs(signature[i] - frame[i]);
+      }
+    if (distance < bestDistance)
+      {
+      bestDistance = distance;
+      best = static_cast<int>(baseline);
+      }
+    }
+  return best;
+}
+
+//---------------------------------------------------------------------------
+int vtkSlicerRTThermometryLogic::GetNumberOfTemperatureImages()
+{
+  return static_cast<int>(this->TemperatureImages.size());
+}
+
+//---------------------------------------------------------------------------
+vtkImageData* vtkSlicerRTThermometryLogic::GetTemperatureImage(int index)
+{
+  if (index < 0 || index >= static_cast<int>(this->TemperatureImages.size()))
+    {
+    return NULL;
+    }
+
+  CachedTemperature& cached = this->TemperatureImages[index];
+  int scalarType = this->PhaseHistory[index]->GetScalarType();
+  if (!cached.Image)
+    {
+    cached.Image = this->NewTemperatureImage();
+    }
+  else if (this->IsTemperatureStampCurrent(cached, scalarType))
+    {
+    this->TouchTemperatureImage(index);
+    return cached.Image;
+    }
+
+  this->ConvertPhaseToTemperature(this->PhaseHistory[index], cached.Image);
+  if (this->SpatialFilter != NoSpatialFilter)
+    {
+    this->SmoothTemperature(cached.Image);
+    }
+  this->StampTemperature(cached, scalarType);
+  this->TouchTemperatureImage(index);
+  return cached.Image;
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::StampTemperature(CachedTemperature& cached, int scalarType)
+{
+  cached.BaseTemperature = this->BaseTemperature;
+  cached.Factor = this->GetPhaseToTemperatureFactor();
+  cached.Quantization = this->GetConversionQuantization(scalarType);
+  cached.SpatialFilter = this->SpatialFilter;
+  cached.SpatialFilterRadius = this->SpatialFilterRadius;
+  cached.SpatialFilterThroughSlices = this->SpatialFilterThroughSlices;
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerRTThermometryLogic::IsTemperatureStampCurrent(const CachedTemperature& cached,
+                                                            int scalarType)
+{
+  if (cached.BaseTemperature != this->BaseTemperature ||
+      cached.Factor != this->GetPhaseToTemperatureFactor() ||
+      cached.Quantization != this->GetConversionQuantization(scalarType) ||
+      cached.SpatialFilter != this->SpatialFilter)
+    {
+    return false;
+    }
+  return this->SpatialFilter == NoSpatialFilter ||
+    (cached.SpatialFilterRadius == this->SpatialFilterRadius &&
+     cached.SpatialFilterThroughSlices == this->SpatialFilterThroughSlices);
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::SmoothTemperature(vtkImageData* temperature)
+{
+  int radius = this->SpatialFilterRadius;
+  if (this->SpatialKernelFilter != this->SpatialFilter || this->SpatialKernelRadius != radius)
+    {
+    this->SpatialKernel.resize(2 * radius + 1);
+    double sum = 0.0;
+    for (int k = -radius; k <= radius; ++k)
+      {
+      double sigma = radius / 2.0;
+      double weight = this->SpatialFilter == GaussianFilter ?
+        exp(-k * k / (2.0 * sigma * sigma)) : 1.0;
+      this->SpatialKernel[k + radius] = weight;
+      sum += weight;
+      }
+    for (int k = 0; k <= 2 * radius; ++k)
+      {
+      this->SpatialKernel[k] /= sum;
+      }
+    this->SpatialKernelFilter = this->SpatialFilter;
+    this->SpatialKernelRadius = radius;
+    }
+
+  SmoothArgs args;
+  args.Image = temperature->GetScalarPointer();
+  args.ScalarType = temperature->GetScalarType();
+  args.Weights = NULL;
+  temperature->GetDimensions(args.Dimensions);
+  args.Kernel = &this->SpatialKernel[0];
+  args.Radius = radius;
+  vtkIdType numberOfVoxels = temperature->GetNumberOfPoints();
+
+  // With a mask, voxels outside of it do not contribute: their weight is
+  // smoothed along and divides the result (normalized convolution)
+  bool masked = this->IsMaskApplicable(args.Dimensions) && this->NumberOfMaskedVoxels > 0;
+  if (masked)
+    {
+    this->SpatialWeights.resize(numberOfVoxels);
+    for (vtkIdType i = 0; i < numberOfVoxels; ++i)
+      {
+      this->SpatialWeights[i] = this->MaskVoxels[i] ? 1.0 : 0.0;
+      }
+    args.Weights = &this->SpatialWeights[0];
+    if (args.ScalarType == VTK_FLOAT)
+      {
+      WeightSmoothedImage(static_cast<float*>(args.Image), args.Weights, numberOfVoxels);
+      }
+    else
+      {
+      WeightSmoothedImage(static_cast<double*>(args.Image), args.Weights, numberOfVoxels);
+      }
+    }
+
+  int maximumLength = std::max(args.Dimensions[0], std::max(args.Dimensions[1], args.Dimensions[2]));
+  args.ScratchSize = static_cast<vtkIdType>(maximumLength + 2 * radius) * SmoothBlockWidth;
+  if (static_cast<vtkIdType>(this->SpatialScratch.size()) < args.ScratchSize * this->NumberOfThreads)
+    {
+    this->SpatialScratch.resize(args.ScratchSize * this->NumberOfThreads);
+    }
+  args.Scratch = &this->SpatialScratch[0];
+
+  int numberOfAxes = (this->SpatialFilterThroughSlices && args.Dimensions[2] > 1) ? 3 : 2;
+  for (args.Axis = 0; args.Axis < numberOfAxes; ++args.Axis)
+    {
+    int numberOfUnits = GetNumberOfSmoothUnits(args.Dimensions, args.Axis);
+    this->Threader->SetNumberOfThreads(std::max(1, std::min(this->NumberOfThreads, numberOfUnits)));
+    this->Threader->SetSingleMethod(SmoothThreadedExecute, &args);
+    this->Threader->SingleMethodExecute();
+    }
+
+  if (masked && args.ScalarType == VTK_FLOAT)
+    {
+    NormalizeSmoothedImage(static_cast<float*>(args.Image), args.Weights,
+                           &this->MaskVoxels[0], numberOfVoxels);
+    }
+  else if (masked)
+    {
+    NormalizeSmoothedImage(static_cast<double*>(args.Image), args.Weights,
+                           &this->MaskVoxels[0], numberOfVoxels);
+    }
+  temperature->Modified();
+}
+
+//---------------------------------------------------------------------------
+vtkImageData* vtkSlicerRTThermometryLogic::GetLastTemperatureImage()
+{
+  return this->GetTemperatureImage(static_cast<int>(this->TemperatureImages.size()) - 1);
+}
+
+//---------------------------------------------------------------------------
+vtkImageData* vtkSlicerRTThermometryLogic::GetAccumulatedPhaseImage(int index)
+{
+  if (index < 0 || index >= static_cast<int>(this->PhaseHistory.size()))
+    {
+    return NULL;
+    }
+  return this->PhaseHistory[index];
+}
+
+//---------------------------------------------------------------------------
+vtkImageData* vtkSlicerRTThermometryLogic::NewTemperatureImage()
+{
+  vtkImageData* temperature = this->FramePool->Acquire(this->ProcessingExtent, this->TemperatureScalarType);
+  temperature->SetSpacing(1.0, 1.0, 1.0); // Not sure why spacing should be 1.0, 1.0, 1.0, but not fitting otherwise
+  if (this->IsMaskApplicable(temperature->GetDimensions()))
+    {
+    ZeroImage(temperature);
+    }
+  return temperature;
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::TouchTemperatureImage(int index)
+{
+  // Most recently used last
+  if (!this->TemperatureCacheOrder.empty() && this->TemperatureCacheOrder.back() == index)
+    {
+    return;
+    }
+  std::deque<int>::iterator it =
+    std::find(this->TemperatureCacheOrder.begin(), this->TemperatureCacheOrder.end(), index);
+  if (it != this->TemperatureCacheOrder.end())
+    {
+    this->TemperatureCacheOrder.erase(it);
+    }
+  this->TemperatureCacheOrder.push_back(index);
+
+  // Release the least recently used images, except the last frame
+  int lastIndex = static_cast<int>(this->TemperatureImages.size()) - 1;
+  size_t numberOfCandidates = this->TemperatureCacheOrder.size();
+  while (this->TemperatureCacheSize > 0 && numberOfCandidates-- > 0 &&
+         this->TemperatureCacheOrder.size() > static_cast<size_t>(this->TemperatureCacheSize))
+    {
+    int evicted = this->TemperatureCacheOrder.front();
+    this->TemperatureCacheOrder.pop_front();
+    if (evicted == lastIndex || evicted == index)
+      {
+      this->TemperatureCacheOrder.push_back(evicted);
+      continue;
+      }
+    this->FramePool->Release(this->TemperatureImages[evicted].Image);
+    this->TemperatureImages[evicted].Image = NULL;
+    }
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::ConvertPhaseToTemperature(vtkImageData* accumulated,
+                                                            vtkImageData* temperature)
+{
+  PhaseKernelArgs args;
+  args.Previous = NULL;
+  args.Current = NULL;
+  args.Accumulated = accumulated->GetScalarPointer();
+  args.Temperature = temperature->GetScalarPointer();
+  args.ScalarType = accumulated->GetScalarType();
+  args.TemperatureScalarType = temperature->GetScalarType();
+  args.NumberOfVoxels = accumulated->GetNumberOfPoints();
+  args.BaseTemperature = this->BaseTemperature;
+  args.Factor = this->GetPhaseToTemperatureFactor();
+  args.ConvertOnly = true;
+  args.FromReference = false;
+  args.LookupTable = this->UseLookupTable(args.ScalarType, false) ?
+    this->UpdateLookupTable(args.ScalarType, args.TemperatureScalarType) : NULL;
+  args.FilterState = NULL;
+  args.FilterGain = 0.0;
+  args.Filtered = NULL;
+  for (int map = 0; map < NumberOfDerivedMaps; ++map)
+    {
+    args.DerivedMaps[map] = NULL;
+    }
+  args.DerivedMapFlags = 0;
+  args.TemperatureThreshold = this->TemperatureThreshold;
+  args.FrameInterval = 0.0;
+  args.LethalTemperature = VTK_DOUBLE_MAX;
+  args.LethalDose = VTK_DOUBLE_MAX;
+  args.NewlyAblatedVoxels = NULL;
+  args.NumberOfRuns = 0;
+  args.RunBegins = NULL;
+  args.RunEnds = NULL;
+  args.RunOffsets = NULL;
+  args.NumberOfMaskedVoxels = 0;
+
+  int dimensions[3];
+  accumulated->GetDimensions(dimensions);
+  if (this->IsMaskApplicable(dimensions))
+    {
+    if (this->NumberOfMaskedVoxels == 0)
+      {
+      return;
+      }
+    args.NumberOfRuns = this->GetNumberOfMaskRuns();
+    args.RunBegins = &this->MaskRunBegins[0];
+    args.RunEnds = &this->MaskRunEnds[0];
+    args.RunOffsets = &this->MaskRunOffsets[0];
+    args.NumberOfMaskedVoxels = this->NumberOfMaskedVoxels;
+    }
+
+  this->Threader->SetNumberOfThreads(this->NumberOfThreads);
+  this->Threader->SetSingleMethod(PhaseKernelThreadedExecute, &args);
+  this->Threader->SingleMethodExecute();
+  temperature->Modified();
+}
+
+//---------------------------------------------------------------------------
+double vtkSlicerRTThermometryLogic::GetTemperatureAtIJK(const double ijk[3])
+{
+  vtkImageData* lastImage = this->GetLastTemperatureImage();
+  if (!lastImage)
+    {
+    return this->BaseTemperature;
+    }
+
+  int dimensions[3];
+  int* extent = lastImage->GetExtent();
+  lastImage->GetDimensions(dimensions);
+  int position[3];
+  for (int i = 0; i < 3; ++i)
+    {
+    position[i] = static_cast<int>(ijk[i]);
+    if (ijk[i] < 0 || position[i] < extent[2*i] || position[i] > extent[2*i+1])
+      {
+      return this->BaseTemperature;
+      }
+    position[i] -= extent[2*i];
+    }
+
+  vtkIdType index = (static_cast<vtkIdType>(position[2])*dimensions[1] + position[1])*dimensions[0] + position[0];
+  if (this->IsMaskApplicable(dimensions) && !this->MaskVoxels[index])
+    {
+    return this->BaseTemperature;
+    }
+
+  if (lastImage->GetScalarType() == VTK_FLOAT)
+    {
+    return static_cast<float*>(lastImage->GetScalarPointer())[index];
+    }
+  return static_cast<double*>(lastImage->GetScalarPointer())[index];
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerRTThermometryLogic::SetMaskFromLabelMap(vtkImageData* labelMap)
+{
+  return this->SetMaskFromImage(labelMap, true, 0.0);
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerRTThermometryLogic::SetMaskFromMagnitude(vtkImageData* magnitude, double threshold)
+{
+  return this->SetMaskFromImage(magnitude, false, threshold);
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerRTThermometryLogic::SetMaskFromImage(vtkImageData* image, bool labelMap,
+                                                   double threshold)
+{
+  if (!image || !image->GetScalarPointer() || image->GetNumberOfScalarComponents() != 1)
+    {
+    vtkErrorMacro("SetMask: Invalid mask image");
+    return false;
+    }
+
+  vtkIdType numberOfVoxels = image->GetNumberOfPoints();
+  this->MaskSourceVoxels.resize(numberOfVoxels);
+  switch (image->GetScalarType())
+    {
+    vtkTemplateMacro(
+      BuildMaskExecute(static_cast<VTK_TT*>(image->GetScalarPointer()), numberOfVoxels,
+                       labelMap, threshold, &this->MaskSourceVoxels[0]));
+    default:
+      vtkErrorMacro("SetMask: Unsupported scalar type");
+      this->ClearMask();
+      return false;
+    }
+  image->GetDimensions(this->MaskSourceDimensions);
+
+  this->CompileMask();
+  this->CompileProtectionZones();
+  this->CompileLineProfiles();
+  this->Modified();
+  return true;
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::CompileMask()
+{
+  this->MaskVoxels.clear();
+  this->MaskRunBegins.clear();
+  this->MaskRunEnds.clear();
+  this->MaskRunOffsets.clear();
+  this->NumberOfMaskedVoxels = 0;
+  this->MaskDimensions[0] = this->MaskDimensions[1] = this->MaskDimensions[2] = 0;
+  if (this->MaskSourceVoxels.empty())
+    {
+    return;
+    }
+
+  // Mask voxels are laid out like the processed images: the processing
+  // extent once a baseline is set, the whole mask image before
+  int extent[6] = { 0, this->MaskSourceDimensions[0] - 1,
+                    0, this->MaskSourceDimensions[1] - 1,
+                    0, this->MaskSourceDimensions[2] - 1 };
+  if (this->HasBaseline())
+    {
+    for (int axis = 0; axis < 3; ++axis)
+      {
+      if (this->AcquisitionDimensions[axis] != this->MaskSourceDimensions[axis])
+        {
+        // Not applicable to this acquisition
+        return;
+        }
+      extent[2*axis] = this->ProcessingExtent[2*axis];
+      extent[2*axis+1] = this->ProcessingExtent[2*axis+1];
+      }
+    }
+
+  for (int axis = 0; axis < 3; ++axis)
+    {
+    this->MaskDimensions[axis] = extent[2*axis+1] - extent[2*axis] + 1;
+    }
+  this->MaskVoxels.resize(static_cast<size_t>(this->MaskDimensions[0]) *
+                          this->MaskDimensions[1] * this->MaskDimensions[2]);
+  vtkIdType index = 0;
+  for (int k = extent[4]; k <= extent[5]; ++k)
+    {
+    for (int j = extent[2]; j <= extent[3]; ++j)
+      {
+      const unsigned char* source = &this->MaskSourceVoxels[
+        (static_cast<vtkIdType>(k) * this->MaskSourceDimensions[1] + j) *
+        this->MaskSourceDimensions[0] + extent[0]];
+      for (int i = extent[0]; i <= extent[1]; ++i, ++index, ++source)
+        {
+        this->MaskVoxels[index] = *source;
+        }
+      }
+    }
+
+  // Runs of contiguous voxels
+  vtkIdType numberOfVoxels = static_cast<vtkIdType>(this->MaskVoxels.size());
+  vtkIdType i = 0;
+  while (i < numberOfVoxels)
+    {
+    if (!this->MaskVoxels[i])
+      {
+      ++i;
+      continue;
+      }
+    vtkIdType begin = i;
+    while (i < numberOfVoxels && this->MaskVoxels[i])
+      {
+      ++i;
+      }
+    this->MaskRunBegins.push_back(begin);
+    this->MaskRunEnds.push_back(i);
+    this->MaskRunOffsets.push_back(this->NumberOfMaskedVoxels);
+    this->NumberOfMaskedVoxels += i - begin;
+    }
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::SetProcessingExtent(const int extent[6])
+{
+  for (int i = 0; i < 6; ++i)
+    {
+    this->RequestedExtent[i] = extent[i];
+    }
+  this->UseRequestedExtent = true;
+  this->Modified();
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::ClearProcessingExtent()
+{
+  this->UseRequestedExtent = false;
+  this->Modified();
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerRTThermometryLogic::HasProcessingExtent()
+{
+  return this->UseRequestedExtent;
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerRTThermometryLogic::GetProcessingExtent(int extent[6])
+{
+  if (!this->HasBaseline())
+    {
+    return false;
+    }
+  for (int i = 0; i < 6; ++i)
+    {
+    extent[i] = this->ProcessingExtent[i];
+    }
+  return true;
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::UpdateProcessingExtent(vtkImageData* phaseImage)
+{
+  phaseImage->GetDimensions(this->AcquisitionDimensions);
+  bool empty = false;
+  for (int axis = 0; axis < 3; ++axis)
+    {
+    int lower = 0;
+    int upper = this->AcquisitionDimensions[axis] - 1;
+    if (this->UseRequestedExtent)
+      {
+      lower = std::max(lower, this->RequestedExtent[2*axis]);
+      upper = std::min(upper, this->RequestedExtent[2*axis+1]);
+      }
+    this->ProcessingExtent[2*axis] = lower;
+    this->ProcessingExtent[2*axis+1] = upper;
+    empty = empty || lower > upper;
+    }
+
+  if (empty)
+    {
+    vtkWarningMacro("UpdateProcessingExtent: Requested extent is outside of the image, "
+                    "processing the whole image");
+    for (int axis = 0; axis < 3; ++axis)
+      {
+      this->ProcessingExtent[2*axis] = 0;
+      this->ProcessingExtent[2*axis+1] = this->AcquisitionDimensions[axis] - 1;
+      }
+    }
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::ClearMask()
+{
+  this->MaskSourceVoxels.clear();
+  this->MaskSourceDimensions[0] = this->MaskSourceDimensions[1] = this->MaskSourceDimensions[2] = 0;
+  this->MaskVoxels.clear();
+  this->MaskRunBegins.clear();
+  this->MaskRunEnds.clear();
+  this->MaskRunOffsets.clear();
+  this->NumberOfMaskedVoxels = 0;
+  this->MaskDimensions[0] = this->MaskDimensions[1] = this->MaskDimensions[2] = 0;
+  this->CompileProtectionZones();
+  this->CompileLineProfiles();
+  this->Modified();
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerRTThermometryLogic::HasMask()
+{
+  return !this->MaskSourceVoxels.empty();
+}
+
+//---------------------------------------------------------------------------
+vtkIdType vtkSlicerRTThermometryLogic::GetNumberOfMaskedVoxels()
+{
+  return this->NumberOfMaskedVoxels;
+}
+
+//---------------------------------------------------------------------------
+int vtkSlicerRTThermometryLogic::GetNumberOfMaskRuns()
+{
+  return static_cast<int>(this->MaskRunBegins.size());
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerRTThermometryLogic::IsMaskApplicable(const int dimensions[3])
+{
+  return !this->MaskVoxels.empty() &&
+    this->MaskDimensions[0] == dimensions[0] &&
+    this->MaskDimensions[1] == dimensions[1] &&
+    this->MaskDimensions[2] == dimensions[2];
+}
+
+//---------------------------------------------------------------------------
+double vtkSlicerRTThermometryLogic::GetPhaseToTemperatureFactor()
+{
+  double coefficient =
+    1 / (this->EchoTime * 2*M_PI*this->GyromagneticRatio * this->MagneticField * this->ThermalCoefficient);
+  return M_PI / this->ScaleFactor * coefficient;
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic
+::ComputePhaseDifference(vtkImageData* previous, vtkImageData* current,
+                         vtkImageData* accumulated, vtkImageData* temperature,
+                         bool fromReference)
+{
+  this->RunPhaseKernel(previous, current, accumulated, temperature, fromReference, NULL, false);
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic
+::RunPhaseKernel(vtkImageData* previous, vtkImageData* current,
+                 vtkImageData* accumulated, vtkImageData* temperature,
+                 bool fromReference, vtkImageData* filtered, bool derivedMaps)
+{
+  if (!previous || !current || !accumulated || !temperature)
+    {
+    return;
+    }
+
+  if (previous == current)
+    {
+    return;
+    }
+
+  if ((temperature->GetScalarType() != VTK_FLOAT &&
+       temperature->GetScalarType() != VTK_DOUBLE) ||
+      previous->GetScalarType() != current->GetScalarType() ||
+      previous->GetScalarType() != accumulated->GetScalarType())
+    {
+    vtkErrorMacro("ComputePhaseDifference: Scalar types do not match");
+    return;
+    }
+
+  PhaseKernelArgs args;
+  args.Previous = previous->GetScalarPointer();
+  args.Current = current->GetScalarPointer();
+  args.Accumulated = accumulated->GetScalarPointer();
+  args.Temperature = temperature->GetScalarPointer();
+  args.ScalarType = accumulated->GetScalarType();
+  args.TemperatureScalarType = temperature->GetScalarType();
+  args.NumberOfVoxels = accumulated->GetNumberOfPoints();
+  args.BaseTemperature = this->BaseTemperature;
+  args.Factor = this->GetPhaseToTemperatureFactor();
+  args.ConvertOnly = false;
+  args.FromReference = fromReference;
+  args.LookupTable = this->UseLookupTable(args.ScalarType, true) ?
+    this->UpdateLookupTable(args.ScalarType, args.TemperatureScalarType) : NULL;
+  args.FilterState = NULL;
+  args.FilterGain = 0.0;
+  args.Filtered = NULL;
+  for (int map = 0; map < NumberOfDerivedMaps; ++map)
+    {
+    args.DerivedMaps[map] = NULL;
+    }
+  args.DerivedMapFlags = 0;
+  args.TemperatureThreshold = this->TemperatureThreshold;
+  args.FrameInterval = 0.0;
+  args.LethalTemperature = VTK_DOUBLE_MAX;
+  args.LethalDose = VTK_DOUBLE_MAX;
+  args.NewlyAblatedVoxels = NULL;
+  args.NumberOfRuns = 0;
+  args.RunBegins = NULL;
+  args.RunEnds = NULL;
+  args.RunOffsets = NULL;
+  args.NumberOfMaskedVoxels = 0;
+
+  if (filtered)
+    {
+    if (!this->FilterStateValid)
+      {
+      // Start from the accumulated phase so that switching the filter on
+      // does not cause a transient
+      this->FilterState.resize(args.NumberOfVoxels);
+      switch (args.ScalarType)
+        {
+        vtkTemplateMacro(
+          InitializeFilterExecute(static_cast<VTK_TT*>(args.Accumulated),
+                                  &this->FilterState[0], args.NumberOfVoxels));
+        }
+      this->KalmanVariance = this->KalmanMeasurementNoise * this->KalmanMeasurementNoise;
+      this->FilterStateValid = true;
+      }
+    args.FilterState = &this->FilterState[0];
+    args.FilterGain = this->UpdateTemporalFilterGain();
+    args.Filtered = filtered->GetScalarPointer();
+    }
+
+  if (derivedMaps)
+    {
+    this->UpdateDerivedMapConversion();
+    for (int map = 0; map < NumberOfDerivedMaps; ++map)
+      {
+      if (this->DerivedMapEnabled[map] && this->DerivedMapImages[map] &&
+          this->DerivedMapImages[map]->GetNumberOfPoints() == args.NumberOfVoxels)
+        {
+        args.DerivedMaps[map] = static_cast<double*>(this->DerivedMapImages[map]->GetScalarPointer());
+        args.DerivedMapFlags |= 1 << map;
+        }
+      }
+    args.FrameInterval = this->FrameInterval;
+
+    // Count the crossings of this frame on top of the current count
+    if (args.DerivedMaps[this->GetAblationMap()])
+      {
+      this->GetNumberOfAblatedVoxels();
+      if (this->AblationCriterion == ThermalDoseAblation)
+        {
+        args.LethalDose = this->LethalDose;
+        }
+      else
+        {
+        args.LethalTemperature = this->LethalTemperature;
+        }
+      this->NewlyAblatedVoxels.assign(this->NumberOfThreads, 0);
+      args.NewlyAblatedVoxels = &this->NewlyAblatedVoxels[0];
+      }
+    }
+
+  int dimensions[3];
+  accumulated->GetDimensions(dimensions);
+  if (this->IsMaskApplicable(dimensions))
+    {
+    if (this->NumberOfMaskedVoxels == 0)
+      {
+      return;
+      }
+    args.NumberOfRuns = this->GetNumberOfMaskRuns();
+    args.RunBegins = &this->MaskRunBegins[0];
+    args.RunEnds = &this->MaskRunEnds[0];
+    args.RunOffsets = &this->MaskRunOffsets[0];
+    args.NumberOfMaskedVoxels = this->NumberOfMaskedVoxels;
+    }
+  else if (this->HasMask())
+    {
+    vtkWarningMacro("ComputePhaseDifference: Mask does not match the image dimensions, ignored");
+    }
+
+  if (!args.Previous || !args.Current ||
+      !args.Accumulated || !args.Temperature)
+    {
+    return;
+    }
+
+  double start = vtkTimerLog::GetUniversalTime();
+  this->Threader->SetNumberOfThreads(this->NumberOfThreads);
+  this->Threader->SetSingleMethod(PhaseKernelThreadedExecute, &args);
+  this->Threader->SingleMethodExecute();
+  this->ActiveConversion = args.LookupTable ? LookupTableConversion : ArithmeticConversion;
+  for (int map = 0; map < NumberOfDerivedMaps; ++map)
+    {
+    if (args.DerivedMaps[map])
+      {
+      this->DerivedMapImages[map]->Modified();
+      }
+    }
+  if (args.NewlyAblatedVoxels)
+    {
+    vtkIdType newlyAblated = 0;
+    for (int thread = 0; thread < this->NumberOfThreads; ++thread)
+      {
+      newlyAblated += this->NewlyAblatedVoxels[thread];
+      }
+    if (newlyAblated > 0)
+      {
+      this->NumberOfAblatedVoxels += newlyAblated;
+      this->AblationSurfaceValid = false;
+      }
+    }
+
+  if (this->IsCalibratingConversion(args.ScalarType))
+    {
+    // Keep the best time per voxel of each conversion
+    vtkIdType numberOfVoxels = args.NumberOfRuns > 0 ? args.NumberOfMaskedVoxels : args.NumberOfVoxels;
+    double time = (vtkTimerLog::GetUniversalTime() - start) / std::max(numberOfVoxels, vtkIdType(1));
+    int conversion = this->ActiveConversion;
+    if (this->NumberOfCalibrationSamples[conversion] == 0 ||
+        time < this->CalibrationTimes[conversion])
+      {
+      this->CalibrationTimes[conversion] = time;
+      }
+    this->NumberOfCalibrationSamples[conversion]++;
+    if (this->NumberOfCalibrationSamples[ArithmeticConversion] >= ConversionCalibrationFrames &&
+        this->NumberOfCalibrationSamples[LookupTableConversion] >= ConversionCalibrationFrames)
+      {
+      this->SelectedConversion =
+        this->CalibrationTimes[LookupTableConversion] < this->CalibrationTimes[ArithmeticConversion] ?
+        LookupTableConversion : ArithmeticConversion;
+      }
+    }
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::SetTemporalFilter(int filter)
+{
+  filter = std::max(static_cast<int>(NoTemporalFilter), std::min(filter, static_cast<int>(KalmanFilter)));
+  if (filter == this->TemporalFilter)
+    {
+    return;
+    }
+  this->TemporalFilter = filter;
+  this->FilterStateValid = false;
+  this->Modified();
+}
+
+//---------------------------------------------------------------------------
+double vtkSlicerRTThermometryLogic::UpdateTemporalFilterGain()
+{
+  if (this->TemporalFilter == ExponentialFilter)
+    {
+    return this->TemporalFilterWeight;
+    }
+
+  // Constant temperature model: predict, then update the error variance
+  double predicted = this->KalmanVariance + this->KalmanProcessNoise * this->KalmanProcessNoise;
+  double gain = predicted / (predicted + this->KalmanMeasurementNoise * this->KalmanMeasurementNoise);
+  this->KalmanVariance = (1.0 - gain) * predicted;
+  return gain;
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerRTThermometryLogic::RequiresSequentialReprocessing()
+{
+  // Frames referenced to the library or the fitted background, frames that
+  // may be rejected and filtered phases cannot be computed as a scan of
+  // the frame differences
+  return this->BaselineLibrarySize > 0 ||
+    (this->Referenceless && this->HasBackgroundRing) ||
+    this->RejectionThreshold > 0.0 ||
+    this->TemporalFilter != NoTemporalFilter ||
+    this->DerivedMapEnabled[MaximumTemperatureMap] ||
+    this->DerivedMapEnabled[TimeAboveThresholdMap] ||
+    this->DerivedMapEnabled[ThermalDoseMap];
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::SetDerivedMapEnabled(int map, bool enabled)
+{
+  if (map < 0 || map >= NumberOfDerivedMaps || this->DerivedMapEnabled[map] == enabled)
+    {
+    return;
+    }
+  this->DerivedMapEnabled[map] = enabled;
+  this->Modified();
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerRTThermometryLogic::GetDerivedMapEnabled(int map)
+{
+  return map >= 0 && map < NumberOfDerivedMaps && this->DerivedMapEnabled[map];
+}
+
+//---------------------------------------------------------------------------
+vtkImageData* vtkSlicerRTThermometryLogic::GetDerivedMap(int map)
+{
+  if (map < 0 || map >= NumberOfDerivedMaps)
+    {
+    return NULL;
+    }
+  this->UpdateDerivedMapConversion();
+  return this->DerivedMapImages[map];
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::UpdateDerivedMapConversion()
+{
+  double base = this->BaseTemperature;
+  double factor = this->GetPhaseToTemperatureFactor();
+  // Unset parameters give a NaN factor, which must not count as a change
+  bool sameFactor = factor == this->DerivedMapFactor ||
+    (factor != factor && this->DerivedMapFactor != this->DerivedMapFactor);
+  if (base == this->DerivedMapBaseTemperature && sameFactor)
+    {
+    return;
+    }
+
+  // The maximum is affine in the phase and follows the new conversion, as
+  // long as it stays a maximum (same sign of the factor)
+  double scale = this->DerivedMapFactor != 0.0 ? factor / this->DerivedMapFactor : 0.0;
+  double offset = base - this->DerivedMapBaseTemperature * scale;
+  bool affine = scale > 0.0 && scale <= VTK_DOUBLE_MAX && offset == offset;
+  vtkImageData* maximum = this->DerivedMapImages[MaximumTemperatureMap];
+  if (maximum && affine)
+    {
+    double* data = static_cast<double*>(maximum->GetScalarPointer());
+    vtkIdType numberOfVoxels = maximum->GetNumberOfPoints();
+    for (vtkIdType i = 0; i < numberOfVoxels; ++i)
+      {
+      data[i] = data[i] * scale + offset;
+      }
+    maximum->Modified();
+    }
+  for (size_t zone = 0; affine && zone < this->ProtectionZones.size(); ++zone)
+    {
+    this->ProtectionZones[zone].Maximum = this->ProtectionZones[zone].Maximum * scale + offset;
+    this->ProtectionZones[zone].Mean = this->ProtectionZones[zone].Mean * scale + offset;
+    }
+
+  // The time above threshold and the dose are not: they restart from the
+  // next frame
+  bool restarted = false;
+  for (int map = 0; map < NumberOfDerivedMaps; ++map)
+    {
+    if (this->DerivedMapImages[map] && (map != MaximumTemperatureMap || !affine))
+      {
+      this->FramePool->Release(this->DerivedMapImages[map]);
+      this->DerivedMapImages[map] = NULL;
+      restarted = true;
+      }
+    }
+  if (restarted)
+    {
+    vtkWarningMacro("UpdateDerivedMapConversion: Conversion parameters changed, the derived maps "
+                    "that cannot be converted restart from the next frame");
+    }
+
+  this->DerivedMapBaseTemperature = base;
+  this->DerivedMapFactor = factor;
+  this->InvalidateAblationZone();
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::AllocateDerivedMaps(vtkImageData* phase)
+{
+  for (int map = 0; map < NumberOfDerivedMaps; ++map)
+    {
+    if (!this->DerivedMapEnabled[map] || this->DerivedMapImages[map])
+      {
+      continue;
+      }
+    vtkImageData* image = this->FramePool->Acquire(this->ProcessingExtent, VTK_DOUBLE);
+    image->SetSpacing(phase->GetSpacing());
+    image->SetOrigin(phase->GetOrigin());
+    // The maximum starts from the base temperature, as voxels out of the
+    // mask are never updated
+    double* data = static_cast<double*>(image->GetScalarPointer());
+    std::fill(data, data + image->GetNumberOfPoints(),
+              map == MaximumTemperatureMap ? this->BaseTemperature : 0.0);
+    this->DerivedMapImages[map] = image;
+    if (map == this->GetAblationMap())
+      {
+      this->InvalidateAblationZone();
+      }
+    }
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::SetAblationCriterion(int criterion)
+{
+  criterion = std::max(static_cast<int>(ThermalDoseAblation),
+                       std::min(criterion, static_cast<int>(TemperatureAblation)));
+  if (criterion == this->AblationCriterion)
+    {
+    return;
+    }
+  this->AblationCriterion = criterion;
+  this->InvalidateAblationZone();
+  this->Modified();
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::SetLethalDose(double dose)
+{
+  if (dose == this->LethalDose)
+    {
+    return;
+    }
+  this->LethalDose = dose;
+  this->InvalidateAblationZone();
+  this->Modified();
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::SetLethalTemperature(double temperature)
+{
+  if (temperature == this->LethalTemperature)
+    {
+    return;
+    }
+  this->LethalTemperature = temperature;
+  this->InvalidateAblationZone();
+  this->Modified();
+}
+
+//---------------------------------------------------------------------------
+int vtkSlicerRTThermometryLogic::GetAblationMap()
+{
+  return this->AblationCriterion == ThermalDoseAblation ?
+    ThermalDoseMap : MaximumTemperatureMap;
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::InvalidateAblationZone()
+{
+  this->AblatedVoxelsValid = false;
+  this->AblationSurfaceValid = false;
+}
+
+//---------------------------------------------------------------------------
+vtkIdType vtkSlicerRTThermometryLogic::GetNumberOfAblatedVoxels()
+{
+  this->UpdateDerivedMapConversion();
+  if (this->AblatedVoxelsValid)
+    {
+    return this->NumberOfAblatedVoxels;
+    }
+
+  // Full scan, only after the map or the criterion changed
+  this->NumberOfAblatedVoxels = 0;
+  vtkImageData* map = this->DerivedMapImages[this->GetAblationMap()];
+  if (map)
+    {
+    double threshold = this->AblationCriterion == ThermalDoseAblation ?
+      this->LethalDose : this->LethalTemperature;
+    const double* data = static_cast<const double*>(map->GetScalarPointer());
+    vtkIdType numberOfVoxels = map->GetNumberOfPoints();
+    for (vtkIdType i = 0; i < numberOfVoxels; ++i)
+      {
+      this->NumberOfAblatedVoxels += data[i] >= threshold ? 1 : 0;
+      }
+    }
+  this->AblatedVoxelsValid = true;
+  return this->NumberOfAblatedVoxels;
+}
+
+//---------------------------------------------------------------------------
+double vtkSlicerRTThermometryLogic::GetAblationVolume()
+{
+  this->UpdateDerivedMapConversion();
+  vtkImageData* map = this->DerivedMapImages[this->GetAblationMap()];
+  if (!map)
+    {
+    return 0.0;
+    }
+  double* spacing = map->GetSpacing();
+  return this->GetNumberOfAblatedVoxels() * spacing[0] * spacing[1] * spacing[2] / 1000.0;
+}
+
+//---------------------------------------------------------------------------
+vtkPolyData* vtkSlicerRTThermometryLogic::GetAblationSurface()
+{
+  this->UpdateDerivedMapConversion();
+  if (this->AblationSurfaceValid)
+    {
+    return this->AblationSurface;
+    }
+
+  vtkImageData* map = this->DerivedMapImages[this->GetAblationMap()];
+  if (!map || this->GetNumberOfAblatedVoxels() == 0)
+    {
+    this->AblationSurface->Initialize();
+    }
+  else
+    {
+    // Unit spacing and no origin: points are voxel indices
+    vtkNew<vtkImageData> indexMap;
+    indexMap->ShallowCopy(map);
+    indexMap->SetSpacing(1.0, 1.0, 1.0);
+    indexMap->SetOrigin(0.0, 0.0, 0.0);
+
+    vtkNew<vtkMarchingCubes> contour;
+#if VTK_MAJOR_VERSION <= 5
+    contour->SetInput(indexMap.GetPointer());
+#else
+    contour->SetInputData(indexMap.GetPointer());
+#endif
+    contour->SetValue(0, this->AblationCriterion == ThermalDoseAblation ?
+                      this->LethalDose : this->LethalTemperature);
+    contour->ComputeNormalsOn();
+    contour->ComputeScalarsOff();
+    contour->Update();
+    this->AblationSurface->ShallowCopy(contour->GetOutput());
+    }
+  this->AblationSurface->Modified();
+  this->AblationSurfaceValid = true;
+  return this->AblationSurface;
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerRTThermometryLogic::IsLookupTableType(int scalarType)
+{
+  return scalarType == VTK_CHAR || scalarType == VTK_SIGNED_CHAR ||
+    scalarType == VTK_UNSIGNED_CHAR || scalarType == VTK_SHORT ||
+    scalarType == VTK_UNSIGNED_SHORT;
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerRTThermometryLogic::IsCalibratingConversion(int scalarType)
+{
+  return this->ConversionMode == AutomaticConversion &&
+    this->TemperatureQuantization <= 0.0 &&
+    this->SelectedConversion == AutomaticConversion &&
+    IsLookupTableType(scalarType);
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerRTThermometryLogic::UseLookupTable(int scalarType, bool calibrate)
+{
+  if (!IsLookupTableType(scalarType) || this->ConversionMode == ArithmeticConversion)
+    {
+    return false;
+    }
+  if (this->ConversionMode == LookupTableConversion || this->TemperatureQuantization > 0.0)
+    {
+    return true;
+    }
+  if (this->IsCalibratingConversion(scalarType))
+    {
+    // Alternate between both conversions. Results are identical.
+    return calibrate &&
+      this->NumberOfCalibrationSamples[LookupTableConversion] <
+      this->NumberOfCalibrationSamples[ArithmeticConversion];
+    }
+  return this->SelectedConversion == LookupTableConversion;
+}
+
+//---------------------------------------------------------------------------
+double vtkSlicerRTThermometryLogic::GetConversionQuantization(int scalarType)
+{
+  return this->UseLookupTable(scalarType, false) ? this->TemperatureQuantization : 0.0;
+}
+
+//---------------------------------------------------------------------------
+const double* vtkSlicerRTThermometryLogic::UpdateLookupTable(int scalarType,
+                                                             int temperatureScalarType)
+{
+  double factor = this->GetPhaseToTemperatureFactor();
+  bool singlePrecision = temperatureScalarType == VTK_FLOAT;
+  if (this->LookupTable.empty() ||
+      this->LookupTableScalarType != scalarType ||
+      this->LookupTableTemperatureType != temperatureScalarType ||
+      this->LookupTableBaseTemperature != this->BaseTemperature ||
+      this->LookupTableFactor != factor ||
+      this->LookupTableQuantization != this->TemperatureQuantization)
+    {
+    // Indexed by the signed accumulated phase
+    switch (scalarType)
+      {
+      case VTK_CHAR:
+      case VTK_SIGNED_CHAR:
+      case VTK_UNSIGNED_CHAR:
+        BuildLookupTableExecute<signed char>(this->LookupTable, this->BaseTemperature,
+                                             factor, this->TemperatureQuantization,
+                                             singlePrecision);
+        break;
+      case VTK_SHORT:
+      case VTK_UNSIGNED_SHORT:
+        BuildLookupTableExecute<short>(this->LookupTable, this->BaseTemperature,
+                                       factor, this->TemperatureQuantization,
+                                       singlePrecision);
+        break;
+      default:
+        return NULL;
+      }
+    this->LookupTableScalarType = scalarType;
+    this->LookupTableTemperatureType = temperatureScalarType;
+    this->LookupTableBaseTemperature = this->BaseTemperature;
+    this->LookupTableFactor = factor;
+    this->LookupTableQuantization = this->TemperatureQuantization;
+    }
+
+  // Entry of value 0
+  return &this->LookupTable[this->LookupTable.size() / 2];
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::ResetConversionCalibration()
+{
+  this->ActiveConversion = ArithmeticConversion;
+  this->SelectedConversion = AutomaticConversion;
+  this->NumberOfCalibrationSamples[ArithmeticConversion] = 0;
+  this->NumberOfCalibrationSamples[LookupTableConversion] = 0;
+  this->CalibrationTimes[ArithmeticConversion] = 0.0;
+  this->CalibrationTimes[LookupTableConversion] = 0.0;
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerRTThermometryLogic::ReprocessSession(vtkSlicerRTThermometrySessionReader* reader)
+{
+  if (!reader || reader->GetNumberOfFrames() < 2)
+    {
+    vtkErrorMacro("ReprocessSession: At least two recorded frames are needed");
+    return false;
+    }
+
+  this->ResetBaseline();
+
+  if (this->RequiresSequentialReprocessing())
+    {
+    // Nothing is displayed while reprocessing
+    bool progressivePreview = this->ProgressivePreview;
+    this->ProgressivePreview = false;
+    vtkNew<vtkImageData> frameImage;
+    for (vtkIdType frame = 0; frame < reader->GetNumberOfFrames(); ++frame)
+      {
+      // The baseline, library and rejected frames produce no temperature
+      bool capturing = frame == 0 || this->IsCapturingBaselineLibrary();
+      int numberOfRejectedFrames = this->NumberOfRejectedFrames;
+      if (!reader->ReadFrame(frame, frameImage.GetPointer()) ||
+          (!this->ProcessPhaseImage(frameImage.GetPointer(), reader->GetTimestamp(frame)) &&
+           !capturing &&
+           this->NumberOfRejectedFrames == numberOfRejectedFrames))
+        {
+        vtkErrorMacro("ReprocessSession: Cannot process frame " << frame);
+        this->ProgressivePreview = progressivePreview;
+        return false;
+        }
+      }
+    this->ProgressivePreview = progressivePreview;
+    return true;
+    }
+
+  // The session is read and scanned in chunks: only the phases of one chunk
+  // are loaded at once, next to the history. Only the processing extent of
+  // each frame is kept.
+  int numberOfFrames = static_cast<int>(reader->GetNumberOfFrames());
+  int chunkSize = std::max(this->NumberOfThreads, 1) * ReprocessFramesPerThread;
+  // The last phase of the previous chunk, then the phases of the chunk
+  std::vector<vtkImageData*> phases;
+  vtkNew<vtkImageData> frameImage;
+  std::vector<char> carry;
+  int scalarType = VTK_VOID;
+  vtkIdType numberOfVoxels = 0;
+  int scalarSize = 0;
+  bool success = true;
+  for (int frame = 0; frame < numberOfFrames && success;)
+    {
+    int chunkEnd = std::min(frame + chunkSize, numberOfFrames);
+    for (; frame < chunkEnd && success; ++frame)
+      {
+      success = reader->ReadFrame(frame, frameImage.GetPointer());
+      if (success && frame == 0)
+        {
+        this->UpdateProcessingExtent(frameImage.GetPointer());
+        this->TemperatureScalarType =
+          this->TemperaturePrecision == SinglePrecision ? VTK_FLOAT : VTK_DOUBLE;
+        }
+      else if (success)
+        {
+        int* dimensions = frameImage->GetDimensions();
+        success = dimensions[0] == this->AcquisitionDimensions[0] &&
+          dimensions[1] == this->AcquisitionDimensions[1] &&
+          dimensions[2] == this->AcquisitionDimensions[2] &&
+          frameImage->GetScalarType() == scalarType;
+        if (!success)
+          {
+          vtkErrorMacro("ReprocessSession: Frame " << frame
+                        << " does not match the baseline geometry or scalar type");
+          }
+        }
+      if (success)
+        {
+        vtkImageData* phase =
+          this->FramePool->Acquire(this->ProcessingExtent, frameImage->GetScalarType());
+        CopyExtent(frameImage.GetPointer(), this->ProcessingExtent, phase);
+        phases.push_back(phase);
+        scalarType = phase->GetScalarType();
+        numberOfVoxels = phase->GetNumberOfPoints();
+        scalarSize = phase->GetScalarSize();
+        }
+      }
+    int numberOfDifferences = static_cast<int>(phases.size()) - 1;
+    if (!success || numberOfDifferences < 1)
+      {
+      continue;
+      }
+
+    int numberOfThreads = this->NumberOfThreads < numberOfDifferences ?
+      this->NumberOfThreads : numberOfDifferences;
+    ReprocessArgs args;
+    args.ScalarType = scalarType;
+    args.NumberOfVoxels = numberOfVoxels;
+    args.NumberOfDifferences = numberOfDifferences;
+    for (size_t i = 0; i < phases.size(); ++i)
+      {
+      args.Phases.push_back(phases[i]->GetScalarPointer());
+      }
+    args.InitialSum =
+      this->PhaseHistory.empty() ? NULL : this->PhaseHistory.back()->GetScalarPointer();
+    for (int d = 0; d < numberOfDifferences; ++d)
+      {
+      vtkImageData* history = this->FramePool->Acquire(this->ProcessingExtent, scalarType);
+      history->SetSpacing(phases[0]->GetSpacing());
+      history->SetOrigin(phases[0]->GetOrigin());
+      this->PhaseHistory.push_back(history);
+      args.Accumulated.push_back(history->GetScalarPointer());
+      }
+    carry.resize(static_cast<size_t>(numberOfThreads) * numberOfVoxels * scalarSize);
+    args.Carry = &carry[0];
+
+    this->Threader->SetNumberOfThreads(numberOfThreads);
+    this->Threader->SetSingleMethod(ReprocessThreadedExecute, &args);
+
+    args.Pass = 0;
+    this->Threader->SingleMethodExecute();
+
+    switch (scalarType)
+      {
+      vtkTemplateMacro(ReprocessCarryExecute<VTK_TT>(&args, numberOfThreads));
+      }
+
+    args.Pass = 1;
+    this->Threader->SingleMethodExecute();
+
+    // The last phase starts the next chunk
+    for (int d = 0; d < numberOfDifferences; ++d)
+      {
+      this->FramePool->Release(phases[d]);
+      }
+    phases.erase(phases.begin(), phases.end() - 1);
+    }
+  if (!success)
+    {
+    for (size_t i = 0; i < phases.size(); ++i)
+      {
+      this->FramePool->Release(phases[i]);
+      }
+    this->ResetBaseline();
+    return false;
+    }
+
+  // Leave the pipeline ready to continue from the last frame
+  this->PreviousPhase = phases.back();
+
+  this->AccumulatedPhase = vtkImageData::New();
+  this->AccumulatedPhase->SetSpacing(this->PreviousPhase->GetSpacing());
+  this->AccumulatedPhase->SetOrigin(this->PreviousPhase->GetOrigin());
+  AllocateImage(this->AccumulatedPhase, this->ProcessingExtent, scalarType);
+  memcpy(this->AccumulatedPhase->GetScalarPointer(), this->PhaseHistory.back()->GetScalarPointer(),
+         static_cast<size_t>(numberOfVoxels) * scalarSize);
+  this->CompileMask();
+  this->CompileProtectionZones();
+  this->CompileLineProfiles();
+
+  // Temperature images are derived when accessed; only the last one is
+  // converted now
+  CachedTemperature cached;
+  cached.Image = NULL;
+  this->StampTemperature(cached, scalarType);
+  this->TemperatureImages.resize(this->PhaseHistory.size(), cached);
+  vtkImageData* lastTemperature = this->GetLastTemperatureImage();
+  if (lastTemperature && !this->LineProfiles.empty())
+    {
+    this->GatherLineProfiles(lastTemperature);
+    }
+
+  return true;
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::UpdateCheckpoint(bool force)
+{
+  if (!this->CheckpointWriter->IsOpen())
+    {
+    return;
+    }
+
+  // While the writer is busy, the checkpoint is retried on the next frame
+  this->FramesSinceCheckpoint++;
+  if ((force || this->FramesSinceCheckpoint >= this->CheckpointInterval) &&
+      this->SaveCheckpoint())
+    {
+    this->FramesSinceCheckpoint = 0;
+    }
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerRTThermometryLogic::SaveCheckpoint()
+{
+  if (!this->HasBaseline())
+    {
+    return false;
+    }
+
+  std::vector<char>* payload = this->CheckpointWriter->BeginCheckpoint();
+  if (!payload)
+    {
+    return false;
+    }
+
+  this->Profiler->StartStage(vtkSlicerRTThermometryProfiler::Checkpoint);
+  this->WriteCheckpoint(*payload);
+  this->CheckpointWriter->CommitCheckpoint(this->LastFrameTime);
+  this->Profiler->StopStage(vtkSlicerRTThermometryProfiler::Checkpoint);
+  return true;
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::WriteCheckpoint(std::vector<char>& payload)
+{
+  // The maps are written in the conversion of the written parameters
+  this->UpdateDerivedMapConversion();
+  CheckpointOutput output(payload);
+
+  // Parameters
+  output.Write(this->EchoTime);
+  output.Write(this->MagneticField);
+  output.Write(this->GyromagneticRatio);
+  output.Write(this->ThermalCoefficient);
+  output.Write(this->ScaleFactor);
+  output.Write(this->BaseTemperature);
+  output.Write(this->TemperatureQuantization);
+  output.Write(this->TemperatureScalarType);
+  output.Write(this->TemporalFilter);
+  output.Write(this->TemporalFilterWeight);
+  output.Write(this->KalmanProcessNoise);
+  output.Write(this->KalmanMeasurementNoise);
+  output.Write(this->SpatialFilter);
+  output.Write(this->SpatialFilterRadius);
+  output.Write(this->SpatialFilterThroughSlices);
+  output.Write(this->RejectionThreshold);
+  output.WriteArray(this->DerivedMapEnabled, NumberOfDerivedMaps);
+  output.Write(this->TemperatureThreshold);
+  output.Write(this->AblationCriterion);
+  output.Write(this->LethalDose);
+  output.Write(this->LethalTemperature);
+  output.Write(this->Referenceless);
+  output.Write(this->HasBackgroundRing);
+  output.WriteArray(this->BackgroundRingCenter, 3);
+  output.WriteArray(this->BackgroundRingRadii, 2);
+  output.Write(this->BackgroundPolynomialOrder);
+  output.Write(this->BaselineLibrarySize);
+  output.Write(this->SignatureSubsampling);
+
+  // Geometry and mask
+  output.Write(this->UseRequestedExtent);
+  output.WriteArray(this->RequestedExtent, 6);
+  output.WriteArray(this->ProcessingExtent, 6);
+  output.WriteArray(this->AcquisitionDimensions, 3);
+  output.WriteArray(this->MaskSourceDimensions, 3);
+  output.WriteVector(this->MaskSourceVoxels);
+
+  // Pipeline state. The last history image is only saved when it differs
+  // from the accumulated phase.
+  output.WriteImage(this->PreviousPhase);
+  output.WriteImage(this->AccumulatedPhase);
+  bool hasHistory = !this->PhaseHistory.empty();
+  output.Write(hasHistory);
+  output.WriteImage(hasHistory && this->TemporalFilter != NoTemporalFilter ?
+                    this->PhaseHistory.back() : NULL);
+  output.Write(this->ActiveBaselineLibrarySize);
+  output.Write(static_cast<vtkTypeUInt64>(this->BaselineLibrary.size()));
+  for (size_t i = 0; i < this->BaselineLibrary.size(); ++i)
+    {
+    output.WriteImage(this->BaselineLibrary[i]);
+    }
+  output.Write(this->NumberOfRejectedFrames);
+  output.WriteVector(std::vector<double>(this->AcceptedDeviations.begin(),
+                                         this->AcceptedDeviations.end()));
+  output.Write(this->KalmanVariance);
+  output.Write(this->FilterStateValid);
+  output.WriteVector(this->FilterState);
+  output.Write(this->LastFrameTime);
+  output.Write(this->FrameInterval);
+  for (int map = 0; map < NumberOfDerivedMaps; ++map)
+    {
+    output.WriteImage(this->DerivedMapImages[map]);
+    }
+
+  // Protection zones and sensors
+  output.Write(static_cast<vtkTypeUInt64>(this->ProtectionZones.size()));
+  for (size_t zone = 0; zone < this->ProtectionZones.size(); ++zone)
+    {
+    const ProtectionZone& protectionZone = this->ProtectionZones[zone];
+    output.WriteString(protectionZone.Name);
+    output.Write(protectionZone.Limit);
+    output.WriteArray(protectionZone.SourceDimensions, 3);
+    output.WriteVector(protectionZone.SourceVoxels);
+    output.Write(protectionZone.Maximum);
+    output.Write(protectionZone.Mean);
+    output.Write(protectionZone.Alarm);
+    }
+  output.Write(static_cast<vtkTypeUInt64>(this->CheckpointSensors.size()));
+  for (size_t sensor = 0; sensor < this->CheckpointSensors.size(); ++sensor)
+    {
+    output.WriteString(this->CheckpointSensors[sensor].Name);
+    output.WriteArray(this->CheckpointSensors[sensor].Position, 3);
+    }
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerRTThermometryLogic::ResumeFromCheckpoint(const char* fileName)
+{
+  std::vector<char> payload;
+  if (!vtkSlicerRTThermometryCheckpointWriter::ReadCheckpoint(fileName, payload))
+    {
+    vtkErrorMacro("ResumeFromCheckpoint: Cannot read " << (fileName ? fileName : "(null)"));
+    return false;
+    }
+
+  // The session is only replaced once the whole checkpoint is validated
+  CheckpointState state(this->FramePool);
+  if (!this->ReadCheckpoint(payload, state))
+    {
+    vtkErrorMacro("ResumeFromCheckpoint: Invalid checkpoint " << fileName);
+    return false;
+    }
+  this->ResetBaseline();
+  this->RestoreCheckpoint(state);
+  this->Modified();
+  return true;
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerRTThermometryLogic::ReadCheckpoint(const std::vector<char>& payload,
+                                                 CheckpointState& state)
+{
+  CheckpointInput input(payload, this->FramePool);
+
+  // Parameters
+  input.Read(state.EchoTime);
+  input.Read(state.MagneticField);
+  input.Read(state.GyromagneticRatio);
+  input.Read(state.ThermalCoefficient);
+  input.Read(state.ScaleFactor);
+  input.Read(state.BaseTemperature);
+  input.Read(state.TemperatureQuantization);
+  input.Read(state.TemperatureScalarType);
+  input.Read(state.TemporalFilter);
+  input.Read(state.TemporalFilterWeight);
+  input.Read(state.KalmanProcessNoise);
+  input.Read(state.KalmanMeasurementNoise);
+  input.Read(state.SpatialFilter);
+  input.Read(state.SpatialFilterRadius);
+  input.Read(state.SpatialFilterThroughSlices);
+  input.Read(state.RejectionThreshold);
+  for (int map = 0; map < NumberOfDerivedMaps; ++map)
+    {
+    input.Read(state.DerivedMapEnabled[map]);
+    }
+  input.Read(state.TemperatureThreshold);
+  input.Read(state.AblationCriterion);
+  input.Read(state.LethalDose);
+  input.Read(state.LethalTemperature);
+  input.Read(state.Referenceless);
+  input.Read(state.HasBackgroundRing);
+  input.ReadArray(state.BackgroundRingCenter, 3);
+  input.ReadArray(state.BackgroundRingRadii, 2);
+  input.Read(state.BackgroundPolynomialOrder);
+  input.Read(state.BaselineLibrarySize);
+  input.Read(state.SignatureSubsampling);
+
+  // Geometry and mask
+  input.Read(state.UseRequestedExtent);
+  input.ReadArray(state.RequestedExtent, 6);
+  input.ReadArray(state.ProcessingExtent, 6);
+  input.ReadArray(state.AcquisitionDimensions, 3);
+  input.ReadArray(state.MaskSourceDimensions, 3);
+  input.ReadVector(state.MaskSourceVoxels);
+
+  // Pipeline state
+  state.PreviousPhase = input.ReadImage();
+  state.AccumulatedPhase = input.ReadImage();
+  input.Read(state.HasHistory);
+  state.History = input.ReadImage();
+  input.Read(state.ActiveBaselineLibrarySize);
+  vtkTypeUInt64 numberOfBaselines = 0;
+  input.Read(numberOfBaselines);
+  for (vtkTypeUInt64 i = 0; i < numberOfBaselines && !input.HasFailed(); ++i)
+    {
+    // Kept even if NULL, so that a missing image fails the validation
+    state.BaselineLibrary.push_back(input.ReadImage());
+    }
+  input.Read(state.NumberOfRejectedFrames);
+  input.ReadVector(state.AcceptedDeviations);
+  input.Read(state.KalmanVariance);
+  input.Read(state.FilterStateValid);
+  input.ReadVector(state.FilterState);
+  input.Read(state.LastFrameTime);
+  input.Read(state.FrameInterval);
+  for (int map = 0; map < NumberOfDerivedMaps; ++map)
+    {
+    state.DerivedMapImages[map] = input.ReadImage();
+    }
+
+  // Protection zones and sensors
+  vtkTypeUInt64 numberOfZones = 0;
+  input.Read(numberOfZones);
+  for (vtkTypeUInt64 zone = 0; zone < numberOfZones && !input.HasFailed(); ++zone)
+    {
+    ProtectionZone protectionZone;
+    input.ReadString(protectionZone.Name);
+    input.Read(protectionZone.Limit);
+    input.ReadArray(protectionZone.SourceDimensions, 3);
+    input.ReadVector(protectionZone.SourceVoxels);
+    input.Read(protectionZone.Maximum);
+    input.Read(protectionZone.Mean);
+    input.Read(protectionZone.Alarm);
+    protectionZone.NumberOfVoxels = 0;
+    protectionZone.NumberOfClippedVoxels = 0;
+    state.ProtectionZones.push_back(protectionZone);
+    }
+  vtkTypeUInt64 numberOfSensors = 0;
+  input.Read(numberOfSensors);
+  for (vtkTypeUInt64 sensor = 0; sensor < numberOfSensors && !input.HasFailed(); ++sensor)
+    {
+    CheckpointSensor checkpointSensor;
+    input.ReadString(checkpointSensor.Name);
+    input.ReadArray(checkpointSensor.Position, 3);
+    state.CheckpointSensors.push_back(checkpointSensor);
+    }
+
+  if (!input.IsComplete())
+    {
+    vtkErrorMacro("ReadCheckpoint: Truncated or oversized payload");
+    return false;
+    }
+
+  // Parameters within the ranges accepted by their setters. Comparisons
+  // are written so that NaN fails them.
+  bool valid =
+    (state.TemperatureScalarType == VTK_FLOAT || state.TemperatureScalarType == VTK_DOUBLE) &&
+    state.TemperatureQuantization >= 0.0 &&
+    state.TemporalFilter >= NoTemporalFilter && state.TemporalFilter <= KalmanFilter &&
+    state.TemporalFilterWeight >= 0.01 && state.TemporalFilterWeight <= 1.0 &&
+    state.KalmanProcessNoise >= 0.0 && state.KalmanMeasurementNoise >= 0.001 &&
+    state.KalmanVariance >= 0.0 &&
+    state.SpatialFilter >= NoSpatialFilter && state.SpatialFilter <= BoxFilter &&
+    state.SpatialFilterRadius >= 1 && state.SpatialFilterRadius <= 16 &&
+    state.RejectionThreshold >= 0.0 && state.NumberOfRejectedFrames >= 0 &&
+    state.AblationCriterion >= ThermalDoseAblation &&
+    state.AblationCriterion <= TemperatureAblation &&
+    state.BackgroundPolynomialOrder >= 0 && state.BackgroundPolynomialOrder <= 4 &&
+    (!state.HasBackgroundRing ||
+     (state.BackgroundRingRadii[0] >= 0.0 &&
+      state.BackgroundRingRadii[1] > state.BackgroundRingRadii[0])) &&
+    state.BaselineLibrarySize >= 0 && state.SignatureSubsampling >= 1 &&
+    state.ActiveBaselineLibrarySize >= 0 &&
+    static_cast<size_t>(state.ActiveBaselineLibrarySize) <= state.BaselineLibrary.size() &&
+    state.FrameInterval >= 0.0;
+  if (!valid)
+    {
+    vtkErrorMacro("ReadCheckpoint: Parameter out of range");
+    return false;
+    }
+
+  // Processing extent within the acquisition, masks and zones with one
+  // value per voxel of their source image
+  for (int axis = 0; valid && axis < 3; ++axis)
+    {
+    valid = state.ProcessingExtent[2*axis] >= 0 &&
+      state.ProcessingExtent[2*axis] <= state.ProcessingExtent[2*axis+1] &&
+      state.ProcessingExtent[2*axis+1] < state.AcquisitionDimensions[axis];
+    }
+  valid = valid && HasCheckpointDimensions(state.MaskSourceVoxels.size(), state.MaskSourceDimensions);
+  for (size_t zone = 0; valid && zone < state.ProtectionZones.size(); ++zone)
+    {
+    valid = HasCheckpointDimensions(state.ProtectionZones[zone].SourceVoxels.size(),
+                                    state.ProtectionZones[zone].SourceDimensions);
+    }
+  if (!valid)
+    {
+    vtkErrorMacro("ReadCheckpoint: Inconsistent geometry");
+    return false;
+    }
+
+  // Every image covers the processing extent, phases with one scalar type
+  const int* extent = state.ProcessingExtent;
+  int phaseType = state.PreviousPhase ? state.PreviousPhase->GetScalarType() : VTK_VOID;
+  valid = HasCheckpointGeometry(state.PreviousPhase, extent, phaseType) &&
+    HasCheckpointGeometry(state.AccumulatedPhase, extent, phaseType) &&
+    (!state.History || HasCheckpointGeometry(state.History, extent, phaseType));
+  for (size_t i = 0; valid && i < state.BaselineLibrary.size(); ++i)
+    {
+    valid = HasCheckpointGeometry(state.BaselineLibrary[i], extent, phaseType);
+    }
+  for (int map = 0; valid && map < NumberOfDerivedMaps; ++map)
+    {
+    valid = !state.DerivedMapImages[map] ||
+      HasCheckpointGeometry(state.DerivedMapImages[map], extent, VTK_DOUBLE);
+    }
+  valid = valid && (!state.FilterStateValid ||
+    static_cast<vtkIdType>(state.FilterState.size()) == state.AccumulatedPhase->GetNumberOfPoints());
+  if (!valid)
+    {
+    vtkErrorMacro("ReadCheckpoint: Image does not match the processing extent");
+    return false;
+    }
+  return true;
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::RestoreCheckpoint(CheckpointState& state)
+{
+  // Parameters
+  this->EchoTime = state.EchoTime;
+  this->MagneticField = state.MagneticField;
+  this->GyromagneticRatio = state.GyromagneticRatio;
+  this->ThermalCoefficient = state.ThermalCoefficient;
+  this->ScaleFactor = state.ScaleFactor;
+  this->BaseTemperature = state.BaseTemperature;
+  this->TemperatureQuantization = state.TemperatureQuantization;
+  // Temperatures continue with the precision of the checkpointed session
+  this->TemperatureScalarType = state.TemperatureScalarType;
+  this->TemperaturePrecision =
+    state.TemperatureScalarType == VTK_FLOAT ? SinglePrecision : DoublePrecision;
+  this->TemporalFilter = state.TemporalFilter;
+  this->TemporalFilterWeight = state.TemporalFilterWeight;
+  this->KalmanProcessNoise = state.KalmanProcessNoise;
+  this->KalmanMeasurementNoise = state.KalmanMeasurementNoise;
+  this->SpatialFilter = state.SpatialFilter;
+  this->SpatialFilterRadius = state.SpatialFilterRadius;
+  this->SpatialFilterThroughSlices = state.SpatialFilterThroughSlices;
+  this->RejectionThreshold = state.RejectionThreshold;
+  for (int map = 0; map < NumberOfDerivedMaps; ++map)
+    {
+    this->DerivedMapEnabled[map] = state.DerivedMapEnabled[map];
+    }
+  this->TemperatureThreshold = state.TemperatureThreshold;
+  this->AblationCriterion = state.AblationCriterion;
+  this->LethalDose = state.LethalDose;
+  this->LethalTemperature = state.LethalTemperature;
+  this->Referenceless = state.Referenceless;
+  this->HasBackgroundRing = state.HasBackgroundRing;
+  std::copy(state.BackgroundRingCenter, state.BackgroundRingCenter + 3, this->BackgroundRingCenter);
+  std::copy(state.BackgroundRingRadii, state.BackgroundRingRadii + 2, this->BackgroundRingRadii);
+  this->BackgroundPolynomialOrder = state.BackgroundPolynomialOrder;
+  this->BaselineLibrarySize = state.BaselineLibrarySize;
+  this->SignatureSubsampling = state.SignatureSubsampling;
+
+  // Geometry and mask
+  this->UseRequestedExtent = state.UseRequestedExtent;
+  std::copy(state.RequestedExtent, state.RequestedExtent + 6, this->RequestedExtent);
+  std::copy(state.ProcessingExtent, state.ProcessingExtent + 6, this->ProcessingExtent);
+  std::copy(state.AcquisitionDimensions, state.AcquisitionDimensions + 3, this->AcquisitionDimensions);
+  std::copy(state.MaskSourceDimensions, state.MaskSourceDimensions + 3, this->MaskSourceDimensions);
+  this->MaskSourceVoxels.swap(state.MaskSourceVoxels);
+
+  // Pipeline state, the images are now owned by the logic
+  this->PreviousPhase = state.PreviousPhase;
+  this->AccumulatedPhase = state.AccumulatedPhase;
+  state.PreviousPhase = NULL;
+  state.AccumulatedPhase = NULL;
+  this->ActiveBaselineLibrarySize = state.ActiveBaselineLibrarySize;
+  this->NumberOfRejectedFrames = state.NumberOfRejectedFrames;
+  this->AcceptedDeviations.assign(state.AcceptedDeviations.begin(), state.AcceptedDeviations.end());
+  this->KalmanVariance = state.KalmanVariance;
+  this->FilterStateValid = state.FilterStateValid;
+  this->FilterState.swap(state.FilterState);
+  this->LastFrameTime = state.LastFrameTime;
+  this->FrameInterval = state.FrameInterval;
+  for (int map = 0; map < NumberOfDerivedMaps; ++map)
+    {
+    this->DerivedMapImages[map] = state.DerivedMapImages[map];
+    state.DerivedMapImages[map] = NULL;
+    }
+  this->DerivedMapBaseTemperature = this->BaseTemperature;
+  this->DerivedMapFactor = this->GetPhaseToTemperatureFactor();
+  this->ProtectionZones.swap(state.ProtectionZones);
+  this->CheckpointSensors.swap(state.CheckpointSensors);
+
+  // Compiled state: signatures of the library, mask runs, zone runs and
+  // background fit. The library images read go back to the pool with the
+  // state.
+  for (size_t i = 0; i < state.BaselineLibrary.size(); ++i)
+    {
+    this->AddLibraryBaseline(state.BaselineLibrary[i]);
+    }
+  this->CompileMask();
+  this->CompileProtectionZones();
+  this->CompileLineProfiles();
+  this->CompileBackgroundFit();
+  this->InvalidateAblationZone();
+
+  // The history restarts with the temperature of the checkpointed frame
+  if (state.HasHistory)
+    {
+    vtkImageData* history = state.History;
+    state.History = NULL;
+    if (!history)
+      {
+      history = this->FramePool->Acquire(this->ProcessingExtent,
+                                         this->AccumulatedPhase->GetScalarType());
+      CopyExtent(this->AccumulatedPhase, this->ProcessingExtent, history);
+      }
+    this->PhaseHistory.push_back(history);
+    CachedTemperature cached;
+    cached.Image = NULL;
+    this->StampTemperature(cached, history->GetScalarType());
+    this->TemperatureImages.push_back(cached);
+    this->GetLastTemperatureImage();
+    }
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::AddCheckpointSensor(const char* name, const double ras[3])
+{
+  CheckpointSensor sensor;
+  sensor.Name = name ? name : "";
+  sensor.Position[0] = ras[0];
+  sensor.Position[1] = ras[1];
+  sensor.Position[2] = ras[2];
+  this->CheckpointSensors.push_back(sensor);
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::ClearCheckpointSensors()
+{
+  this->CheckpointSensors.clear();
+}
+
+//---------------------------------------------------------------------------
+int vtkSlicerRTThermometryLogic::GetNumberOfCheckpointSensors()
+{
+  return static_cast<int>(this->CheckpointSensors.size());
+}
+
+//---------------------------------------------------------------------------
+const char* vtkSlicerRTThermometryLogic::GetCheckpointSensorName(int sensor)
+{
+  if (sensor < 0 || sensor >= static_cast<int>(this->CheckpointSensors.size()))
+    {
+    return NULL;
+    }
+  return this->CheckpointSensors[sensor].Name.c_str();
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerRTThermometryLogic::GetCheckpointSensorPosition(int sensor, double ras[3])
+{
+  if (sensor < 0 || sensor >= static_cast<int>(this->CheckpointSensors.size()))
+    {
+    return false;
+    }
+  ras[0] = this->CheckpointSensors[sensor].Position[0];
+  ras[1] = this->CheckpointSensors[sensor].Position[1];
+  ras[2] = this->CheckpointSensors[sensor].Position[2];
+  return true;
+}
+
+//---------------------------------------------------------------------------
+int vtkSlicerRTThermometryLogic::AddProtectionZoneFromLabelMap(vtkImageData* labelMap,
+                                                               double limit, const char* name)
+{
+  if (!labelMap || !labelMap->GetScalarPointer() || labelMap->GetNumberOfScalarComponents() != 1)
+    {
+    vtkErrorMacro("AddProtectionZone: Invalid label map");
+    return -1;
+    }
+
+  vtkIdType numberOfVoxels = labelMap->GetNumberOfPoints();
+  std::vector<unsigned char> voxels(numberOfVoxels);
+  switch (labelMap->GetScalarType())
+    {
+    vtkTemplateMacro(
+      BuildMaskExecute(static_cast<VTK_TT*>(labelMap->GetScalarPointer()), numberOfVoxels,
+                       true, 0.0, &voxels[0]));
+    default:
+      vtkErrorMacro("AddProtectionZone: Unsupported scalar type");
+      return -1;
+    }
+  return this->AddProtectionZone(voxels, labelMap->GetDimensions(), limit, name);
+}
+
+//---------------------------------------------------------------------------
+int vtkSlicerRTThermometryLogic::AddProtectionZoneFromExtent(const int dimensions[3],
+                                                             const int extent[6],
+                                                             double limit, const char* name)
+{
+  int clamped[6];
+  for (int axis = 0; axis < 3; ++axis)
+    {
+    clamped[2*axis] = std::max(extent[2*axis], 0);
+    clamped[2*axis+1] = std::min(extent[2*axis+1], dimensions[axis] - 1);
+    if (clamped[2*axis] > clamped[2*axis+1])
+      {
+      vtkErrorMacro("AddProtectionZone: Extent is outside of the images");
+      return -1;
+      }
+    }
+
+  std::vector<unsigned char> voxels(
+    static_cast<size_t>(dimensions[0]) * dimensions[1] * dimensions[2], 0);
+  for (int k = clamped[4]; k <= clamped[5]; ++k)
+    {
+    for (int j = clamped[2]; j <= clamped[3]; ++j)
+      {
+      vtkIdType row = (static_cast<vtkIdType>(k) * dimensions[1] + j) * dimensions[0];
+      std::fill(voxels.begin() + row + clamped[0], voxels.begin() + row + clamped[1] + 1, 1);
+      }
+    }
+  return this->AddProtectionZone(voxels, dimensions, limit, name);
+}
+
+//---------------------------------------------------------------------------
+int vtkSlicerRTThermometryLogic::AddProtectionZone(const std::vector<unsigned char>& voxels,
+                                                   const int dimensions[3],
+                                                   double limit, const char* name)
+{
+  ProtectionZone zone;
+  if (name)
+    {
+    zone.Name = name;
+    }
+  else
+    {
+    std::ostringstream defaultName;
+    defaultName << "Zone " << this->ProtectionZones.size() + 1;
+    zone.Name = defaultName.str();
+    }
+  zone.Limit = limit;
+  zone.SourceVoxels = voxels;
+  zone.SourceDimensions[0] = dimensions[0];
+  zone.SourceDimensions[1] = dimensions[1];
+  zone.SourceDimensions[2] = dimensions[2];
+  zone.NumberOfVoxels = 0;
+  zone.NumberOfClippedVoxels = 0;
+  zone.Maximum = this->BaseTemperature;
+  zone.Mean = this->BaseTemperature;
+  zone.Alarm = false;
+  this->ProtectionZones.push_back(zone);
+
+  this->CompileProtectionZones();
+  this->Modified();
+  return static_cast<int>(this->ProtectionZones.size()) - 1;
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::RemoveProtectionZone(int zone)
+{
+  if (zone < 0 || zone >= static_cast<int>(this->ProtectionZones.size()))
+    {
+    return;
+    }
+  this->ProtectionZones.erase(this->ProtectionZones.begin() + zone);
+  this->Modified();
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::ClearProtectionZones()
+{
+  this->ProtectionZones.clear();
+  this->Modified();
+}
+
+//---------------------------------------------------------------------------
+int vtkSlicerRTThermometryLogic::GetNumberOfProtectionZones()
+{
+  return static_cast<int>(this->ProtectionZones.size());
+}
+
+//---------------------------------------------------------------------------
+const char* vtkSlicerRTThermometryLogic::GetProtectionZoneName(int zone)
+{
+  if (zone < 0 || zone >= static_cast<int>(this->ProtectionZones.size()))
+    {
+    return NULL;
+    }
+  return this->ProtectionZones[zone].Name.c_str();
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::SetProtectionZoneLimit(int zone, double limit)
+{
+  if (zone < 0 || zone >= static_cast<int>(this->ProtectionZones.size()) ||
+      this->ProtectionZones[zone].Limit == limit)
+    {
+    return;
+    }
+  // Takes effect on the next frame
+  this->ProtectionZones[zone].Limit = limit;
+  this->Modified();
+}
+
+//---------------------------------------------------------------------------
+double vtkSlicerRTThermometryLogic::GetProtectionZoneLimit(int zone)
+{
+  if (zone < 0 || zone >= static_cast<int>(this->ProtectionZones.size()))
+    {
+    return 0.0;
+    }
+  return this->ProtectionZones[zone].Limit;
+}
+
+//---------------------------------------------------------------------------
+vtkIdType vtkSlicerRTThermometryLogic::GetNumberOfProtectionZoneVoxels(int zone)
+{
+  if (zone < 0 || zone >= static_cast<int>(this->ProtectionZones.size()))
+    {
+    return 0;
+    }
+  return this->ProtectionZones[zone].NumberOfVoxels;
+}
+
+//---------------------------------------------------------------------------
+vtkIdType vtkSlicerRTThermometryLogic::GetNumberOfProtectionZoneClippedVoxels(int zone)
+{
+  if (zone < 0 || zone >= static_cast<int>(this->ProtectionZones.size()))
+    {
+    return 0;
+    }
+  return this->ProtectionZones[zone].NumberOfClippedVoxels;
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerRTThermometryLogic::IsProtectionZoneMonitored(int zone)
+{
+  return zone >= 0 && zone < static_cast<int>(this->ProtectionZones.size()) &&
+    (!this->HasBaseline() || this->ProtectionZones[zone].NumberOfVoxels > 0);
+}
+
+//---------------------------------------------------------------------------
+double vtkSlicerRTThermometryLogic::GetProtectionZoneMaximum(int zone)
+{
+  if (zone < 0 || zone >= static_cast<int>(this->ProtectionZones.size()))
+    {
+    return this->BaseTemperature;
+    }
+  this->UpdateDerivedMapConversion();
+  return this->ProtectionZones[zone].Maximum;
+}
+
+//---------------------------------------------------------------------------
+double vtkSlicerRTThermometryLogic::GetProtectionZoneMean(int zone)
+{
+  if (zone < 0 || zone >= static_cast<int>(this->ProtectionZones.size()))
+    {
+    return this->BaseTemperature;
+    }
+  this->UpdateDerivedMapConversion();
+  return this->ProtectionZones[zone].Mean;
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerRTThermometryLogic::IsProtectionZoneInAlarm(int zone)
+{
+  return zone >= 0 && zone < static_cast<int>(this->ProtectionZones.size()) &&
+    this->ProtectionZones[zone].Alarm;
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::CompileProtectionZones()
+{
+  int dimensions[3];
+  for (int axis = 0; axis < 3; ++axis)
+    {
+    dimensions[axis] = this->ProcessingExtent[2*axis+1] - this->ProcessingExtent[2*axis] + 1;
+    }
+  const unsigned char* mask = this->HasBaseline() && this->IsMaskApplicable(dimensions) ?
+    &this->MaskVoxels[0] : NULL;
+
+  for (size_t zone = 0; zone < this->ProtectionZones.size(); ++zone)
+    {
+    ProtectionZone& protectionZone = this->ProtectionZones[zone];
+    protectionZone.RunBegins.clear();
+    protectionZone.RunEnds.clear();
+    protectionZone.PreviewVoxels.clear();
+    protectionZone.NumberOfVoxels = 0;
+    protectionZone.NumberOfClippedVoxels = 0;
+    if (!this->HasBaseline())
+      {
+      continue;
+      }
+    vtkIdType numberOfSourceVoxels = static_cast<vtkIdType>(
+      protectionZone.SourceVoxels.size() -
+      std::count(protectionZone.SourceVoxels.begin(), protectionZone.SourceVoxels.end(), 0));
+    if (protectionZone.SourceDimensions[0] != this->AcquisitionDimensions[0] ||
+        protectionZone.SourceDimensions[1] != this->AcquisitionDimensions[1] ||
+        protectionZone.SourceDimensions[2] != this->AcquisitionDimensions[2])
+      {
+      protectionZone.NumberOfClippedVoxels = numberOfSourceVoxels;
+      vtkWarningMacro("CompileProtectionZones: " << protectionZone.Name
+                      << " does not match the image dimensions, it is not monitored");
+      continue;
+      }
+
+    // Runs of zone voxels, indexed like the processed images
+    vtkIdType index = 0;
+    bool inRun = false;
+    for (int k = this->ProcessingExtent[4]; k <= this->ProcessingExtent[5]; ++k)
+      {
+      for (int j = this->ProcessingExtent[2]; j <= this->ProcessingExtent[3]; ++j)
+        {
+        const unsigned char* source = &protectionZone.SourceVoxels[
+          (static_cast<vtkIdType>(k) * protectionZone.SourceDimensions[1] + j) *
+          protectionZone.SourceDimensions[0] + this->ProcessingExtent[0]];
+        for (int i = this->ProcessingExtent[0]; i <= this->ProcessingExtent[1];
+             ++i, ++index, ++source)
+          {
+          bool inZone = *source && (!mask || mask[index]);
+          if (inZone && !inRun)
+            {
+            protectionZone.RunBegins.push_back(index);
+            }
+          else if (!inZone && inRun)
+            {
+            protectionZone.RunEnds.push_back(index);
+            }
+          inRun = inZone;
+          protectionZone.NumberOfVoxels += inZone;
+          }
+        }
+      }
+    if (inRun)
+      {
+      protectionZone.RunEnds.push_back(index);
+      }
+
+    // Voxels outside the processing extent or the mask cannot alarm
+    protectionZone.NumberOfClippedVoxels = numberOfSourceVoxels - protectionZone.NumberOfVoxels;
+    if (protectionZone.NumberOfVoxels == 0)
+      {
+      vtkWarningMacro("CompileProtectionZones: " << protectionZone.Name
+                      << " is outside of the processing extent or the mask, it is not monitored");
+      }
+    else if (protectionZone.NumberOfClippedVoxels > 0)
+      {
+      vtkWarningMacro("CompileProtectionZones: " << protectionZone.NumberOfClippedVoxels
+                      << " of " << numberOfSourceVoxels << " voxels of " << protectionZone.Name
+                      << " are outside of the processing extent or the mask, they are not monitored");
+      }
+    }
+  this->PreviewZoneStep[0] = this->PreviewZoneStep[1] = this->PreviewZoneStep[2] = 0;
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::CheckProtectionZones(vtkImageData* temperature)
+{
+  for (size_t zone = 0; zone < this->ProtectionZones.size(); ++zone)
+    {
+    ProtectionZone& protectionZone = this->ProtectionZones[zone];
+    if (protectionZone.NumberOfVoxels == 0)
+      {
+      continue;
+      }
+
+    double maximum = 0.0;
+    double sum = 0.0;
+    if (temperature->GetScalarType() == VTK_FLOAT)
+      {
+      ReduceRunsExecute(static_cast<const float*>(temperature->GetScalarPointer()),
+                        &protectionZone.RunBegins[0], &protectionZone.RunEnds[0],
+                        protectionZone.RunBegins.size(), maximum, sum);
+      }
+    else
+      {
+      ReduceRunsExecute(static_cast<const double*>(temperature->GetScalarPointer()),
+                        &protectionZone.RunBegins[0], &protectionZone.RunEnds[0],
+                        protectionZone.RunBegins.size(), maximum, sum);
+      }
+    this->UpdateProtectionZoneAlarm(static_cast<int>(zone), maximum,
+                                    sum / protectionZone.NumberOfVoxels);
+    }
+}
+
+//---------------------------------------------------------------------------
+int vtkSlicerRTThermometryLogic::AddLineProfile(const double start[3], const double end[3],
+                                                int numberOfSamples, const char* name)
+{
+  LineProfile profile;
+  if (name)
+    {
+    profile.Name = name;
+    }
+  else
+    {
+    std::ostringstream defaultName;
+    defaultName << "Profile " << this->LineProfiles.size() + 1;
+    profile.Name = defaultName.str();
+    }
+  this->LineProfiles.push_back(profile);
+
+  int index = static_cast<int>(this->LineProfiles.size()) - 1;
+  this->SetLineProfile(index, start, end, numberOfSamples);
+  return index;
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::SetLineProfile(int profile, const double start[3],
+                                                 const double end[3], int numberOfSamples)
+{
+  if (profile < 0 || profile >= static_cast<int>(this->LineProfiles.size()))
+    {
+    return;
+    }
+  LineProfile& lineProfile = this->LineProfiles[profile];
+  for (int axis = 0; axis < 3; ++axis)
+    {
+    lineProfile.Start[axis] = start[axis];
+    lineProfile.End[axis] = end[axis];
+    }
+  lineProfile.NumberOfSamples = std::max(numberOfSamples, 2);
+
+  this->CompileLineProfiles();
+  this->Modified();
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::RemoveLineProfile(int profile)
+{
+  if (profile < 0 || profile >= static_cast<int>(this->LineProfiles.size()))
+    {
+    return;
+    }
+  this->LineProfiles.erase(this->LineProfiles.begin() + profile);
+  this->Modified();
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::ClearLineProfiles()
+{
+  this->LineProfiles.clear();
+  this->Modified();
+}
+
+//---------------------------------------------------------------------------
+int vtkSlicerRTThermometryLogic::GetNumberOfLineProfiles()
+{
+  return static_cast<int>(this->LineProfiles.size());
+}
+
+//---------------------------------------------------------------------------
+const char* vtkSlicerRTThermometryLogic::GetLineProfileName(int profile)
+{
+  if (profile < 0 || profile >= static_cast<int>(this->LineProfiles.size()))
+    {
+    return NULL;
+    }
+  return this->LineProfiles[profile].Name.c_str();
+}
+
+//---------------------------------------------------------------------------
+int vtkSlicerRTThermometryLogic::GetLineProfileNumberOfSamples(int profile)
+{
+  if (profile < 0 || profile >= static_cast<int>(this->LineProfiles.size()))
+    {
+    return 0;
+    }
+  return this->LineProfiles[profile].NumberOfSamples;
+}
+
+//---------------------------------------------------------------------------
+const double* vtkSlicerRTThermometryLogic::GetLineProfileValues(int profile)
+{
+  if (profile < 0 || profile >= static_cast<int>(this->LineProfiles.size()))
+    {
+    return NULL;
+    }
+  return &this->LineProfiles[profile].Values[0];
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::CompileLineProfiles()
+{
+  int dimensions[3];
+  for (int axis = 0; axis < 3; ++axis)
+    {
+    dimensions[axis] = this->ProcessingExtent[2*axis+1] - this->ProcessingExtent[2*axis] + 1;
+    }
+  const unsigned char* mask = this->HasBaseline() && this->IsMaskApplicable(dimensions) ?
+    &this->MaskVoxels[0] : NULL;
+
+  for (size_t profile = 0; profile < this->LineProfiles.size(); ++profile)
+    {
+    LineProfile& lineProfile = this->LineProfiles[profile];
+    int numberOfSamples = lineProfile.NumberOfSamples;
+    lineProfile.TapVoxels.clear();
+    lineProfile.TapWeights.clear();
+    lineProfile.TapOffsets.assign(1, 0);
+    lineProfile.BaseWeights.assign(numberOfSamples, 1.0);
+    lineProfile.Values.assign(numberOfSamples, this->BaseTemperature);
+    for (int sample = 0; sample < numberOfSamples; ++sample)
+      {
+      // Trilinear interpolation between the 8 voxels around the sample
+      double t = static_cast<double>(sample) / (numberOfSamples - 1);
+      int origin[3];
+      double fraction[3];
+      for (int axis = 0; axis < 3; ++axis)
+        {
+        double position = lineProfile.Start[axis] + t * (lineProfile.End[axis] - lineProfile.Start[axis]);
+        origin[axis] = static_cast<int>(floor(position));
+        fraction[axis] = position - origin[axis];
+        }
+      for (int corner = 0; corner < 8 && this->HasBaseline(); ++corner)
+        {
+        double weight = 1.0;
+        int voxel[3];
+        bool inside = true;
+        for (int axis = 0; axis < 3; ++axis)
+          {
+          int offset = (corner >> axis) & 1;
+          weight *= offset ? fraction[axis] : 1.0 - fraction[axis];
+          voxel[axis] = origin[axis] + offset - this->ProcessingExtent[2*axis];
+          inside = inside && voxel[axis] >= 0 && voxel[axis] < dimensions[axis];
+          }
+        if (weight == 0.0 || !inside)
+          {
+          continue;
+          }
+        vtkIdType index =
+          (static_cast<vtkIdType>(voxel[2]) * dimensions[1] + voxel[1]) * dimensions[0] + voxel[0];
+        if (mask && !mask[index])
+          {
+          continue;
+          }
+        lineProfile.TapVoxels.push_back(index);
+        lineProfile.TapWeights.push_back(weight);
+        lineProfile.BaseWeights[sample] -= weight;
+        }
+      lineProfile.TapOffsets.push_back(static_cast<int>(lineProfile.TapVoxels.size()));
+      }
+    }
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::GatherLineProfiles(vtkImageData* temperature)
+{
+  for (size_t profile = 0; profile < this->LineProfiles.size(); ++profile)
+    {
+    LineProfile& lineProfile = this->LineProfiles[profile];
+    if (lineProfile.TapVoxels.empty())
+      {
+      lineProfile.Values.assign(lineProfile.NumberOfSamples, this->BaseTemperature);
+      continue;
+      }
+    if (temperature->GetScalarType() == VTK_FLOAT)
+      {
+      GatherLineProfileExecute(static_cast<const float*>(temperature->GetScalarPointer()),
+                               &lineProfile.TapVoxels[0], &lineProfile.TapWeights[0],
+                               &lineProfile.TapOffsets[0], &lineProfile.BaseWeights[0],
+                               lineProfile.NumberOfSamples, this->BaseTemperature,
+                               &lineProfile.Values[0]);
+      }
+    else
+      {
+      GatherLineProfileExecute(static_cast<const double*>(temperature->GetScalarPointer()),
+                               &lineProfile.TapVoxels[0], &lineProfile.TapWeights[0],
+                               &lineProfile.TapOffsets[0], &lineProfile.BaseWeights[0],
+                               lineProfile.NumberOfSamples, this->BaseTemperature,
+                               &lineProfile.Values[0]);
+      }
+    }
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::CheckPreviewProtectionZones()
+{
+  int dimensions[3];
+  for (int axis = 0; axis < 3; ++axis)
+    {
+    dimensions[axis] = this->ProcessingExtent[2*axis+1] - this->ProcessingExtent[2*axis] + 1;
+    }
+  const unsigned char* mask = this->IsMaskApplicable(dimensions) ? &this->MaskVoxels[0] : NULL;
+
+  if (this->PreviewZoneStep[0] != this->PreviewStep[0] ||
+      this->PreviewZoneStep[1] != this->PreviewStep[1] ||
+      this->PreviewZoneStep[2] != this->PreviewStep[2])
+    {
+    // Blocks covering each zone, whose sampled voxel is processed
+    std::vector<unsigned char> covered(
+      static_cast<size_t>(this->PreviewDimensions[0]) * this->PreviewDimensions[1] *
+      this->PreviewDimensions[2]);
+    for (size_t zone = 0; zone < this->ProtectionZones.size(); ++zone)
+      {
+      ProtectionZone& protectionZone = this->ProtectionZones[zone];
+      std::fill(covered.begin(), covered.end(), 0);
+      protectionZone.PreviewVoxels.clear();
+      for (size_t run = 0; run < protectionZone.RunBegins.size(); ++run)
+        {
+        for (vtkIdType index = protectionZone.RunBegins[run];
+             index < protectionZone.RunEnds[run]; ++index)
+          {
+          vtkIdType position[3] = { index % dimensions[0],
+                                    (index / dimensions[0]) % dimensions[1],
+                                    index / (static_cast<vtkIdType>(dimensions[0]) * dimensions[1]) };
+          vtkIdType block[3];
+          vtkIdType sample[3];
+          for (int axis = 0; axis < 3; ++axis)
+            {
+            block[axis] = std::min(position[axis] / this->PreviewStep[axis],
+                                   static_cast<vtkIdType>(this->PreviewDimensions[axis] - 1));
+            sample[axis] = block[axis] * this->PreviewStep[axis] + this->PreviewStep[axis] / 2;
+            }
+          vtkIdType previewVoxel =
+            (block[2] * this->PreviewDimensions[1] + block[1]) * this->PreviewDimensions[0] + block[0];
+          if (covered[previewVoxel] ||
+              (mask && !mask[(sample[2] * dimensions[1] + sample[1]) * dimensions[0] + sample[0]]))
+            {
+            continue;
+            }
+          covered[previewVoxel] = 1;
+          protectionZone.PreviewVoxels.push_back(previewVoxel);
+          }
+        }
+      }
+    for (int axis = 0; axis < 3; ++axis)
+      {
+      this->PreviewZoneStep[axis] = this->PreviewStep[axis];
+      }
+    }
+
+  // The blocks are sampled at one voxel, which can miss a hot spot or lie
+  // outside of the zone: the preview only raises alarms early. Zones are
+  // always reduced at full resolution after the phase kernel, which alone
+  // clears alarms.
+  const double* data = static_cast<const double*>(this->PreviewImage->GetScalarPointer());
+  for (size_t zone = 0; zone < this->ProtectionZones.size(); ++zone)
+    {
+    const std::vector<vtkIdType>& voxels = this->ProtectionZones[zone].PreviewVoxels;
+    if (voxels.empty() || this->ProtectionZones[zone].Alarm)
+      {
+      continue;
+      }
+    double maximum = data[voxels[0]];
+    double sum = 0.0;
+    for (size_t voxel = 0; voxel < voxels.size(); ++voxel)
+      {
+      maximum = std::max(maximum, data[voxels[voxel]]);
+      sum += data[voxels[voxel]];
+      }
+    if (maximum > this->ProtectionZones[zone].Limit)
+      {
+      this->UpdateProtectionZoneAlarm(static_cast<int>(zone), maximum, sum / voxels.size());
+      }
+    }
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::UpdateProtectionZoneAlarm(int zone, double maximum, double mean)
+{
+  ProtectionZone& protectionZone = this->ProtectionZones[zone];
+  protectionZone.Maximum = maximum;
+  protectionZone.Mean = mean;
+
+  bool alarm = maximum > protectionZone.Limit;
+  if (alarm == protectionZone.Alarm)
+    {
+    return;
+    }
+  protectionZone.Alarm = alarm;
+  if (alarm)
+    {
+    this->Profiler->IncrementCounter(vtkSlicerRTThermometryProfiler::ProtectionAlarms);
+    this->InvokeEvent(ProtectionZoneAlarmEvent, &zone);
+    }
+  else
+    {
+    this->InvokeEvent(ProtectionZoneClearedEvent, &zone);
+    }
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerRTThermometryLogic::UpdatePreviewGeometry()
+{
+  for (int axis = 0; axis < 3; ++axis)
+    {
+    int dimension = this->ProcessingExtent[2*axis+1] - this->ProcessingExtent[2*axis] + 1;
+    this->PreviewStep[axis] = std::min(this->PreviewDownsampling, dimension);
+    // Blocks whose sampled voxel is in the extent
+    this->PreviewDimensions[axis] =
+      (dimension - 1 - this->PreviewStep[axis] / 2) / this->PreviewStep[axis] + 1;
+    }
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerRTThermometryLogic::ComputePreview(vtkImageData* reference, bool fromReference)
+{
+  this->PreviewValid = false;
+  if (!reference || !this->CurrentPhase || !this->AccumulatedPhase)
+    {
+    return false;
+    }
+
+  this->UpdatePreviewGeometry();
+  int extent[6] = { 0, this->PreviewDimensions[0] - 1,
+                    0, this->PreviewDimensions[1] - 1,
+                    0, this->PreviewDimensions[2] - 1 };
+  if (!this->PreviewImage)
+    {
+    this->PreviewImage = vtkImageData::New();
+    }
+  int* previewExtent = this->PreviewImage->GetExtent();
+  if (!std::equal(extent, extent + 6, previewExtent) ||
+      this->PreviewImage->GetScalarType() != VTK_DOUBLE ||
+      !this->PreviewImage->GetPointData()->GetScalars())
+    {
+    AllocateImage(this->PreviewImage, extent, VTK_DOUBLE);
+    this->PreviewImage->SetSpacing(1.0, 1.0, 1.0);
+    }
+
+  PreviewArgs args;
+  args.Previous = reference->GetScalarPointer();
+  args.Current = this->CurrentPhase->GetScalarPointer();
+  args.Accumulated = this->AccumulatedPhase->GetScalarPointer();
+  args.FromReference = fromReference;
+  args.FilterState = NULL;
+  args.FilterFromAccumulated = false;
+  args.FilterGain = 0.0;
+  args.ScalarType = this->AccumulatedPhase->GetScalarType();
+  args.TemperatureScalarType = this->TemperatureScalarType;
+  args.LookupTable = this->UseLookupTable(args.ScalarType, false) ?
+    this->UpdateLookupTable(args.ScalarType, args.TemperatureScalarType) : NULL;
+  args.BaseTemperature = this->BaseTemperature;
+  args.Factor = this->GetPhaseToTemperatureFactor();
+  this->AccumulatedPhase->GetDimensions(args.Dimensions);
+  args.Mask = this->IsMaskApplicable(args.Dimensions) ? &this->MaskVoxels[0] : NULL;
+  for (int axis = 0; axis < 3; ++axis)
+    {
+    args.Step[axis] = this->PreviewStep[axis];
+    args.PreviewDimensions[axis] = this->PreviewDimensions[axis];
+    }
+  args.Preview = static_cast<double*>(this->PreviewImage->GetScalarPointer());
+
+  if (this->TemporalFilter != NoTemporalFilter)
+    {
+    // Gain of the coming kernel run, without advancing the Kalman variance
+    double variance = this->KalmanVariance;
+    if (!this->FilterStateValid)
+      {
+      this->KalmanVariance = this->KalmanMeasurementNoise * this->KalmanMeasurementNoise;
+      }
+    args.FilterGain = this->UpdateTemporalFilterGain();
+    this->KalmanVariance = variance;
+    if (this->FilterStateValid)
+      {
+      args.FilterState = &this->FilterState[0];
+      }
+    else
+      {
+      args.FilterFromAccumulated = true;
+      }
+    }
+
+  this->Threader->SetNumberOfThreads(
+    std::max(1, std::min(this->NumberOfThreads, this->PreviewDimensions[1] * this->PreviewDimensions[2])));
+  this->Threader->SetSingleMethod(PreviewThreadedExecute, &args);
+  this->Threader->SingleMethodExecute();
+  this->PreviewImage->Modified();
+  this->PreviewValid = true;
+  return true;
+}
+
+//---------------------------------------------------------------------------
+vtkImageData* vtkSlicerRTThermometryLogic::GetPreviewImage()
+{
+  return this->PreviewValid ? this->PreviewImage : NULL;
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerRTThermometryLogic::GetPreviewSampling(int origin[3], int step[3])
+{
+  if (!this->PreviewValid)
+    {
+    return false;
+    }
+  for (int axis = 0; axis < 3; ++axis)
+    {
+    step[axis] = this->PreviewStep[axis];
+    origin[axis] = this->ProcessingExtent[2*axis] + this->PreviewStep[axis] / 2;
+    }
+  return true;
+}
+
+//---------------------------------------------------------------------------
+double vtkSlicerRTThermometryLogic::GetPreviewTemperatureAtIJK(const double ijk[3])
+{
+  if (!this->PreviewValid)
+    {
+    return this->BaseTemperature;
+    }
+
+  int dimensions[3];
+  int sample[3];
+  vtkIdType block[3];
+  for (int axis = 0; axis < 3; ++axis)
+    {
+    dimensions[axis] = this->ProcessingExtent[2*axis+1] - this->ProcessingExtent[2*axis] + 1;
+    int position = static_cast<int>(ijk[axis]);
+    if (ijk[axis] < 0 || position < this->ProcessingExtent[2*axis] ||
+        position > this->ProcessingExtent[2*axis+1])
+      {
+      return this->BaseTemperature;
+      }
+    block[axis] = std::min((position - this->ProcessingExtent[2*axis]) / this->PreviewStep[axis],
+                           this->PreviewDimensions[axis] - 1);
+    sample[axis] = static_cast<int>(block[axis]) * this->PreviewStep[axis] + this->PreviewStep[axis] / 2;
+    }
+
+  if (this->IsMaskApplicable(dimensions) &&
+      !this->MaskVoxels[(static_cast<vtkIdType>(sample[2]) * dimensions[1] + sample[1]) *
+                        dimensions[0] + sample[0]])
+    {
+    return this->BaseTemperature;
+    }
+
+  const double* preview = static_cast<const double*>(this->PreviewImage->GetScalarPointer());
+  return preview[(block[2] * this->PreviewDimensions[1] + block[1]) * this->PreviewDimensions[0] + block[0]];
+}
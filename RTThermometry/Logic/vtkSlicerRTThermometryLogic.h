@@ -30,11 +30,27 @@
 // MRML includes
 #include "vtkMRMLScene.h"
 
+// VTK includes
+#include <vtkCommand.h>
+#include <vtkMultiThreader.h>
+
 // STD includes
 #include <cstdlib>
+#include <deque>
+#include <string>
+#include <vector>
 
 #include "vtkSlicerRTThermometryModuleLogicExport.h"
 
+class vtkImageData;
+class vtkPolyData;
+class vtkSlicerRTThermometryCheckpointWriter;
+class vtkSlicerRTThermometryFramePool;
+class vtkSlicerRTThermometryHotSpotDetector;
+class vtkSlicerRTThermometryIngestQueue;
+class vtkSlicerRTThermometryProfiler;
+class vtkSlicerRTThermometrySessionReader;
+class vtkSlicerRTThermometrySessionRecorder;
 
 /// \ingroup Slicer_QtModules_ExtensionTemplate
 class VTK_SLICER_RTTHERMOMETRY_MODULE_LOGIC_EXPORT vtkSlicerRTThermometryLogic :
@@ -46,6 +62,449 @@ public:
   vtkTypeMacro(vtkSlicerRTThermometryLogic, vtkSlicerModuleLogic);
   void PrintSelf(ostream& os, vtkIndent indent);
 
+  /// Per-stage latency histograms of the thermometry pipeline, never NULL
+  vtkGetObjectMacro(Profiler, vtkSlicerRTThermometryProfiler);
+
+  /// Raw phase frame recorder. When it is recording, every phase image given
+  /// to ProcessPhaseImage() is queued to the session log.
+  vtkGetObjectMacro(Recorder, vtkSlicerRTThermometrySessionRecorder);
+
+  /// Buffers of the temperature images, phase history and derived maps.
+  /// Released images are recycled for the next frames and baselines.
+  vtkGetObjectMacro(FramePool, vtkSlicerRTThermometryFramePool);
+
+  /// Bounded queue of received frames waiting for ProcessPhaseImage(),
+  /// with the frame pool and the profiler of the logic
+  vtkGetObjectMacro(IngestQueue, vtkSlicerRTThermometryIngestQueue);
+
+  /// Connected regions above a threshold in the temperature of the last
+  /// processed frame, labeled with the threads of the logic
+  vtkGetObjectMacro(HotSpotDetector, vtkSlicerRTThermometryHotSpotDetector);
+
+  /// Session checkpoint writer. While it is open, the pipeline state is
+  /// saved after the baseline and every CheckpointInterval processed frames.
+  vtkGetObjectMacro(CheckpointWriter, vtkSlicerRTThermometryCheckpointWriter);
+
+  /// Thermometry parameters
+  vtkSetMacro(EchoTime, double);
+  vtkGetMacro(EchoTime, double);
+  vtkSetMacro(MagneticField, double);
+  vtkGetMacro(MagneticField, double);
+  vtkSetMacro(GyromagneticRatio, double);
+  vtkGetMacro(GyromagneticRatio, double);
+  vtkSetMacro(ThermalCoefficient, double);
+  vtkGetMacro(ThermalCoefficient, double);
+  vtkSetMacro(ScaleFactor, double);
+  vtkGetMacro(ScaleFactor, double);
+  vtkSetMacro(BaseTemperature, double);
+  vtkGetMacro(BaseTemperature, double);
+
+  /// Number of threads used by the phase kernel
+  vtkSetClampMacro(NumberOfThreads, int, 1, VTK_MAX_THREADS);
+  vtkGetMacro(NumberOfThreads, int);
+
+  /// Discard the baseline, the accumulated phase and the temperature history.
+  /// The next phase image received will be used as baseline.
+  void ResetBaseline();
+  bool HasBaseline();
+
+  /// Process a new phase image. The first image after ResetBaseline() is
+  /// copied as baseline and no temperature is produced.
+  /// The acquisition time, in seconds, paces the derived maps; when
+  /// negative (default) the time of reception is used.
+  /// Return the new temperature image (owned by the logic), or NULL.
+  vtkImageData* ProcessPhaseImage(vtkImageData* phaseImage, double acquisitionTime = -1.0);
+
+  /// Temperature history, one image per processed frame. The accumulated
+  /// phase of every frame is kept and temperature, an affine function of
+  /// it, is derived with the current parameters when an image is accessed:
+  /// parameter changes apply to the whole history without a new baseline.
+  /// Images are owned by the logic and remain valid until released from
+  /// the cache (see TemperatureCacheSize).
+  int GetNumberOfTemperatureImages();
+  vtkImageData* GetTemperatureImage(int index);
+  vtkImageData* GetLastTemperatureImage();
+
+  /// Accumulated phase of a frame, in the phase scalar type (temporally
+  /// filtered if a temporal filter is used). Unsigned integer phases
+  /// accumulate as the signed type of the same width.
+  vtkImageData* GetAccumulatedPhaseImage(int index);
+
+  /// Number of temperature images kept in memory (16 by default). The least
+  /// recently used ones are released and derived again when accessed. The
+  /// last image is always kept. 0 keeps every image.
+  vtkSetClampMacro(TemperatureCacheSize, int, 0, VTK_INT_MAX);
+  vtkGetMacro(TemperatureCacheSize, int);
+
+  /// Sample the last temperature image at a voxel position.
+  /// Return the base temperature if no image is available or if the
+  /// position is outside of the image.
+  double GetTemperatureAtIJK(const double ijk[3]);
+
+  /// Compute mask. When set, the phase kernel only processes the voxels of
+  /// the mask (temperature stays at 0 elsewhere), and sensors outside of the
+  /// mask read the base temperature. The mask is compiled into runs of
+  /// contiguous voxels and must have the dimensions of the phase images,
+  /// otherwise it is ignored. Voxels added to the mask during a session
+  /// resume from the phase they had when last processed.
+  /// Label maps select non-zero voxels, magnitude images the voxels at or
+  /// above threshold.
+  bool SetMaskFromLabelMap(vtkImageData* labelMap);
+  bool SetMaskFromMagnitude(vtkImageData* magnitude, double threshold);
+  void ClearMask();
+  bool HasMask();
+  vtkIdType GetNumberOfMaskedVoxels();
+  int GetNumberOfMaskRuns();
+
+  /// Processing extent, in IJK coordinates of the acquired images. It is
+  /// applied when the next baseline is set: only this sub-extent of each
+  /// frame is copied, accumulated and converted, and temperature images
+  /// carry it as their extent. It is clamped to the images; an empty
+  /// intersection falls back to the whole image.
+  void SetProcessingExtent(const int extent[6]);
+  void ClearProcessingExtent();
+  bool HasProcessingExtent();
+  /// Extent in use since the last baseline. Return false without baseline.
+  bool GetProcessingExtent(int extent[6]);
+
+  /// Phase kernel. Add (current - previous) to the accumulated phase,
+  /// convert it into temperature and copy current into previous.
+  /// previous, current and accumulated must share the same scalar type and
+  /// dimensions. temperature must be allocated as VTK_FLOAT or VTK_DOUBLE,
+  /// the precision of the conversion.
+  /// If fromReference is true, previous is a fixed reference: accumulated
+  /// is set to (current - previous) and previous is not modified.
+  void ComputePhaseDifference(vtkImageData* previous, vtkImageData* current,
+                              vtkImageData* accumulated, vtkImageData* temperature,
+                              bool fromReference = false);
+
+  /// Factor converting accumulated phase (raw image units) into degrees
+  double GetPhaseToTemperatureFactor();
+
+  /// Multi-baseline thermometry. When BaselineLibrarySize is N > 0, the
+  /// baseline and the N-1 following frames (e.g. a respiratory cycle) are
+  /// captured into a baseline library and produce no temperature. Each
+  /// following frame is then referenced to the library baseline with the
+  /// closest signature, a subsampled copy of the phase image (sum of
+  /// absolute differences), instead of accumulating phase frame to frame.
+  /// 0 (default) uses a single baseline. Applied at the next baseline.
+  vtkSetClampMacro(BaselineLibrarySize, int, 0, VTK_INT_MAX);
+  vtkGetMacro(BaselineLibrarySize, int);
+  /// Voxel step of the signatures along each axis (4 by default)
+  vtkSetClampMacro(SignatureSubsampling, int, 1, VTK_INT_MAX);
+  vtkGetMacro(SignatureSubsampling, int);
+  int GetNumberOfLibraryBaselines();
+  bool IsCapturingBaselineLibrary();
+  /// Library baseline used by the last frame, -1 if none
+  vtkGetMacro(SelectedBaseline, int);
+
+  /// Referenceless thermometry. The background phase of each frame is
+  /// fitted, slice by slice, with a 2D polynomial over a ring of unheated
+  /// tissue, and temperature is computed from the difference with the
+  /// fitted background instead of the baseline. The ring center is given in
+  /// IJK coordinates of the acquired images, its radii in mm (in-plane).
+  /// Takes precedence over the baseline library.
+  vtkSetMacro(Referenceless, bool);
+  vtkGetMacro(Referenceless, bool);
+  vtkBooleanMacro(Referenceless, bool);
+  void SetBackgroundRing(const double center[3], double innerRadius, double outerRadius);
+  void ClearBackgroundRing();
+  /// Order of the background polynomial, 0 to 4 (2 by default)
+  void SetBackgroundPolynomialOrder(int order);
+  vtkGetMacro(BackgroundPolynomialOrder, int);
+  /// Number of ring voxels per slice used by the fit, 0 if the ring is
+  /// unset, too small or no baseline is set
+  int GetNumberOfRingVoxels();
+
+  /// Frame rejection. Before the phase kernel, the standard deviation of
+  /// the phase difference with the reference is measured on a subsampled
+  /// grid of the processed voxels (masked voxels only if a mask is set).
+  /// A frame whose deviation exceeds RejectionThreshold times the median of
+  /// the last accepted frames is rejected: it is not accumulated and
+  /// produces no temperature. 0 (default) disables the check.
+  vtkSetClampMacro(RejectionThreshold, double, 0.0, VTK_DOUBLE_MAX);
+  vtkGetMacro(RejectionThreshold, double);
+  /// Rejected frames are not accumulated, so after a lasting change of the
+  /// phase (e.g. patient motion) every following frame would be rejected.
+  /// Once MaximumConsecutiveRejections frames are rejected in a row (8 by
+  /// default, 0 for no limit), the next frame is accepted, the deviation
+  /// history restarts from it and RejectionLimitEvent is invoked, so that
+  /// a new baseline can be acquired.
+  vtkSetClampMacro(MaximumConsecutiveRejections, int, 0, VTK_INT_MAX);
+  vtkGetMacro(MaximumConsecutiveRejections, int);
+  /// Frames rejected since the last baseline, and since the last accepted
+  /// frame
+  vtkGetMacro(NumberOfRejectedFrames, int);
+  vtkGetMacro(NumberOfConsecutiveRejectedFrames, int);
+  /// Deviation of the last checked frame, in raw phase units
+  vtkGetMacro(LastFrameDeviation, double);
+
+  /// Temporal filtering of the temperature maps. The accumulated phase of
+  /// each voxel is smoothed over time within the phase kernel pass, either
+  /// with an exponential moving average of weight TemporalFilterWeight, or
+  /// with a scalar Kalman filter (constant temperature model) whose process
+  /// and measurement noises are standard deviations in degrees. The filter
+  /// state is one float per voxel, allocated with the baseline.
+  enum TemporalFilters
+    {
+    NoTemporalFilter = 0,
+    ExponentialFilter,
+    KalmanFilter
+    };
+  void SetTemporalFilter(int filter);
+  vtkGetMacro(TemporalFilter, int);
+  vtkSetClampMacro(TemporalFilterWeight, double, 0.01, 1.0);
+  vtkGetMacro(TemporalFilterWeight, double);
+  vtkSetClampMacro(KalmanProcessNoise, double, 0.0, VTK_DOUBLE_MAX);
+  vtkGetMacro(KalmanProcessNoise, double);
+  vtkSetClampMacro(KalmanMeasurementNoise, double, 0.001, VTK_DOUBLE_MAX);
+  vtkGetMacro(KalmanMeasurementNoise, double);
+
+  /// Spatial smoothing of the temperature maps, applied after the phase
+  /// kernel and before the maps are displayed or sampled. Separable
+  /// Gaussian (standard deviation of half the radius) or box filter along
+  /// i and j, and k if SpatialFilterThroughSlices is on. With a mask, only
+  /// masked voxels are averaged.
+  enum SpatialFilters
+    {
+    NoSpatialFilter = 0,
+    GaussianFilter,
+    BoxFilter
+    };
+  vtkSetClampMacro(SpatialFilter, int, NoSpatialFilter, BoxFilter);
+  vtkGetMacro(SpatialFilter, int);
+  /// Half width of the filter, in voxels (1 by default)
+  vtkSetClampMacro(SpatialFilterRadius, int, 1, 16);
+  vtkGetMacro(SpatialFilterRadius, int);
+  vtkSetMacro(SpatialFilterThroughSlices, bool);
+  vtkGetMacro(SpatialFilterThroughSlices, bool);
+  vtkBooleanMacro(SpatialFilterThroughSlices, bool);
+
+  /// Maps derived from the temperature of every processed frame, updated
+  /// in the same pass as the phase kernel: maximum temperature, time spent
+  /// at or above TemperatureThreshold (seconds) and thermal dose (CEM43,
+  /// minutes). They are accumulated from the unsmoothed temperature at
+  /// processing time. When the conversion parameters change, the maximum
+  /// temperature map and the protection zone reductions are re-mapped like
+  /// the history, while the time above threshold and thermal dose maps,
+  /// not affine in the phase, restart from the next frame with a warning;
+  /// the ablation zone is counted again. Maps enabled during a session
+  /// start from the next frame; they are cleared with the baseline. Images are owned by the logic (NULL until
+  /// the first frame processed with the map enabled).
+  enum DerivedMaps
+    {
+    MaximumTemperatureMap = 0,
+    TimeAboveThresholdMap,
+    ThermalDoseMap,
+    NumberOfDerivedMaps
+    };
+  void SetDerivedMapEnabled(int map, bool enabled);
+  bool GetDerivedMapEnabled(int map);
+  vtkImageData* GetDerivedMap(int map);
+  /// Temperature threshold of the time above threshold map (43 by default)
+  vtkSetMacro(TemperatureThreshold, double);
+  vtkGetMacro(TemperatureThreshold, double);
+
+  /// Ablation zone: voxels whose thermal dose reached LethalDose (240 CEM43
+  /// minutes by default) or whose maximum temperature reached
+  /// LethalTemperature (60 C by default), following the derived map of the
+  /// criterion, which must be enabled. Both maps only increase, so the phase
+  /// kernel counts the voxels crossing the threshold during each frame; the
+  /// map is only scanned again when the criterion or its threshold changes.
+  enum AblationCriteria
+    {
+    ThermalDoseAblation = 0,
+    TemperatureAblation
+    };
+  void SetAblationCriterion(int criterion);
+  vtkGetMacro(AblationCriterion, int);
+  void SetLethalDose(double dose);
+  vtkGetMacro(LethalDose, double);
+  void SetLethalTemperature(double temperature);
+  vtkGetMacro(LethalTemperature, double);
+  vtkIdType GetNumberOfAblatedVoxels();
+  /// Ablated volume, in mL
+  double GetAblationVolume();
+  /// Isosurface of the ablation zone, in IJK coordinates of the acquired
+  /// images. Regenerated when accessed after the zone changed. Owned by the
+  /// logic.
+  vtkPolyData* GetAblationSurface();
+
+  /// Protection zones: structures whose temperature must stay below a
+  /// limit. Zones are given in IJK coordinates of the acquired images, as
+  /// the non-zero voxels of a label map or as an extent, and compiled into
+  /// runs of contiguous voxels of the processing extent (and of the mask)
+  /// when the baseline is set. On every processed frame, after spatial
+  /// filtering, the maximum and mean temperature of each zone are reduced
+  /// and compared to its limit. ProtectionZoneAlarmEvent and
+  /// ProtectionZoneClearedEvent are invoked from ProcessPhaseImage() when
+  /// a zone enters or leaves the alarm state, with the zone index (int*)
+  /// as call data. Return the index of the new zone, or -1.
+  enum Events
+    {
+    ProtectionZoneAlarmEvent = vtkCommand::UserEvent + 1,
+    ProtectionZoneClearedEvent,
+    PreviewReadyEvent,
+    RejectionLimitEvent
+    };
+  int AddProtectionZoneFromLabelMap(vtkImageData* labelMap, double limit, const char* name = NULL);
+  int AddProtectionZoneFromExtent(const int dimensions[3], const int extent[6],
+                                  double limit, const char* name = NULL);
+  void RemoveProtectionZone(int zone);
+  void ClearProtectionZones();
+  int GetNumberOfProtectionZones();
+  const char* GetProtectionZoneName(int zone);
+  void SetProtectionZoneLimit(int zone, double limit);
+  double GetProtectionZoneLimit(int zone);
+  /// Voxels of the zone in the processing extent (0 before the baseline)
+  vtkIdType GetNumberOfProtectionZoneVoxels(int zone);
+  /// Voxels of the zone left out because they are outside of the
+  /// processing extent or the mask, with a warning when the zone is
+  /// compiled. A zone with no voxel left is not monitored and never alarms.
+  vtkIdType GetNumberOfProtectionZoneClippedVoxels(int zone);
+  bool IsProtectionZoneMonitored(int zone);
+  /// Reduction of the last processed frame
+  double GetProtectionZoneMaximum(int zone);
+  double GetProtectionZoneMean(int zone);
+  bool IsProtectionZoneInAlarm(int zone);
+
+  /// Line profiles: temperature sampled at NumberOfSamples evenly spaced
+  /// points of a segment, given in IJK coordinates of the acquired images
+  /// (at least 2 samples, from start to end). The voxels and trilinear
+  /// weights of the samples are laid out over the processing extent (and
+  /// the mask) when the line or the baseline changes; on every processed
+  /// frame, after spatial filtering, profiles are gathered in one pass
+  /// over them. Voxels outside of the processing extent or the mask are
+  /// sampled as BaseTemperature, like sensors. Return the index of the new
+  /// profile.
+  int AddLineProfile(const double start[3], const double end[3], int numberOfSamples,
+                     const char* name = NULL);
+  void SetLineProfile(int profile, const double start[3], const double end[3],
+                      int numberOfSamples);
+  void RemoveLineProfile(int profile);
+  void ClearLineProfiles();
+  int GetNumberOfLineProfiles();
+  const char* GetLineProfileName(int profile);
+  int GetLineProfileNumberOfSamples(int profile);
+  /// Profile of the last processed frame (NumberOfSamples values), or NULL
+  const double* GetLineProfileValues(int profile);
+
+  /// Detect hot spots on every processed frame (off by default), after
+  /// spatial filtering. Results are read from the hot spot detector.
+  vtkSetMacro(HotSpotDetection, bool);
+  vtkGetMacro(HotSpotDetection, bool);
+  vtkBooleanMacro(HotSpotDetection, bool);
+
+  /// Progressive preview (off by default). Before the phase kernel, the
+  /// temperature of one voxel per block of PreviewDownsampling voxels
+  /// along each axis (2 by default, up to 4, limited by the processing
+  /// extent) is computed from the same reference, and PreviewReadyEvent is
+  /// invoked from ProcessPhaseImage() with the preview image as call data,
+  /// so that it can be displayed while the full resolution is computed.
+  /// Preview voxels match the full resolution voxels they sample, before
+  /// spatial filtering. Preview voxel p samples the voxel
+  /// origin + p * step of the acquired images.
+  vtkSetMacro(ProgressivePreview, bool);
+  vtkGetMacro(ProgressivePreview, bool);
+  vtkBooleanMacro(ProgressivePreview, bool);
+  vtkSetClampMacro(PreviewDownsampling, int, 2, 4);
+  vtkGetMacro(PreviewDownsampling, int);
+  /// Preview of the last processed frame (owned by the logic), or NULL
+  vtkImageData* GetPreviewImage();
+  bool GetPreviewSampling(int origin[3], int step[3]);
+  /// Sample the preview at the block of a voxel position. Return the base
+  /// temperature if no preview is available or if the position is outside
+  /// of the image or of the mask.
+  double GetPreviewTemperatureAtIJK(const double ijk[3]);
+  /// Also evaluate protection zones on the preview (off by default):
+  /// alarms can be raised before the phase kernel, from the maximum of the
+  /// blocks covering each zone. Zones are still evaluated at full
+  /// resolution, which alone clears alarms.
+  vtkSetMacro(PreviewSafetyCheck, bool);
+  vtkGetMacro(PreviewSafetyCheck, bool);
+  vtkBooleanMacro(PreviewSafetyCheck, bool);
+
+  /// Phase to temperature conversion. With 8 and 16-bit integer phase,
+  /// temperatures can be gathered from a table of every accumulated phase
+  /// value, rebuilt when parameters change. In automatic mode (default) the
+  /// phase kernel alternates both conversions on the first frames after the
+  /// baseline and keeps the fastest. Other phase types use arithmetic.
+  enum ConversionModes
+    {
+    AutomaticConversion = 0,
+    ArithmeticConversion,
+    LookupTableConversion
+    };
+  vtkSetClampMacro(ConversionMode, int, AutomaticConversion, LookupTableConversion);
+  vtkGetMacro(ConversionMode, int);
+  /// Conversion used by the last phase kernel run
+  vtkGetMacro(ActiveConversion, int);
+
+  /// Precision of the conversion into temperature and of the temperature
+  /// images. Single precision halves the memory traffic of the phase
+  /// kernel and doubles its vector width; double precision is kept for
+  /// validation (see RTThermometryPrecision to compare both on recorded
+  /// sessions). Derived maps accumulate in double precision either way.
+  /// The default is chosen at build time by the
+  /// RTThermometry_TEMPERATURE_PRECISION option. Used from the next
+  /// baseline on.
+  enum TemperaturePrecisions
+    {
+    SinglePrecision = 0,
+    DoublePrecision
+    };
+  vtkSetClampMacro(TemperaturePrecision, int, SinglePrecision, DoublePrecision);
+  vtkGetMacro(TemperaturePrecision, int);
+  /// Scalar type of the temperature images since the last baseline
+  /// (VTK_FLOAT or VTK_DOUBLE)
+  vtkGetMacro(TemperatureScalarType, int);
+
+  /// Round temperatures to a multiple of this step (0, disabled, by
+  /// default). Only applies to the lookup table conversion, which is then
+  /// used in automatic mode.
+  vtkSetClampMacro(TemperatureQuantization, double, 0.0, VTK_DOUBLE_MAX);
+  vtkGetMacro(TemperatureQuantization, double);
+
+  /// Headless reprocessing of a recorded session with the current
+  /// parameters. The first frame is used as baseline and the temperature
+  /// history is replaced by one image per following frame. Frames are
+  /// processed in parallel; results match live processing exactly for
+  /// integer phase types. With a baseline library, referenceless mode,
+  /// frame rejection, a temporal filter or derived maps, frames are
+  /// processed in order at their recorded times. The pipeline is left
+  /// ready to continue from the last frame. Return false if the session
+  /// cannot be processed.
+  bool ReprocessSession(vtkSlicerRTThermometrySessionReader* reader);
+
+  /// Session checkpoints. While the checkpoint writer is open, the state
+  /// needed to continue the session (baseline and baseline library,
+  /// previous and accumulated phase, temporal filter, derived maps, frame
+  /// rejection history, parameters, mask, protection zones and checkpoint
+  /// sensors) is copied after the baseline and then every
+  /// CheckpointInterval processed frames (10 by default), and written to
+  /// disk by the writer thread. A checkpoint is delayed to the next frame
+  /// while the previous one is still being written.
+  vtkSetClampMacro(CheckpointInterval, int, 1, VTK_INT_MAX);
+  vtkGetMacro(CheckpointInterval, int);
+  /// Copy the current state to the checkpoint writer. Return false without
+  /// baseline, or if the writer is closed or busy.
+  bool SaveCheckpoint();
+  /// Restore the state saved in a checkpoint file, replacing the baseline
+  /// and the temperature history, which restarts with the checkpointed
+  /// frame. The next phase image is differenced against that frame, so
+  /// the phase change since the checkpoint must not wrap; frames received
+  /// in between can be recovered from a session log with
+  /// ReprocessSession(). Return false, leaving the session unchanged, if
+  /// the file cannot be read or is inconsistent.
+  bool ResumeFromCheckpoint(const char* fileName);
+  /// Sensors saved with the checkpoints, as names and RAS positions, and
+  /// restored by ResumeFromCheckpoint()
+  void AddCheckpointSensor(const char* name, const double ras[3]);
+  void ClearCheckpointSensors();
+  int GetNumberOfCheckpointSensors();
+  const char* GetCheckpointSensorName(int sensor);
+  bool GetCheckpointSensorPosition(int sensor, double ras[3]);
+
 protected:
   vtkSlicerRTThermometryLogic();
   virtual ~vtkSlicerRTThermometryLogic();
@@ -56,6 +515,308 @@ protected:
   virtual void UpdateFromMRMLScene();
   virtual void OnMRMLSceneNodeAdded(vtkMRMLNode* node);
   virtual void OnMRMLSceneNodeRemoved(vtkMRMLNode* node);
+
+  bool SetMaskFromImage(vtkImageData* image, bool labelMap, double threshold);
+  bool IsMaskApplicable(const int dimensions[3]);
+  /// Lay out the mask voxels and runs over the processing extent
+  void CompileMask();
+  /// Resolve the processing extent against the baseline image
+  void UpdateProcessingExtent(vtkImageData* phaseImage);
+
+  /// Temperature image with the processing extent, zeroed if a mask
+  /// applies (voxels out of the mask are never written)
+  vtkImageData* NewTemperatureImage();
+  /// Convert accumulated phase with the current parameters (mask aware)
+  void ConvertPhaseToTemperature(vtkImageData* accumulated, vtkImageData* temperature);
+  /// Mark a temperature image as used and release the least recently used
+  /// ones beyond the cache size
+  void TouchTemperatureImage(int index);
+
+  void CompileBackgroundFit();
+  void ComputeBackgroundPhase(vtkImageData* phase);
+
+  bool IsFrameRejected(vtkImageData* reference, vtkImageData* current);
+
+  /// Phase kernel of ComputePhaseDifference(). If filtered is set, the
+  /// temporal filter is updated and its phase is written to filtered.
+  /// If derivedMaps is set, the enabled derived maps are updated.
+  void RunPhaseKernel(vtkImageData* previous, vtkImageData* current,
+                      vtkImageData* accumulated, vtkImageData* temperature,
+                      bool fromReference, vtkImageData* filtered, bool derivedMaps);
+  /// Derived map of the ablation criterion
+  int GetAblationMap();
+  void InvalidateAblationZone();
+  int AddProtectionZone(const std::vector<unsigned char>& voxels, const int dimensions[3],
+                        double limit, const char* name);
+  /// Lay out the zone voxels over the processing extent and the mask
+  void CompileProtectionZones();
+  /// Reduce each zone over a new temperature image and raise or clear
+  /// its alarm
+  void CheckProtectionZones(vtkImageData* temperature);
+  void CheckPreviewProtectionZones();
+  void UpdateProtectionZoneAlarm(int zone, double maximum, double mean);
+  /// Lay out the samples of the profiles over the processing extent and
+  /// the mask
+  void CompileLineProfiles();
+  void GatherLineProfiles(vtkImageData* temperature);
+  /// Compute the preview of the frame being processed. Return false if
+  /// none was computed.
+  bool ComputePreview(vtkImageData* reference, bool fromReference);
+  /// Lay out the preview blocks over the processing extent
+  void UpdatePreviewGeometry();
+  /// Allocate the enabled derived maps missing since the baseline
+  void AllocateDerivedMaps(vtkImageData* phase);
+  /// Bring the derived maps and the zone reductions to the current
+  /// conversion parameters
+  void UpdateDerivedMapConversion();
+  double UpdateTemporalFilterGain();
+  void SmoothTemperature(vtkImageData* temperature);
+  bool RequiresSequentialReprocessing();
+
+  /// Save a checkpoint if one is due after a processed frame
+  void UpdateCheckpoint(bool force);
+  void WriteCheckpoint(std::vector<char>& payload);
+  /// Parse a checkpoint payload into state and validate it, without
+  /// changing the logic
+  struct CheckpointState;
+  bool ReadCheckpoint(const std::vector<char>& payload, CheckpointState& state);
+  /// Replace the session with a validated checkpoint, after ResetBaseline()
+  void RestoreCheckpoint(CheckpointState& state);
+
+  void AddLibraryBaseline(vtkImageData* phase);
+  void ExtractSignature(vtkImageData* phase, float* signature);
+  int SelectLibraryBaseline(vtkImageData* phase);
+
+  static bool IsLookupTableType(int scalarType);
+  bool IsCalibratingConversion(int scalarType);
+  /// Whether the kernel converts with the lookup table. Only the phase
+  /// kernel alternates conversions while calibrating.
+  bool UseLookupTable(int scalarType, bool calibrate);
+  double GetConversionQuantization(int scalarType);
+  /// Rebuild the table if parameters changed. Return the entry of value 0.
+  /// Entries are computed in the precision of temperatureScalarType.
+  const double* UpdateLookupTable(int scalarType, int temperatureScalarType);
+  void ResetConversionCalibration();
+
+  vtkSlicerRTThermometryProfiler* Profiler;
+  vtkSlicerRTThermometrySessionRecorder* Recorder;
+  vtkSlicerRTThermometryFramePool* FramePool;
+  vtkSlicerRTThermometryIngestQueue* IngestQueue;
+  vtkSlicerRTThermometryHotSpotDetector* HotSpotDetector;
+  vtkSlicerRTThermometryCheckpointWriter* CheckpointWriter;
+  vtkMultiThreader* Threader;
+  int NumberOfThreads;
+
+  // Thermometry parameters
+  double EchoTime;
+  double MagneticField;
+  double GyromagneticRatio;
+  double ThermalCoefficient;
+  double ScaleFactor;
+  double BaseTemperature;
+
+  // Pipeline state
+  vtkImageData* PreviousPhase;
+  vtkImageData* CurrentPhase;
+  vtkImageData* AccumulatedPhase;
+
+  // Temperature history: accumulated phase of every frame, and temperature
+  // images cached with the conversion they were derived with
+  struct CachedTemperature
+  {
+    vtkImageData* Image;
+    double        BaseTemperature;
+    double        Factor;
+    double        Quantization;
+    int           SpatialFilter;
+    int           SpatialFilterRadius;
+    bool          SpatialFilterThroughSlices;
+  };
+  /// Record the current conversion and filter in a cached temperature, or
+  /// check they did not change since
+  void StampTemperature(CachedTemperature& cached, int scalarType);
+  bool IsTemperatureStampCurrent(const CachedTemperature& cached, int scalarType);
+  std::vector<vtkImageData*> PhaseHistory;
+  std::vector<CachedTemperature> TemperatureImages;
+  std::deque<int> TemperatureCacheOrder;
+  int TemperatureCacheSize;
+
+  // Baseline library, with one signature per baseline stored contiguously
+  int BaselineLibrarySize;
+  int ActiveBaselineLibrarySize;
+  int SignatureSubsampling;
+  int SelectedBaseline;
+  std::vector<vtkImageData*> BaselineLibrary;
+  std::vector<float> BaselineSignatures;
+  std::vector<float> FrameSignature;
+
+  // Referenceless background fit. BackgroundFitMatrix is the least squares
+  // solution operator (A^T A)^-1 A^T, one row per polynomial term, applied
+  // to the ring voxels of each slice.
+  bool Referenceless;
+  bool HasBackgroundRing;
+  double BackgroundRingCenter[3];
+  double BackgroundRingRadii[2];
+  int BackgroundPolynomialOrder;
+  std::vector<vtkIdType> RingVoxels;
+  std::vector<double> BackgroundFitMatrix;
+  std::vector<double> BackgroundCoefficients;
+  std::vector<double> RingPhase;
+  vtkImageData* BackgroundPhase;
+
+  // Frame rejection, relative to the median deviation of the last
+  // QualityHistoryLength accepted frames
+  enum
+    {
+    QualitySubsampling = 4,
+    QualityHistoryLength = 16,
+    QualityMinimumHistory = 4
+    };
+  double RejectionThreshold;
+  int MaximumConsecutiveRejections;
+  int NumberOfRejectedFrames;
+  int NumberOfConsecutiveRejectedFrames;
+  double LastFrameDeviation;
+  std::deque<double> AcceptedDeviations;
+  std::vector<double> DeviationScratch;
+
+  // Temporal filter. The Kalman error variance does not depend on the data,
+  // so it is shared by all voxels.
+  int TemporalFilter;
+  double TemporalFilterWeight;
+  double KalmanProcessNoise;
+  double KalmanMeasurementNoise;
+  double KalmanVariance;
+  std::vector<float> FilterState;
+  bool FilterStateValid;
+
+  // Spatial filter. The kernel is rebuilt when the filter changes; the
+  // scratch buffers only grow.
+  int SpatialFilter;
+  int SpatialFilterRadius;
+  bool SpatialFilterThroughSlices;
+  std::vector<double> SpatialKernel;
+  int SpatialKernelFilter;
+  int SpatialKernelRadius;
+  std::vector<double> SpatialScratch;
+  std::vector<double> SpatialWeights;
+
+  // Derived maps. FrameInterval is the time between the last two frames.
+  bool DerivedMapEnabled[NumberOfDerivedMaps];
+  vtkImageData* DerivedMapImages[NumberOfDerivedMaps];
+  // Conversion the maps and the zone reductions were computed with
+  double DerivedMapBaseTemperature;
+  double DerivedMapFactor;
+  double TemperatureThreshold;
+  double LastFrameTime;
+  double FrameInterval;
+
+  // Ablation zone. The count is rebuilt from the map when not valid.
+  int AblationCriterion;
+  double LethalDose;
+  double LethalTemperature;
+  vtkIdType NumberOfAblatedVoxels;
+  bool AblatedVoxelsValid;
+  std::vector<vtkIdType> NewlyAblatedVoxels;
+  vtkPolyData* AblationSurface;
+  bool AblationSurfaceValid;
+
+  // Protection zones. Source voxels follow the acquired images, runs the
+  // processing extent.
+  struct ProtectionZone
+  {
+    std::string Name;
+    double Limit;
+    std::vector<unsigned char> SourceVoxels;
+    int SourceDimensions[3];
+    std::vector<vtkIdType> RunBegins;
+    std::vector<vtkIdType> RunEnds;
+    vtkIdType NumberOfVoxels;
+    vtkIdType NumberOfClippedVoxels;
+    // Preview voxels of the blocks covering the zone
+    std::vector<vtkIdType> PreviewVoxels;
+    double Maximum;
+    double Mean;
+    bool Alarm;
+  };
+  std::vector<ProtectionZone> ProtectionZones;
+
+  // Line profiles. Sample s gathers the taps TapOffsets[s] to
+  // TapOffsets[s+1] - 1 of the processing extent, plus BaseWeights[s] times
+  // BaseTemperature for the corners outside of the extent or the mask.
+  struct LineProfile
+  {
+    std::string Name;
+    double Start[3];
+    double End[3];
+    int NumberOfSamples;
+    std::vector<vtkIdType> TapVoxels;
+    std::vector<double> TapWeights;
+    std::vector<int> TapOffsets;
+    std::vector<double> BaseWeights;
+    std::vector<double> Values;
+  };
+  std::vector<LineProfile> LineProfiles;
+
+  bool HotSpotDetection;
+
+  // Progressive preview. Preview voxel p samples the voxel
+  // p * PreviewStep + PreviewStep / 2 of the processing extent; zone
+  // preview voxels are compiled for PreviewZoneStep.
+  bool ProgressivePreview;
+  int PreviewDownsampling;
+  bool PreviewSafetyCheck;
+  vtkImageData* PreviewImage;
+  bool PreviewValid;
+  int PreviewStep[3];
+  int PreviewDimensions[3];
+  int PreviewZoneStep[3];
+
+  // Checkpoints. FramesSinceCheckpoint counts the processed frames not
+  // saved yet.
+  int CheckpointInterval;
+  int FramesSinceCheckpoint;
+  struct CheckpointSensor
+  {
+    std::string Name;
+    double Position[3];
+  };
+  std::vector<CheckpointSensor> CheckpointSensors;
+
+  // Phase to temperature conversion
+  enum { ConversionCalibrationFrames = 4 };
+  int ConversionMode;
+  int ActiveConversion;
+  int TemperaturePrecision;
+  int TemperatureScalarType;
+  double TemperatureQuantization;
+  std::vector<double> LookupTable;
+  int LookupTableScalarType;
+  int LookupTableTemperatureType;
+  double LookupTableBaseTemperature;
+  double LookupTableFactor;
+  double LookupTableQuantization;
+  // Automatic mode: AutomaticConversion until both conversions were timed
+  int SelectedConversion;
+  int NumberOfCalibrationSamples[3];
+  double CalibrationTimes[3];
+
+  // Processing extent
+  bool UseRequestedExtent;
+  int RequestedExtent[6];
+  int ProcessingExtent[6];
+  int AcquisitionDimensions[3];
+
+  // Compute mask, as set and compiled over the processing extent
+  std::vector<unsigned char> MaskSourceVoxels;
+  int MaskSourceDimensions[3];
+  std::vector<unsigned char> MaskVoxels;
+  std::vector<vtkIdType> MaskRunBegins;
+  std::vector<vtkIdType> MaskRunEnds;
+  std::vector<vtkIdType> MaskRunOffsets;
+  vtkIdType NumberOfMaskedVoxels;
+  int MaskDimensions[3];
+
 private:
 
   vtkSlicerRTThermometryLogic(const vtkSlicerRTThermometryLogic&); // Not implemented
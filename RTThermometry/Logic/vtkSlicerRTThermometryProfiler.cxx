@@ -0,0 +1,368 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// RTThermometry Logic includes
+#include "vtkSlicerRTThermometryProfiler.h"
+
+// VTK includes
+#include <vtkObjectFactory.h>
+#include <vtkTimerLog.h>
+
+// STD includes
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+//----------------------------------------------------------------------------
+vtkStandardNewMacro(vtkSlicerRTThermometryProfiler);
+
+//----------------------------------------------------------------------------
+vtkSlicerRTThermometryProfiler::vtkSlicerRTThermometryProfiler()
+{
+  this->Reset();
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerRTThermometryProfiler::~vtkSlicerRTThermometryProfiler()
+{
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerRTThermometryProfiler::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+
+  for (int stage = 0; stage < NumberOfStages; ++stage)
+    {
+    os << indent << GetStageName(stage) << ": "
+       << this->Count[stage] << " samples, p50="
+       << this->GetPercentile(stage, 50.0) * 1000.0 << "ms, p95="
+       << this->GetPercentile(stage, 95.0) * 1000.0 << "ms, p99="
+       << this->GetPercentile(stage, 99.0) * 1000.0 << "ms\n";
+    }
+  for (int counter = 0; counter < NumberOfCounters; ++counter)
+    {
+    os << indent << GetCounterName(counter) << ": " << this->Counter[counter] << "\n";
+    }
+}
+
+//----------------------------------------------------------------------------
+const char* vtkSlicerRTThermometryProfiler::GetStageName(int stage)
+{
+  switch (stage)
+    {
+    case IngestCopy:     return "IngestCopy";
+    case PhaseKernel:    return "PhaseKernel";
+    case SensorSampling: return "SensorSampling";
+    case TableUpdate:    return "TableUpdate";
+    case GraphUpdate:    return "GraphUpdate";
+    case RenderHandoff:  return "RenderHandoff";
+    case SessionRecord:  return "SessionRecord";
+    case BaselineSelection: return "BaselineSelection";
+    case BackgroundFit:  return "BackgroundFit";
+    case QualityCheck:   return "QualityCheck";
+    case SpatialFilter:  return "SpatialFilter";
+    case SafetyCheck:    return "SafetyCheck";
+    case HotSpotDetection: return "HotSpotDetection";
+    case Preview:        return "Preview";
+    case Checkpoint:     return "Checkpoint";
+    case LineProfile:    return "LineProfile";
+    case FrameTotal:     return "FrameTotal";
+    default:             return "Unknown";
+    }
+}
+
+//----------------------------------------------------------------------------
+const char* vtkSlicerRTThermometryProfiler::GetCounterName(int counter)
+{
+  switch (counter)
+    {
+    case RejectedFrames: return "RejectedFrames";
+    case DroppedFrames:  return "DroppedFrames";
+    case LateFrames:     return "LateFrames";
+    case ProtectionAlarms: return "ProtectionAlarms";
+    default:             return "Unknown";
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerRTThermometryProfiler::IncrementCounter(int counter)
+{
+  if (counter >= 0 && counter < NumberOfCounters)
+    {
+    this->Counter[counter]++;
+    }
+}
+
+//----------------------------------------------------------------------------
+vtkIdType vtkSlicerRTThermometryProfiler::GetCounter(int counter)
+{
+  if (counter < 0 || counter >= NumberOfCounters)
+    {
+    return 0;
+    }
+  return this->Counter[counter];
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerRTThermometryProfiler::StartFrame()
+{
+  for (int stage = 0; stage < NumberOfStages; ++stage)
+    {
+    this->FrameAccumulator[stage] = 0.0;
+    this->FrameStageUsed[stage] = false;
+    }
+  this->InFrame = true;
+  this->FrameStart = vtkTimerLog::GetUniversalTime();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerRTThermometryProfiler::EndFrame()
+{
+  if (!this->InFrame)
+    {
+    return;
+    }
+
+  double frameDuration = vtkTimerLog::GetUniversalTime() - this->FrameStart;
+  this->InFrame = false;
+
+  for (int stage = 0; stage < NumberOfStages; ++stage)
+    {
+    if (this->FrameStageUsed[stage])
+      {
+      this->RecordStage(stage, this->FrameAccumulator[stage]);
+      }
+    }
+  this->RecordStage(FrameTotal, frameDuration);
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerRTThermometryProfiler::StartStage(int stage)
+{
+  if (stage < 0 || stage >= NumberOfStages)
+    {
+    return;
+    }
+  this->StageStart[stage] = vtkTimerLog::GetUniversalTime();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerRTThermometryProfiler::StopStage(int stage)
+{
+  if (stage < 0 || stage >= NumberOfStages)
+    {
+    return;
+    }
+
+  double elapsed = vtkTimerLog::GetUniversalTime() - this->StageStart[stage];
+  if (this->InFrame)
+    {
+    this->FrameAccumulator[stage] += elapsed;
+    this->FrameStageUsed[stage] = true;
+    }
+  else
+    {
+    this->RecordStage(stage, elapsed);
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerRTThermometryProfiler::RecordStage(int stage, double seconds)
+{
+  if (stage < 0 || stage >= NumberOfStages)
+    {
+    return;
+    }
+
+  this->Histogram[stage][this->GetBin(seconds)]++;
+  this->Count[stage]++;
+  this->Sum[stage] += seconds;
+  this->Last[stage] = seconds;
+  if (seconds > this->Maximum[stage])
+    {
+    this->Maximum[stage] = seconds;
+    }
+}
+
+//----------------------------------------------------------------------------
+vtkIdType vtkSlicerRTThermometryProfiler::GetNumberOfSamples(int stage)
+{
+  if (stage < 0 || stage >= NumberOfStages)
+    {
+    return 0;
+    }
+  return this->Count[stage];
+}
+
+//----------------------------------------------------------------------------
+double vtkSlicerRTThermometryProfiler::GetPercentile(int stage, double percentile)
+{
+  if (stage < 0 || stage >= NumberOfStages || this->Count[stage] == 0)
+    {
+    return 0.0;
+    }
+
+  // Rank of the requested sample (1-based)
+  vtkIdType rank = static_cast<vtkIdType>(std::ceil(percentile / 100.0 * this->Count[stage]));
+  if (rank < 1)
+    {
+    rank = 1;
+    }
+
+  vtkIdType cumulated = 0;
+  for (int bin = 0; bin < NumberOfBins; ++bin)
+    {
+    cumulated += this->Histogram[stage][bin];
+    if (cumulated >= rank)
+      {
+      // Bin center is an approximation, never report more than what was seen
+      double value = this->GetBinValue(bin);
+      return value < this->Maximum[stage] ? value : this->Maximum[stage];
+      }
+    }
+  return this->Maximum[stage];
+}
+
+//----------------------------------------------------------------------------
+double vtkSlicerRTThermometryProfiler::GetMean(int stage)
+{
+  if (stage < 0 || stage >= NumberOfStages || this->Count[stage] == 0)
+    {
+    return 0.0;
+    }
+  return this->Sum[stage] / this->Count[stage];
+}
+
+//----------------------------------------------------------------------------
+double vtkSlicerRTThermometryProfiler::GetMaximum(int stage)
+{
+  if (stage < 0 || stage >= NumberOfStages)
+    {
+    return 0.0;
+    }
+  return this->Maximum[stage];
+}
+
+//----------------------------------------------------------------------------
+double vtkSlicerRTThermometryProfiler::GetLast(int stage)
+{
+  if (stage < 0 || stage >= NumberOfStages)
+    {
+    return 0.0;
+    }
+  return this->Last[stage];
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerRTThermometryProfiler::Reset()
+{
+  memset(this->Histogram, 0, sizeof(this->Histogram));
+  for (int stage = 0; stage < NumberOfStages; ++stage)
+    {
+    this->Count[stage] = 0;
+    this->Sum[stage] = 0.0;
+    this->Maximum[stage] = 0.0;
+    this->Last[stage] = 0.0;
+    this->StageStart[stage] = 0.0;
+    this->FrameAccumulator[stage] = 0.0;
+    this->FrameStageUsed[stage] = false;
+    }
+  for (int counter = 0; counter < NumberOfCounters; ++counter)
+    {
+    this->Counter[counter] = 0;
+    }
+  this->FrameStart = 0.0;
+  this->InFrame = false;
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerRTThermometryProfiler::WriteToFile(const char* fileName)
+{
+  if (!fileName)
+    {
+    return false;
+    }
+
+  std::ofstream file(fileName);
+  if (!file.is_open())
+    {
+    vtkErrorMacro("WriteToFile: Cannot open " << fileName);
+    return false;
+    }
+
+  // Summary
+  file << "# RTThermometry stage latency profile (durations in ms)\n";
+  file << "stage,count,mean,p50,p95,p99,max\n";
+  for (int stage = 0; stage < NumberOfStages; ++stage)
+    {
+    file << GetStageName(stage) << ","
+         << this->Count[stage] << ","
+         << this->GetMean(stage) * 1000.0 << ","
+         << this->GetPercentile(stage, 50.0) * 1000.0 << ","
+         << this->GetPercentile(stage, 95.0) * 1000.0 << ","
+         << this->GetPercentile(stage, 99.0) * 1000.0 << ","
+         << this->Maximum[stage] * 1000.0 << "\n";
+    }
+
+  // Raw histograms, so profiles from different runs can be merged or compared
+  file << "\n# Histograms (lower bin bound in ms, then one count per stage)\n";
+  file << "bin";
+  for (int stage = 0; stage < NumberOfStages; ++stage)
+    {
+    file << "," << GetStageName(stage);
+    }
+  file << "\n";
+  for (int bin = 0; bin < NumberOfBins; ++bin)
+    {
+    file << 1e-4 * std::pow(10.0, static_cast<double>(bin) / NumberOfBinsPerDecade);
+    for (int stage = 0; stage < NumberOfStages; ++stage)
+      {
+      file << "," << this->Histogram[stage][bin];
+      }
+    file << "\n";
+    }
+
+  file << "\n# Counters\n";
+  file << "counter,count\n";
+  for (int counter = 0; counter < NumberOfCounters; ++counter)
+    {
+    file << GetCounterName(counter) << "," << this->Counter[counter] << "\n";
+    }
+
+  return true;
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerRTThermometryProfiler::GetBin(double seconds)
+{
+  double scaled = seconds * 1e7;
+  if (scaled <= 1.0)
+    {
+    return 0;
+    }
+
+  int bin = static_cast<int>(std::log10(scaled) * NumberOfBinsPerDecade);
+  return bin < NumberOfBins ? bin : NumberOfBins - 1;
+}
+
+//----------------------------------------------------------------------------
+double vtkSlicerRTThermometryProfiler::GetBinValue(int bin)
+{
+  // Geometric center of the bin, in seconds
+  return 1e-7 * std::pow(10.0, (bin + 0.5) / NumberOfBinsPerDecade);
+}
@@ -0,0 +1,140 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME vtkSlicerRTThermometryProfiler - per-stage latency histograms
+// .SECTION Description
+// This class records how long each stage of the thermometry pipeline takes
+// for every frame. Durations are binned in logarithmic histograms so that
+// recording is constant time and percentiles can be queried at any moment.
+
+#ifndef __vtkSlicerRTThermometryProfiler_h
+#define __vtkSlicerRTThermometryProfiler_h
+
+// VTK includes
+#include <vtkObject.h>
+
+#include "vtkSlicerRTThermometryModuleLogicExport.h"
+
+/// \ingroup Slicer_QtModules_ExtensionTemplate
+class VTK_SLICER_RTTHERMOMETRY_MODULE_LOGIC_EXPORT vtkSlicerRTThermometryProfiler :
+  public vtkObject
+{
+public:
+
+  static vtkSlicerRTThermometryProfiler *New();
+  vtkTypeMacro(vtkSlicerRTThermometryProfiler, vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  enum Stages
+    {
+    IngestCopy = 0,
+    PhaseKernel,
+    SensorSampling,
+    TableUpdate,
+    GraphUpdate,
+    RenderHandoff,
+    SessionRecord,
+    BaselineSelection,
+    BackgroundFit,
+    QualityCheck,
+    SpatialFilter,
+    SafetyCheck,
+    HotSpotDetection,
+    Preview,
+    Checkpoint,
+    LineProfile,
+    FrameTotal,
+    NumberOfStages
+    };
+
+  /// Histograms cover 0.1 microsecond to 100 seconds, with
+  /// NumberOfBinsPerDecade logarithmic bins per power of ten.
+  enum
+    {
+    NumberOfBinsPerDecade = 40,
+    NumberOfDecades = 9,
+    NumberOfBins = NumberOfBinsPerDecade * NumberOfDecades
+    };
+
+  static const char* GetStageName(int stage);
+
+  /// Pipeline events counted alongside the stage latencies
+  enum Counters
+    {
+    RejectedFrames = 0,
+    DroppedFrames,
+    LateFrames,
+    ProtectionAlarms,
+    NumberOfCounters
+    };
+
+  static const char* GetCounterName(int counter);
+  void IncrementCounter(int counter);
+  vtkIdType GetCounter(int counter);
+
+  /// Open a frame. Stage durations measured until EndFrame() are summed
+  /// and recorded once per frame, together with the FrameTotal stage.
+  void StartFrame();
+  void EndFrame();
+
+  /// Time a stage. Outside of a frame, the duration is recorded directly.
+  void StartStage(int stage);
+  void StopStage(int stage);
+
+  /// Record a duration (in seconds) for a stage.
+  void RecordStage(int stage, double seconds);
+
+  /// Statistics. Durations are returned in seconds.
+  vtkIdType GetNumberOfSamples(int stage);
+  double GetPercentile(int stage, double percentile);
+  double GetMean(int stage);
+  double GetMaximum(int stage);
+  double GetLast(int stage);
+
+  /// Clear all histograms and counters.
+  void Reset();
+
+  /// Write statistics and raw histograms to a text file (CSV).
+  bool WriteToFile(const char* fileName);
+
+protected:
+  vtkSlicerRTThermometryProfiler();
+  virtual ~vtkSlicerRTThermometryProfiler();
+
+  int GetBin(double seconds);
+  double GetBinValue(int bin);
+
+  vtkIdType Histogram[NumberOfStages][NumberOfBins];
+  vtkIdType Count[NumberOfStages];
+  double Sum[NumberOfStages];
+  double Maximum[NumberOfStages];
+  double Last[NumberOfStages];
+  vtkIdType Counter[NumberOfCounters];
+
+  double StageStart[NumberOfStages];
+  double FrameAccumulator[NumberOfStages];
+  bool   FrameStageUsed[NumberOfStages];
+  double FrameStart;
+  bool   InFrame;
+
+private:
+
+  vtkSlicerRTThermometryProfiler(const vtkSlicerRTThermometryProfiler&); // Not implemented
+  void operator=(const vtkSlicerRTThermometryProfiler&);                 // Not implemented
+};
+
+#endif
@@ -0,0 +1,330 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// RTThermometry Logic includes
+#include "vtkSlicerRTThermometrySessionReader.h"
+
+// VTK includes
+#include <vtkDataArray.h>
+#include <vtkImageData.h>
+#include <vtkMatrix4x4.h>
+#include <vtkObjectFactory.h>
+#include <vtkVersion.h>
+#include <vtkZLibDataCompressor.h>
+
+// STD includes
+#include <cstring>
+
+//----------------------------------------------------------------------------
+vtkStandardNewMacro(vtkSlicerRTThermometrySessionReader);
+
+namespace
+{
+
+//----------------------------------------------------------------------------
+// True if the sizes of a frame header agree with its geometry, so that its
+// payload can be read into an image allocated from it
+bool IsConsistentFrameHeader(const vtkSlicerRTThermometrySessionRecorder::FrameHeader& header)
+{
+  vtkTypeUInt64 rawSize = 0;
+  switch (header.ScalarType)
+    {
+    vtkTemplateMacro(rawSize = sizeof(VTK_TT));
+    }
+  if (rawSize == 0 || header.NumberOfComponents <= 0 ||
+      (header.Compression != 0 && header.Compression != 1))
+    {
+    return false;
+    }
+  rawSize *= header.NumberOfComponents;
+  for (int axis = 0; axis < 3; ++axis)
+    {
+    // Bounded so that the product cannot overflow
+    if (header.Dimensions[axis] <= 0 || header.Dimensions[axis] > (1 << 20))
+      {
+      return false;
+      }
+    rawSize *= static_cast<vtkTypeUInt64>(header.Dimensions[axis]);
+    }
+  return rawSize == header.RawSize &&
+    (header.Compression != 0 || header.CompressedSize == header.RawSize);
+}
+
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerRTThermometrySessionReader::vtkSlicerRTThermometrySessionReader()
+{
+  this->FileSize = 0;
+  this->Compressor = vtkZLibDataCompressor::New();
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerRTThermometrySessionReader::~vtkSlicerRTThermometrySessionReader()
+{
+  this->Close();
+  this->Compressor->Delete();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerRTThermometrySessionReader::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+
+  os << indent << "FileName: " << this->FileName << "\n";
+  os << indent << "NumberOfFrames: " << this->Index.size() << "\n";
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerRTThermometrySessionReader::Open(const char* fileName)
+{
+  this->Close();
+  if (!fileName)
+    {
+    return false;
+    }
+
+  this->File.open(fileName, std::ios::in | std::ios::binary);
+  char magic[8];
+  if (!this->File.is_open() ||
+      !this->File.read(magic, 8) ||
+      memcmp(magic, vtkSlicerRTThermometrySessionRecorder::FileMagic, 8) != 0)
+    {
+    vtkErrorMacro("Open: " << fileName << " is not a thermometry session log");
+    this->Close();
+    return false;
+    }
+  this->FileName = fileName;
+  this->File.seekg(0, std::ios::end);
+  this->FileSize = this->File.tellg();
+
+  if (!this->ReadIndex() && !this->ScanFrames())
+    {
+    vtkErrorMacro("Open: Cannot read frames from " << fileName);
+    this->Close();
+    return false;
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerRTThermometrySessionReader::Close()
+{
+  if (this->File.is_open())
+    {
+    this->File.close();
+    }
+  this->File.clear();
+  this->FileName.clear();
+  this->FileSize = 0;
+  this->Index.clear();
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerRTThermometrySessionReader::IsOpen()
+{
+  return this->File.is_open();
+}
+
+//----------------------------------------------------------------------------
+vtkIdType vtkSlicerRTThermometrySessionReader::GetNumberOfFrames()
+{
+  return static_cast<vtkIdType>(this->Index.size());
+}
+
+//----------------------------------------------------------------------------
+double vtkSlicerRTThermometrySessionReader::GetTimestamp(vtkIdType frame)
+{
+  if (frame < 0 || frame >= this->GetNumberOfFrames())
+    {
+    return 0.0;
+    }
+  return this->Index[frame].Timestamp;
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerRTThermometrySessionReader::ReadFrame(vtkIdType frame, vtkImageData* output,
+                                                    vtkMatrix4x4* ijkToRAS)
+{
+  if (!output || frame < 0 || frame >= this->GetNumberOfFrames())
+    {
+    return false;
+    }
+
+  FrameHeader header;
+  this->File.clear();
+  this->File.seekg(static_cast<std::streamoff>(this->Index[frame].Offset));
+  std::streamoff dataOffset =
+    static_cast<std::streamoff>(this->Index[frame].Offset + sizeof(header));
+  if (!this->File.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+      memcmp(header.Magic, vtkSlicerRTThermometrySessionRecorder::FrameMagic, 4) != 0 ||
+      !IsConsistentFrameHeader(header) ||
+      header.CompressedSize > static_cast<vtkTypeUInt64>(this->FileSize - dataOffset))
+    {
+    vtkErrorMacro("ReadFrame: Corrupted frame " << frame);
+    return false;
+    }
+
+  // Allocate output
+  int* dimensions = output->GetDimensions();
+  if (dimensions[0] != header.Dimensions[0] ||
+      dimensions[1] != header.Dimensions[1] ||
+      dimensions[2] != header.Dimensions[2] ||
+      !output->GetScalarPointer() ||
+      output->GetScalarType() != header.ScalarType ||
+      output->GetNumberOfScalarComponents() != header.NumberOfComponents)
+    {
+    output->SetDimensions(header.Dimensions);
+#if VTK_MAJOR_VERSION <= 5
+    output->SetScalarType(header.ScalarType);
+    output->SetNumberOfScalarComponents(header.NumberOfComponents);
+    output->AllocateScalars();
+#else
+    output->AllocateScalars(header.ScalarType, header.NumberOfComponents);
+#endif
+    }
+  output->SetSpacing(header.Spacing);
+  output->SetOrigin(header.Origin);
+
+  vtkTypeUInt64 outputSize = static_cast<vtkTypeUInt64>(output->GetNumberOfPoints()) *
+    output->GetScalarSize() * header.NumberOfComponents;
+  if (outputSize != header.RawSize)
+    {
+    vtkErrorMacro("ReadFrame: Unexpected size for frame " << frame);
+    return false;
+    }
+
+  // Read payload
+  bool success = false;
+  size_t compressedSize = static_cast<size_t>(header.CompressedSize);
+  if (header.Compression == 0)
+    {
+    success = !!this->File.read(static_cast<char*>(output->GetScalarPointer()),
+                                static_cast<std::streamsize>(compressedSize));
+    }
+  else
+    {
+    if (this->CompressedBuffer.size() < compressedSize)
+      {
+      this->CompressedBuffer.resize(compressedSize);
+      }
+    success = this->File.read(reinterpret_cast<char*>(&this->CompressedBuffer[0]),
+                              static_cast<std::streamsize>(compressedSize)) &&
+      this->Compressor->Uncompress(&this->CompressedBuffer[0], compressedSize,
+                                   static_cast<unsigned char*>(output->GetScalarPointer()),
+                                   static_cast<size_t>(header.RawSize)) == header.RawSize;
+    }
+  if (!success)
+    {
+    vtkErrorMacro("ReadFrame: Cannot read data of frame " << frame);
+    return false;
+    }
+
+  if (ijkToRAS)
+    {
+    for (int i = 0; i < 16; ++i)
+      {
+      ijkToRAS->SetElement(i / 4, i % 4, header.IJKToRAS[i]);
+      }
+    }
+
+  output->Modified();
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerRTThermometrySessionReader::ReadIndex()
+{
+  IndexTrailer trailer;
+  this->File.clear();
+  this->File.seekg(0, std::ios::end);
+  std::streamoff fileSize = this->FileSize;
+  if (fileSize < static_cast<std::streamoff>(8 + sizeof(trailer)))
+    {
+    return false;
+    }
+
+  this->File.seekg(fileSize - static_cast<std::streamoff>(sizeof(trailer)));
+  if (!this->File.read(reinterpret_cast<char*>(&trailer), sizeof(trailer)) ||
+      memcmp(trailer.Magic, vtkSlicerRTThermometrySessionRecorder::IndexMagic, 8) != 0)
+    {
+    return false;
+    }
+
+  // The index fills the file between the last frame and the trailer,
+  // otherwise the trailer is garbage and the frames are scanned
+  vtkTypeUInt64 indexEnd = static_cast<vtkTypeUInt64>(fileSize) - sizeof(trailer);
+  if (trailer.IndexOffset < 8 || trailer.IndexOffset > indexEnd ||
+      trailer.NumberOfFrames != (indexEnd - trailer.IndexOffset) / sizeof(IndexEntry) ||
+      trailer.IndexOffset + trailer.NumberOfFrames * sizeof(IndexEntry) != indexEnd)
+    {
+    return false;
+    }
+
+  this->Index.resize(static_cast<size_t>(trailer.NumberOfFrames));
+  if (this->Index.empty())
+    {
+    return true;
+    }
+  this->File.seekg(static_cast<std::streamoff>(trailer.IndexOffset));
+  if (!this->File.read(reinterpret_cast<char*>(&this->Index[0]),
+                       this->Index.size() * sizeof(IndexEntry)))
+    {
+    this->Index.clear();
+    return false;
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerRTThermometrySessionReader::ScanFrames()
+{
+  // Walk the frame records until the first incomplete one
+  this->Index.clear();
+  this->File.clear();
+  std::streamoff fileSize = this->FileSize;
+
+  std::streamoff offset = 8;
+  FrameHeader header;
+  while (offset + static_cast<std::streamoff>(sizeof(header)) <= fileSize)
+    {
+    this->File.seekg(offset);
+    if (!this->File.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        memcmp(header.Magic, vtkSlicerRTThermometrySessionRecorder::FrameMagic, 4) != 0 ||
+        !IsConsistentFrameHeader(header) ||
+        header.CompressedSize > static_cast<vtkTypeUInt64>(fileSize))
+      {
+      break;
+      }
+    std::streamoff next = offset + static_cast<std::streamoff>(sizeof(header)) +
+      static_cast<std::streamoff>(header.CompressedSize);
+    if (next > fileSize)
+      {
+      break;
+      }
+
+    IndexEntry entry;
+    entry.Offset = static_cast<vtkTypeUInt64>(offset);
+    entry.Timestamp = header.Timestamp;
+    this->Index.push_back(entry);
+    offset = next;
+    }
+
+  vtkWarningMacro("ScanFrames: " << this->FileName << " has no index, "
+                  << this->Index.size() << " frames recovered");
+  return !this->Index.empty();
+}
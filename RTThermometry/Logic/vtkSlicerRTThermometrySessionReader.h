@@ -0,0 +1,91 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME vtkSlicerRTThermometrySessionReader - raw phase frame log reader
+// .SECTION Description
+// This class gives random access to the frames of a session log written by
+// vtkSlicerRTThermometrySessionRecorder. The index is read from the end of
+// the file; if the log was not closed properly, it is rebuilt by scanning
+// the frame records.
+
+#ifndef __vtkSlicerRTThermometrySessionReader_h
+#define __vtkSlicerRTThermometrySessionReader_h
+
+// VTK includes
+#include <vtkObject.h>
+
+// STD includes
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "vtkSlicerRTThermometryModuleLogicExport.h"
+#include "vtkSlicerRTThermometrySessionRecorder.h"
+
+class vtkImageData;
+class vtkMatrix4x4;
+class vtkZLibDataCompressor;
+
+/// \ingroup Slicer_QtModules_ExtensionTemplate
+class VTK_SLICER_RTTHERMOMETRY_MODULE_LOGIC_EXPORT vtkSlicerRTThermometrySessionReader :
+  public vtkObject
+{
+public:
+
+  static vtkSlicerRTThermometrySessionReader *New();
+  vtkTypeMacro(vtkSlicerRTThermometrySessionReader, vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  /// Open a session log and load its index.
+  bool Open(const char* fileName);
+  void Close();
+  bool IsOpen();
+
+  vtkIdType GetNumberOfFrames();
+
+  /// Timestamp of a frame, in seconds. Return 0 for invalid frames.
+  double GetTimestamp(vtkIdType frame);
+
+  /// Read a frame into output (reallocated if needed). Geometry is copied
+  /// into ijkToRAS if not NULL.
+  bool ReadFrame(vtkIdType frame, vtkImageData* output, vtkMatrix4x4* ijkToRAS = NULL);
+
+protected:
+  vtkSlicerRTThermometrySessionReader();
+  virtual ~vtkSlicerRTThermometrySessionReader();
+
+  typedef vtkSlicerRTThermometrySessionRecorder::FrameHeader FrameHeader;
+  typedef vtkSlicerRTThermometrySessionRecorder::IndexEntry IndexEntry;
+  typedef vtkSlicerRTThermometrySessionRecorder::IndexTrailer IndexTrailer;
+
+  bool ReadIndex();
+  bool ScanFrames();
+
+  std::string FileName;
+  std::ifstream File;
+  std::streamoff FileSize;
+  std::vector<IndexEntry> Index;
+  std::vector<unsigned char> CompressedBuffer;
+  vtkZLibDataCompressor* Compressor;
+
+private:
+
+  vtkSlicerRTThermometrySessionReader(const vtkSlicerRTThermometrySessionReader&); // Not implemented
+  void operator=(const vtkSlicerRTThermometrySessionReader&);                      // Not implemented
+};
+
+#endif
@@ -0,0 +1,368 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// RTThermometry Logic includes
+#include "vtkSlicerRTThermometrySessionRecorder.h"
+
+// VTK includes
+#include <vtkConditionVariable.h>
+#include <vtkImageData.h>
+#include <vtkMatrix4x4.h>
+#include <vtkMutexLock.h>
+#include <vtkObjectFactory.h>
+#include <vtkZLibDataCompressor.h>
+
+// STD includes
+#include <cstring>
+
+//----------------------------------------------------------------------------
+vtkStandardNewMacro(vtkSlicerRTThermometrySessionRecorder);
+
+const char* vtkSlicerRTThermometrySessionRecorder::FileMagic = "RTTHLOG1";
+const char* vtkSlicerRTThermometrySessionRecorder::FrameMagic = "FRAM";
+const char* vtkSlicerRTThermometrySessionRecorder::IndexMagic = "RTTHIDX1";
+
+//----------------------------------------------------------------------------
+vtkSlicerRTThermometrySessionRecorder::vtkSlicerRTThermometrySessionRecorder()
+{
+  this->CompressionLevel = 1;
+  this->MaximumQueueLength = 32;
+  for (int i = 0; i < 16; ++i)
+    {
+    this->IJKToRAS[i] = (i % 5 == 0) ? 1.0 : 0.0;
+    }
+
+  this->Compressor = vtkZLibDataCompressor::New();
+
+  this->Threader = vtkMultiThreader::New();
+  this->WriterThreadID = -1;
+  this->Lock = vtkMutexLock::New();
+  this->FrameQueued = vtkConditionVariable::New();
+  this->StopWriter = false;
+  this->WriteFailed = false;
+  this->NumberOfRecordedFrames = 0;
+  this->NumberOfDroppedFrames = 0;
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerRTThermometrySessionRecorder::~vtkSlicerRTThermometrySessionRecorder()
+{
+  this->Close();
+
+  for (size_t i = 0; i < this->FreeRecords.size(); ++i)
+    {
+    delete this->FreeRecords[i];
+    }
+  this->FreeRecords.clear();
+
+  this->FrameQueued->Delete();
+  this->Lock->Delete();
+  this->Threader->Delete();
+  this->Compressor->Delete();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerRTThermometrySessionRecorder::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+
+  os << indent << "FileName: " << this->FileName << "\n";
+  os << indent << "CompressionLevel: " << this->CompressionLevel << "\n";
+  os << indent << "MaximumQueueLength: " << this->MaximumQueueLength << "\n";
+  os << indent << "NumberOfRecordedFrames: " << this->GetNumberOfRecordedFrames() << "\n";
+  os << indent << "NumberOfDroppedFrames: " << this->GetNumberOfDroppedFrames() << "\n";
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerRTThermometrySessionRecorder::Open(const char* fileName)
+{
+  if (!fileName)
+    {
+    return false;
+    }
+
+  this->Close();
+
+  this->File.open(fileName, std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!this->File.is_open())
+    {
+    vtkErrorMacro("Open: Cannot create " << fileName);
+    return false;
+    }
+  this->File.write(FileMagic, 8);
+  if (!this->File.good())
+    {
+    vtkErrorMacro("Open: Cannot write to " << fileName);
+    this->File.close();
+    return false;
+    }
+
+  this->FileName = fileName;
+  this->Index.clear();
+  this->Compressor->SetCompressionLevel(this->CompressionLevel);
+  this->StopWriter = false;
+  this->WriteFailed = false;
+  this->NumberOfRecordedFrames = 0;
+  this->NumberOfDroppedFrames = 0;
+  this->WriterThreadID = this->Threader->SpawnThread(
+    vtkSlicerRTThermometrySessionRecorder::WriterThread, this);
+  return true;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerRTThermometrySessionRecorder::Close()
+{
+  if (this->WriterThreadID < 0)
+    {
+    return;
+    }
+
+  // Let the writer drain the queue, then wait for it
+  this->Lock->Lock();
+  this->StopWriter = true;
+  this->FrameQueued->Broadcast();
+  this->Lock->Unlock();
+  this->Threader->TerminateThread(this->WriterThreadID);
+  this->WriterThreadID = -1;
+
+  // Without index, the reader recovers the frames written before the error
+  if (this->WriteFailed)
+    {
+    this->File.close();
+    return;
+    }
+
+  // Index
+  IndexTrailer trailer;
+  trailer.IndexOffset = static_cast<vtkTypeUInt64>(this->File.tellp());
+  trailer.NumberOfFrames = this->Index.size();
+  memcpy(trailer.Magic, IndexMagic, 8);
+  if (!this->Index.empty())
+    {
+    this->File.write(reinterpret_cast<const char*>(&this->Index[0]),
+                     this->Index.size() * sizeof(IndexEntry));
+    }
+  this->File.write(reinterpret_cast<const char*>(&trailer), sizeof(trailer));
+  this->File.close();
+  if (this->File.fail())
+    {
+    vtkErrorMacro("Close: Cannot write the index of " << this->FileName);
+    }
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerRTThermometrySessionRecorder::IsRecording()
+{
+  return this->WriterThreadID >= 0 && !this->HasWriteError();
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerRTThermometrySessionRecorder::HasWriteError()
+{
+  this->Lock->Lock();
+  bool failed = this->WriteFailed;
+  this->Lock->Unlock();
+  return failed;
+}
+
+//----------------------------------------------------------------------------
+const char* vtkSlicerRTThermometrySessionRecorder::GetFileName()
+{
+  return this->FileName.c_str();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerRTThermometrySessionRecorder::SetIJKToRASMatrix(vtkMatrix4x4* matrix)
+{
+  if (!matrix)
+    {
+    return;
+    }
+  for (int i = 0; i < 16; ++i)
+    {
+    this->IJKToRAS[i] = matrix->GetElement(i / 4, i % 4);
+    }
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerRTThermometrySessionRecorder::RecordFrame(vtkImageData* image, double timestamp)
+{
+  if (!this->IsRecording() || !image || !image->GetScalarPointer())
+    {
+    return false;
+    }
+
+  // Take a recycled record, unless the writer is too far behind
+  FrameRecord* record = NULL;
+  this->Lock->Lock();
+  if (static_cast<int>(this->Queue.size()) >= this->MaximumQueueLength)
+    {
+    this->NumberOfDroppedFrames++;
+    this->Lock->Unlock();
+    return false;
+    }
+  if (!this->FreeRecords.empty())
+    {
+    record = this->FreeRecords.back();
+    this->FreeRecords.pop_back();
+    }
+  this->Lock->Unlock();
+
+  if (!record)
+    {
+    record = new FrameRecord;
+    }
+
+  FrameHeader& header = record->Header;
+  memcpy(header.Magic, FrameMagic, 4);
+  image->GetDimensions(header.Dimensions);
+  header.ScalarType = image->GetScalarType();
+  header.NumberOfComponents = image->GetNumberOfScalarComponents();
+  header.Compression = 0;
+  image->GetSpacing(header.Spacing);
+  image->GetOrigin(header.Origin);
+  memcpy(header.IJKToRAS, this->IJKToRAS, sizeof(header.IJKToRAS));
+  header.Timestamp = timestamp;
+  header.RawSize = static_cast<vtkTypeUInt64>(image->GetNumberOfPoints()) *
+    image->GetScalarSize() * header.NumberOfComponents;
+  header.CompressedSize = 0;
+
+  // Capacity is kept between frames: no allocation once the pool is warm
+  record->Data.resize(static_cast<size_t>(header.RawSize));
+  memcpy(&record->Data[0], image->GetScalarPointer(), static_cast<size_t>(header.RawSize));
+
+  this->Lock->Lock();
+  this->Queue.push_back(record);
+  this->FrameQueued->Signal();
+  this->Lock->Unlock();
+  return true;
+}
+
+//----------------------------------------------------------------------------
+vtkIdType vtkSlicerRTThermometrySessionRecorder::GetNumberOfRecordedFrames()
+{
+  this->Lock->Lock();
+  vtkIdType count = this->NumberOfRecordedFrames;
+  this->Lock->Unlock();
+  return count;
+}
+
+//----------------------------------------------------------------------------
+vtkIdType vtkSlicerRTThermometrySessionRecorder::GetNumberOfDroppedFrames()
+{
+  this->Lock->Lock();
+  vtkIdType count = this->NumberOfDroppedFrames;
+  this->Lock->Unlock();
+  return count;
+}
+
+//----------------------------------------------------------------------------
+VTK_THREAD_RETURN_TYPE vtkSlicerRTThermometrySessionRecorder::WriterThread(void* arg)
+{
+  vtkMultiThreader::ThreadInfo* info = static_cast<vtkMultiThreader::ThreadInfo*>(arg);
+  static_cast<vtkSlicerRTThermometrySessionRecorder*>(info->UserData)->WriteFrames();
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerRTThermometrySessionRecorder::WriteFrames()
+{
+  while (true)
+    {
+    this->Lock->Lock();
+    while (this->Queue.empty() && !this->StopWriter)
+      {
+      this->FrameQueued->Wait(this->Lock);
+      }
+    if (this->Queue.empty())
+      {
+      // Stopped and drained
+      this->Lock->Unlock();
+      break;
+      }
+    FrameRecord* record = this->Queue.front();
+    this->Queue.pop_front();
+    this->Lock->Unlock();
+
+    bool written = !this->WriteFailed && this->WriteFrame(record);
+
+    // After an error, the queued frames are dropped and no more are
+    // accepted until Close()
+    this->Lock->Lock();
+    this->FreeRecords.push_back(record);
+    bool failed = !written && !this->WriteFailed;
+    if (written)
+      {
+      this->NumberOfRecordedFrames++;
+      }
+    else
+      {
+      this->WriteFailed = true;
+      this->NumberOfDroppedFrames += 1 + static_cast<vtkIdType>(this->Queue.size());
+      this->FreeRecords.insert(this->FreeRecords.end(), this->Queue.begin(), this->Queue.end());
+      this->Queue.clear();
+      }
+    this->Lock->Unlock();
+
+    if (failed)
+      {
+      vtkErrorMacro("WriteFrames: Cannot write to " << this->FileName << ", recording stopped");
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerRTThermometrySessionRecorder::WriteFrame(FrameRecord* record)
+{
+  FrameHeader& header = record->Header;
+  size_t rawSize = static_cast<size_t>(header.RawSize);
+  const char* payload = &record->Data[0];
+
+  // Keep the frame uncompressed if zlib does not help
+  header.Compression = 0;
+  header.CompressedSize = header.RawSize;
+  if (this->CompressionLevel > 0)
+    {
+    size_t space = this->Compressor->GetMaximumCompressionSpace(rawSize);
+    if (this->CompressedBuffer.size() < space)
+      {
+      this->CompressedBuffer.resize(space);
+      }
+    size_t compressedSize = this->Compressor->Compress(
+      reinterpret_cast<const unsigned char*>(payload), rawSize,
+      &this->CompressedBuffer[0], space);
+    if (compressedSize > 0 && compressedSize < rawSize)
+      {
+      header.Compression = 1;
+      header.CompressedSize = compressedSize;
+      payload = reinterpret_cast<const char*>(&this->CompressedBuffer[0]);
+      }
+    }
+
+  // Only frames completely written are indexed
+  IndexEntry entry;
+  entry.Offset = static_cast<vtkTypeUInt64>(this->File.tellp());
+  entry.Timestamp = header.Timestamp;
+  this->File.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  this->File.write(payload, static_cast<std::streamsize>(header.CompressedSize));
+  if (!this->File.good())
+    {
+    return false;
+    }
+  this->Index.push_back(entry);
+  return true;
+}
@@ -0,0 +1,175 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME vtkSlicerRTThermometrySessionRecorder - raw phase frame log writer
+// .SECTION Description
+// This class appends raw phase frames, with their geometry and timestamp, to
+// a session log file. RecordFrame() only copies the frame into a recycled
+// buffer and queues it: compression (zlib) and disk writes happen on a
+// background thread. If the writer falls behind by more than
+// MaximumQueueLength frames, new frames are dropped and counted instead of
+// stalling the caller.
+//
+// Each frame is compressed on its own so that any frame can be read back
+// directly through the index written when the log is closed. Logs that were
+// not closed properly can still be read by scanning the frame records.
+// See vtkSlicerRTThermometrySessionReader.
+
+#ifndef __vtkSlicerRTThermometrySessionRecorder_h
+#define __vtkSlicerRTThermometrySessionRecorder_h
+
+// VTK includes
+#include <vtkMultiThreader.h>
+#include <vtkObject.h>
+
+// STD includes
+#include <deque>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "vtkSlicerRTThermometryModuleLogicExport.h"
+
+class vtkConditionVariable;
+class vtkImageData;
+class vtkMatrix4x4;
+class vtkMutexLock;
+class vtkZLibDataCompressor;
+
+/// \ingroup Slicer_QtModules_ExtensionTemplate
+class VTK_SLICER_RTTHERMOMETRY_MODULE_LOGIC_EXPORT vtkSlicerRTThermometrySessionRecorder :
+  public vtkObject
+{
+public:
+
+  static vtkSlicerRTThermometrySessionRecorder *New();
+  vtkTypeMacro(vtkSlicerRTThermometrySessionRecorder, vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  /// On-disk layout, in native byte order:
+  ///   "RTTHLOG1"
+  ///   for each frame: FrameHeader, then CompressedSize bytes of zlib data
+  ///   for each frame: IndexEntry
+  ///   IndexTrailer
+  struct FrameHeader
+    {
+    char          Magic[4];
+    int           Dimensions[3];
+    int           ScalarType;
+    int           NumberOfComponents;
+    int           Compression; // 0: raw, 1: zlib
+    double        Spacing[3];
+    double        Origin[3];
+    double        IJKToRAS[16];
+    double        Timestamp;
+    vtkTypeUInt64 RawSize;
+    vtkTypeUInt64 CompressedSize;
+    };
+
+  struct IndexEntry
+    {
+    vtkTypeUInt64 Offset;
+    double        Timestamp;
+    };
+
+  struct IndexTrailer
+    {
+    vtkTypeUInt64 IndexOffset;
+    vtkTypeUInt64 NumberOfFrames;
+    char          Magic[8];
+    };
+
+  static const char* FileMagic;
+  static const char* FrameMagic;
+  static const char* IndexMagic;
+
+  /// zlib compression level (1 by default: fast, still lossless)
+  vtkSetClampMacro(CompressionLevel, int, 0, 9);
+  vtkGetMacro(CompressionLevel, int);
+
+  /// Number of frames waiting for the writer before new frames are dropped
+  vtkSetClampMacro(MaximumQueueLength, int, 1, VTK_INT_MAX);
+  vtkGetMacro(MaximumQueueLength, int);
+
+  /// Create the log file and start the writer thread.
+  bool Open(const char* fileName);
+
+  /// Write the pending frames and the index, then close the file.
+  void Close();
+
+  /// False once a frame could not be written (e.g. disk full): recording
+  /// then stops, the queued frames are dropped and HasWriteError() is true
+  /// until the next Open(). The frames written before can still be read.
+  bool IsRecording();
+  bool HasWriteError();
+  const char* GetFileName();
+
+  /// Geometry saved with the following frames (identity by default)
+  void SetIJKToRASMatrix(vtkMatrix4x4* matrix);
+
+  /// Queue a copy of the frame. Timestamp is in seconds.
+  /// Return false if the frame was dropped.
+  bool RecordFrame(vtkImageData* image, double timestamp);
+
+  /// Frames written to disk and frames dropped since Open()
+  vtkIdType GetNumberOfRecordedFrames();
+  vtkIdType GetNumberOfDroppedFrames();
+
+protected:
+  vtkSlicerRTThermometrySessionRecorder();
+  virtual ~vtkSlicerRTThermometrySessionRecorder();
+
+  struct FrameRecord
+    {
+    FrameHeader Header;
+    std::vector<char> Data;
+    };
+
+  static VTK_THREAD_RETURN_TYPE WriterThread(void* arg);
+  void WriteFrames();
+  /// Return false if the frame could not be written (e.g. disk full)
+  bool WriteFrame(FrameRecord* record);
+
+  int CompressionLevel;
+  int MaximumQueueLength;
+  double IJKToRAS[16];
+
+  std::string FileName;
+  std::ofstream File;
+  std::vector<IndexEntry> Index;
+  std::vector<unsigned char> CompressedBuffer;
+  vtkZLibDataCompressor* Compressor;
+
+  // Shared with the writer thread, protected by Lock
+  vtkMultiThreader* Threader;
+  int WriterThreadID;
+  vtkMutexLock* Lock;
+  vtkConditionVariable* FrameQueued;
+  std::deque<FrameRecord*> Queue;
+  std::vector<FrameRecord*> FreeRecords;
+  bool StopWriter;
+  bool WriteFailed;
+  vtkIdType NumberOfRecordedFrames;
+  vtkIdType NumberOfDroppedFrames;
+
+private:
+
+  vtkSlicerRTThermometrySessionRecorder(const vtkSlicerRTThermometrySessionRecorder&); // Not implemented
+  void operator=(const vtkSlicerRTThermometrySessionRecorder&);                        // Not implemented
+};
+
+#endif
@@ -0,0 +1,275 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// RTThermometry Logic includes
+#include "vtkSlicerRTThermometrySyntheticPhaseSource.h"
+
+// VTK includes
+#include <vtkImageData.h>
+#include <vtkObjectFactory.h>
+#include <vtkVersion.h>
+
+// STD includes
+#include <cmath>
+#include <limits>
+#include <vector>
+
+//----------------------------------------------------------------------------
+vtkStandardNewMacro(vtkSlicerRTThermometrySyntheticPhaseSource);
+
+//----------------------------------------------------------------------------
+namespace
+{
+
+// Integer types are rounded and wrap around their range, like the phase
+// of the scanner and as the phase kernel reads them; floating point types
+// are stored as is
+template <class T>
+inline void ConvertValue(double value, T& output)
+{
+  const double minimum = static_cast<double>(std::numeric_limits<T>::min());
+  const double range = static_cast<double>(std::numeric_limits<T>::max()) - minimum + 1.0;
+  double rounded = std::floor(value + 0.5);
+  if (!(std::fabs(rounded) <= VTK_DOUBLE_MAX))
+    {
+    output = 0;
+    return;
+    }
+  rounded -= range * std::floor((rounded - minimum) / range);
+  // Rounding of the 64 bit types
+  if (rounded >= minimum + range)
+    {
+    rounded -= range;
+    }
+  else if (rounded < minimum)
+    {
+    rounded += range;
+    }
+  output = static_cast<T>(rounded);
+}
+
+inline void ConvertValue(double value, float& output)
+{
+  output = static_cast<float>(value);
+}
+
+inline void ConvertValue(double value, double& output)
+{
+  output = value;
+}
+
+//----------------------------------------------------------------------------
+template <class T>
+void GenerateFrameExecute(const double* phase, vtkIdType numberOfVoxels, T* output)
+{
+  for (vtkIdType i = 0; i < numberOfVoxels; ++i)
+    {
+    ConvertValue(phase[i], output[i]);
+    }
+}
+
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerRTThermometrySyntheticPhaseSource::vtkSlicerRTThermometrySyntheticPhaseSource()
+{
+  this->Dimensions[0] = 256;
+  this->Dimensions[1] = 256;
+  this->Dimensions[2] = 1;
+  this->Spacing[0] = this->Spacing[1] = this->Spacing[2] = 1.0;
+  this->Origin[0] = this->Origin[1] = this->Origin[2] = 0.0;
+  this->ScalarType = VTK_SHORT;
+  this->HeatingPattern = GaussianHeating;
+  this->PhaseIncrement = -50.0;
+  this->HeatingWidth = 0.1;
+  this->NoiseStandardDeviation = 0.0;
+  this->ScaleFactor = 4096.0;
+  this->WrapPhase = false;
+  this->Seed = 1;
+
+  this->Reset();
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerRTThermometrySyntheticPhaseSource::~vtkSlicerRTThermometrySyntheticPhaseSource()
+{
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerRTThermometrySyntheticPhaseSource::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+
+  os << indent << "Dimensions: " << this->Dimensions[0] << " "
+     << this->Dimensions[1] << " " << this->Dimensions[2] << "\n";
+  os << indent << "ScalarType: " << this->ScalarType << "\n";
+  os << indent << "HeatingPattern: " << this->HeatingPattern << "\n";
+  os << indent << "PhaseIncrement: " << this->PhaseIncrement << "\n";
+  os << indent << "HeatingWidth: " << this->HeatingWidth << "\n";
+  os << indent << "NoiseStandardDeviation: " << this->NoiseStandardDeviation << "\n";
+  os << indent << "ScaleFactor: " << this->ScaleFactor << "\n";
+  os << indent << "WrapPhase: " << this->WrapPhase << "\n";
+  os << indent << "Seed: " << this->Seed << "\n";
+  os << indent << "FrameIndex: " << this->FrameIndex << "\n";
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerRTThermometrySyntheticPhaseSource::Reset()
+{
+  this->FrameIndex = 0;
+  this->RandomState = this->Seed;
+  this->HasSpareGaussian = false;
+  this->SpareGaussian = 0.0;
+}
+
+//----------------------------------------------------------------------------
+double vtkSlicerRTThermometrySyntheticPhaseSource::GetPeakPhase(int frameIndex)
+{
+  if (this->HeatingPattern == NoHeating)
+    {
+    return 0.0;
+    }
+  return frameIndex * this->PhaseIncrement;
+}
+
+//----------------------------------------------------------------------------
+double vtkSlicerRTThermometrySyntheticPhaseSource::NextGaussian()
+{
+  // Box-Muller transform on a linear congruential generator: cheap and
+  // reproducible across platforms
+  if (this->HasSpareGaussian)
+    {
+    this->HasSpareGaussian = false;
+    return this->SpareGaussian;
+    }
+
+  double u1, u2;
+  do
+    {
+    this->RandomState = this->RandomState * 1664525u + 1013904223u;
+    u1 = (this->RandomState >> 8) / 16777216.0;
+    }
+  while (u1 <= 0.0);
+  this->RandomState = this->RandomState * 1664525u + 1013904223u;
+  u2 = (this->RandomState >> 8) / 16777216.0;
+
+  double radius = std::sqrt(-2.0 * std::log(u1));
+  this->SpareGaussian = radius * std::sin(2.0 * 3.14159265358979323846 * u2);
+  this->HasSpareGaussian = true;
+  return radius * std::cos(2.0 * 3.14159265358979323846 * u2);
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerRTThermometrySyntheticPhaseSource::GenerateNextFrame(vtkImageData* output)
+{
+  if (!output)
+    {
+    return;
+    }
+
+  int* outputDimensions = output->GetDimensions();
+  if (outputDimensions[0] != this->Dimensions[0] ||
+      outputDimensions[1] != this->Dimensions[1] ||
+      outputDimensions[2] != this->Dimensions[2] ||
+      !output->GetScalarPointer() ||
+      output->GetScalarType() != this->ScalarType)
+    {
+    output->SetDimensions(this->Dimensions);
+#if VTK_MAJOR_VERSION <= 5
+    output->SetScalarType(this->ScalarType);
+    output->SetNumberOfScalarComponents(1);
+    output->AllocateScalars();
+#else
+    output->AllocateScalars(this->ScalarType, 1);
+#endif
+    }
+  output->SetSpacing(this->Spacing);
+  output->SetOrigin(this->Origin);
+
+  vtkIdType numberOfVoxels =
+    static_cast<vtkIdType>(this->Dimensions[0]) * this->Dimensions[1] * this->Dimensions[2];
+  std::vector<double> phase(numberOfVoxels);
+
+  double center[3];
+  double sigma[3];
+  for (int axis = 0; axis < 3; ++axis)
+    {
+    center[axis] = (this->Dimensions[axis] - 1) / 2.0;
+    sigma[axis] = this->HeatingWidth * this->Dimensions[axis];
+    if (sigma[axis] <= 0.0 || this->Dimensions[axis] == 1)
+      {
+      sigma[axis] = 1.0;
+      }
+    }
+
+  double peak = this->GetPeakPhase(this->FrameIndex);
+  double range = this->ScaleFactor;
+
+  vtkIdType index = 0;
+  for (int k = 0; k < this->Dimensions[2]; ++k)
+    {
+    double dk = (k - center[2]) / sigma[2];
+    for (int j = 0; j < this->Dimensions[1]; ++j)
+      {
+      double dj = (j - center[1]) / sigma[1];
+      for (int i = 0; i < this->Dimensions[0]; ++i, ++index)
+        {
+        double di = (i - center[0]) / sigma[0];
+
+        // Smooth background phase, like field inhomogeneities
+        double value = 0.1 * range * (static_cast<double>(i) / this->Dimensions[0] - 0.5)
+          + 0.05 * range * (static_cast<double>(j) / this->Dimensions[1] - 0.5);
+
+        // Heating
+        if (this->HeatingPattern == GaussianHeating)
+          {
+          value += peak * std::exp(-0.5 * (di*di + dj*dj + dk*dk));
+          }
+        else if (this->HeatingPattern == UniformHeating)
+          {
+          value += peak;
+          }
+
+        // Noise
+        if (this->NoiseStandardDeviation > 0.0)
+          {
+          value += this->NoiseStandardDeviation * this->NextGaussian();
+          }
+
+        if (this->WrapPhase && range > 0.0)
+          {
+          value = value - 2.0 * range * std::floor((value + range) / (2.0 * range));
+          }
+
+        phase[index] = value;
+        }
+      }
+    }
+
+  switch (this->ScalarType)
+    {
+    vtkTemplateMacro(
+      GenerateFrameExecute(&phase[0], numberOfVoxels,
+                           static_cast<VTK_TT*>(output->GetScalarPointer())));
+    default:
+      vtkErrorMacro("GenerateNextFrame: Unsupported scalar type " << this->ScalarType);
+      return;
+    }
+
+  output->Modified();
+  this->FrameIndex++;
+}
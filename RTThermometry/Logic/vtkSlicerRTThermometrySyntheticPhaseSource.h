@@ -0,0 +1,140 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME vtkSlicerRTThermometrySyntheticPhaseSource - synthetic phase stream
+// .SECTION Description
+// Generate a sequence of phase images as sent by the scanner, without a
+// scanner. A static background phase is combined with a heating pattern
+// that grows linearly with the frame index, and with gaussian noise.
+// Values are expressed in raw image units, where [-ScaleFactor, ScaleFactor]
+// maps to [-pi, pi]. The sequence is deterministic for a given seed.
+
+#ifndef __vtkSlicerRTThermometrySyntheticPhaseSource_h
+#define __vtkSlicerRTThermometrySyntheticPhaseSource_h
+
+// VTK includes
+#include <vtkObject.h>
+
+#include "vtkSlicerRTThermometryModuleLogicExport.h"
+
+class vtkImageData;
+
+/// \ingroup Slicer_QtModules_ExtensionTemplate
+class VTK_SLICER_RTTHERMOMETRY_MODULE_LOGIC_EXPORT vtkSlicerRTThermometrySyntheticPhaseSource :
+  public vtkObject
+{
+public:
+
+  static vtkSlicerRTThermometrySyntheticPhaseSource *New();
+  vtkTypeMacro(vtkSlicerRTThermometrySyntheticPhaseSource, vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  enum HeatingPatterns
+    {
+    NoHeating = 0,
+    GaussianHeating,
+    UniformHeating
+    };
+
+  /// Image dimensions
+  vtkSetVector3Macro(Dimensions, int);
+  vtkGetVector3Macro(Dimensions, int);
+
+  /// Image spacing and origin
+  vtkSetVector3Macro(Spacing, double);
+  vtkGetVector3Macro(Spacing, double);
+  vtkSetVector3Macro(Origin, double);
+  vtkGetVector3Macro(Origin, double);
+
+  /// Scalar type of the generated images (VTK_SHORT by default)
+  vtkSetMacro(ScalarType, int);
+  vtkGetMacro(ScalarType, int);
+
+  /// Heating pattern
+  vtkSetMacro(HeatingPattern, int);
+  vtkGetMacro(HeatingPattern, int);
+
+  /// Phase added at the center of the heating pattern at each frame
+  vtkSetMacro(PhaseIncrement, double);
+  vtkGetMacro(PhaseIncrement, double);
+
+  /// Width of the gaussian heating pattern, as a fraction of the dimensions
+  vtkSetMacro(HeatingWidth, double);
+  vtkGetMacro(HeatingWidth, double);
+
+  /// Standard deviation of the noise, in raw image units
+  vtkSetMacro(NoiseStandardDeviation, double);
+  vtkGetMacro(NoiseStandardDeviation, double);
+
+  /// Phase range: [-ScaleFactor, ScaleFactor] represents [-pi, pi]
+  vtkSetMacro(ScaleFactor, double);
+  vtkGetMacro(ScaleFactor, double);
+
+  /// Wrap generated phase into [-ScaleFactor, ScaleFactor) like the scanner
+  /// does. Off by default.
+  vtkSetMacro(WrapPhase, bool);
+  vtkGetMacro(WrapPhase, bool);
+  vtkBooleanMacro(WrapPhase, bool);
+
+  /// Seed of the noise generator
+  vtkSetMacro(Seed, unsigned int);
+  vtkGetMacro(Seed, unsigned int);
+
+  /// Restart the sequence at frame 0
+  void Reset();
+
+  /// Index of the next frame generated
+  vtkGetMacro(FrameIndex, int);
+
+  /// Generate the next frame into output. The output is reallocated if
+  /// its dimensions or scalar type do not match.
+  void GenerateNextFrame(vtkImageData* output);
+
+  /// Phase accumulated at the center of the heating pattern after n frames,
+  /// without noise. Useful to compute expected temperatures.
+  double GetPeakPhase(int frameIndex);
+
+protected:
+  vtkSlicerRTThermometrySyntheticPhaseSource();
+  virtual ~vtkSlicerRTThermometrySyntheticPhaseSource();
+
+  double NextGaussian();
+
+  int    Dimensions[3];
+  double Spacing[3];
+  double Origin[3];
+  int    ScalarType;
+  int    HeatingPattern;
+  double PhaseIncrement;
+  double HeatingWidth;
+  double NoiseStandardDeviation;
+  double ScaleFactor;
+  bool   WrapPhase;
+  unsigned int Seed;
+
+  int    FrameIndex;
+  unsigned int RandomState;
+  bool   HasSpareGaussian;
+  double SpareGaussian;
+
+private:
+
+  vtkSlicerRTThermometrySyntheticPhaseSource(const vtkSlicerRTThermometrySyntheticPhaseSource&); // Not implemented
+  void operator=(const vtkSlicerRTThermometrySyntheticPhaseSource&);                             // Not implemented
+};
+
+#endif
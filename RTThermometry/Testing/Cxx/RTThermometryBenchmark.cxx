@@ -0,0 +1,610 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// Benchmark of the thermometry pipeline on synthetic phase streams.
+//
+// Usage: RTThermometryBenchmark [options]
+//   --sizes 128x128x1,256x256x1,...  Image dimensions to benchmark
+//   --threads 1,2,4,...               Thread counts used by the phase kernel
+//   --scalar short|int|float|double   Scalar type of the phase images
+//   --pattern none|gaussian|uniform   Heating pattern
+//   --noise <sigma>                   Noise standard deviation (raw units)
+//   --frames <n>                      Number of frames per configuration
+//   --sensors <n>                     Number of sensors sampled per frame
+//   --mask <fraction>                 Restrict the phase kernel to a central
+//                                     compute mask covering this fraction
+//   --conversion auto,arithmetic,table  Phase to temperature conversions
+//                                     benchmarked by the phase kernel
+//                                     (arithmetic,table by default)
+//   --no-graph                        Skip the graph append benchmark (no GUI)
+//   --format csv|json                 Output format (csv by default)
+//   --output <file>                   Output file (standard output by default)
+
+// Qt includes
+#include <QApplication>
+
+// RTThermometry includes
+#include "qSlicerRTThermometryGraphWidget.h"
+#include "vtkSlicerRTThermometryLogic.h"
+#include "vtkSlicerRTThermometryProfiler.h"
+#include "vtkSlicerRTThermometrySyntheticPhaseSource.h"
+
+// VTK includes
+#include <vtkImageData.h>
+#include <vtkMultiThreader.h>
+#include <vtkNew.h>
+#include <vtkTimerLog.h>
+#include <vtkVersion.h>
+
+// STD includes
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+//----------------------------------------------------------------------------
+struct BenchmarkOptions
+{
+  std::vector<std::vector<int> > Sizes;
+  std::vector<int> Threads;
+  int ScalarType;
+  int HeatingPattern;
+  double Noise;
+  int Frames;
+  int Sensors;
+  double MaskFraction;
+  std::vector<int> Conversions;
+  bool Graph;
+  bool Json;
+  std::string Output;
+};
+
+//----------------------------------------------------------------------------
+struct BenchmarkResult
+{
+  int Dimensions[3];
+  std::string ScalarType;
+  int Threads;
+  std::string Stage;
+  std::string Conversion;
+  vtkIdType Samples;
+  double Mean;
+  double P50;
+  double P95;
+  double P99;
+  double Maximum;
+  double Throughput;
+};
+
+//----------------------------------------------------------------------------
+std::vector<std::string> SplitString(const std::string& str, char separator)
+{
+  std::vector<std::string> tokens;
+  std::stringstream stream(str);
+  std::string token;
+  while (std::getline(stream, token, separator))
+    {
+    if (!token.empty())
+      {
+      tokens.push_back(token);
+      }
+    }
+  return tokens;
+}
+
+//----------------------------------------------------------------------------
+const char* ScalarTypeName(int scalarType)
+{
+  switch (scalarType)
+    {
+    case VTK_SHORT:  return "short";
+    case VTK_INT:    return "int";
+    case VTK_FLOAT:  return "float";
+    case VTK_DOUBLE: return "double";
+    default:         return "unknown";
+    }
+}
+
+//----------------------------------------------------------------------------
+const char* ConversionName(int conversion)
+{
+  switch (conversion)
+    {
+    case vtkSlicerRTThermometryLogic::AutomaticConversion:   return "auto";
+    case vtkSlicerRTThermometryLogic::ArithmeticConversion:  return "arithmetic";
+    case vtkSlicerRTThermometryLogic::LookupTableConversion: return "table";
+    default:                                                 return "unknown";
+    }
+}
+
+//----------------------------------------------------------------------------
+bool ParseArguments(int argc, char* argv[], BenchmarkOptions& options)
+{
+  std::string sizes = "128x128x1,256x256x1,256x256x16,256x256x64";
+  std::stringstream defaultThreads;
+  defaultThreads << "1";
+  for (int n = 2; n < vtkMultiThreader::GetGlobalDefaultNumberOfThreads(); n *= 2)
+    {
+    defaultThreads << "," << n;
+    }
+  if (vtkMultiThreader::GetGlobalDefaultNumberOfThreads() > 1)
+    {
+    defaultThreads << "," << vtkMultiThreader::GetGlobalDefaultNumberOfThreads();
+    }
+  std::string threads = defaultThreads.str();
+  std::string conversions = "arithmetic,table";
+
+  options.ScalarType = VTK_SHORT;
+  options.HeatingPattern = vtkSlicerRTThermometrySyntheticPhaseSource::GaussianHeating;
+  options.Noise = 10.0;
+  options.Frames = 50;
+  options.Sensors = 8;
+  options.MaskFraction = 1.0;
+  options.Graph = true;
+  options.Json = false;
+
+  for (int i = 1; i < argc; ++i)
+    {
+    std::string arg(argv[i]);
+    bool hasValue = (i + 1 < argc);
+    if (arg == "--sizes" && hasValue)
+      {
+      sizes = argv[++i];
+      }
+    else if (arg == "--threads" && hasValue)
+      {
+      threads = argv[++i];
+      }
+    else if (arg == "--scalar" && hasValue)
+      {
+      std::string type(argv[++i]);
+      if (type == "short")       { options.ScalarType = VTK_SHORT; }
+      else if (type == "int")    { options.ScalarType = VTK_INT; }
+      else if (type == "float")  { options.ScalarType = VTK_FLOAT; }
+      else if (type == "double") { options.ScalarType = VTK_DOUBLE; }
+      else
+        {
+        std::cerr << "Unknown scalar type: " << type << std::endl;
+        return false;
+        }
+      }
+    else if (arg == "--pattern" && hasValue)
+      {
+      std::string pattern(argv[++i]);
+      if (pattern == "none")
+        {
+        options.HeatingPattern = vtkSlicerRTThermometrySyntheticPhaseSource::NoHeating;
+        }
+      else if (pattern == "gaussian")
+        {
+        options.HeatingPattern = vtkSlicerRTThermometrySyntheticPhaseSource::GaussianHeating;
+        }
+      else if (pattern == "uniform")
+        {
+        options.HeatingPattern = vtkSlicerRTThermometrySyntheticPhaseSource::UniformHeating;
+        }
+      else
+        {
+        std::cerr << "Unknown heating pattern: " << pattern << std::endl;
+        return false;
+        }
+      }
+    else if (arg == "--noise" && hasValue)
+      {
+      options.Noise = atof(argv[++i]);
+      }
+    else if (arg == "--frames" && hasValue)
+      {
+      options.Frames = atoi(argv[++i]);
+      }
+    else if (arg == "--sensors" && hasValue)
+      {
+      options.Sensors = atoi(argv[++i]);
+      }
+    else if (arg == "--mask" && hasValue)
+      {
+      options.MaskFraction = atof(argv[++i]);
+      }
+    else if (arg == "--conversion" && hasValue)
+      {
+      conversions = argv[++i];
+      }
+    else if (arg == "--no-graph")
+      {
+      options.Graph = false;
+      }
+    else if (arg == "--format" && hasValue)
+      {
+      options.Json = (std::string(argv[++i]) == "json");
+      }
+    else if (arg == "--output" && hasValue)
+      {
+      options.Output = argv[++i];
+      }
+    else
+      {
+      std::cerr << "Unknown or incomplete argument: " << arg << std::endl;
+      return false;
+      }
+    }
+
+  std::vector<std::string> sizeTokens = SplitString(sizes, ',');
+  for (size_t i = 0; i < sizeTokens.size(); ++i)
+    {
+    std::vector<int> dimensions(3, 1);
+    if (sscanf(sizeTokens[i].c_str(), "%dx%dx%d",
+               &dimensions[0], &dimensions[1], &dimensions[2]) < 2)
+      {
+      std::cerr << "Invalid size: " << sizeTokens[i] << std::endl;
+      return false;
+      }
+    options.Sizes.push_back(dimensions);
+    }
+
+  std::vector<std::string> threadTokens = SplitString(threads, ',');
+  for (size_t i = 0; i < threadTokens.size(); ++i)
+    {
+    options.Threads.push_back(atoi(threadTokens[i].c_str()));
+    }
+
+  std::vector<std::string> conversionTokens = SplitString(conversions, ',');
+  for (size_t i = 0; i < conversionTokens.size(); ++i)
+    {
+    int conversion = vtkSlicerRTThermometryLogic::AutomaticConversion;
+    while (conversion <= vtkSlicerRTThermometryLogic::LookupTableConversion &&
+           conversionTokens[i] != ConversionName(conversion))
+      {
+      ++conversion;
+      }
+    if (conversion > vtkSlicerRTThermometryLogic::LookupTableConversion)
+      {
+      std::cerr << "Unknown conversion: " << conversionTokens[i] << std::endl;
+      return false;
+      }
+    options.Conversions.push_back(conversion);
+    }
+
+  return options.Frames > 0 && !options.Sizes.empty() && !options.Threads.empty() &&
+    !options.Conversions.empty();
+}
+
+//----------------------------------------------------------------------------
+BenchmarkResult MakeResult(const int dimensions[3], int scalarType, int threads,
+                           vtkSlicerRTThermometryProfiler* profiler, int stage,
+                           double itemsPerSample)
+{
+  BenchmarkResult result;
+  for (int i = 0; i < 3; ++i)
+    {
+    result.Dimensions[i] = dimensions[i];
+    }
+  result.ScalarType = ScalarTypeName(scalarType);
+  result.Threads = threads;
+  result.Stage = vtkSlicerRTThermometryProfiler::GetStageName(stage);
+  result.Conversion = "-";
+  result.Samples = profiler->GetNumberOfSamples(stage);
+  result.Mean = profiler->GetMean(stage) * 1000.0;
+  result.P50 = profiler->GetPercentile(stage, 50.0) * 1000.0;
+  result.P95 = profiler->GetPercentile(stage, 95.0) * 1000.0;
+  result.P99 = profiler->GetPercentile(stage, 99.0) * 1000.0;
+  result.Maximum = profiler->GetMaximum(stage) * 1000.0;
+  result.Throughput = result.Mean > 0.0 ? itemsPerSample / (result.Mean / 1000.0) : 0.0;
+  return result;
+}
+
+//----------------------------------------------------------------------------
+void AllocateImage(vtkImageData* image, const int dimensions[3], int scalarType)
+{
+  image->SetDimensions(dimensions[0], dimensions[1], dimensions[2]);
+#if VTK_MAJOR_VERSION <= 5
+  image->SetScalarType(scalarType);
+  image->SetNumberOfScalarComponents(1);
+  image->AllocateScalars();
+#else
+  image->AllocateScalars(scalarType, 1);
+#endif
+  memset(image->GetScalarPointer(), 0, image->GetNumberOfPoints() * image->GetScalarSize());
+}
+
+//----------------------------------------------------------------------------
+void SetupSource(vtkSlicerRTThermometrySyntheticPhaseSource* source,
+                 const BenchmarkOptions& options, const int dimensions[3])
+{
+  source->SetDimensions(dimensions[0], dimensions[1], dimensions[2]);
+  source->SetScalarType(options.ScalarType);
+  source->SetHeatingPattern(options.HeatingPattern);
+  source->SetNoiseStandardDeviation(options.Noise);
+  source->Reset();
+}
+
+//----------------------------------------------------------------------------
+void SetupLogic(vtkSlicerRTThermometryLogic* logic)
+{
+  logic->SetEchoTime(0.01);
+  logic->SetMagneticField(3.0);
+  logic->SetGyromagneticRatio(42.576);
+  logic->SetThermalCoefficient(-0.01);
+  logic->SetScaleFactor(4096.0);
+  logic->SetBaseTemperature(37.0);
+}
+
+//----------------------------------------------------------------------------
+// Label map selecting a centered box of about fraction of the voxels
+void BuildMask(vtkImageData* labelMap, const int dimensions[3], double fraction)
+{
+  AllocateImage(labelMap, dimensions, VTK_UNSIGNED_CHAR);
+  double side = std::sqrt(fraction);
+  int begin[2], end[2];
+  for (int axis = 0; axis < 2; ++axis)
+    {
+    int width = static_cast<int>(side * dimensions[axis] + 0.5);
+    begin[axis] = (dimensions[axis] - width) / 2;
+    end[axis] = begin[axis] + width;
+    }
+
+  unsigned char* voxel = static_cast<unsigned char*>(labelMap->GetScalarPointer());
+  for (int k = 0; k < dimensions[2]; ++k)
+    {
+    for (int j = 0; j < dimensions[1]; ++j)
+      {
+      for (int i = 0; i < dimensions[0]; ++i, ++voxel)
+        {
+        *voxel = (i >= begin[0] && i < end[0] && j >= begin[1] && j < end[1]) ? 1 : 0;
+        }
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+// Phase kernel on preallocated buffers, for one thread count and one
+// conversion. The conversion reported is the one used on the last frame,
+// i.e. the choice of the automatic mode.
+BenchmarkResult BenchmarkPhaseKernel(const BenchmarkOptions& options,
+                                     const int dimensions[3], int threads,
+                                     int conversion)
+{
+  vtkNew<vtkSlicerRTThermometrySyntheticPhaseSource> source;
+  SetupSource(source.GetPointer(), options, dimensions);
+
+  vtkNew<vtkSlicerRTThermometryLogic> logic;
+  SetupLogic(logic.GetPointer());
+  logic->SetNumberOfThreads(threads);
+  logic->SetConversionMode(conversion);
+  if (options.MaskFraction < 1.0)
+    {
+    vtkNew<vtkImageData> labelMap;
+    BuildMask(labelMap.GetPointer(), dimensions, options.MaskFraction);
+    logic->SetMaskFromLabelMap(labelMap.GetPointer());
+    }
+
+  vtkNew<vtkImageData> previous;
+  vtkNew<vtkImageData> current;
+  vtkNew<vtkImageData> accumulated;
+  vtkNew<vtkImageData> temperature;
+  source->GenerateNextFrame(previous.GetPointer());
+  AllocateImage(accumulated.GetPointer(), dimensions, options.ScalarType);
+  AllocateImage(temperature.GetPointer(), dimensions, VTK_DOUBLE);
+
+  vtkNew<vtkSlicerRTThermometryProfiler> profiler;
+  for (int frame = 0; frame < options.Frames; ++frame)
+    {
+    source->GenerateNextFrame(current.GetPointer());
+
+    double start = vtkTimerLog::GetUniversalTime();
+    logic->ComputePhaseDifference(previous.GetPointer(), current.GetPointer(),
+                                  accumulated.GetPointer(), temperature.GetPointer());
+    profiler->RecordStage(vtkSlicerRTThermometryProfiler::PhaseKernel,
+                          vtkTimerLog::GetUniversalTime() - start);
+    }
+
+  BenchmarkResult result =
+    MakeResult(dimensions, options.ScalarType, threads, profiler.GetPointer(),
+               vtkSlicerRTThermometryProfiler::PhaseKernel,
+               static_cast<double>(temperature->GetNumberOfPoints()));
+  result.Conversion = ConversionName(logic->GetActiveConversion());
+  if (conversion == vtkSlicerRTThermometryLogic::AutomaticConversion)
+    {
+    result.Conversion = std::string("auto:") + result.Conversion;
+    }
+  return result;
+}
+
+//----------------------------------------------------------------------------
+// Sensor sampling on the last temperature image of the logic
+BenchmarkResult BenchmarkSensorSampling(const BenchmarkOptions& options,
+                                        const int dimensions[3])
+{
+  vtkNew<vtkSlicerRTThermometrySyntheticPhaseSource> source;
+  SetupSource(source.GetPointer(), options, dimensions);
+
+  vtkNew<vtkSlicerRTThermometryLogic> logic;
+  SetupLogic(logic.GetPointer());
+
+  vtkNew<vtkImageData> phase;
+  for (int frame = 0; frame < 2; ++frame)
+    {
+    source->GenerateNextFrame(phase.GetPointer());
+    logic->ProcessPhaseImage(phase.GetPointer());
+    }
+
+  // Sensors spread along the diagonal of the volume
+  std::vector<double> positions;
+  for (int sensor = 0; sensor < options.Sensors; ++sensor)
+    {
+    double t = (sensor + 0.5) / options.Sensors;
+    positions.push_back(t * (dimensions[0] - 1));
+    positions.push_back(t * (dimensions[1] - 1));
+    positions.push_back(t * (dimensions[2] - 1));
+    }
+
+  vtkNew<vtkSlicerRTThermometryProfiler> profiler;
+  double sum = 0.0;
+  for (int frame = 0; frame < options.Frames; ++frame)
+    {
+    double start = vtkTimerLog::GetUniversalTime();
+    for (int sensor = 0; sensor < options.Sensors; ++sensor)
+      {
+      sum += logic->GetTemperatureAtIJK(&positions[3*sensor]);
+      }
+    profiler->RecordStage(vtkSlicerRTThermometryProfiler::SensorSampling,
+                          vtkTimerLog::GetUniversalTime() - start);
+    }
+  if (sum != sum)
+    {
+    std::cerr << "Invalid temperature sampled" << std::endl;
+    }
+
+  return MakeResult(dimensions, options.ScalarType, 1, profiler.GetPointer(),
+                    vtkSlicerRTThermometryProfiler::SensorSampling, options.Sensors);
+}
+
+//----------------------------------------------------------------------------
+// Append one value per sensor and per frame to the temperature graph
+BenchmarkResult BenchmarkGraphAppend(const BenchmarkOptions& options,
+                                     const int dimensions[3])
+{
+  qSlicerRTThermometryGraphWidget graph;
+
+  std::vector<std::string> sensorIDs;
+  for (int sensor = 0; sensor < options.Sensors; ++sensor)
+    {
+    std::stringstream sensorID;
+    sensorID << "Sensor" << sensor;
+    sensorIDs.push_back(sensorID.str());
+    }
+
+  vtkNew<vtkSlicerRTThermometryProfiler> profiler;
+  for (int frame = 1; frame <= options.Frames; ++frame)
+    {
+    double start = vtkTimerLog::GetUniversalTime();
+    for (int sensor = 0; sensor < options.Sensors; ++sensor)
+      {
+      graph.recordNewData(sensorIDs[sensor], sensorIDs[sensor], 37.0 + 0.1 * frame, frame);
+      }
+    profiler->RecordStage(vtkSlicerRTThermometryProfiler::GraphUpdate,
+                          vtkTimerLog::GetUniversalTime() - start);
+    }
+
+  return MakeResult(dimensions, options.ScalarType, 1, profiler.GetPointer(),
+                    vtkSlicerRTThermometryProfiler::GraphUpdate, options.Sensors);
+}
+
+//----------------------------------------------------------------------------
+void WriteResults(std::ostream& os, const std::vector<BenchmarkResult>& results, bool json)
+{
+  if (json)
+    {
+    os << "[\n";
+    for (size_t i = 0; i < results.size(); ++i)
+      {
+      const BenchmarkResult& r = results[i];
+      os << "  {\"dimensions\": [" << r.Dimensions[0] << ", " << r.Dimensions[1]
+         << ", " << r.Dimensions[2] << "], \"scalar_type\": \"" << r.ScalarType
+         << "\", \"threads\": " << r.Threads << ", \"stage\": \"" << r.Stage
+         << "\", \"conversion\": \"" << r.Conversion
+         << "\", \"samples\": " << r.Samples << ", \"mean_ms\": " << r.Mean
+         << ", \"p50_ms\": " << r.P50 << ", \"p95_ms\": " << r.P95
+         << ", \"p99_ms\": " << r.P99 << ", \"max_ms\": " << r.Maximum
+         << ", \"items_per_s\": " << r.Throughput << "}"
+         << (i + 1 < results.size() ? "," : "") << "\n";
+      }
+    os << "]\n";
+    return;
+    }
+
+  os << "size_x,size_y,size_z,scalar_type,threads,stage,conversion,samples,"
+     << "mean_ms,p50_ms,p95_ms,p99_ms,max_ms,items_per_s\n";
+  for (size_t i = 0; i < results.size(); ++i)
+    {
+    const BenchmarkResult& r = results[i];
+    os << r.Dimensions[0] << "," << r.Dimensions[1] << "," << r.Dimensions[2] << ","
+       << r.ScalarType << "," << r.Threads << "," << r.Stage << "," << r.Conversion << ","
+       << r.Samples << ","
+       << r.Mean << "," << r.P50 << "," << r.P95 << "," << r.P99 << ","
+       << r.Maximum << "," << r.Throughput << "\n";
+    }
+}
+
+}
+
+//----------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+  BenchmarkOptions options;
+  if (!ParseArguments(argc, argv, options))
+    {
+    std::cerr << "Usage: " << argv[0] << " [--sizes WxHxD,...] [--threads N,...]"
+              << " [--scalar short|int|float|double] [--pattern none|gaussian|uniform]"
+              << " [--noise sigma] [--frames N] [--sensors N] [--mask fraction]"
+              << " [--conversion auto,arithmetic,table] [--no-graph]"
+              << " [--format csv|json] [--output file]" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // The graph widget needs a GUI application
+  QApplication* application = NULL;
+  if (options.Graph)
+    {
+    application = new QApplication(argc, argv);
+    }
+
+  std::vector<BenchmarkResult> results;
+  for (size_t size = 0; size < options.Sizes.size(); ++size)
+    {
+    const int* dimensions = &options.Sizes[size][0];
+    for (size_t thread = 0; thread < options.Threads.size(); ++thread)
+      {
+      for (size_t conversion = 0; conversion < options.Conversions.size(); ++conversion)
+        {
+        results.push_back(BenchmarkPhaseKernel(options, dimensions, options.Threads[thread],
+                                               options.Conversions[conversion]));
+        }
+      }
+    results.push_back(BenchmarkSensorSampling(options, dimensions));
+    if (options.Graph)
+      {
+      results.push_back(BenchmarkGraphAppend(options, dimensions));
+      }
+    }
+
+  if (options.Output.empty())
+    {
+    WriteResults(std::cout, results, options.Json);
+    }
+  else
+    {
+    std::ofstream file(options.Output.c_str());
+    if (!file.is_open())
+      {
+      std::cerr << "Cannot open " << options.Output << std::endl;
+      delete application;
+      return EXIT_FAILURE;
+      }
+    WriteResults(file, results, options.Json);
+    }
+
+  delete application;
+  return EXIT_SUCCESS;
+}
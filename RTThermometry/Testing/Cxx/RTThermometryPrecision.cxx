@@ -0,0 +1,281 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// Comparison of single and double precision temperatures on recorded
+// thermometry sessions.
+//
+// Every session log (.rtlog) is reprocessed twice with the given
+// parameters, in single and in double precision. One line is written per
+// frame with the maximum and mean absolute temperature difference,
+// followed by one summary line per session with the largest temperature
+// difference, the largest differences of the derived maps and the ablated
+// voxel counts of both precisions.
+//
+// Usage: RTThermometryPrecision [options] session1.rtlog [session2.rtlog ...]
+//   --echo-time <s>          Echo time (0.01 by default)
+//   --field <T>              Magnetic field (3.0 by default)
+//   --gyromagnetic <MHz/T>   Gyromagnetic ratio (42.576 by default)
+//   --coefficient <ppm/C>    Thermal coefficient (-0.01 by default)
+//   --scale <n>              Phase scale factor (4096 by default)
+//   --base <C>               Base temperature (37 by default)
+//   --threads <n>            Number of threads (all cores by default)
+//   --tolerance <C>          Fail if a temperature differs by more (none
+//                            by default)
+//   --output <file>          Output file (standard output by default)
+
+// RTThermometry includes
+#include "vtkSlicerRTThermometryLogic.h"
+#include "vtkSlicerRTThermometrySessionReader.h"
+
+// VTK includes
+#include <vtkDataArray.h>
+#include <vtkImageData.h>
+#include <vtkMultiThreader.h>
+#include <vtkNew.h>
+#include <vtkPointData.h>
+
+// STD includes
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+//----------------------------------------------------------------------------
+struct PrecisionOptions
+{
+  double EchoTime;
+  double MagneticField;
+  double GyromagneticRatio;
+  double ThermalCoefficient;
+  double ScaleFactor;
+  double BaseTemperature;
+  int Threads;
+  double Tolerance;
+  std::string Output;
+  std::vector<std::string> Sessions;
+};
+
+//----------------------------------------------------------------------------
+bool ParseArguments(int argc, char* argv[], PrecisionOptions& options)
+{
+  options.EchoTime = 0.01;
+  options.MagneticField = 3.0;
+  options.GyromagneticRatio = 42.576;
+  options.ThermalCoefficient = -0.01;
+  options.ScaleFactor = 4096.0;
+  options.BaseTemperature = 37.0;
+  options.Threads = vtkMultiThreader::GetGlobalDefaultNumberOfThreads();
+  options.Tolerance = -1.0;
+
+  for (int i = 1; i < argc; ++i)
+    {
+    std::string arg(argv[i]);
+    bool hasValue = (i + 1 < argc);
+    if (arg == "--echo-time" && hasValue)
+      {
+      options.EchoTime = atof(argv[++i]);
+      }
+    else if (arg == "--field" && hasValue)
+      {
+      options.MagneticField = atof(argv[++i]);
+      }
+    else if (arg == "--gyromagnetic" && hasValue)
+      {
+      options.GyromagneticRatio = atof(argv[++i]);
+      }
+    else if (arg == "--coefficient" && hasValue)
+      {
+      options.ThermalCoefficient = atof(argv[++i]);
+      }
+    else if (arg == "--scale" && hasValue)
+      {
+      options.ScaleFactor = atof(argv[++i]);
+      }
+    else if (arg == "--base" && hasValue)
+      {
+      options.BaseTemperature = atof(argv[++i]);
+      }
+    else if (arg == "--threads" && hasValue)
+      {
+      options.Threads = atoi(argv[++i]);
+      }
+    else if (arg == "--tolerance" && hasValue)
+      {
+      options.Tolerance = atof(argv[++i]);
+      }
+    else if (arg == "--output" && hasValue)
+      {
+      options.Output = argv[++i];
+      }
+    else if (arg.compare(0, 2, "--") == 0)
+      {
+      std::cerr << "Unknown or incomplete argument: " << arg << std::endl;
+      return false;
+      }
+    else
+      {
+      options.Sessions.push_back(arg);
+      }
+    }
+
+  return !options.Sessions.empty();
+}
+
+//----------------------------------------------------------------------------
+void SetupLogic(vtkSlicerRTThermometryLogic* logic, const PrecisionOptions& options,
+                int precision)
+{
+  logic->SetEchoTime(options.EchoTime);
+  logic->SetMagneticField(options.MagneticField);
+  logic->SetGyromagneticRatio(options.GyromagneticRatio);
+  logic->SetThermalCoefficient(options.ThermalCoefficient);
+  logic->SetScaleFactor(options.ScaleFactor);
+  logic->SetBaseTemperature(options.BaseTemperature);
+  logic->SetNumberOfThreads(options.Threads);
+  logic->SetTemperaturePrecision(precision);
+  for (int map = 0; map < vtkSlicerRTThermometryLogic::NumberOfDerivedMaps; ++map)
+    {
+    logic->SetDerivedMapEnabled(map, true);
+    }
+}
+
+//----------------------------------------------------------------------------
+// Largest and mean absolute difference between two images of the same
+// geometry, whatever their scalar types. Return false on size mismatch.
+bool CompareImages(vtkImageData* image, vtkImageData* reference,
+                   double& maximum, double& mean)
+{
+  maximum = 0.0;
+  mean = 0.0;
+  if (!image || !reference || image->GetNumberOfPoints() != reference->GetNumberOfPoints())
+    {
+    return false;
+    }
+  vtkDataArray* values = image->GetPointData()->GetScalars();
+  vtkDataArray* referenceValues = reference->GetPointData()->GetScalars();
+  vtkIdType numberOfVoxels = image->GetNumberOfPoints();
+  double sum = 0.0;
+  for (vtkIdType i = 0; i < numberOfVoxels; ++i)
+    {
+    double difference = fabs(values->GetComponent(i, 0) - referenceValues->GetComponent(i, 0));
+    maximum = difference > maximum ? difference : maximum;
+    sum += difference;
+    }
+  mean = numberOfVoxels > 0 ? sum / numberOfVoxels : 0.0;
+  return true;
+}
+
+}
+
+//----------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+  PrecisionOptions options;
+  if (!ParseArguments(argc, argv, options))
+    {
+    std::cerr << "Usage: " << argv[0] << " [--echo-time s] [--field T]"
+              << " [--gyromagnetic MHz/T] [--coefficient ppm/C] [--scale n]"
+              << " [--base C] [--threads n] [--tolerance C] [--output file]"
+              << " session1.rtlog [session2.rtlog ...]" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  std::ofstream file;
+  if (!options.Output.empty())
+    {
+    file.open(options.Output.c_str());
+    if (!file.is_open())
+      {
+      std::cerr << "Cannot open " << options.Output << std::endl;
+      return EXIT_FAILURE;
+      }
+    }
+  std::ostream& os = file.is_open() ? file : std::cout;
+
+  vtkNew<vtkSlicerRTThermometryLogic> single;
+  SetupLogic(single.GetPointer(), options, vtkSlicerRTThermometryLogic::SinglePrecision);
+  vtkNew<vtkSlicerRTThermometryLogic> reference;
+  SetupLogic(reference.GetPointer(), options, vtkSlicerRTThermometryLogic::DoublePrecision);
+
+  const char* mapNames[vtkSlicerRTThermometryLogic::NumberOfDerivedMaps] =
+    { "max_temperature", "time_above_threshold", "thermal_dose" };
+
+  int status = EXIT_SUCCESS;
+  double overallMaximum = 0.0;
+  os << "session,frame,timestamp,max_difference,mean_difference\n";
+  for (size_t s = 0; s < options.Sessions.size(); ++s)
+    {
+    const std::string& session = options.Sessions[s];
+    vtkNew<vtkSlicerRTThermometrySessionReader> reader;
+    if (!reader->Open(session.c_str()) ||
+        !single->ReprocessSession(reader.GetPointer()) ||
+        !reference->ReprocessSession(reader.GetPointer()))
+      {
+      status = EXIT_FAILURE;
+      continue;
+      }
+    if (single->GetNumberOfTemperatureImages() != reference->GetNumberOfTemperatureImages())
+      {
+      std::cerr << session << ": precisions produced different numbers of frames" << std::endl;
+      status = EXIT_FAILURE;
+      continue;
+      }
+
+    double sessionMaximum = 0.0;
+    for (int frame = 0; frame < reference->GetNumberOfTemperatureImages(); ++frame)
+      {
+      double maximum, mean;
+      if (!CompareImages(single->GetTemperatureImage(frame),
+                         reference->GetTemperatureImage(frame), maximum, mean))
+        {
+        std::cerr << session << ": frame " << frame + 1 << " differs in size" << std::endl;
+        status = EXIT_FAILURE;
+        break;
+        }
+      sessionMaximum = maximum > sessionMaximum ? maximum : sessionMaximum;
+      os << session << "," << frame + 1 << "," << reader->GetTimestamp(frame + 1)
+         << "," << maximum << "," << mean << "\n";
+      }
+    overallMaximum = sessionMaximum > overallMaximum ? sessionMaximum : overallMaximum;
+
+    std::cerr << session << ": maximum temperature difference " << sessionMaximum << " C";
+    for (int map = 0; map < vtkSlicerRTThermometryLogic::NumberOfDerivedMaps; ++map)
+      {
+      double maximum, mean;
+      if (CompareImages(single->GetDerivedMap(map), reference->GetDerivedMap(map), maximum, mean))
+        {
+        std::cerr << ", " << mapNames[map] << " " << maximum;
+        }
+      }
+    std::cerr << ", ablated voxels " << single->GetNumberOfAblatedVoxels()
+              << " (single) / " << reference->GetNumberOfAblatedVoxels()
+              << " (double)" << std::endl;
+    }
+
+  std::cerr << "Maximum temperature difference: " << overallMaximum << " C" << std::endl;
+  if (options.Tolerance >= 0.0 && overallMaximum > options.Tolerance)
+    {
+    std::cerr << "Exceeds the tolerance of " << options.Tolerance << " C" << std::endl;
+    status = EXIT_FAILURE;
+    }
+  return status;
+}
@@ -0,0 +1,587 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// Replay phase frames to the RTThermometry module over OpenIGTLink.
+//
+// Frames are synthetic, read from VTK image files (.vti), or read from a
+// recorded session log (.rtlog), and sent as IMAGE messages named
+// "ImagerClient". Session logs are paced by their recorded timestamps.
+// When "Send frame acknowledgments" is enabled in the module Diagnostics
+// panel, the module answers with an "RTThermometryAck" TRANSFORM message
+// after each processed frame. The acknowledgments are used to report how
+// many frames the module kept up with.
+//
+// Usage: RTThermometryReplay [options] [session.rtlog | frame1.vti frame2.vti ...]
+//   --host <name>          Module host (localhost by default)
+//   --port <n>             Port (18944 by default)
+//   --server               Listen for the module instead of connecting to it
+//   --frames <n>           Number of synthetic frames (ignored with files)
+//   --size WxHxD           Synthetic image dimensions (256x256x1 by default)
+//   --noise <sigma>        Synthetic noise standard deviation (raw units)
+//   --period <s>           Frame period in seconds (1.0 by default, ignored
+//                          with session logs)
+//   --speed <x>            Replay speed factor (1.0 is real time)
+//   --max-rate             Send frames as fast as possible
+//   --drain <s>            Wait for acknowledgments after the last frame (2 s)
+//   --log <file>           Write one line per sent frame and acknowledgment
+
+// OpenIGTLink includes
+#include <igtlClientSocket.h>
+#include <igtlImageMessage.h>
+#include <igtlMessageHeader.h>
+#include <igtlOSUtil.h>
+#include <igtlServerSocket.h>
+#include <igtlTransformMessage.h>
+
+// RTThermometry includes
+#include "vtkSlicerRTThermometrySessionReader.h"
+#include "vtkSlicerRTThermometrySyntheticPhaseSource.h"
+
+// VTK includes
+#include <vtkImageData.h>
+#include <vtkMultiThreader.h>
+#include <vtkMutexLock.h>
+#include <vtkNew.h>
+#include <vtkSmartPointer.h>
+#include <vtkTimerLog.h>
+#include <vtkXMLImageDataReader.h>
+
+// STD includes
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+//----------------------------------------------------------------------------
+struct ReplayOptions
+{
+  std::string Host;
+  int Port;
+  bool Server;
+  int Frames;
+  int Dimensions[3];
+  double Noise;
+  double Period;
+  double Speed;
+  bool MaxRate;
+  double Drain;
+  std::string Log;
+  std::vector<std::string> Files;
+};
+
+//----------------------------------------------------------------------------
+// State shared between the sending loop and the acknowledgment thread
+struct ReplayState
+{
+  igtl::Socket* Socket;
+  vtkMutexLock* Lock;
+  bool Stop;
+
+  std::vector<double> SendTimes;
+  vtkIdType AcksReceived;
+  double LastAckTime;
+  double ProcessedFrames;
+  double ReceivedFrames;
+  double ModuleLatency;
+  std::vector<double> AckDelays;
+  std::ofstream* Log;
+  // The acknowledgment stream lost sync and is no longer read
+  bool AcksLost;
+};
+
+//----------------------------------------------------------------------------
+bool ParseArguments(int argc, char* argv[], ReplayOptions& options)
+{
+  options.Host = "localhost";
+  options.Port = 18944;
+  options.Server = false;
+  options.Frames = 100;
+  options.Dimensions[0] = 256;
+  options.Dimensions[1] = 256;
+  options.Dimensions[2] = 1;
+  options.Noise = 10.0;
+  options.Period = 1.0;
+  options.Speed = 1.0;
+  options.MaxRate = false;
+  options.Drain = 2.0;
+
+  for (int i = 1; i < argc; ++i)
+    {
+    std::string arg(argv[i]);
+    bool hasValue = (i + 1 < argc);
+    if (arg == "--host" && hasValue)
+      {
+      options.Host = argv[++i];
+      }
+    else if (arg == "--port" && hasValue)
+      {
+      options.Port = atoi(argv[++i]);
+      }
+    else if (arg == "--server")
+      {
+      options.Server = true;
+      }
+    else if (arg == "--frames" && hasValue)
+      {
+      options.Frames = atoi(argv[++i]);
+      }
+    else if (arg == "--size" && hasValue)
+      {
+      if (sscanf(argv[++i], "%dx%dx%d", &options.Dimensions[0],
+                 &options.Dimensions[1], &options.Dimensions[2]) < 2)
+        {
+        std::cerr << "Invalid size: " << argv[i] << std::endl;
+        return false;
+        }
+      }
+    else if (arg == "--noise" && hasValue)
+      {
+      options.Noise = atof(argv[++i]);
+      }
+    else if (arg == "--period" && hasValue)
+      {
+      options.Period = atof(argv[++i]);
+      }
+    else if (arg == "--speed" && hasValue)
+      {
+      options.Speed = atof(argv[++i]);
+      }
+    else if (arg == "--max-rate")
+      {
+      options.MaxRate = true;
+      }
+    else if (arg == "--drain" && hasValue)
+      {
+      options.Drain = atof(argv[++i]);
+      }
+    else if (arg == "--log" && hasValue)
+      {
+      options.Log = argv[++i];
+      }
+    else if (arg.compare(0, 2, "--") == 0)
+      {
+      std::cerr << "Unknown or incomplete argument: " << arg << std::endl;
+      return false;
+      }
+    else
+      {
+      options.Files.push_back(arg);
+      }
+    }
+
+  return options.Speed > 0.0 && options.Period >= 0.0;
+}
+
+//----------------------------------------------------------------------------
+int ToIGTLScalarType(int vtkScalarType)
+{
+  switch (vtkScalarType)
+    {
+    case VTK_CHAR:
+    case VTK_SIGNED_CHAR:    return igtl::ImageMessage::TYPE_INT8;
+    case VTK_UNSIGNED_CHAR:  return igtl::ImageMessage::TYPE_UINT8;
+    case VTK_SHORT:          return igtl::ImageMessage::TYPE_INT16;
+    case VTK_UNSIGNED_SHORT: return igtl::ImageMessage::TYPE_UINT16;
+    case VTK_INT:            return igtl::ImageMessage::TYPE_INT32;
+    case VTK_UNSIGNED_INT:   return igtl::ImageMessage::TYPE_UINT32;
+    case VTK_FLOAT:          return igtl::ImageMessage::TYPE_FLOAT32;
+    case VTK_DOUBLE:         return igtl::ImageMessage::TYPE_FLOAT64;
+    default:                 return -1;
+    }
+}
+
+//----------------------------------------------------------------------------
+bool PackImage(vtkImageData* image, igtl::ImageMessage* message)
+{
+  int scalarType = ToIGTLScalarType(image->GetScalarType());
+  if (scalarType < 0)
+    {
+    std::cerr << "Unsupported scalar type: " << image->GetScalarType() << std::endl;
+    return false;
+    }
+
+  int dimensions[3];
+  image->GetDimensions(dimensions);
+  double* spacing = image->GetSpacing();
+  double* origin = image->GetOrigin();
+  int offset[3] = { 0, 0, 0 };
+
+  message->SetDimensions(dimensions);
+  message->SetSpacing(static_cast<float>(spacing[0]), static_cast<float>(spacing[1]),
+                      static_cast<float>(spacing[2]));
+  message->SetScalarType(scalarType);
+  message->SetDeviceName("ImagerClient");
+  message->SetSubVolume(dimensions, offset);
+  message->AllocateScalars();
+  memcpy(message->GetScalarPointer(), image->GetScalarPointer(), message->GetImageSize());
+
+  igtl::Matrix4x4 matrix;
+  igtl::IdentityMatrix(matrix);
+  matrix[0][3] = static_cast<float>(origin[0]);
+  matrix[1][3] = static_cast<float>(origin[1]);
+  matrix[2][3] = static_cast<float>(origin[2]);
+  message->SetMatrix(matrix);
+
+  igtl::TimeStamp::Pointer timeStamp = igtl::TimeStamp::New();
+  timeStamp->GetTime();
+  message->SetTimeStamp(timeStamp);
+
+  message->Pack();
+  return true;
+}
+
+//----------------------------------------------------------------------------
+enum ReceiveStatus
+{
+  Received,
+  Idle,
+  Lost
+};
+
+// Consecutive empty reads tolerated inside a message, of one receive
+// timeout (100 ms) each
+const int MaximumReceiveRetries = 20;
+
+//----------------------------------------------------------------------------
+// Receive exactly length bytes, or NULL data to discard them. A timeout
+// before the first byte is Idle when allowed; inside a message the read is
+// retried, and the stream is Lost when it stays silent or when stopped.
+ReceiveStatus ReceiveAll(ReplayState* state, char* data, int length, bool allowIdle)
+{
+  std::vector<char> discarded(data ? 0 : std::min(length, 65536));
+  int total = 0;
+  int retries = 0;
+  while (total < length)
+    {
+    char* buffer = data ? data + total : &discarded[0];
+    int size = data ? length - total : std::min(length - total, static_cast<int>(discarded.size()));
+    int received = state->Socket->Receive(buffer, size, 0);
+    if (received > 0)
+      {
+      total += received;
+      retries = 0;
+      continue;
+      }
+    if (total == 0 && allowIdle)
+      {
+      return Idle;
+      }
+    state->Lock->Lock();
+    bool stop = state->Stop;
+    state->Lock->Unlock();
+    if (stop || ++retries > MaximumReceiveRetries)
+      {
+      return Lost;
+      }
+    }
+  return Received;
+}
+
+//----------------------------------------------------------------------------
+// Receive "RTThermometryAck" TRANSFORM messages until asked to stop, or
+// until a message is cut short
+VTK_THREAD_RETURN_TYPE ReceiveAcknowledgments(void* arg)
+{
+  vtkMultiThreader::ThreadInfo* info = static_cast<vtkMultiThreader::ThreadInfo*>(arg);
+  ReplayState* state = static_cast<ReplayState*>(info->UserData);
+
+  igtl::MessageHeader::Pointer header = igtl::MessageHeader::New();
+  while (true)
+    {
+    state->Lock->Lock();
+    bool stop = state->Stop;
+    state->Lock->Unlock();
+    if (stop)
+      {
+      break;
+      }
+
+    header->InitPack();
+    ReceiveStatus status = ReceiveAll(state, static_cast<char*>(header->GetPackPointer()),
+                                      header->GetPackSize(), true);
+    if (status == Idle)
+      {
+      continue;
+      }
+
+    igtl::TransformMessage::Pointer transform = igtl::TransformMessage::New();
+    if (status == Received)
+      {
+      header->Unpack();
+      if (strcmp(header->GetDeviceType(), "TRANSFORM") != 0 ||
+          strcmp(header->GetDeviceName(), "RTThermometryAck") != 0)
+        {
+        status = ReceiveAll(state, NULL, static_cast<int>(header->GetBodySizeToRead()), false);
+        if (status == Received)
+          {
+          continue;
+          }
+        }
+      else
+        {
+        transform->SetMessageHeader(header);
+        transform->AllocatePack();
+        status = ReceiveAll(state, static_cast<char*>(transform->GetPackBodyPointer()),
+                            transform->GetPackBodySize(), false);
+        }
+      }
+    if (status == Lost)
+      {
+      // The next bytes are not the start of a message anymore
+      state->Lock->Lock();
+      state->AcksLost = !state->Stop;
+      state->Lock->Unlock();
+      break;
+      }
+    if (!(transform->Unpack(1) & igtl::MessageHeader::UNPACK_BODY))
+      {
+      continue;
+      }
+
+    igtl::Matrix4x4 matrix;
+    transform->GetMatrix(matrix);
+    double now = vtkTimerLog::GetUniversalTime();
+
+    state->Lock->Lock();
+    state->AcksReceived++;
+    state->LastAckTime = now;
+    state->ProcessedFrames = matrix[0][3];
+    state->ReceivedFrames = matrix[1][3];
+    state->ModuleLatency = matrix[2][3];
+    if (!state->SendTimes.empty())
+      {
+      // Delay since the most recent frame was sent
+      state->AckDelays.push_back(now - state->SendTimes.back());
+      }
+    if (state->Log)
+      {
+      *state->Log << "ack," << now << "," << matrix[0][3] << ","
+                  << matrix[1][3] << "," << matrix[2][3] << "\n";
+      }
+    state->Lock->Unlock();
+    }
+
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+//----------------------------------------------------------------------------
+double Percentile(std::vector<double> values, double percentile)
+{
+  if (values.empty())
+    {
+    return 0.0;
+    }
+  std::sort(values.begin(), values.end());
+  size_t index = static_cast<size_t>(percentile / 100.0 * (values.size() - 1) + 0.5);
+  return values[index];
+}
+
+}
+
+//----------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+  ReplayOptions options;
+  if (!ParseArguments(argc, argv, options))
+    {
+    std::cerr << "Usage: " << argv[0] << " [--host name] [--port n] [--server]"
+              << " [--frames n] [--size WxHxD] [--noise sigma] [--period s]"
+              << " [--speed x] [--max-rate] [--drain s] [--log file]"
+              << " [session.rtlog | frame1.vti ...]" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // Connect
+  igtl::ServerSocket::Pointer serverSocket;
+  igtl::ClientSocket::Pointer socket;
+  if (options.Server)
+    {
+    serverSocket = igtl::ServerSocket::New();
+    if (serverSocket->CreateServer(options.Port) < 0)
+      {
+      std::cerr << "Cannot listen on port " << options.Port << std::endl;
+      return EXIT_FAILURE;
+      }
+    std::cout << "Waiting for the module on port " << options.Port << "..." << std::endl;
+    while (!socket.IsNotNull())
+      {
+      socket = serverSocket->WaitForConnection(1000);
+      }
+    }
+  else
+    {
+    socket = igtl::ClientSocket::New();
+    if (socket->ConnectToServer(options.Host.c_str(), options.Port) != 0)
+      {
+      std::cerr << "Cannot connect to " << options.Host << ":" << options.Port << std::endl;
+      return EXIT_FAILURE;
+      }
+    }
+  socket->SetReceiveTimeout(100);
+
+  std::ofstream log;
+  if (!options.Log.empty())
+    {
+    log.open(options.Log.c_str());
+    log << "event,time,value1,value2,value3\n";
+    }
+
+  vtkNew<vtkMutexLock> lock;
+  ReplayState state;
+  state.Socket = socket.GetPointer();
+  state.Lock = lock.GetPointer();
+  state.Stop = false;
+  state.AcksReceived = 0;
+  state.LastAckTime = 0.0;
+  state.ProcessedFrames = 0.0;
+  state.ReceivedFrames = 0.0;
+  state.ModuleLatency = 0.0;
+  state.Log = log.is_open() ? &log : NULL;
+  state.AcksLost = false;
+
+  vtkNew<vtkMultiThreader> threader;
+  int receiverID = threader->SpawnThread(ReceiveAcknowledgments, &state);
+
+  // Frame sources
+  vtkNew<vtkSlicerRTThermometrySyntheticPhaseSource> source;
+  source->SetDimensions(options.Dimensions);
+  source->SetNoiseStandardDeviation(options.Noise);
+  vtkNew<vtkXMLImageDataReader> reader;
+  vtkNew<vtkSlicerRTThermometrySessionReader> sessionReader;
+  vtkNew<vtkImageData> frameBuffer;
+
+  bool session = options.Files.size() == 1 && options.Files[0].size() > 6 &&
+    options.Files[0].compare(options.Files[0].size() - 6, 6, ".rtlog") == 0;
+  if (session && !sessionReader->Open(options.Files[0].c_str()))
+    {
+    return EXIT_FAILURE;
+    }
+
+  int numberOfFrames = options.Frames;
+  if (session)
+    {
+    numberOfFrames = static_cast<int>(sessionReader->GetNumberOfFrames());
+    }
+  else if (!options.Files.empty())
+    {
+    numberOfFrames = static_cast<int>(options.Files.size());
+    }
+  double period = options.MaxRate ? 0.0 : options.Period / options.Speed;
+
+  igtl::ImageMessage::Pointer message = igtl::ImageMessage::New();
+  double start = vtkTimerLog::GetUniversalTime();
+  int sent = 0;
+  for (int frame = 0; frame < numberOfFrames; ++frame)
+    {
+    vtkImageData* image = NULL;
+    double due = start + frame * period;
+    if (session)
+      {
+      if (sessionReader->ReadFrame(frame, frameBuffer.GetPointer()))
+        {
+        image = frameBuffer.GetPointer();
+        }
+      if (!options.MaxRate)
+        {
+        due = start + (sessionReader->GetTimestamp(frame) -
+                       sessionReader->GetTimestamp(0)) / options.Speed;
+        }
+      }
+    else if (options.Files.empty())
+      {
+      source->GenerateNextFrame(frameBuffer.GetPointer());
+      image = frameBuffer.GetPointer();
+      }
+    else
+      {
+      reader->SetFileName(options.Files[frame].c_str());
+      reader->Update();
+      image = reader->GetOutput();
+      }
+
+    if (!image || !PackImage(image, message))
+      {
+      break;
+      }
+
+    // Wait for the frame slot
+    double now = vtkTimerLog::GetUniversalTime();
+    if (due > now)
+      {
+      igtl::Sleep(static_cast<int>((due - now) * 1000.0));
+      }
+
+    if (socket->Send(message->GetPackPointer(), message->GetPackSize()) == 0)
+      {
+      std::cerr << "Connection lost after " << sent << " frames" << std::endl;
+      break;
+      }
+    ++sent;
+
+    double sendTime = vtkTimerLog::GetUniversalTime();
+    lock->Lock();
+    state.SendTimes.push_back(sendTime);
+    if (state.Log)
+      {
+      log << "sent," << sendTime << "," << frame << ",,\n";
+      }
+    lock->Unlock();
+    }
+  double sendDuration = vtkTimerLog::GetUniversalTime() - start;
+
+  // Let the module finish its backlog
+  igtl::Sleep(static_cast<int>(options.Drain * 1000.0));
+  lock->Lock();
+  state.Stop = true;
+  lock->Unlock();
+  threader->TerminateThread(receiverID);
+  socket->CloseSocket();
+
+  // Report
+  double processed = state.ProcessedFrames;
+  std::cout << "frames_sent," << sent << "\n"
+            << "send_duration_s," << sendDuration << "\n"
+            << "send_rate_hz," << (sendDuration > 0.0 ? sent / sendDuration : 0.0) << "\n"
+            << "acks_received," << state.AcksReceived << "\n"
+            << "module_frames_received," << state.ReceivedFrames << "\n"
+            << "module_frames_processed," << processed << "\n"
+            << "kept_up_percent," << (sent > 0 ? 100.0 * state.AcksReceived / sent : 0.0) << "\n"
+            << "module_last_frame_latency_ms," << state.ModuleLatency << "\n"
+            << "ack_delay_p50_ms," << Percentile(state.AckDelays, 50.0) * 1000.0 << "\n"
+            << "ack_delay_p95_ms," << Percentile(state.AckDelays, 95.0) * 1000.0 << "\n"
+            << "ack_delay_max_ms," << Percentile(state.AckDelays, 100.0) * 1000.0 << std::endl;
+
+  if (state.AcksLost)
+    {
+    std::cerr << "The acknowledgment stream was cut within a message, later "
+              << "acknowledgments were not read." << std::endl;
+    }
+  if (state.AcksReceived == 0)
+    {
+    std::cerr << "No acknowledgment received. Enable \"Send frame acknowledgments\" "
+              << "in the module Diagnostics panel and set a baseline." << std::endl;
+    }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,237 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// Batch reprocessing of recorded thermometry sessions.
+//
+// Every session log (.rtlog) is reprocessed with the given parameters. One
+// line is written per frame with the maximum and mean temperature, followed
+// by one summary line per session with the processing speed relative to the
+// recorded duration.
+//
+// Usage: RTThermometryReprocess [options] session1.rtlog [session2.rtlog ...]
+//   --echo-time <s>          Echo time (0.01 by default)
+//   --field <T>              Magnetic field (3.0 by default)
+//   --gyromagnetic <MHz/T>   Gyromagnetic ratio (42.576 by default)
+//   --coefficient <ppm/C>    Thermal coefficient (-0.01 by default)
+//   --scale <n>              Phase scale factor (4096 by default)
+//   --base <C>               Base temperature (37 by default)
+//   --threads <n>            Number of threads (all cores by default)
+//   --output <file>          Output file (standard output by default)
+
+// RTThermometry includes
+#include "vtkSlicerRTThermometryLogic.h"
+#include "vtkSlicerRTThermometrySessionReader.h"
+
+// VTK includes
+#include <vtkImageData.h>
+#include <vtkMultiThreader.h>
+#include <vtkNew.h>
+#include <vtkTimerLog.h>
+
+// STD includes
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+//----------------------------------------------------------------------------
+struct ReprocessOptions
+{
+  double EchoTime;
+  double MagneticField;
+  double GyromagneticRatio;
+  double ThermalCoefficient;
+  double ScaleFactor;
+  double BaseTemperature;
+  int Threads;
+  std::string Output;
+  std::vector<std::string> Sessions;
+};
+
+//----------------------------------------------------------------------------
+bool ParseArguments(int argc, char* argv[], ReprocessOptions& options)
+{
+  options.EchoTime = 0.01;
+  options.MagneticField = 3.0;
+  options.GyromagneticRatio = 42.576;
+  options.ThermalCoefficient = -0.01;
+  options.ScaleFactor = 4096.0;
+  options.BaseTemperature = 37.0;
+  options.Threads = vtkMultiThreader::GetGlobalDefaultNumberOfThreads();
+
+  for (int i = 1; i < argc; ++i)
+    {
+    std::string arg(argv[i]);
+    bool hasValue = (i + 1 < argc);
+    if (arg == "--echo-time" && hasValue)
+      {
+      options.EchoTime = atof(argv[++i]);
+      }
+    else if (arg == "--field" && hasValue)
+      {
+      options.MagneticField = atof(argv[++i]);
+      }
+    else if (arg == "--gyromagnetic" && hasValue)
+      {
+      options.GyromagneticRatio = atof(argv[++i]);
+      }
+    else if (arg == "--coefficient" && hasValue)
+      {
+      options.ThermalCoefficient = atof(argv[++i]);
+      }
+    else if (arg == "--scale" && hasValue)
+      {
+      options.ScaleFactor = atof(argv[++i]);
+      }
+    else if (arg == "--base" && hasValue)
+      {
+      options.BaseTemperature = atof(argv[++i]);
+      }
+    else if (arg == "--threads" && hasValue)
+      {
+      options.Threads = atoi(argv[++i]);
+      }
+    else if (arg == "--output" && hasValue)
+      {
+      options.Output = argv[++i];
+      }
+    else if (arg.compare(0, 2, "--") == 0)
+      {
+      std::cerr << "Unknown or incomplete argument: " << arg << std::endl;
+      return false;
+      }
+    else
+      {
+      options.Sessions.push_back(arg);
+      }
+    }
+
+  return !options.Sessions.empty();
+}
+
+//----------------------------------------------------------------------------
+template <class Real>
+void GetTemperatureStatistics(const Real* temperature, vtkIdType numberOfVoxels,
+                              double& maximum, double& mean)
+{
+  maximum = temperature[0];
+  double sum = 0.0;
+  for (vtkIdType i = 0; i < numberOfVoxels; ++i)
+    {
+    maximum = temperature[i] > maximum ? temperature[i] : maximum;
+    sum += temperature[i];
+    }
+  mean = sum / numberOfVoxels;
+}
+
+//----------------------------------------------------------------------------
+void GetTemperatureStatistics(vtkImageData* image, double& maximum, double& mean)
+{
+  // Temperature images are float or double, depending on the precision
+  if (image->GetScalarType() == VTK_FLOAT)
+    {
+    GetTemperatureStatistics(static_cast<const float*>(image->GetScalarPointer()),
+                             image->GetNumberOfPoints(), maximum, mean);
+    }
+  else
+    {
+    GetTemperatureStatistics(static_cast<const double*>(image->GetScalarPointer()),
+                             image->GetNumberOfPoints(), maximum, mean);
+    }
+}
+
+}
+
+//----------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+  ReprocessOptions options;
+  if (!ParseArguments(argc, argv, options))
+    {
+    std::cerr << "Usage: " << argv[0] << " [--echo-time s] [--field T]"
+              << " [--gyromagnetic MHz/T] [--coefficient ppm/C] [--scale n]"
+              << " [--base C] [--threads n] [--output file]"
+              << " session1.rtlog [session2.rtlog ...]" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  std::ofstream file;
+  if (!options.Output.empty())
+    {
+    file.open(options.Output.c_str());
+    if (!file.is_open())
+      {
+      std::cerr << "Cannot open " << options.Output << std::endl;
+      return EXIT_FAILURE;
+      }
+    }
+  std::ostream& os = file.is_open() ? file : std::cout;
+
+  vtkNew<vtkSlicerRTThermometryLogic> logic;
+  logic->SetEchoTime(options.EchoTime);
+  logic->SetMagneticField(options.MagneticField);
+  logic->SetGyromagneticRatio(options.GyromagneticRatio);
+  logic->SetThermalCoefficient(options.ThermalCoefficient);
+  logic->SetScaleFactor(options.ScaleFactor);
+  logic->SetBaseTemperature(options.BaseTemperature);
+  logic->SetNumberOfThreads(options.Threads);
+
+  int status = EXIT_SUCCESS;
+  os << "session,frame,timestamp,max_temperature,mean_temperature\n";
+  for (size_t s = 0; s < options.Sessions.size(); ++s)
+    {
+    const std::string& session = options.Sessions[s];
+    vtkNew<vtkSlicerRTThermometrySessionReader> reader;
+    if (!reader->Open(session.c_str()))
+      {
+      status = EXIT_FAILURE;
+      continue;
+      }
+
+    double start = vtkTimerLog::GetUniversalTime();
+    if (!logic->ReprocessSession(reader.GetPointer()))
+      {
+      status = EXIT_FAILURE;
+      continue;
+      }
+    double elapsed = vtkTimerLog::GetUniversalTime() - start;
+
+    for (int frame = 0; frame < logic->GetNumberOfTemperatureImages(); ++frame)
+      {
+      double maximum, mean;
+      GetTemperatureStatistics(logic->GetTemperatureImage(frame), maximum, mean);
+      os << session << "," << frame + 1 << "," << reader->GetTimestamp(frame + 1)
+         << "," << maximum << "," << mean << "\n";
+      }
+
+    vtkIdType numberOfFrames = reader->GetNumberOfFrames();
+    double duration = reader->GetTimestamp(numberOfFrames - 1) - reader->GetTimestamp(0);
+    std::cerr << session << ": " << numberOfFrames << " frames in "
+              << elapsed * 1000.0 << " ms";
+    if (elapsed > 0.0 && duration > 0.0)
+      {
+      std::cerr << " (" << duration / elapsed << "x real time)";
+      }
+    std::cerr << std::endl;
+    }
+
+  return status;
+}
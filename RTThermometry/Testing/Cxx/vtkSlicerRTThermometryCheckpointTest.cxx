@@ -0,0 +1,355 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// Checkpoint test: a session resumed from a checkpoint continues exactly as
+// the uninterrupted session (temperature, temporal filter, derived maps,
+// frame rejection and protection zones), and corrupted or inconsistent
+// checkpoints are refused without changing the session. The checkpoint is
+// written to the directory given as argument.
+
+// RTThermometry includes
+#include "vtkSlicerRTThermometryCheckpointWriter.h"
+#include "vtkSlicerRTThermometryLogic.h"
+#include "vtkSlicerRTThermometrySyntheticPhaseSource.h"
+
+// VTK includes
+#include <vtkDataArray.h>
+#include <vtkImageData.h>
+#include <vtkNew.h>
+#include <vtkPointData.h>
+#include <vtkTimerLog.h>
+
+// STD includes
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+const int Dimensions[3] = { 32, 32, 4 };
+const double FrameInterval = 0.5;
+
+// Offset of the temporal filter in the payload, after seven doubles and the
+// temperature scalar type (see vtkSlicerRTThermometryLogic::WriteCheckpoint())
+const size_t TemporalFilterOffset = 7 * sizeof(double) + sizeof(int);
+
+//----------------------------------------------------------------------------
+void SetupLogic(vtkSlicerRTThermometryLogic* logic)
+{
+  logic->SetEchoTime(0.01);
+  logic->SetMagneticField(3.0);
+  logic->SetGyromagneticRatio(42.576);
+  logic->SetThermalCoefficient(-0.01);
+  logic->SetScaleFactor(4096.0);
+  logic->SetBaseTemperature(37.0);
+  logic->SetNumberOfThreads(2);
+  logic->SetTemporalFilter(vtkSlicerRTThermometryLogic::KalmanFilter);
+  logic->SetRejectionThreshold(4.0);
+  logic->SetDerivedMapEnabled(vtkSlicerRTThermometryLogic::MaximumTemperatureMap, true);
+  logic->SetDerivedMapEnabled(vtkSlicerRTThermometryLogic::ThermalDoseMap, true);
+
+  const int zoneExtent[6] = { 14, 17, 14, 17, 1, 2 };
+  logic->AddProtectionZoneFromExtent(Dimensions, zoneExtent, 40.0, "Nerve");
+  const double sensor[3] = { 1.5, -2.0, 10.25 };
+  logic->AddCheckpointSensor("Tip", sensor);
+}
+
+//----------------------------------------------------------------------------
+bool CompareImages(vtkImageData* image, vtkImageData* expected, const char* what)
+{
+  if (!image || !expected || image->GetNumberOfPoints() != expected->GetNumberOfPoints())
+    {
+    std::cerr << what << ": missing image or size mismatch" << std::endl;
+    return false;
+    }
+  vtkDataArray* values = image->GetPointData()->GetScalars();
+  vtkDataArray* expectedValues = expected->GetPointData()->GetScalars();
+  for (vtkIdType i = 0; i < image->GetNumberOfPoints(); ++i)
+    {
+    if (values->GetComponent(i, 0) != expectedValues->GetComponent(i, 0))
+      {
+      std::cerr << what << ": voxel " << i << " is " << values->GetComponent(i, 0)
+                << ", expected " << expectedValues->GetComponent(i, 0) << std::endl;
+      return false;
+      }
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+// The resumed logic matches the uninterrupted one after the same frame
+bool CompareLogics(vtkSlicerRTThermometryLogic* resumed, vtkSlicerRTThermometryLogic* expected)
+{
+  bool same =
+    CompareImages(resumed->GetLastTemperatureImage(), expected->GetLastTemperatureImage(),
+                  "temperature") &&
+    CompareImages(resumed->GetDerivedMap(vtkSlicerRTThermometryLogic::MaximumTemperatureMap),
+                  expected->GetDerivedMap(vtkSlicerRTThermometryLogic::MaximumTemperatureMap),
+                  "maximum temperature") &&
+    CompareImages(resumed->GetDerivedMap(vtkSlicerRTThermometryLogic::ThermalDoseMap),
+                  expected->GetDerivedMap(vtkSlicerRTThermometryLogic::ThermalDoseMap),
+                  "thermal dose");
+  if (same && (resumed->GetNumberOfAblatedVoxels() != expected->GetNumberOfAblatedVoxels() ||
+               resumed->GetNumberOfRejectedFrames() != expected->GetNumberOfRejectedFrames() ||
+               resumed->GetProtectionZoneMaximum(0) != expected->GetProtectionZoneMaximum(0) ||
+               resumed->IsProtectionZoneInAlarm(0) != expected->IsProtectionZoneInAlarm(0)))
+    {
+    std::cerr << "ablation, rejection or protection zone state differs" << std::endl;
+    same = false;
+    }
+  return same;
+}
+
+//----------------------------------------------------------------------------
+// Write payload as a checkpoint with a valid header and checksum, so that
+// only the logic can refuse it
+bool WriteTamperedCheckpoint(const std::string& fileName, const std::vector<char>& payload)
+{
+  vtkTypeUInt32 a = 1;
+  vtkTypeUInt32 b = 0;
+  for (size_t i = 0; i < payload.size(); ++i)
+    {
+    a = (a + static_cast<unsigned char>(payload[i])) % 65521;
+    b = (b + a) % 65521;
+    }
+
+  vtkSlicerRTThermometryCheckpointWriter::Header header;
+  memcpy(header.Magic, vtkSlicerRTThermometryCheckpointWriter::FileMagic, 8);
+  header.Version = vtkSlicerRTThermometryCheckpointWriter::CheckpointVersion;
+  header.Checksum = (b << 16) | a;
+  header.PayloadSize = payload.size();
+  header.Timestamp = 0.0;
+  std::ofstream file(fileName.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  file.write(&payload[0], static_cast<std::streamsize>(payload.size()));
+  file.close();
+  return !file.fail();
+}
+
+//----------------------------------------------------------------------------
+// A tampered checkpoint that passes the checksum is refused, and the
+// session of the logic is left as it was
+bool CheckTamperedCheckpoint(const std::string& fileName, const std::vector<char>& payload,
+                             vtkSlicerRTThermometryLogic* resumed,
+                             vtkSlicerRTThermometryLogic* expected, const char* what)
+{
+  std::vector<char> checked;
+  if (!WriteTamperedCheckpoint(fileName, payload) ||
+      !vtkSlicerRTThermometryCheckpointWriter::ReadCheckpoint(fileName.c_str(), checked))
+    {
+    std::cerr << what << ": cannot write a checkpoint with a valid checksum" << std::endl;
+    return false;
+    }
+  int numberOfTemperatureImages = resumed->GetNumberOfTemperatureImages();
+  if (resumed->ResumeFromCheckpoint(fileName.c_str()))
+    {
+    std::cerr << what << ": the checkpoint was accepted" << std::endl;
+    return false;
+    }
+  if (!resumed->HasBaseline() ||
+      resumed->GetTemporalFilter() != expected->GetTemporalFilter() ||
+      resumed->GetNumberOfTemperatureImages() != numberOfTemperatureImages ||
+      !CompareLogics(resumed, expected))
+    {
+    std::cerr << what << ": the session was changed by a refused checkpoint" << std::endl;
+    return false;
+    }
+  return true;
+}
+
+} // end of anonymous namespace
+
+//----------------------------------------------------------------------------
+int vtkSlicerRTThermometryCheckpointTest(int argc, char* argv[])
+{
+  std::string fileName =
+    std::string(argc > 1 ? argv[1] : ".") + "/vtkSlicerRTThermometryCheckpointTest.rtckp";
+
+  vtkNew<vtkSlicerRTThermometrySyntheticPhaseSource> source;
+  source->SetDimensions(Dimensions[0], Dimensions[1], Dimensions[2]);
+  source->SetScalarType(VTK_SHORT);
+  source->SetHeatingPattern(vtkSlicerRTThermometrySyntheticPhaseSource::GaussianHeating);
+  source->SetNoiseStandardDeviation(5.0);
+  source->Reset();
+
+  vtkNew<vtkSlicerRTThermometryLogic> logic;
+  SetupLogic(logic.GetPointer());
+  logic->SetCheckpointInterval(4);
+  vtkSlicerRTThermometryCheckpointWriter* writer = logic->GetCheckpointWriter();
+  if (!writer->Open(fileName.c_str()))
+    {
+    std::cerr << "Cannot open the checkpoint writer" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  vtkNew<vtkImageData> phase;
+  const int checkpointFrame = 12;
+  for (int frame = 0; frame <= checkpointFrame; ++frame)
+    {
+    source->GenerateNextFrame(phase.GetPointer());
+    logic->ProcessPhaseImage(phase.GetPointer(), frame * FrameInterval);
+    }
+  writer->Close();
+  if (writer->GetNumberOfCheckpoints() == 0)
+    {
+    std::cerr << "No periodic checkpoint was written" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // Checkpoint of the last frame: the writer is idle after Open()
+  writer->Open(fileName.c_str());
+  bool saved = logic->SaveCheckpoint();
+  writer->Close();
+  if (!saved || writer->GetNumberOfCheckpoints() != 1 ||
+      writer->GetLastCheckpointTime() != checkpointFrame * FrameInterval)
+    {
+    std::cerr << "Checkpoint of frame " << checkpointFrame << " was not written" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  vtkNew<vtkSlicerRTThermometryLogic> resumed;
+  resumed->SetNumberOfThreads(2);
+  double start = vtkTimerLog::GetUniversalTime();
+  if (!resumed->ResumeFromCheckpoint(fileName.c_str()))
+    {
+    std::cerr << "Cannot resume from " << fileName << std::endl;
+    return EXIT_FAILURE;
+    }
+  double resumeTime = vtkTimerLog::GetUniversalTime() - start;
+  std::cout << "Resumed in " << resumeTime * 1000.0 << " ms" << std::endl;
+  if (resumeTime > 1.0)
+    {
+    std::cerr << "Resume took more than a second" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  double sensor[3];
+  if (!resumed->HasBaseline() ||
+      resumed->GetNumberOfTemperatureImages() != 1 ||
+      resumed->GetPhaseToTemperatureFactor() != logic->GetPhaseToTemperatureFactor() ||
+      resumed->GetTemporalFilter() != vtkSlicerRTThermometryLogic::KalmanFilter ||
+      resumed->GetNumberOfProtectionZones() != 1 ||
+      std::string(resumed->GetProtectionZoneName(0)) != "Nerve" ||
+      resumed->GetNumberOfProtectionZoneVoxels(0) != logic->GetNumberOfProtectionZoneVoxels(0) ||
+      resumed->GetNumberOfCheckpointSensors() != 1 ||
+      std::string(resumed->GetCheckpointSensorName(0)) != "Tip" ||
+      !resumed->GetCheckpointSensorPosition(0, sensor) || sensor[2] != 10.25)
+    {
+    std::cerr << "Parameters, zones or sensors were not restored" << std::endl;
+    return EXIT_FAILURE;
+    }
+  if (!CompareLogics(resumed.GetPointer(), logic.GetPointer()))
+    {
+    std::cerr << "  after resuming" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // Both sessions continue identically
+  for (int frame = checkpointFrame + 1; frame < checkpointFrame + 12; ++frame)
+    {
+    source->GenerateNextFrame(phase.GetPointer());
+    logic->ProcessPhaseImage(phase.GetPointer(), frame * FrameInterval);
+    resumed->ProcessPhaseImage(phase.GetPointer(), frame * FrameInterval);
+    if (!CompareLogics(resumed.GetPointer(), logic.GetPointer()))
+      {
+      std::cerr << "  at frame " << frame << std::endl;
+      return EXIT_FAILURE;
+      }
+    }
+
+  // Checkpoints with a valid checksum but inconsistent content are refused
+  // before any of them is restored: an out-of-range temporal filter, and a
+  // processing extent that does not match the saved images
+  std::vector<char> payload;
+  if (!vtkSlicerRTThermometryCheckpointWriter::ReadCheckpoint(fileName.c_str(), payload))
+    {
+    std::cerr << "Cannot read " << fileName << std::endl;
+    return EXIT_FAILURE;
+    }
+  std::string tamperedFileName = fileName + ".tampered";
+  std::vector<char> tampered(payload);
+  const int invalidFilter = 7;
+  memcpy(&tampered[TemporalFilterOffset], &invalidFilter, sizeof(int));
+  bool refused = CheckTamperedCheckpoint(tamperedFileName, tampered, resumed.GetPointer(),
+                                         logic.GetPointer(), "out-of-range temporal filter");
+
+  // The processing extent is followed by the acquisition dimensions
+  const int geometry[9] = { 0, Dimensions[0] - 1, 0, Dimensions[1] - 1, 0, Dimensions[2] - 1,
+                            Dimensions[0], Dimensions[1], Dimensions[2] };
+  std::vector<char>::iterator extent =
+    std::search(payload.begin(), payload.end(), reinterpret_cast<const char*>(geometry),
+                reinterpret_cast<const char*>(geometry) + sizeof(geometry));
+  if (refused && extent == payload.end())
+    {
+    std::cerr << "Processing extent not found in the checkpoint" << std::endl;
+    refused = false;
+    }
+  if (refused)
+    {
+    tampered = payload;
+    const int narrowerExtent = Dimensions[0] - 2;
+    memcpy(&tampered[(extent - payload.begin()) + sizeof(int)], &narrowerExtent, sizeof(int));
+    refused = CheckTamperedCheckpoint(tamperedFileName, tampered, resumed.GetPointer(),
+                                      logic.GetPointer(), "mismatched processing extent");
+    }
+  remove(tamperedFileName.c_str());
+  if (!refused)
+    {
+    return EXIT_FAILURE;
+    }
+
+  // A write interrupted before replacing the checkpoint leaves the new one
+  // in the temporary file only, which is read instead
+  std::string temporaryFileName = fileName + ".tmp";
+  std::vector<char> recovered;
+  bool recoveredFromTemporary =
+    rename(fileName.c_str(), temporaryFileName.c_str()) == 0 &&
+    vtkSlicerRTThermometryCheckpointWriter::ReadCheckpoint(fileName.c_str(), recovered) &&
+    recovered == payload;
+  rename(temporaryFileName.c_str(), fileName.c_str());
+  if (!recoveredFromTemporary)
+    {
+    std::cerr << "The temporary checkpoint was not read" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // A corrupted checkpoint is refused and leaves no baseline
+  {
+  std::fstream file(fileName.c_str(), std::ios::in | std::ios::out | std::ios::binary);
+  char last = 0;
+  file.seekg(-1, std::ios::end);
+  file.get(last);
+  file.seekp(-1, std::ios::end);
+  file.put(static_cast<char>(last ^ 0x5a));
+  }
+  vtkNew<vtkSlicerRTThermometryLogic> corrupted;
+  bool resumedCorrupted = corrupted->ResumeFromCheckpoint(fileName.c_str());
+  remove(fileName.c_str());
+  if (resumedCorrupted || corrupted->HasBaseline())
+    {
+    std::cerr << "A corrupted checkpoint was accepted" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,230 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// Per-frame latency test of the thermometry pipeline on a synthetic
+// volume. Frames are processed as in the module (profiled frame, phase
+// kernel and sensor sampling) and the test fails when a percentile of a
+// stage exceeds its budget.
+//
+// Arguments:
+//   --size 128x128x16           Image dimensions
+//   --frames <n>                Number of timed frames (40 by default)
+//   --threads <n>               Threads of the phase kernel (default of
+//                               vtkMultiThreader)
+//   --percentile <p>            Percentile compared to the budgets (95)
+//   --budget <Stage>=<ms>       Budget of a profiler stage, repeatable
+//                               (PhaseKernel=25 and FrameTotal=50 if none)
+
+// RTThermometry includes
+#include "vtkSlicerRTThermometryLogic.h"
+#include "vtkSlicerRTThermometryProfiler.h"
+#include "vtkSlicerRTThermometrySyntheticPhaseSource.h"
+
+// VTK includes
+#include <vtkImageData.h>
+#include <vtkMultiThreader.h>
+#include <vtkNew.h>
+
+// STD includes
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+//----------------------------------------------------------------------------
+struct LatencyBudget
+{
+  int    Stage;
+  double Milliseconds;
+};
+
+//----------------------------------------------------------------------------
+int StageFromName(const std::string& name)
+{
+  for (int stage = 0; stage < vtkSlicerRTThermometryProfiler::NumberOfStages; ++stage)
+    {
+    if (name == vtkSlicerRTThermometryProfiler::GetStageName(stage))
+      {
+      return stage;
+      }
+    }
+  return -1;
+}
+
+//----------------------------------------------------------------------------
+bool AddBudget(const std::string& argument, std::vector<LatencyBudget>& budgets)
+{
+  std::string::size_type separator = argument.find('=');
+  if (separator == std::string::npos)
+    {
+    return false;
+    }
+  LatencyBudget budget;
+  budget.Stage = StageFromName(argument.substr(0, separator));
+  budget.Milliseconds = atof(argument.substr(separator + 1).c_str());
+  if (budget.Stage < 0 || budget.Milliseconds <= 0.0)
+    {
+    return false;
+    }
+  budgets.push_back(budget);
+  return true;
+}
+
+} // end of anonymous namespace
+
+//----------------------------------------------------------------------------
+int vtkSlicerRTThermometryLatencyTest(int argc, char* argv[])
+{
+  int dimensions[3] = { 128, 128, 16 };
+  int frames = 40;
+  int threads = vtkMultiThreader::GetGlobalDefaultNumberOfThreads();
+  double percentile = 95.0;
+  std::vector<LatencyBudget> budgets;
+
+  for (int i = 1; i < argc; ++i)
+    {
+    std::string arg(argv[i]);
+    bool hasValue = (i + 1 < argc);
+    if (arg == "--size" && hasValue)
+      {
+      dimensions[2] = 1;
+      if (sscanf(argv[++i], "%dx%dx%d", &dimensions[0], &dimensions[1], &dimensions[2]) < 2)
+        {
+        std::cerr << "Invalid size: " << argv[i] << std::endl;
+        return EXIT_FAILURE;
+        }
+      }
+    else if (arg == "--frames" && hasValue)
+      {
+      frames = atoi(argv[++i]);
+      }
+    else if (arg == "--threads" && hasValue)
+      {
+      threads = atoi(argv[++i]);
+      }
+    else if (arg == "--percentile" && hasValue)
+      {
+      percentile = atof(argv[++i]);
+      }
+    else if (arg == "--budget" && hasValue)
+      {
+      if (!AddBudget(argv[++i], budgets))
+        {
+        std::cerr << "Invalid budget: " << argv[i] << std::endl;
+        return EXIT_FAILURE;
+        }
+      }
+    else
+      {
+      std::cerr << "Unknown or incomplete argument: " << arg << std::endl;
+      return EXIT_FAILURE;
+      }
+    }
+  if (budgets.empty())
+    {
+    AddBudget("PhaseKernel=25", budgets);
+    AddBudget("FrameTotal=50", budgets);
+    }
+  if (frames <= 0 || dimensions[0] <= 0 || dimensions[1] <= 0 || dimensions[2] <= 0)
+    {
+    std::cerr << "Invalid size or number of frames" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  vtkNew<vtkSlicerRTThermometrySyntheticPhaseSource> source;
+  source->SetDimensions(dimensions);
+  source->SetScalarType(VTK_SHORT);
+  source->SetHeatingPattern(vtkSlicerRTThermometrySyntheticPhaseSource::GaussianHeating);
+  source->SetNoiseStandardDeviation(10.0);
+  source->Reset();
+
+  vtkNew<vtkSlicerRTThermometryLogic> logic;
+  logic->SetEchoTime(0.01);
+  logic->SetMagneticField(3.0);
+  logic->SetGyromagneticRatio(42.576);
+  logic->SetThermalCoefficient(-0.01);
+  logic->SetScaleFactor(4096.0);
+  logic->SetBaseTemperature(37.0);
+  logic->SetNumberOfThreads(threads);
+
+  // Sensors spread along the diagonal of the volume
+  const int numberOfSensors = 8;
+  double positions[numberOfSensors][3];
+  for (int sensor = 0; sensor < numberOfSensors; ++sensor)
+    {
+    double t = (sensor + 0.5) / numberOfSensors;
+    for (int axis = 0; axis < 3; ++axis)
+      {
+      positions[sensor][axis] = t * (dimensions[axis] - 1);
+      }
+    }
+
+  // The baseline and the first frames (allocations, conversion
+  // calibration) are not timed
+  const int warmUpFrames = 8;
+  vtkSlicerRTThermometryProfiler* profiler = logic->GetProfiler();
+  vtkNew<vtkImageData> phase;
+  double sum = 0.0;
+  for (int frame = 0; frame < warmUpFrames + frames; ++frame)
+    {
+    if (frame == warmUpFrames)
+      {
+      profiler->Reset();
+      }
+    source->GenerateNextFrame(phase.GetPointer());
+    profiler->StartFrame();
+    logic->ProcessPhaseImage(phase.GetPointer(), frame);
+    profiler->StartStage(vtkSlicerRTThermometryProfiler::SensorSampling);
+    for (int sensor = 0; sensor < numberOfSensors; ++sensor)
+      {
+      sum += logic->GetTemperatureAtIJK(positions[sensor]);
+      }
+    profiler->StopStage(vtkSlicerRTThermometryProfiler::SensorSampling);
+    profiler->EndFrame();
+    }
+  if (logic->GetNumberOfTemperatureImages() == 0)
+    {
+    std::cerr << "No temperature was produced" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  std::cout << dimensions[0] << "x" << dimensions[1] << "x" << dimensions[2]
+            << ", " << threads << " threads, " << frames << " frames, mean sensor temperature "
+            << sum / ((warmUpFrames + frames) * numberOfSensors) << std::endl;
+  bool success = true;
+  for (size_t i = 0; i < budgets.size(); ++i)
+    {
+    const LatencyBudget& budget = budgets[i];
+    const char* name = vtkSlicerRTThermometryProfiler::GetStageName(budget.Stage);
+    if (profiler->GetNumberOfSamples(budget.Stage) == 0)
+      {
+      std::cerr << name << ": no sample recorded" << std::endl;
+      success = false;
+      continue;
+      }
+    double latency = profiler->GetPercentile(budget.Stage, percentile) * 1000.0;
+    bool withinBudget = latency <= budget.Milliseconds;
+    std::cout << name << ": p" << percentile << " " << latency << " ms (budget "
+              << budget.Milliseconds << " ms)" << (withinBudget ? "" : " EXCEEDED") << std::endl;
+    success = success && withinBudget;
+    }
+  return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
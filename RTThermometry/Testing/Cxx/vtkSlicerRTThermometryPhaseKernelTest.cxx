@@ -0,0 +1,716 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// Regression test of the phase kernel and of the sensor path: temperatures
+// computed from known phase inputs are compared to reference values, for
+// every phase scalar type, both conversions and both temperature
+// precisions, including phase wraps and overflows of the integer
+// accumulated phase.
+
+// RTThermometry includes
+#include "vtkSlicerRTThermometryLogic.h"
+
+// VTK includes
+#include <vtkCallbackCommand.h>
+#include <vtkDataArray.h>
+#include <vtkImageData.h>
+#include <vtkNew.h>
+#include <vtkPointData.h>
+#include <vtkVersion.h>
+
+// STD includes
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+namespace
+{
+
+//----------------------------------------------------------------------------
+// Parameters of SetupLogic(): pi / 4096 / (0.01 * 2 pi * 42.576 * 3 * -0.01)
+const double ReferenceFactor = -0.009557051899348613;
+const double ReferenceBaseTemperature = 37.0;
+
+// One frame accumulated from a zero phase. Integer differences are signed
+// and wrap: the difference of two phases across the wrap is the short way
+// around, also for unsigned phase. Accumulated is the signed phase, stored
+// in the unsigned images as the signed type of the same width.
+struct PhaseKernelCase
+{
+  const char* Name;
+  int         ScalarType;
+  double      Previous;
+  double      Current;
+  double      Accumulated;
+  double      Temperature;
+};
+
+const PhaseKernelCase PhaseKernelCases[] =
+{
+  { "short",                    VTK_SHORT,                0.0,    -1000.0,   -1000.0,  46.557051899348615 },
+  { "short wrap",               VTK_SHORT,            32000.0,   -32000.0,    1536.0,   22.32036828260053 },
+  { "signed char wrap",         VTK_SIGNED_CHAR,        100.0,     -100.0,      56.0,   36.46480509363648 },
+  { "unsigned char",            VTK_UNSIGNED_CHAR,       10.0,      250.0,     -16.0,  37.152912830389575 },
+  { "unsigned char wrap",       VTK_UNSIGNED_CHAR,      250.0,       10.0,      16.0,  36.847087169610425 },
+  { "unsigned char decrease",   VTK_UNSIGNED_CHAR,       20.0,       15.0,      -5.0,   37.04778525949674 },
+  { "unsigned short",           VTK_UNSIGNED_SHORT,     100.0,    65000.0,    -636.0,   43.07828500798572 },
+  { "unsigned short wrap",      VTK_UNSIGNED_SHORT,   65000.0,      100.0,     636.0,   30.92171499201428 },
+  { "unsigned short decrease",  VTK_UNSIGNED_SHORT,    1000.0,      990.0,     -10.0,   37.09557051899348 },
+  { "int",                      VTK_INT,                  0.0,    -1000.0,   -1000.0,  46.557051899348615 },
+  { "float",                    VTK_FLOAT,                0.0,     -300.0,    -300.0,   39.86711556980458 },
+  { "float fraction",           VTK_FLOAT,                0.0,       0.25,      0.25,   36.99761073702516 },
+  { "double",                   VTK_DOUBLE,               0.0,   -12345.5,  -12345.5,   154.9865842234083 }
+};
+
+const int Dimensions[3] = { 5, 4, 3 };
+
+//----------------------------------------------------------------------------
+void SetupLogic(vtkSlicerRTThermometryLogic* logic)
+{
+  logic->SetEchoTime(0.01);
+  logic->SetMagneticField(3.0);
+  logic->SetGyromagneticRatio(42.576);
+  logic->SetThermalCoefficient(-0.01);
+  logic->SetScaleFactor(4096.0);
+  logic->SetBaseTemperature(ReferenceBaseTemperature);
+  logic->SetNumberOfThreads(2);
+}
+
+//----------------------------------------------------------------------------
+void AllocateImage(vtkImageData* image, const int dimensions[3], int scalarType)
+{
+  image->SetDimensions(dimensions[0], dimensions[1], dimensions[2]);
+#if VTK_MAJOR_VERSION <= 5
+  image->SetScalarType(scalarType);
+  image->SetNumberOfScalarComponents(1);
+  image->AllocateScalars();
+#else
+  image->AllocateScalars(scalarType, 1);
+#endif
+}
+
+//----------------------------------------------------------------------------
+template <class T>
+void FillImageExecute(T* voxels, vtkIdType numberOfVoxels, double value)
+{
+  for (vtkIdType i = 0; i < numberOfVoxels; ++i)
+    {
+    voxels[i] = static_cast<T>(value);
+    }
+}
+
+//----------------------------------------------------------------------------
+void FillImage(vtkImageData* image, double value)
+{
+  switch (image->GetScalarType())
+    {
+    vtkTemplateMacro(FillImageExecute(static_cast<VTK_TT*>(image->GetScalarPointer()),
+                                      image->GetNumberOfPoints(), value));
+    }
+}
+
+//----------------------------------------------------------------------------
+bool CheckValue(double value, double expected, const char* what, const char* name,
+                double tolerance = 1e-9)
+{
+  if (std::fabs(value - expected) > tolerance * std::max(1.0, std::fabs(expected)))
+    {
+    std::cerr << name << ": " << what << " is " << value
+              << ", expected " << expected << std::endl;
+    return false;
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+// Every voxel of the image has the expected value
+bool CheckImage(vtkImageData* image, double expected, const char* what, const char* name,
+                double tolerance = 1e-9)
+{
+  for (vtkIdType i = 0; i < image->GetNumberOfPoints(); ++i)
+    {
+    if (!CheckValue(image->GetPointData()->GetScalars()->GetComponent(i, 0), expected, what, name,
+                    tolerance))
+      {
+      return false;
+      }
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+// Accumulated phase of the image, read as the signed type of the phase
+bool CheckAccumulatedImage(vtkImageData* image, double expected, const char* name)
+{
+  double range = 0.0;
+  if (image->GetScalarType() == VTK_UNSIGNED_CHAR)
+    {
+    range = 256.0;
+    }
+  else if (image->GetScalarType() == VTK_UNSIGNED_SHORT)
+    {
+    range = 65536.0;
+    }
+  for (vtkIdType i = 0; i < image->GetNumberOfPoints(); ++i)
+    {
+    double value = image->GetPointData()->GetScalars()->GetComponent(i, 0);
+    if (range > 0.0 && value >= range / 2.0)
+      {
+      value -= range;
+      }
+    if (!CheckValue(value, expected, "accumulated phase", name))
+      {
+      return false;
+      }
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool TestReferenceValues()
+{
+  vtkNew<vtkSlicerRTThermometryLogic> logic;
+  SetupLogic(logic.GetPointer());
+  if (!CheckValue(logic->GetPhaseToTemperatureFactor(), ReferenceFactor, "factor", "parameters"))
+    {
+    return false;
+    }
+
+  const int conversions[2] = { vtkSlicerRTThermometryLogic::ArithmeticConversion,
+                               vtkSlicerRTThermometryLogic::LookupTableConversion };
+  // Single precision temperatures are within a few float roundings
+  const int temperatureTypes[2] = { VTK_DOUBLE, VTK_FLOAT };
+  const double tolerances[2] = { 1e-9, 1e-6 };
+  int numberOfCases = sizeof(PhaseKernelCases) / sizeof(PhaseKernelCases[0]);
+  for (int c = 0; c < numberOfCases; ++c)
+    {
+    const PhaseKernelCase& testCase = PhaseKernelCases[c];
+    for (int run = 0; run < 4; ++run)
+      {
+      int conversion = run % 2;
+      int precision = run / 2;
+      // The table only applies to 8 and 16-bit phase, others fall back to
+      // arithmetic
+      logic->SetConversionMode(conversions[conversion]);
+
+      vtkNew<vtkImageData> previous;
+      vtkNew<vtkImageData> current;
+      vtkNew<vtkImageData> accumulated;
+      vtkNew<vtkImageData> temperature;
+      AllocateImage(previous.GetPointer(), Dimensions, testCase.ScalarType);
+      AllocateImage(current.GetPointer(), Dimensions, testCase.ScalarType);
+      AllocateImage(accumulated.GetPointer(), Dimensions, testCase.ScalarType);
+      AllocateImage(temperature.GetPointer(), Dimensions, temperatureTypes[precision]);
+      FillImage(previous.GetPointer(), testCase.Previous);
+      FillImage(current.GetPointer(), testCase.Current);
+      FillImage(accumulated.GetPointer(), 0.0);
+
+      logic->ComputePhaseDifference(previous.GetPointer(), current.GetPointer(),
+                                    accumulated.GetPointer(), temperature.GetPointer());
+      if (!CheckAccumulatedImage(accumulated.GetPointer(), testCase.Accumulated, testCase.Name) ||
+          !CheckImage(temperature.GetPointer(), testCase.Temperature, "temperature", testCase.Name,
+                      tolerances[precision]) ||
+          !CheckImage(previous.GetPointer(), testCase.Current, "previous phase", testCase.Name))
+        {
+        std::cerr << "  with the " << (conversion == 0 ? "arithmetic" : "table")
+                  << " conversion in " << (precision == 0 ? "double" : "single")
+                  << " precision" << std::endl;
+        return false;
+        }
+      }
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+// Integer accumulated phase wraps like the phase: two steps of +20000 on a
+// short phase accumulate to -25536
+bool TestAccumulatedOverflow()
+{
+  vtkNew<vtkSlicerRTThermometryLogic> logic;
+  SetupLogic(logic.GetPointer());
+
+  vtkNew<vtkImageData> previous;
+  vtkNew<vtkImageData> current;
+  vtkNew<vtkImageData> accumulated;
+  vtkNew<vtkImageData> temperature;
+  AllocateImage(previous.GetPointer(), Dimensions, VTK_SHORT);
+  AllocateImage(current.GetPointer(), Dimensions, VTK_SHORT);
+  AllocateImage(accumulated.GetPointer(), Dimensions, VTK_SHORT);
+  AllocateImage(temperature.GetPointer(), Dimensions, VTK_DOUBLE);
+  FillImage(previous.GetPointer(), 0.0);
+  FillImage(accumulated.GetPointer(), 0.0);
+
+  const double frames[2] = { 20000.0, -25536.0 };
+  for (int frame = 0; frame < 2; ++frame)
+    {
+    FillImage(current.GetPointer(), frames[frame]);
+    logic->ComputePhaseDifference(previous.GetPointer(), current.GetPointer(),
+                                  accumulated.GetPointer(), temperature.GetPointer());
+    }
+  return CheckImage(accumulated.GetPointer(), -25536.0, "accumulated phase", "short overflow") &&
+    CheckImage(temperature.GetPointer(), 281.0488773017662, "temperature", "short overflow");
+}
+
+//----------------------------------------------------------------------------
+// From a fixed reference, the accumulated phase is replaced and the
+// reference is left untouched
+bool TestFixedReference()
+{
+  vtkNew<vtkSlicerRTThermometryLogic> logic;
+  SetupLogic(logic.GetPointer());
+
+  vtkNew<vtkImageData> reference;
+  vtkNew<vtkImageData> current;
+  vtkNew<vtkImageData> accumulated;
+  vtkNew<vtkImageData> temperature;
+  AllocateImage(reference.GetPointer(), Dimensions, VTK_SHORT);
+  AllocateImage(current.GetPointer(), Dimensions, VTK_SHORT);
+  AllocateImage(accumulated.GetPointer(), Dimensions, VTK_SHORT);
+  AllocateImage(temperature.GetPointer(), Dimensions, VTK_DOUBLE);
+  FillImage(reference.GetPointer(), 500.0);
+  FillImage(accumulated.GetPointer(), 12345.0);
+
+  for (int frame = 0; frame < 2; ++frame)
+    {
+    FillImage(current.GetPointer(), -500.0);
+    logic->ComputePhaseDifference(reference.GetPointer(), current.GetPointer(),
+                                  accumulated.GetPointer(), temperature.GetPointer(), true);
+    }
+  return CheckImage(accumulated.GetPointer(), -1000.0, "accumulated phase", "fixed reference") &&
+    CheckImage(temperature.GetPointer(), 46.557051899348615, "temperature", "fixed reference") &&
+    CheckImage(reference.GetPointer(), 500.0, "reference phase", "fixed reference");
+}
+
+//----------------------------------------------------------------------------
+// Phase difference of the voxel (i, j, k) in the sensor test
+double SensorPhase(double i, double j, double k)
+{
+  return -10.0 * (i + 2 * j + 3 * k);
+}
+
+//----------------------------------------------------------------------------
+void FillSensorPhase(vtkImageData* phase)
+{
+  int* dimensions = phase->GetDimensions();
+  short* voxel = static_cast<short*>(phase->GetScalarPointer());
+  for (int k = 0; k < dimensions[2]; ++k)
+    {
+    for (int j = 0; j < dimensions[1]; ++j)
+      {
+      for (int i = 0; i < dimensions[0]; ++i, ++voxel)
+        {
+        *voxel = static_cast<short>(SensorPhase(i, j, k));
+        }
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+// Sensors sample the last temperature image through the processing extent
+// and the compute mask, and follow parameter changes
+bool TestSensorSampling()
+{
+  vtkNew<vtkSlicerRTThermometryLogic> logic;
+  SetupLogic(logic.GetPointer());
+
+  const int dimensions[3] = { 16, 12, 4 };
+  const int extent[6] = { 2, 13, 1, 10, 1, 2 };
+  logic->SetProcessingExtent(extent);
+
+  // Odd columns are masked out
+  vtkNew<vtkImageData> labelMap;
+  AllocateImage(labelMap.GetPointer(), dimensions, VTK_UNSIGNED_CHAR);
+  unsigned char* label = static_cast<unsigned char*>(labelMap->GetScalarPointer());
+  for (vtkIdType i = 0; i < labelMap->GetNumberOfPoints(); ++i)
+    {
+    label[i] = (i % dimensions[0]) % 2 == 0 ? 1 : 0;
+    }
+  logic->SetMaskFromLabelMap(labelMap.GetPointer());
+
+  vtkNew<vtkImageData> phase;
+  AllocateImage(phase.GetPointer(), dimensions, VTK_SHORT);
+  FillImage(phase.GetPointer(), 0.0);
+  if (logic->ProcessPhaseImage(phase.GetPointer(), 0.0) || !logic->HasBaseline())
+    {
+    std::cerr << "sensors: the first frame must be the baseline" << std::endl;
+    return false;
+    }
+
+  FillSensorPhase(phase.GetPointer());
+  vtkImageData* temperature = logic->ProcessPhaseImage(phase.GetPointer(), 1.0);
+  if (!temperature)
+    {
+    std::cerr << "sensors: no temperature produced" << std::endl;
+    return false;
+    }
+  int* temperatureExtent = temperature->GetExtent();
+  for (int i = 0; i < 6; ++i)
+    {
+    if (temperatureExtent[i] != extent[i])
+      {
+      std::cerr << "sensors: temperature extent does not match the processing extent" << std::endl;
+      return false;
+      }
+    }
+
+  // Temperatures have the default precision of the build
+  double tolerance =
+    logic->GetTemperatureScalarType() == VTK_FLOAT ? 1e-6 : 1e-9;
+  const double baseTemperatures[2] = { ReferenceBaseTemperature, 20.0 };
+  for (int pass = 0; pass < 2; ++pass)
+    {
+    // The history is derived again with the new base temperature
+    logic->SetBaseTemperature(baseTemperatures[pass]);
+    for (int k = 0; k < dimensions[2]; ++k)
+      {
+      for (int j = 0; j < dimensions[1]; ++j)
+        {
+        for (int i = 0; i < dimensions[0]; ++i)
+          {
+          bool processed = i >= extent[0] && i <= extent[1] && j >= extent[2] && j <= extent[3] &&
+            k >= extent[4] && k <= extent[5] && i % 2 == 0;
+          double expected = baseTemperatures[pass] +
+            (processed ? SensorPhase(i, j, k) * ReferenceFactor : 0.0);
+          double ijk[3] = { i + 0.25, j + 0.25, k + 0.25 };
+          if (!CheckValue(logic->GetTemperatureAtIJK(ijk), expected, "sensor temperature", "sensors",
+                          tolerance))
+            {
+            std::cerr << "  at " << i << ", " << j << ", " << k << std::endl;
+            return false;
+            }
+          }
+        }
+      }
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+// The phase of the sensor test is linear, so trilinear samples of the
+// processing extent match it exactly; voxels outside of it are sampled as
+// the base temperature.
+bool TestLineProfiles()
+{
+  vtkNew<vtkSlicerRTThermometryLogic> logic;
+  SetupLogic(logic.GetPointer());
+
+  const int dimensions[3] = { 16, 12, 4 };
+  const int extent[6] = { 2, 13, 1, 10, 1, 2 };
+  logic->SetProcessingExtent(extent);
+
+  // Along i through the extent, then fractional positions inside it
+  const double start[2][3] = { { 0.0, 5.0, 1.5 }, { 2.25, 1.5, 1.0 } };
+  const double end[2][3] = { { 15.0, 5.0, 1.5 }, { 13.0, 10.0, 2.0 } };
+  const int numberOfSamples[2] = { 31, 7 };
+  for (int profile = 0; profile < 2; ++profile)
+    {
+    logic->AddLineProfile(start[profile], end[profile], numberOfSamples[profile]);
+    }
+
+  vtkNew<vtkImageData> phase;
+  AllocateImage(phase.GetPointer(), dimensions, VTK_SHORT);
+  FillImage(phase.GetPointer(), 0.0);
+  logic->ProcessPhaseImage(phase.GetPointer(), 0.0);
+  FillSensorPhase(phase.GetPointer());
+  if (!logic->ProcessPhaseImage(phase.GetPointer(), 1.0))
+    {
+    std::cerr << "profiles: no temperature produced" << std::endl;
+    return false;
+    }
+
+  double tolerance = logic->GetTemperatureScalarType() == VTK_FLOAT ? 1e-6 : 1e-9;
+  for (int profile = 0; profile < 2; ++profile)
+    {
+    const double* values = logic->GetLineProfileValues(profile);
+    if (!values || logic->GetLineProfileNumberOfSamples(profile) != numberOfSamples[profile])
+      {
+      std::cerr << "profiles: profile " << profile << " was not gathered" << std::endl;
+      return false;
+      }
+    for (int sample = 0; sample < numberOfSamples[profile]; ++sample)
+      {
+      double t = static_cast<double>(sample) / (numberOfSamples[profile] - 1);
+      double position[3];
+      for (int axis = 0; axis < 3; ++axis)
+        {
+        position[axis] = start[profile][axis] + t * (end[profile][axis] - start[profile][axis]);
+        }
+      // Only the first profile leaves the extent, along i: interpolate
+      // along i between voxels of the extent and the base temperature
+      int i = static_cast<int>(std::floor(position[0]));
+      double fraction = position[0] - i;
+      double phaseDifference = 0.0;
+      for (int offset = 0; offset < 2; ++offset)
+        {
+        if (i + offset >= extent[0] && i + offset <= extent[1])
+          {
+          phaseDifference += (offset ? fraction : 1.0 - fraction) *
+            SensorPhase(i + offset, position[1], position[2]);
+          }
+        }
+      double expected = ReferenceBaseTemperature + phaseDifference * ReferenceFactor;
+      if (!CheckValue(values[sample], expected, "profile sample", "profiles", tolerance))
+        {
+        std::cerr << "  at sample " << sample << " of profile " << profile << std::endl;
+        return false;
+        }
+      }
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+// A hot spot smaller than a preview block, away from its sampled voxel,
+// raises the alarm of its zone when the zones are also evaluated on the
+// preview
+bool TestPreviewProtectionZones()
+{
+  vtkNew<vtkSlicerRTThermometryLogic> logic;
+  SetupLogic(logic.GetPointer());
+  logic->SetProgressivePreview(true);
+  logic->SetPreviewDownsampling(4);
+  logic->SetPreviewSafetyCheck(true);
+
+  const int dimensions[3] = { 16, 16, 4 };
+  const int zoneExtent[6] = { 0, 3, 0, 3, 0, 3 };
+  logic->AddProtectionZoneFromExtent(dimensions, zoneExtent, 40.0, "Hot spot");
+
+  vtkNew<vtkImageData> phase;
+  AllocateImage(phase.GetPointer(), dimensions, VTK_SHORT);
+  FillImage(phase.GetPointer(), 0.0);
+  logic->ProcessPhaseImage(phase.GetPointer(), 0.0);
+  // The preview samples voxel (2, 2, 2) of the block
+  static_cast<short*>(phase->GetScalarPointer(1, 0, 1))[0] = -1000;
+  if (!logic->ProcessPhaseImage(phase.GetPointer(), 1.0))
+    {
+    std::cerr << "preview zones: no temperature produced" << std::endl;
+    return false;
+    }
+  if (!logic->IsProtectionZoneInAlarm(0) ||
+      !CheckValue(logic->GetProtectionZoneMaximum(0), 46.557051899348615, "zone maximum",
+                  "preview zones", 1e-6))
+    {
+    std::cerr << "preview zones: the hot spot did not raise the alarm" << std::endl;
+    return false;
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+// Zone voxels outside of the processing extent are counted as clipped, and
+// a zone left without voxels is reported as not monitored
+bool TestClippedProtectionZones()
+{
+  vtkNew<vtkSlicerRTThermometryLogic> logic;
+  SetupLogic(logic.GetPointer());
+  const int processingExtent[6] = { 4, 11, 4, 11, 0, 3 };
+  logic->SetProcessingExtent(processingExtent);
+
+  const int dimensions[3] = { 16, 16, 4 };
+  const int clippedExtent[6] = { 2, 5, 4, 5, 0, 0 };
+  const int outsideExtent[6] = { 12, 15, 0, 3, 0, 3 };
+  logic->AddProtectionZoneFromExtent(dimensions, clippedExtent, 40.0, "Clipped");
+  logic->AddProtectionZoneFromExtent(dimensions, outsideExtent, 40.0, "Outside");
+  if (!logic->IsProtectionZoneMonitored(0) || !logic->IsProtectionZoneMonitored(1))
+    {
+    std::cerr << "clipped zones: zones not monitored before the baseline" << std::endl;
+    return false;
+    }
+
+  vtkNew<vtkImageData> phase;
+  AllocateImage(phase.GetPointer(), dimensions, VTK_SHORT);
+  FillImage(phase.GetPointer(), 0.0);
+  logic->ProcessPhaseImage(phase.GetPointer(), 0.0);
+  if (logic->GetNumberOfProtectionZoneVoxels(0) != 4 ||
+      logic->GetNumberOfProtectionZoneClippedVoxels(0) != 4 ||
+      !logic->IsProtectionZoneMonitored(0))
+    {
+    std::cerr << "clipped zones: " << logic->GetNumberOfProtectionZoneVoxels(0)
+              << " voxels and " << logic->GetNumberOfProtectionZoneClippedVoxels(0)
+              << " clipped, expected 4 and 4" << std::endl;
+    return false;
+    }
+  if (logic->GetNumberOfProtectionZoneVoxels(1) != 0 ||
+      logic->GetNumberOfProtectionZoneClippedVoxels(1) != 64 ||
+      logic->IsProtectionZoneMonitored(1))
+    {
+    std::cerr << "clipped zones: a zone outside of the processing extent is monitored"
+              << std::endl;
+    return false;
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+// Noisy short phase around offset, with a deterministic generator
+void FillNoisyPhase(vtkImageData* image, double offset, unsigned int& seed)
+{
+  short* voxels = static_cast<short*>(image->GetScalarPointer());
+  for (vtkIdType i = 0; i < image->GetNumberOfPoints(); ++i)
+    {
+    seed = seed * 1103515245u + 12345u;
+    voxels[i] = static_cast<short>(offset + static_cast<int>((seed >> 16) % 21) - 10);
+    }
+  image->Modified();
+}
+
+//----------------------------------------------------------------------------
+void CountEvent(vtkObject* vtkNotUsed(caller), unsigned long vtkNotUsed(eventId),
+                void* clientData, void* vtkNotUsed(callData))
+{
+  ++*static_cast<int*>(clientData);
+}
+
+//----------------------------------------------------------------------------
+// After a lasting phase change (motion), frames are rejected until the
+// limit, then accepted again with RejectionLimitEvent
+bool TestRejectionLimit()
+{
+  vtkNew<vtkSlicerRTThermometryLogic> logic;
+  SetupLogic(logic.GetPointer());
+  logic->SetRejectionThreshold(3.0);
+  logic->SetMaximumConsecutiveRejections(3);
+  int numberOfLimitEvents = 0;
+  vtkNew<vtkCallbackCommand> callback;
+  callback->SetCallback(CountEvent);
+  callback->SetClientData(&numberOfLimitEvents);
+  logic->AddObserver(vtkSlicerRTThermometryLogic::RejectionLimitEvent, callback.GetPointer());
+
+  const int dimensions[3] = { 16, 16, 4 };
+  vtkNew<vtkImageData> phase;
+  AllocateImage(phase.GetPointer(), dimensions, VTK_SHORT);
+  unsigned int seed = 1;
+  for (int frame = 0; frame < 8; ++frame)
+    {
+    FillNoisyPhase(phase.GetPointer(), 0.0, seed);
+    logic->ProcessPhaseImage(phase.GetPointer(), frame);
+    }
+  if (logic->GetNumberOfRejectedFrames() != 0)
+    {
+    std::cerr << "rejection limit: frames rejected before the motion" << std::endl;
+    return false;
+    }
+
+  // Slices move in opposite phase directions: the stale reference rejects
+  // the frames until the limit
+  bool accepted[8];
+  vtkIdType sliceSize = dimensions[0] * dimensions[1];
+  for (int frame = 0; frame < 8; ++frame)
+    {
+    FillNoisyPhase(phase.GetPointer(), 2000.0, seed);
+    short* voxels = static_cast<short*>(phase->GetScalarPointer());
+    for (vtkIdType i = 0; i < phase->GetNumberOfPoints(); ++i)
+      {
+      if ((i / sliceSize) % 2)
+        {
+        voxels[i] = static_cast<short>(voxels[i] - 4000);
+        }
+      }
+    accepted[frame] = logic->ProcessPhaseImage(phase.GetPointer(), 8.0 + frame) != NULL;
+    }
+  if (accepted[0] || accepted[1] || accepted[2] || !accepted[3] ||
+      !accepted[4] || !accepted[7] || logic->GetNumberOfRejectedFrames() != 3 ||
+      logic->GetNumberOfConsecutiveRejectedFrames() != 0 || numberOfLimitEvents != 1)
+    {
+    std::cerr << "rejection limit: " << logic->GetNumberOfRejectedFrames()
+              << " frames rejected and " << numberOfLimitEvents
+              << " events, expected 3 frames rejected then accepted with one event" << std::endl;
+    return false;
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+// A change of the conversion re-maps the maximum map and the zone maximum,
+// and restarts the thermal dose
+bool TestConversionChange()
+{
+  vtkNew<vtkSlicerRTThermometryLogic> logic;
+  SetupLogic(logic.GetPointer());
+  logic->SetDerivedMapEnabled(vtkSlicerRTThermometryLogic::MaximumTemperatureMap, true);
+  logic->SetDerivedMapEnabled(vtkSlicerRTThermometryLogic::ThermalDoseMap, true);
+  const int zoneExtent[6] = { 0, 4, 0, 3, 0, 2 };
+  logic->AddProtectionZoneFromExtent(Dimensions, zoneExtent, 40.0, "Zone");
+
+  vtkNew<vtkImageData> phase;
+  AllocateImage(phase.GetPointer(), Dimensions, VTK_SHORT);
+  FillImage(phase.GetPointer(), 0.0);
+  logic->ProcessPhaseImage(phase.GetPointer(), 0.0);
+  FillImage(phase.GetPointer(), -1000.0);
+  phase->Modified();
+  logic->ProcessPhaseImage(phase.GetPointer(), 1.0);
+  vtkImageData* maximum = logic->GetDerivedMap(vtkSlicerRTThermometryLogic::MaximumTemperatureMap);
+  if (!maximum || !logic->GetDerivedMap(vtkSlicerRTThermometryLogic::ThermalDoseMap) ||
+      !CheckImage(maximum, 46.557051899348615, "maximum", "conversion change", 1e-6))
+    {
+    std::cerr << "conversion change: derived maps not computed" << std::endl;
+    return false;
+    }
+
+  // Twice the echo time halves the temperature change
+  logic->SetEchoTime(0.02);
+  const double expected = ReferenceBaseTemperature - 1000.0 * ReferenceFactor / 2.0;
+  maximum = logic->GetDerivedMap(vtkSlicerRTThermometryLogic::MaximumTemperatureMap);
+  if (!maximum || !CheckImage(maximum, expected, "maximum", "conversion change", 1e-6) ||
+      !CheckValue(logic->GetProtectionZoneMaximum(0), expected, "zone maximum",
+                  "conversion change", 1e-6))
+    {
+    return false;
+    }
+  if (logic->GetDerivedMap(vtkSlicerRTThermometryLogic::ThermalDoseMap))
+    {
+    std::cerr << "conversion change: the thermal dose was kept" << std::endl;
+    return false;
+    }
+
+  // The dose restarts with the next frame, with the new conversion
+  logic->ProcessPhaseImage(phase.GetPointer(), 2.0);
+  if (!logic->GetDerivedMap(vtkSlicerRTThermometryLogic::ThermalDoseMap))
+    {
+    std::cerr << "conversion change: the thermal dose did not restart" << std::endl;
+    return false;
+    }
+
+  // A change of sign swaps maxima and minima, the maximum cannot be kept
+  logic->SetThermalCoefficient(0.01);
+  if (logic->GetDerivedMap(vtkSlicerRTThermometryLogic::MaximumTemperatureMap))
+    {
+    std::cerr << "conversion change: the maximum was kept across a change of sign" << std::endl;
+    return false;
+    }
+  return true;
+}
+
+} // end of anonymous namespace
+
+//----------------------------------------------------------------------------
+int vtkSlicerRTThermometryPhaseKernelTest(int vtkNotUsed(argc), char* vtkNotUsed(argv)[])
+{
+  bool success = true;
+  success = TestReferenceValues() && success;
+  success = TestAccumulatedOverflow() && success;
+  success = TestFixedReference() && success;
+  success = TestSensorSampling() && success;
+  success = TestLineProfiles() && success;
+  success = TestPreviewProtectionZones() && success;
+  success = TestClippedProtectionZones() && success;
+  success = TestRejectionLimit() && success;
+  success = TestConversionChange() && success;
+  return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -24,6 +24,11 @@
 #include "qSlicerRTThermometryGraphWidget.h"
 #include "ui_qSlicerRTThermometryGraphWidget.h"
 
+// STD includes
+#include <algorithm>
+#include <deque>
+#include <sstream>
+
 //-----------------------------------------------------------------------------
 /// \ingroup Slicer_QtModules_LoadableModuleTemplate
 class qSlicerRTThermometryGraphWidgetPrivate
@@ -37,6 +42,25 @@ public:
   std::map<std::string, vtkTable*>  TemperatureMap;
   typedef std::map<std::string, vtkTable*>::iterator TemperatureMapIter;
 
+  // Line profiles: the plotted table has the distance along the line and
+  // the last profile. The history is a ring of the last recorded profiles,
+  // in image order; evicted arrays are reused.
+  struct ProfileRecord
+    {
+    int ImageNumber;
+    double Length;
+    vtkSmartPointer<vtkDoubleArray> Values;
+    };
+  struct ProfileSeries
+    {
+    vtkSmartPointer<vtkTable> Table;
+    vtkPlot* Plot;
+    std::deque<ProfileRecord> History;
+    };
+  std::map<std::string, ProfileSeries> ProfileMap;
+  typedef std::map<std::string, ProfileSeries>::iterator ProfileMapIter;
+  int MaximumNumberOfProfiles;
+
 public:
   qSlicerRTThermometryGraphWidgetPrivate(
     qSlicerRTThermometryGraphWidget& object);
@@ -49,6 +73,7 @@ qSlicerRTThermometryGraphWidgetPrivate
   qSlicerRTThermometryGraphWidget& object)
   : q_ptr(&object)
 {
+  this->MaximumNumberOfProfiles = 1000;
 }
 
 // --------------------------------------------------------------------------
@@ -78,6 +103,15 @@ qSlicerRTThermometryGraphWidget
     chartXY->SetShowLegend(true);
     chartXY->GetLegend()->SetDragEnabled(true);
     }
+
+  if (d->ProfileChartView && d->ProfileChartView->chart())
+    {
+    vtkChartXY* chartXY = d->ProfileChartView->chart();
+    chartXY->GetAxis(1)->SetTitle("Distance (mm)");
+    chartXY->GetAxis(0)->SetTitle("Temperature (C)");
+    chartXY->SetShowLegend(true);
+    chartXY->GetLegend()->SetDragEnabled(true);
+    }
 }
 
 //-----------------------------------------------------------------------------
@@ -192,6 +226,231 @@ void qSlicerRTThermometryGraphWidget
       }
     ++iter;
     }
+
+  this->clearProfiles();
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryGraphWidget
+::recordNewProfile(std::string profileID, std::string profileName, double length,
+                   const double* values, int numberOfSamples, int imageNumber)
+{
+  Q_D(qSlicerRTThermometryGraphWidget);
+
+  if (!d->ProfileChartView || !d->ProfileChartView->chart() || !values || numberOfSamples < 2)
+    {
+    return;
+    }
+  vtkChartXY* chartXY = d->ProfileChartView->chart();
+
+  qSlicerRTThermometryGraphWidgetPrivate::ProfileMapIter iter
+    = d->ProfileMap.find(profileID);
+  if (iter == d->ProfileMap.end())
+    {
+    // Profile table not found. Add new table and line.
+    qSlicerRTThermometryGraphWidgetPrivate::ProfileSeries series;
+    series.Table = vtkSmartPointer<vtkTable>::New();
+    vtkSmartPointer<vtkDoubleArray> distance = vtkSmartPointer<vtkDoubleArray>::New();
+    distance->SetName("Distance");
+    series.Table->AddColumn(distance);
+    vtkSmartPointer<vtkDoubleArray> temperature = vtkSmartPointer<vtkDoubleArray>::New();
+    temperature->SetName("Temperature");
+    series.Table->AddColumn(temperature);
+
+    series.Plot = chartXY->AddPlot(vtkChart::LINE);
+    if (!series.Plot)
+      {
+      return;
+      }
+#if VTK_MAJOR_VERSION <= 5
+    series.Plot->SetInput(series.Table, 0, 1);
+#else
+    series.Plot->SetInputData(series.Table, 0, 1);
+#endif
+    int array = chartXY->GetNumberOfPlots();
+    series.Plot->SetColor((array*76)%255, ((array+1)*76)%255, ((array+2)*76)%255);
+    iter = d->ProfileMap.insert(
+      std::pair<std::string, qSlicerRTThermometryGraphWidgetPrivate::ProfileSeries>(
+        profileID, series)).first;
+    }
+  qSlicerRTThermometryGraphWidgetPrivate::ProfileSeries& series = iter->second;
+
+  // Record in the history: the same image again replaces its profile,
+  // otherwise the oldest profile is recycled once the history is full
+  std::deque<qSlicerRTThermometryGraphWidgetPrivate::ProfileRecord>& history = series.History;
+  if (history.empty() || history.back().ImageNumber != imageNumber)
+    {
+    qSlicerRTThermometryGraphWidgetPrivate::ProfileRecord record;
+    if (static_cast<int>(history.size()) >= d->MaximumNumberOfProfiles)
+      {
+      record = history.front();
+      history.pop_front();
+      }
+    else
+      {
+      record.Values = vtkSmartPointer<vtkDoubleArray>::New();
+      }
+    record.ImageNumber = imageNumber;
+    std::ostringstream name;
+    name << "Image " << imageNumber;
+    record.Values->SetName(name.str().c_str());
+    history.push_back(record);
+    }
+  qSlicerRTThermometryGraphWidgetPrivate::ProfileRecord& record = history.back();
+  record.Length = length;
+  record.Values->SetNumberOfValues(numberOfSamples);
+  std::copy(values, values + numberOfSamples, record.Values->GetPointer(0));
+  record.Values->Modified();
+
+  // Plot the last profile, along the current line
+  vtkDoubleArray* distance = vtkDoubleArray::SafeDownCast(series.Table->GetColumn(0));
+  vtkDoubleArray* temperature = vtkDoubleArray::SafeDownCast(series.Table->GetColumn(1));
+  distance->SetNumberOfValues(numberOfSamples);
+  temperature->SetNumberOfValues(numberOfSamples);
+  for (int i = 0; i < numberOfSamples; ++i)
+    {
+    distance->SetValue(i, length * i / (numberOfSamples - 1));
+    temperature->SetValue(i, values[i]);
+    }
+  series.Table->Modified();
+
+  series.Plot->SetLabel(profileName);
+  chartXY->RecalculateBounds();
+  this->repaint();
+}
+
+//-----------------------------------------------------------------------------
+vtkDoubleArray* qSlicerRTThermometryGraphWidget
+::getProfile(std::string profileID, int imageNumber)
+{
+  Q_D(qSlicerRTThermometryGraphWidget);
+
+  qSlicerRTThermometryGraphWidgetPrivate::ProfileMapIter iter
+    = d->ProfileMap.find(profileID);
+  if (iter == d->ProfileMap.end())
+    {
+    return NULL;
+    }
+  // Recent images are the most asked for
+  std::deque<qSlicerRTThermometryGraphWidgetPrivate::ProfileRecord>& history =
+    iter->second.History;
+  for (size_t i = history.size(); i > 0; --i)
+    {
+    if (history[i - 1].ImageNumber == imageNumber)
+      {
+      return history[i - 1].Values;
+      }
+    }
+  return NULL;
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryGraphWidget
+::clearProfiles()
+{
+  Q_D(qSlicerRTThermometryGraphWidget);
+
+  qSlicerRTThermometryGraphWidgetPrivate::ProfileMapIter iter
+    = d->ProfileMap.begin();
+  while(iter != d->ProfileMap.end())
+    {
+    if (d->ProfileChartView && d->ProfileChartView->chart())
+      {
+      d->ProfileChartView->chart()->RemovePlotInstance(iter->second.Plot);
+      }
+    ++iter;
+    }
+  d->ProfileMap.clear();
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryGraphWidget
+::setMaximumNumberOfProfiles(int maximum)
+{
+  Q_D(qSlicerRTThermometryGraphWidget);
+
+  d->MaximumNumberOfProfiles = std::max(maximum, 1);
+  qSlicerRTThermometryGraphWidgetPrivate::ProfileMapIter iter
+    = d->ProfileMap.begin();
+  while(iter != d->ProfileMap.end())
+    {
+    std::deque<qSlicerRTThermometryGraphWidgetPrivate::ProfileRecord>& history =
+      iter->second.History;
+    while (static_cast<int>(history.size()) > d->MaximumNumberOfProfiles)
+      {
+      history.pop_front();
+      }
+    ++iter;
+    }
+}
+
+//-----------------------------------------------------------------------------
+int qSlicerRTThermometryGraphWidget
+::maximumNumberOfProfiles() const
+{
+  Q_D(const qSlicerRTThermometryGraphWidget);
+  return d->MaximumNumberOfProfiles;
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryGraphWidget
+::remapData(double scale, double shift)
+{
+  Q_D(qSlicerRTThermometryGraphWidget);
+
+  qSlicerRTThermometryGraphWidgetPrivate::TemperatureMapIter iter
+    = d->TemperatureMap.begin();
+  while(iter != d->TemperatureMap.end())
+    {
+    vtkTable* sensorTable = (*iter).second;
+    vtkDoubleArray* temperature =
+      sensorTable ? vtkDoubleArray::SafeDownCast(sensorTable->GetColumn(1)) : NULL;
+    if (temperature)
+      {
+      for (vtkIdType i = 0; i < temperature->GetNumberOfTuples(); ++i)
+        {
+        temperature->SetValue(i, temperature->GetValue(i) * scale + shift);
+        }
+      temperature->Modified();
+      sensorTable->Modified();
+      }
+    ++iter;
+    }
+
+  qSlicerRTThermometryGraphWidgetPrivate::ProfileMapIter profileIter
+    = d->ProfileMap.begin();
+  while(profileIter != d->ProfileMap.end())
+    {
+    vtkTable* profileTable = profileIter->second.Table;
+    vtkDoubleArray* temperature = vtkDoubleArray::SafeDownCast(profileTable->GetColumn(1));
+    for (vtkIdType i = 0; temperature && i < temperature->GetNumberOfTuples(); ++i)
+      {
+      temperature->SetValue(i, temperature->GetValue(i) * scale + shift);
+      }
+    profileTable->Modified();
+    std::deque<qSlicerRTThermometryGraphWidgetPrivate::ProfileRecord>& history =
+      profileIter->second.History;
+    for (size_t record = 0; record < history.size(); ++record)
+      {
+      vtkDoubleArray* profile = history[record].Values;
+      for (vtkIdType i = 0; i < profile->GetNumberOfTuples(); ++i)
+        {
+        profile->SetValue(i, profile->GetValue(i) * scale + shift);
+        }
+      profile->Modified();
+      }
+    ++profileIter;
+    }
+
+  if (d->ChartView && d->ChartView->chart())
+    {
+    d->ChartView->chart()->RecalculateBounds();
+    this->repaint();
+    }
+  if (d->ProfileChartView && d->ProfileChartView->chart())
+    {
+    d->ProfileChartView->chart()->RecalculateBounds();
+    }
 }
 
 //-----------------------------------------------------------------------------
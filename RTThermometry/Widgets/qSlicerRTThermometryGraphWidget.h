@@ -53,6 +53,25 @@ public:
   void recordNewData(std::string sensorID, std::string sensorName, double sensorValue, int imageNumber);
   void clearData();
 
+  /// Record the profile of a line for an image. The last
+  /// maximumNumberOfProfiles() profiles of each line are kept, with their
+  /// own number of samples; the last one is plotted against the distance
+  /// along the line (length in mm).
+  void recordNewProfile(std::string profileID, std::string profileName, double length,
+                        const double* values, int numberOfSamples, int imageNumber);
+  /// Profile recorded for an image, or NULL if it was not recorded or is
+  /// older than the kept history
+  vtkDoubleArray* getProfile(std::string profileID, int imageNumber);
+  void clearProfiles();
+
+  /// Number of profiles kept per line, 1000 by default. Older profiles are
+  /// recycled.
+  void setMaximumNumberOfProfiles(int maximum);
+  int maximumNumberOfProfiles() const;
+
+  /// Apply value * scale + shift to the recorded temperatures
+  void remapData(double scale, double shift);
+
 protected slots:
 
 protected:
@@ -17,12 +17,39 @@
 
 // Qt includes
 #include <QDebug>
+#include <QFileDialog>
+#include <QTimer>
+#include <vtkCommand.h>
+#include <vtkMath.h>
+#include <vtkTimerLog.h>
+#include <vtkTransform.h>
+#include <vtkTransformPolyDataFilter.h>
 #include <vtkVersion.h>
 
+// STD includes
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
 // SlicerQt includes
+#include "qSlicerApplication.h"
+#include "qSlicerLayoutManager.h"
 #include "qSlicerRTThermometryModuleWidget.h"
 #include "ui_qSlicerRTThermometryModuleWidget.h"
 
+// MRMLWidgets includes
+#include <qMRMLSliceView.h>
+#include <qMRMLSliceWidget.h>
+
+// RTThermometry Logic includes
+#include "vtkSlicerRTThermometryCheckpointWriter.h"
+#include "vtkSlicerRTThermometryFramePool.h"
+#include "vtkSlicerRTThermometryHotSpotDetector.h"
+#include "vtkSlicerRTThermometryIngestQueue.h"
+#include "vtkSlicerRTThermometryLogic.h"
+#include "vtkSlicerRTThermometryProfiler.h"
+#include "vtkSlicerRTThermometrySessionRecorder.h"
+
 //-----------------------------------------------------------------------------
 /// \ingroup Slicer_QtModules_ExtensionTemplate
 class qSlicerRTThermometryModuleWidgetPrivate: public Ui_qSlicerRTThermometryModuleWidget
@@ -34,13 +61,20 @@ public:
 
   vtkMRMLIGTLConnectorNode* IGTLConnector;
   vtkMRMLMarkupsFiducialNode* SensorList;
-  vtkImageData* Image1;
-  vtkImageData* Image2;
-  vtkImageData* TotalPhaseDifference;
+  vtkMRMLMarkupsFiducialNode* HotSpotList;
+  vtkMRMLModelNode* AblationModel;
+  unsigned long AblationSurfaceTime;
   vtkMRMLScalarVolumeNode* OpenIGTLinkBuffer;
   vtkMRMLScalarVolumeNode* ViewerNode;
-  std::vector<vtkImageData*> TemperatureImageList;
+  // The viewer shows the preview of the frame being processed, and
+  // sensors are sampled from it
+  bool ShowingPreview;
+  bool SensorsOnPreview;
+  // Frames were rejected in a row until the limit, the reference is stale
+  bool RejectionLimitReached;
+  vtkMRMLLinearTransformNode* AcknowledgeNode;
   int NumberOfMarkupSample;
+  int NumberOfFramesReceived;
   
   int    ImageDimension[3];
   double ImageOrigin[3];
@@ -48,16 +82,17 @@ public:
   int    ImageScalarType;
   vtkMatrix4x4* RASToIJK;
 
-  // Thermometry Parameters
-  double EchoTime;
-  double MagneticField;
-  double GyromagneticRatio;
-  double ThermalCoefficient;
-  double ScaleFactor;
-  double BaseTemperature;
-
   qSlicerRTThermometryGraphWidget* TemperatureGraph;
 
+  // Rulers of the line profiles, in the order of the profiles of the logic
+  std::vector<std::string> ProfileNodeIDs;
+
+  QTimer* DiagnosticsTimer;
+  QTimer* IngestTimer;
+  // Stands for the profiler of the logic until there is one, so that
+  // profiler() is never NULL
+  vtkSlicerRTThermometryProfiler* NoLogicProfiler;
+
 public:
   qSlicerRTThermometryModuleWidgetPrivate();
   ~qSlicerRTThermometryModuleWidgetPrivate();
@@ -74,24 +109,26 @@ qSlicerRTThermometryModuleWidgetPrivate::qSlicerRTThermometryModuleWidgetPrivate
 
   this->IGTLConnector = NULL;
   this->SensorList = NULL;
-  this->Image1 = NULL;
-  this->Image2 = NULL;
-  this->TotalPhaseDifference = NULL;
+  this->HotSpotList = NULL;
+  this->AblationModel = NULL;
+  this->AblationSurfaceTime = 0;
   this->OpenIGTLinkBuffer = NULL;
   this->ViewerNode = NULL;
+  this->ShowingPreview = false;
+  this->RejectionLimitReached = false;
+  this->SensorsOnPreview = false;
+  this->AcknowledgeNode = NULL;
   this->NumberOfMarkupSample = 0;
+  this->NumberOfFramesReceived = 0;
 
   this->ImageScalarType = VTK_SHORT;
   this->RASToIJK = vtkMatrix4x4::New();
 
   this->TemperatureGraph = NULL;
 
-  this->EchoTime = 0.0;
-  this->MagneticField = 0.0;
-  this->GyromagneticRatio = 0.0;
-  this->ThermalCoefficient = 0.0;
-  this->ScaleFactor = 0.0;
-  this->BaseTemperature = 0.0;
+  this->DiagnosticsTimer = NULL;
+  this->IngestTimer = NULL;
+  this->NoLogicProfiler = vtkSlicerRTThermometryProfiler::New();
 }
 
 //-----------------------------------------------------------------------------
@@ -108,24 +145,24 @@ qSlicerRTThermometryModuleWidgetPrivate::~qSlicerRTThermometryModuleWidgetPrivat
     this->SensorList->Delete();
     }
 
-  if (this->Image1)
+  if (this->HotSpotList)
     {
-    this->Image1->Delete();
+    this->HotSpotList->Delete();
     }
 
-  if (this->Image2)
+  if (this->AblationModel)
     {
-    this->Image2->Delete();
+    this->AblationModel->Delete();
     }
 
-  if (this->TotalPhaseDifference)
+  if (this->ViewerNode)
     {
-    this->TotalPhaseDifference->Delete();
+    this->ViewerNode->Delete();
     }
 
-  if (this->ViewerNode)
+  if (this->AcknowledgeNode)
     {
-    this->ViewerNode->Delete();
+    this->AcknowledgeNode->Delete();
     }
 
   if (this->RASToIJK)
@@ -133,15 +170,10 @@ qSlicerRTThermometryModuleWidgetPrivate::~qSlicerRTThermometryModuleWidgetPrivat
     this->RASToIJK->Delete();
     }
 
-  for (unsigned int i = 0; i < this->TemperatureImageList.size(); ++i)
+  if (this->NoLogicProfiler)
     {
-    vtkImageData* imData = this->TemperatureImageList[i];
-    if (imData)
-      {
-      imData->Delete();
-      }
+    this->NoLogicProfiler->Delete();
     }
-  this->TemperatureImageList.clear();
 
   if (this->TemperatureGraph)
     {
@@ -180,16 +212,123 @@ void qSlicerRTThermometryModuleWidget::setup()
           this, SLOT(onConnectClicked()));
 
   // Thermometry Parameters
-  d->EchoTime = d->EchoTimeWidget->value();
-  d->MagneticField = d->MagneticFieldWidget->value();
-  d->GyromagneticRatio = d->GyromagneticRatioWidget->value();
-  d->ThermalCoefficient = d->ThermalCoeffWidget->value();
-  d->ScaleFactor = d->ScaleFactorWidget->value();
-  d->BaseTemperature = d->BaseTemperatureWidget->value();
+  this->updateLogicParameters();
 
   connect(d->SetBaselineButton, SIGNAL(clicked()),
 	  this, SLOT(onSetBaselineClicked()));
 
+  QList<ctkDoubleSpinBox*> parameterWidgets;
+  parameterWidgets << d->EchoTimeWidget << d->MagneticFieldWidget
+                   << d->GyromagneticRatioWidget << d->ThermalCoeffWidget
+                   << d->ScaleFactorWidget << d->BaseTemperatureWidget;
+  foreach(ctkDoubleSpinBox* parameterWidget, parameterWidgets)
+    {
+    connect(parameterWidget, SIGNAL(valueChanged(double)),
+            this, SLOT(onThermometryParametersChanged()));
+    }
+
+  connect(d->BaselineLibrarySizeWidget, SIGNAL(valueChanged(int)),
+          this, SLOT(onBaselineLibrarySizeChanged(int)));
+
+  connect(d->RejectionThresholdWidget, SIGNAL(valueChanged(double)),
+          this, SLOT(onRejectionThresholdChanged(double)));
+
+  connect(d->TemporalFilterComboBox, SIGNAL(currentIndexChanged(int)),
+          this, SLOT(onTemporalFilterChanged()));
+  connect(d->TemporalFilterWeightWidget, SIGNAL(valueChanged(double)),
+          this, SLOT(onTemporalFilterChanged()));
+  connect(d->KalmanProcessNoiseWidget, SIGNAL(valueChanged(double)),
+          this, SLOT(onTemporalFilterChanged()));
+  connect(d->KalmanMeasurementNoiseWidget, SIGNAL(valueChanged(double)),
+          this, SLOT(onTemporalFilterChanged()));
+  this->onTemporalFilterChanged();
+
+  connect(d->SpatialFilterComboBox, SIGNAL(currentIndexChanged(int)),
+          this, SLOT(onSpatialFilterChanged()));
+  connect(d->SpatialFilterRadiusWidget, SIGNAL(valueChanged(int)),
+          this, SLOT(onSpatialFilterChanged()));
+  connect(d->SpatialFilterThroughSlicesCheckBox, SIGNAL(toggled(bool)),
+          this, SLOT(onSpatialFilterChanged()));
+  this->onSpatialFilterChanged();
+
+  connect(d->DisplayedMapComboBox, SIGNAL(currentIndexChanged(int)),
+          this, SLOT(onDisplayedMapChanged()));
+  connect(d->TemperatureThresholdWidget, SIGNAL(valueChanged(double)),
+          this, SLOT(onDisplayedMapChanged()));
+  this->onDisplayedMapChanged();
+
+  // Ablation zone
+  connect(d->AblationCheckBox, SIGNAL(toggled(bool)),
+          this, SLOT(onAblationCriterionChanged()));
+  connect(d->AblationCriterionComboBox, SIGNAL(currentIndexChanged(int)),
+          this, SLOT(onAblationCriterionChanged()));
+  connect(d->AblationThresholdWidget, SIGNAL(valueChanged(double)),
+          this, SLOT(onAblationThresholdChanged(double)));
+  connect(d->ShowAblationSurfaceCheckBox, SIGNAL(toggled(bool)),
+          this, SLOT(updateAblationSurface()));
+  this->onAblationCriterionChanged();
+
+  // Compute Mask
+  connect(d->ApplyMaskButton, SIGNAL(clicked()),
+          this, SLOT(onApplyMaskClicked()));
+
+  connect(d->ClearMaskButton, SIGNAL(clicked()),
+          this, SLOT(onClearMaskClicked()));
+
+  // Protection Zones
+  connect(d->AddZoneButton, SIGNAL(clicked()),
+          this, SLOT(onAddZoneClicked()));
+  connect(d->ClearZonesButton, SIGNAL(clicked()),
+          this, SLOT(onClearZonesClicked()));
+
+  // Line Profiles
+  connect(d->AddProfileButton, SIGNAL(clicked()),
+          this, SLOT(onAddProfileClicked()));
+  connect(d->ClearProfilesButton, SIGNAL(clicked()),
+          this, SLOT(onClearProfilesClicked()));
+
+  connect(d->HotSpotCheckBox, SIGNAL(toggled(bool)),
+          this, SLOT(onHotSpotDetectionChanged()));
+  connect(d->HotSpotThresholdWidget, SIGNAL(valueChanged(double)),
+          this, SLOT(onHotSpotDetectionChanged()));
+  this->onHotSpotDetectionChanged();
+
+  // Progressive Preview
+  connect(d->PreviewCheckBox, SIGNAL(toggled(bool)),
+          this, SLOT(onPreviewChanged()));
+  connect(d->PreviewDownsamplingComboBox, SIGNAL(currentIndexChanged(int)),
+          this, SLOT(onPreviewChanged()));
+  connect(d->PreviewSafetyCheckBox, SIGNAL(toggled(bool)),
+          this, SLOT(onPreviewChanged()));
+  this->onPreviewChanged();
+
+  // Alarms are reported as soon as the frame is checked, not at display refresh
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  if (rtLogic)
+    {
+    this->qvtkConnect(rtLogic, vtkSlicerRTThermometryLogic::ProtectionZoneAlarmEvent,
+                      this, SLOT(onProtectionZoneAlarm(vtkObject*, void*)));
+    this->qvtkConnect(rtLogic, vtkSlicerRTThermometryLogic::ProtectionZoneClearedEvent,
+                      this, SLOT(updateProtectionZones()));
+    this->qvtkConnect(rtLogic, vtkSlicerRTThermometryLogic::PreviewReadyEvent,
+                      this, SLOT(onPreviewReady(vtkObject*, void*)));
+    this->qvtkConnect(rtLogic, vtkSlicerRTThermometryLogic::RejectionLimitEvent,
+                      this, SLOT(onRejectionLimitReached()));
+    }
+
+  // Referenceless Thermometry
+  connect(d->ReferencelessCheckBox, SIGNAL(toggled(bool)),
+          this, SLOT(updateBackgroundRing()));
+  connect(d->RingCenterSelector, SIGNAL(currentNodeChanged(vtkMRMLNode*)),
+          this, SLOT(updateBackgroundRing()));
+  connect(d->RingInnerRadiusWidget, SIGNAL(valueChanged(double)),
+          this, SLOT(updateBackgroundRing()));
+  connect(d->RingOuterRadiusWidget, SIGNAL(valueChanged(double)),
+          this, SLOT(updateBackgroundRing()));
+  connect(d->BackgroundOrderWidget, SIGNAL(valueChanged(int)),
+          this, SLOT(updateBackgroundRing()));
+
   // Sensors
   if (d->SensorTableWidget)
     {
@@ -210,6 +349,76 @@ void qSlicerRTThermometryModuleWidget::setup()
           this, SLOT(onSensorChanged(int,int)));
 
   // Time Player
+
+  // Session Recording
+  connect(d->RecordButton, SIGNAL(toggled(bool)),
+          this, SLOT(onRecordToggled(bool)));
+
+  connect(d->CheckpointButton, SIGNAL(toggled(bool)),
+          this, SLOT(onCheckpointToggled(bool)));
+  connect(d->CheckpointIntervalWidget, SIGNAL(valueChanged(int)),
+          this, SLOT(onCheckpointIntervalChanged(int)));
+  connect(d->ResumeButton, SIGNAL(clicked()),
+          this, SLOT(onResumeClicked()));
+
+  // Diagnostics
+  if (d->DiagnosticsTableWidget)
+    {
+    d->DiagnosticsTableWidget->setRowCount(vtkSlicerRTThermometryProfiler::NumberOfStages);
+    for (int stage = 0; stage < vtkSlicerRTThermometryProfiler::NumberOfStages; ++stage)
+      {
+      d->DiagnosticsTableWidget->setVerticalHeaderItem(
+        stage, new QTableWidgetItem(vtkSlicerRTThermometryProfiler::GetStageName(stage)));
+      for (int column = 0; column < d->DiagnosticsTableWidget->columnCount(); ++column)
+        {
+        QTableWidgetItem* item = new QTableWidgetItem();
+        item->setFlags(item->flags() & ~Qt::ItemIsEditable);
+        d->DiagnosticsTableWidget->setItem(stage, column, item);
+        }
+      }
+    }
+
+  connect(d->ResetDiagnosticsButton, SIGNAL(clicked()),
+          this, SLOT(onResetDiagnosticsClicked()));
+
+  connect(d->SaveDiagnosticsButton, SIGNAL(clicked()),
+          this, SLOT(onSaveDiagnosticsClicked()));
+
+  connect(d->AcknowledgeFramesCheckBox, SIGNAL(toggled(bool)),
+          this, SLOT(onAcknowledgeFramesToggled(bool)));
+
+  // Received frames are queued and processed from the event loop, one per
+  // iteration, so that bursts do not block the GUI
+  d->IngestTimer = new QTimer(this);
+  d->IngestTimer->setSingleShot(true);
+  d->IngestTimer->setInterval(0);
+  connect(d->IngestTimer, SIGNAL(timeout()),
+          this, SLOT(processQueuedFrame()));
+
+  connect(d->IngestQueueDepthWidget, SIGNAL(valueChanged(int)),
+          this, SLOT(onIngestQueueChanged()));
+  connect(d->IngestDropPolicyComboBox, SIGNAL(currentIndexChanged(int)),
+          this, SLOT(onIngestQueueChanged()));
+  this->onIngestQueueChanged();
+
+  // Refresh statistics at a fixed rate, independently of the frame rate
+  d->DiagnosticsTimer = new QTimer(this);
+  d->DiagnosticsTimer->setInterval(1000);
+  connect(d->DiagnosticsTimer, SIGNAL(timeout()),
+          this, SLOT(updateDiagnostics()));
+  connect(d->DiagnosticsTimer, SIGNAL(timeout()),
+          this, SLOT(updateRecordingStatus()));
+  connect(d->DiagnosticsTimer, SIGNAL(timeout()),
+          this, SLOT(updateCheckpointStatus()));
+  connect(d->DiagnosticsTimer, SIGNAL(timeout()),
+          this, SLOT(updateBaselineLibraryStatus()));
+  connect(d->DiagnosticsTimer, SIGNAL(timeout()),
+          this, SLOT(updateRejectionStatus()));
+  connect(d->DiagnosticsTimer, SIGNAL(timeout()),
+          this, SLOT(updateProtectionZones()));
+  connect(d->DiagnosticsTimer, SIGNAL(timeout()),
+          this, SLOT(updateAblationSurface()));
+  d->DiagnosticsTimer->start();
 }
 
 //-----------------------------------------------------------------------------
@@ -333,6 +542,8 @@ void qSlicerRTThermometryModuleWidget::onStatusConnected()
 	    this, SLOT(onGraphHidden()));
     }
 
+  this->updateAcknowledgeNode();
+
   d->ConnectionFrame->setText("Connection - Connected");
 }
 
@@ -356,50 +567,443 @@ void qSlicerRTThermometryModuleWidget::onSetBaselineClicked()
     return;
     }
 
-  d->EchoTime = d->EchoTimeWidget->value();
-  d->MagneticField = d->MagneticFieldWidget->value();
-  d->GyromagneticRatio = d->GyromagneticRatioWidget->value();
-  d->ThermalCoefficient = d->ThermalCoeffWidget->value();
-  d->ScaleFactor = d->ScaleFactorWidget->value();
-  d->BaseTemperature = d->BaseTemperatureWidget->value();
-  
-  if (d->Image1)
+  this->updateLogicParameters();
+
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  if (rtLogic)
+    {
+    rtLogic->GetIngestQueue()->Clear();
+    rtLogic->ResetBaseline();
+    d->RejectionLimitReached = false;
+    this->updateHotSpots();
+    this->updateAblationVolume();
+    this->updateAblationSurface();
+    }
+
+  if (d->TemperatureGraph)
     {
-    d->Image1->Delete();
-    d->Image1 = NULL;
+    d->TemperatureGraph->clearData();
     }
 
-  if (d->Image2)
+  d->NumberOfMarkupSample = 0;
+  d->NumberOfFramesReceived = 0;
+
+  this->qvtkConnect(d->OpenIGTLinkBuffer, vtkMRMLVolumeNode::ImageDataModifiedEvent,
+		    this, SLOT(onPhaseImageModified()));
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::onThermometryParametersChanged()
+{
+  Q_D(qSlicerRTThermometryModuleWidget);
+
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  if (!rtLogic)
     {
-    d->Image2->Delete();
-    d->Image2 = NULL;
+    return;
     }
 
-  if (d->TotalPhaseDifference)
+  double previousBase = rtLogic->GetBaseTemperature();
+  double previousFactor = rtLogic->GetPhaseToTemperatureFactor();
+  this->updateLogicParameters();
+  double base = rtLogic->GetBaseTemperature();
+  double factor = rtLogic->GetPhaseToTemperatureFactor();
+  if (base == previousBase && factor == previousFactor)
     {
-    d->TotalPhaseDifference->Delete();
-    d->TotalPhaseDifference = NULL;
+    return;
     }
-  
-  for (unsigned int i = 0; i < d->TemperatureImageList.size(); ++i)
+
+  // Temperature is affine in the accumulated phase: the history is kept and
+  // only re-mapped, no new baseline is needed
+  vtkImageData* temperature = rtLogic->GetLastTemperatureImage();
+  if (d->ViewerNode && temperature)
     {
-    vtkImageData* imData = d->TemperatureImageList[i];
-    if (imData)
+    // The maximum map is re-mapped too, the other maps restart from the next
+    // frame: show the temperature until then
+    int map = d->DisplayedMapComboBox->currentIndex() - 1;
+    if (!d->ShowingPreview && map >= 0)
       {
-      imData->Delete();
+      vtkImageData* derivedMap = rtLogic->GetDerivedMap(map);
+      d->ViewerNode->SetAndObserveImageData(derivedMap ? derivedMap : temperature);
       }
+    this->updateAllMarkups(false);
     }
-  d->TemperatureImageList.clear();
-  
-  if (d->TemperatureGraph)
+  this->updateAblationVolume();
+  this->updateAblationSurface();
+  this->updateProtectionZones();
+
+  if (d->TemperatureGraph && previousFactor != 0.0)
     {
-    d->TemperatureGraph->clearData();
+    double scale = factor / previousFactor;
+    d->TemperatureGraph->remapData(scale, base - previousBase * scale);
     }
+}
 
-  d->NumberOfMarkupSample = 0;
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::onBaselineLibrarySizeChanged(int size)
+{
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  if (rtLogic)
+    {
+    // Used from the next baseline on
+    rtLogic->SetBaselineLibrarySize(size);
+    }
+}
 
-  this->qvtkConnect(d->OpenIGTLinkBuffer, vtkMRMLVolumeNode::ImageDataModifiedEvent,
-		    this, SLOT(onPhaseImageModified()));
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::onRejectionThresholdChanged(double threshold)
+{
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  if (rtLogic)
+    {
+    rtLogic->SetRejectionThreshold(threshold);
+    }
+  this->updateRejectionStatus();
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::onTemporalFilterChanged()
+{
+  Q_D(qSlicerRTThermometryModuleWidget);
+
+  // Combo box items follow vtkSlicerRTThermometryLogic::TemporalFilters
+  int filter = d->TemporalFilterComboBox->currentIndex();
+  d->TemporalFilterWeightWidget->setEnabled(
+    filter == vtkSlicerRTThermometryLogic::ExponentialFilter);
+  d->KalmanProcessNoiseWidget->setEnabled(filter == vtkSlicerRTThermometryLogic::KalmanFilter);
+  d->KalmanMeasurementNoiseWidget->setEnabled(filter == vtkSlicerRTThermometryLogic::KalmanFilter);
+
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  if (!rtLogic)
+    {
+    return;
+    }
+  rtLogic->SetTemporalFilter(filter);
+  rtLogic->SetTemporalFilterWeight(d->TemporalFilterWeightWidget->value());
+  rtLogic->SetKalmanProcessNoise(d->KalmanProcessNoiseWidget->value());
+  rtLogic->SetKalmanMeasurementNoise(d->KalmanMeasurementNoiseWidget->value());
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::onSpatialFilterChanged()
+{
+  Q_D(qSlicerRTThermometryModuleWidget);
+
+  // Combo box items follow vtkSlicerRTThermometryLogic::SpatialFilters
+  int filter = d->SpatialFilterComboBox->currentIndex();
+  d->SpatialFilterRadiusWidget->setEnabled(filter != vtkSlicerRTThermometryLogic::NoSpatialFilter);
+  d->SpatialFilterThroughSlicesCheckBox->setEnabled(
+    filter != vtkSlicerRTThermometryLogic::NoSpatialFilter);
+
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  if (!rtLogic)
+    {
+    return;
+    }
+  rtLogic->SetSpatialFilter(filter);
+  rtLogic->SetSpatialFilterRadius(d->SpatialFilterRadiusWidget->value());
+  rtLogic->SetSpatialFilterThroughSlices(d->SpatialFilterThroughSlicesCheckBox->isChecked());
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::onDisplayedMapChanged()
+{
+  Q_D(qSlicerRTThermometryModuleWidget);
+
+  // Combo box items are the temperature, then
+  // vtkSlicerRTThermometryLogic::DerivedMaps
+  int map = d->DisplayedMapComboBox->currentIndex() - 1;
+  d->TemperatureThresholdWidget->setEnabled(
+    map == vtkSlicerRTThermometryLogic::TimeAboveThresholdMap);
+
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  if (!rtLogic)
+    {
+    return;
+    }
+  // Maps shown once keep accumulating until the next baseline
+  if (map >= 0)
+    {
+    rtLogic->SetDerivedMapEnabled(map, true);
+    }
+  rtLogic->SetTemperatureThreshold(d->TemperatureThresholdWidget->value());
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::onAblationCriterionChanged()
+{
+  Q_D(qSlicerRTThermometryModuleWidget);
+
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  if (!rtLogic)
+    {
+    return;
+    }
+
+  // Combo box items follow vtkSlicerRTThermometryLogic::AblationCriteria
+  int criterion = d->AblationCriterionComboBox->currentIndex();
+  rtLogic->SetAblationCriterion(criterion);
+  bool doseCriterion = criterion == vtkSlicerRTThermometryLogic::ThermalDoseAblation;
+  if (d->AblationCheckBox->isChecked())
+    {
+    rtLogic->SetDerivedMapEnabled(doseCriterion ?
+                                  vtkSlicerRTThermometryLogic::ThermalDoseMap :
+                                  vtkSlicerRTThermometryLogic::MaximumTemperatureMap, true);
+    }
+
+  bool wasBlocked = d->AblationThresholdWidget->blockSignals(true);
+  d->AblationThresholdWidget->setSuffix(doseCriterion ? " CEM43" : QString::fromUtf8(" \xC2\xB0""C"));
+  d->AblationThresholdWidget->setValue(doseCriterion ?
+                                       rtLogic->GetLethalDose() : rtLogic->GetLethalTemperature());
+  d->AblationThresholdWidget->blockSignals(wasBlocked);
+
+  this->updateAblationVolume();
+  this->updateAblationSurface();
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::onAblationThresholdChanged(double threshold)
+{
+  Q_D(qSlicerRTThermometryModuleWidget);
+
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  if (!rtLogic)
+    {
+    return;
+    }
+
+  if (d->AblationCriterionComboBox->currentIndex() == vtkSlicerRTThermometryLogic::ThermalDoseAblation)
+    {
+    rtLogic->SetLethalDose(threshold);
+    }
+  else
+    {
+    rtLogic->SetLethalTemperature(threshold);
+    }
+  this->updateAblationVolume();
+  this->updateAblationSurface();
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::updateAblationVolume()
+{
+  Q_D(qSlicerRTThermometryModuleWidget);
+
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  if (!rtLogic)
+    {
+    return;
+    }
+
+  // Incrementally counted, reading it does not scan the map
+  d->AblationVolumeLabel->setText(QString("%1 mL").arg(rtLogic->GetAblationVolume(), 0, 'f', 2));
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::updateAblationSurface()
+{
+  Q_D(qSlicerRTThermometryModuleWidget);
+
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  if (!rtLogic || !this->mrmlScene())
+    {
+    return;
+    }
+
+  bool visible = d->ShowAblationSurfaceCheckBox->isChecked();
+  if (!visible && !d->AblationModel)
+    {
+    return;
+    }
+
+  // Create Model node
+  if (!d->AblationModel)
+    {
+    d->AblationModel = vtkMRMLModelNode::New();
+    d->AblationModel->SetName("AblationZone");
+    this->mrmlScene()->AddNode(d->AblationModel);
+    vtkMRMLModelDisplayNode* displayNode =
+      vtkMRMLModelDisplayNode::New();
+    displayNode->SetColor(1.0, 0.5, 0.0);
+    displayNode->SetOpacity(0.5);
+    displayNode->SetSliceIntersectionVisibility(1);
+    this->mrmlScene()->AddNode(displayNode);
+    d->AblationModel->SetAndObserveDisplayNodeID(displayNode->GetID());
+    displayNode->Delete();
+    }
+  d->AblationModel->GetDisplayNode()->SetVisibility(visible ? 1 : 0);
+  if (!visible)
+    {
+    return;
+    }
+
+  // The surface is only regenerated by the logic when the zone changed
+  vtkPolyData* surface = rtLogic->GetAblationSurface();
+  if (surface->GetMTime() == d->AblationSurfaceTime && d->AblationModel->GetPolyData())
+    {
+    return;
+    }
+  d->AblationSurfaceTime = surface->GetMTime();
+
+  vtkSmartPointer<vtkTransform> ijkToRAS = vtkSmartPointer<vtkTransform>::New();
+  ijkToRAS->SetMatrix(d->RASToIJK);
+  ijkToRAS->Inverse();
+  vtkSmartPointer<vtkTransformPolyDataFilter> transformFilter =
+    vtkSmartPointer<vtkTransformPolyDataFilter>::New();
+#if VTK_MAJOR_VERSION <= 5
+  transformFilter->SetInput(surface);
+#else
+  transformFilter->SetInputData(surface);
+#endif
+  transformFilter->SetTransform(ijkToRAS);
+  transformFilter->Update();
+
+  vtkSmartPointer<vtkPolyData> rasSurface = vtkSmartPointer<vtkPolyData>::New();
+  rasSurface->DeepCopy(transformFilter->GetOutput());
+  d->AblationModel->SetAndObservePolyData(rasSurface);
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::updateRejectionStatus()
+{
+  Q_D(qSlicerRTThermometryModuleWidget);
+
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  if (!rtLogic || !d->RejectedFramesLabel)
+    {
+    return;
+    }
+
+  if (rtLogic->GetRejectionThreshold() <= 0.0)
+    {
+    d->RejectedFramesLabel->setText("");
+    return;
+    }
+  if (d->RejectionLimitReached)
+    {
+    d->RejectedFramesLabel->setText(QString("%1 frames rejected, reference lost: reset the baseline")
+                                    .arg(rtLogic->GetNumberOfRejectedFrames()));
+    return;
+    }
+  d->RejectedFramesLabel->setText(QString("%1 frames rejected")
+                                  .arg(rtLogic->GetNumberOfRejectedFrames()));
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::onRejectionLimitReached()
+{
+  Q_D(qSlicerRTThermometryModuleWidget);
+
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  if (!rtLogic)
+    {
+    return;
+    }
+
+  // Thermometry continues from the frame accepted by the logic, but the
+  // motion since the baseline shows as temperature
+  qWarning() << rtLogic->GetMaximumConsecutiveRejections()
+             << "frames were rejected in a row, the baseline should be reset";
+  d->RejectionLimitReached = true;
+  this->updateRejectionStatus();
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::updateBackgroundRing()
+{
+  Q_D(qSlicerRTThermometryModuleWidget);
+
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  if (!rtLogic)
+    {
+    return;
+    }
+
+  rtLogic->SetReferenceless(d->ReferencelessCheckBox->isChecked());
+  rtLogic->SetBackgroundPolynomialOrder(d->BackgroundOrderWidget->value());
+
+  vtkMRMLMarkupsFiducialNode* centerNode =
+    vtkMRMLMarkupsFiducialNode::SafeDownCast(d->RingCenterSelector->currentNode());
+  if (!centerNode || centerNode->GetNumberOfFiducials() == 0 || !d->OpenIGTLinkBuffer)
+    {
+    rtLogic->ClearBackgroundRing();
+    d->RingStatusLabel->setText("No ring");
+    return;
+    }
+  if (d->RingOuterRadiusWidget->value() <= d->RingInnerRadiusWidget->value())
+    {
+    rtLogic->ClearBackgroundRing();
+    d->RingStatusLabel->setText("The outer radius must be larger than the inner radius");
+    return;
+    }
+
+  double ras[4] = { 0.0, 0.0, 0.0, 1.0 };
+  centerNode->GetNthFiducialPosition(0, ras);
+  vtkSmartPointer<vtkMatrix4x4> rasToIJK = vtkSmartPointer<vtkMatrix4x4>::New();
+  d->OpenIGTLinkBuffer->GetRASToIJKMatrix(rasToIJK);
+  double ijk[4];
+  rasToIJK->MultiplyPoint(ras, ijk);
+  rtLogic->SetBackgroundRing(ijk, d->RingInnerRadiusWidget->value(),
+                             d->RingOuterRadiusWidget->value());
+
+  if (!rtLogic->HasBaseline())
+    {
+    d->RingStatusLabel->setText("Applied when the baseline is set");
+    }
+  else if (rtLogic->GetNumberOfRingVoxels() == 0)
+    {
+    d->RingStatusLabel->setText("Ring too small or outside the processing region");
+    }
+  else
+    {
+    d->RingStatusLabel->setText(QString("%1 ring voxels per slice")
+                                .arg(rtLogic->GetNumberOfRingVoxels()));
+    }
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::updateBaselineLibraryStatus()
+{
+  Q_D(qSlicerRTThermometryModuleWidget);
+
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  if (!rtLogic || !d->BaselineLibraryStatusLabel)
+    {
+    return;
+    }
+
+  int numberOfBaselines = rtLogic->GetNumberOfLibraryBaselines();
+  if (numberOfBaselines == 0)
+    {
+    d->BaselineLibraryStatusLabel->setText("");
+    }
+  else if (rtLogic->IsCapturingBaselineLibrary())
+    {
+    d->BaselineLibraryStatusLabel->setText(QString("Capturing %1/%2")
+                                           .arg(numberOfBaselines)
+                                           .arg(rtLogic->GetBaselineLibrarySize()));
+    }
+  else
+    {
+    d->BaselineLibraryStatusLabel->setText(QString("Baseline %1 of %2")
+                                           .arg(rtLogic->GetSelectedBaseline() + 1)
+                                           .arg(numberOfBaselines));
+    }
 }
 
 //-----------------------------------------------------------------------------
@@ -511,6 +1115,7 @@ void qSlicerRTThermometryModuleWidget::onMarkupNodeAdded()
       lastMarkup->Description.assign(lastMarkup->Label);
       }
     }
+  this->updateCheckpointSensors();
 }
 
 //-----------------------------------------------------------------------------
@@ -540,6 +1145,7 @@ void qSlicerRTThermometryModuleWidget::onMarkupNodeModified(vtkObject* vtkNotUse
       this->updateMarkupInWidget(modifiedMarkup);
       }
     }
+  this->updateCheckpointSensors();
 }
 
 //-----------------------------------------------------------------------------
@@ -563,6 +1169,7 @@ void qSlicerRTThermometryModuleWidget::onMarkupNodeRemoved()
     Markup* tmpMarkup = d->SensorList->GetNthMarkup(i);
     this->updateMarkupInWidget(tmpMarkup);
     }
+  this->updateCheckpointSensors();
 }
 
 //-----------------------------------------------------------------------------
@@ -603,61 +1210,122 @@ void qSlicerRTThermometryModuleWidget::onPhaseImageModified()
     }
 
   vtkImageData* dataReceived = d->OpenIGTLinkBuffer->GetImageData();
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  if (!rtLogic || !dataReceived)
+    {
+    return;
+    }
 
-  if (!d->Image1 && !d->TotalPhaseDifference)
+  // A session resumed from a checkpoint has a baseline, but no viewer yet
+  bool resumed = rtLogic->HasBaseline() && !d->ViewerNode;
+  if (!rtLogic->HasBaseline() || resumed)
     {
     d->OpenIGTLinkBuffer->GetOrigin(d->ImageOrigin);
     d->OpenIGTLinkBuffer->GetSpacing(d->ImageSpacing);
     d->OpenIGTLinkBuffer->GetRASToIJKMatrix(d->RASToIJK);
     dataReceived->GetDimensions(d->ImageDimension);
+    this->updateLineProfileEnds();
     d->ImageScalarType = dataReceived->GetScalarType();
 
-    d->Image1 = vtkImageData::New();
-    d->Image1->DeepCopy(dataReceived);
+    vtkSmartPointer<vtkMatrix4x4> ijkToRAS = vtkSmartPointer<vtkMatrix4x4>::New();
+    d->OpenIGTLinkBuffer->GetIJKToRASMatrix(ijkToRAS);
+    rtLogic->GetRecorder()->SetIJKToRASMatrix(ijkToRAS);
 
-    d->TotalPhaseDifference = vtkImageData::New();
-    d->TotalPhaseDifference->SetDimensions(d->ImageDimension);
-    d->TotalPhaseDifference->SetSpacing(d->ImageSpacing);
-    d->TotalPhaseDifference->SetOrigin(d->ImageOrigin);
-#if VTK_MAJOR_VERSION <= 5
-    d->TotalPhaseDifference->SetScalarType(d->ImageScalarType);
-    d->TotalPhaseDifference->SetNumberOfScalarComponents(1);
-    d->TotalPhaseDifference->AllocateScalars();
-#else
-    d->TotalPhaseDifference->AllocateScalars(d->ImageScalarType, 1);
-#endif
-    memset(d->TotalPhaseDifference->GetScalarPointer(), 0x00, d->TotalPhaseDifference->GetActualMemorySize()*1024);
+    if (!resumed)
+      {
+      this->updateProcessingExtent();
+      rtLogic->ProcessPhaseImage(dataReceived);
+      this->updateBackgroundRing();
 
+      this->createViewerNode();
+      return;
+      }
     this->createViewerNode();
-    return;
-    }
-
-  if (!d->Image2)
-    {
-    d->Image2 = vtkImageData::New();
     }
-  d->Image2->DeepCopy(dataReceived);
-  
 
-  if (d->Image1 && d->Image2 && 
-      d->TotalPhaseDifference && d->ViewerNode)
+  // The receive buffer is overwritten by the next frame: keep a copy until
+  // it is processed
+  d->NumberOfFramesReceived++;
+  rtLogic->GetIngestQueue()->Push(dataReceived, vtkTimerLog::GetUniversalTime());
+  if (!d->IngestTimer->isActive())
     {
-    this->computePhaseDifference(d->Image1, d->Image2);
+    d->IngestTimer->start();
     }
 }
 
 //-----------------------------------------------------------------------------
-void qSlicerRTThermometryModuleWidget::onGraphHidden()
+void qSlicerRTThermometryModuleWidget::processQueuedFrame()
 {
   Q_D(qSlicerRTThermometryModuleWidget);
-  
-  if (!d->ShowGraphCheckbox)
+
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  if (!rtLogic || !rtLogic->HasBaseline())
     {
     return;
     }
 
-  d->ShowGraphCheckbox->setChecked(false);
-}
+  vtkSlicerRTThermometryIngestQueue* queue = rtLogic->GetIngestQueue();
+  double arrivalTime = 0.0;
+  vtkImageData* frame = queue->Pop(&arrivalTime);
+  if (!frame)
+    {
+    return;
+    }
+
+  vtkSlicerRTThermometryProfiler* profiler = rtLogic->GetProfiler();
+  profiler->StartFrame();
+
+  // Frames dropped from the queue are skipped: the next one is differenced
+  // against the last processed frame. Derived maps are paced by arrival.
+  if (d->ViewerNode && rtLogic->ProcessPhaseImage(frame, arrivalTime))
+    {
+    this->newImageAdded();
+    this->updateHotSpots();
+    this->updateAblationVolume();
+    }
+  queue->Release(frame);
+
+  profiler->EndFrame();
+
+  this->sendAcknowledgment();
+
+  if (!queue->IsEmpty())
+    {
+    d->IngestTimer->start();
+    }
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::onIngestQueueChanged()
+{
+  Q_D(qSlicerRTThermometryModuleWidget);
+
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  if (!rtLogic)
+    {
+    return;
+    }
+  vtkSlicerRTThermometryIngestQueue* queue = rtLogic->GetIngestQueue();
+  // Combo box items follow vtkSlicerRTThermometryIngestQueue::DropPolicies
+  queue->SetDropPolicy(d->IngestDropPolicyComboBox->currentIndex());
+  queue->SetMaximumDepth(d->IngestQueueDepthWidget->value());
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::onGraphHidden()
+{
+  Q_D(qSlicerRTThermometryModuleWidget);
+  
+  if (!d->ShowGraphCheckbox)
+    {
+    return;
+    }
+
+  d->ShowGraphCheckbox->setChecked(false);
+}
 
 //-----------------------------------------------------------------------------
 void qSlicerRTThermometryModuleWidget::updateMarkupInWidget(Markup* modifiedMarkup)
@@ -702,9 +1370,14 @@ void qSlicerRTThermometryModuleWidget::updateMarkupInWidget(Markup* modifiedMark
     itemIndex = rowNumber;
     }
 
+  vtkSlicerRTThermometryProfiler* profiler = this->profiler();
+
   // Update temperature
+  profiler->StartStage(vtkSlicerRTThermometryProfiler::SensorSampling);
   double temp = 0.0;
-  if (d->TemperatureImageList.size() > 0)
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  if (rtLogic && rtLogic->GetNumberOfTemperatureImages() > 0)
     {
     // Get Markup position
     double mPos[4] = { modifiedMarkup->points[0].GetX(),
@@ -714,13 +1387,12 @@ void qSlicerRTThermometryModuleWidget::updateMarkupInWidget(Markup* modifiedMark
     double mIJKPos[4];
     d->RASToIJK->MultiplyPoint(mPos, mIJKPos);
 
-    vtkImageData* lastImage =
-      d->ViewerNode->GetImageData();
-    if (lastImage)
-      {
-      temp = lastImage->GetScalarComponentAsDouble(mIJKPos[0], mIJKPos[1], mIJKPos[2], 0);
-      }
+    temp = d->SensorsOnPreview ?
+      rtLogic->GetPreviewTemperatureAtIJK(mIJKPos) : rtLogic->GetTemperatureAtIJK(mIJKPos);
     }
+  profiler->StopStage(vtkSlicerRTThermometryProfiler::SensorSampling);
+
+  profiler->StartStage(vtkSlicerRTThermometryProfiler::TableUpdate);
   QString tempNumber = QString::number(temp,'f',1);
   d->SensorTableWidget->item(itemIndex, 2)->setText(tempNumber);
 
@@ -730,6 +1402,7 @@ void qSlicerRTThermometryModuleWidget::updateMarkupInWidget(Markup* modifiedMark
   modifiedMarkup->Label = markupName.str();
   d->SensorList->Modified();
   d->SensorTableWidget->item(itemIndex,1)->setText(modifiedMarkup->Description.c_str());
+  profiler->StopStage(vtkSlicerRTThermometryProfiler::TableUpdate);
 }
 
 //-----------------------------------------------------------------------------
@@ -756,80 +1429,6 @@ getMarkupIndexByID(const char* markupID)
   return -1;
 }
 
-//-----------------------------------------------------------------------------
-void qSlicerRTThermometryModuleWidget::
-computePhaseDifference(vtkImageData* im1, vtkImageData* im2)
-{
-  Q_D(qSlicerRTThermometryModuleWidget);
-
-  if (!im1 || !im2 || !d->TotalPhaseDifference)
-    {
-    return;
-    }
-
-  if (im1 == im2)
-    {
-    return;
-    }
-
-  vtkImageData* newImData = vtkImageData::New();
-  newImData->SetDimensions(d->ImageDimension);
-  newImData->SetSpacing(1.0, 1.0, 1.0); // Not sure why spacing should be 1.0, 1.0, 1.0, but not fitting otherwise
-#if VTK_MAJOR_VERSION <= 5
-  newImData->SetScalarTypeToDouble();
-  newImData->SetNumberOfScalarComponents(1);
-  newImData->AllocateScalars();
-#else
-  newImData->AllocateScalars(VTK_DOUBLE, 1);
-#endif
-  memset(newImData->GetScalarPointer(), 0x00, newImData->GetActualMemorySize()*1024);
-  d->TemperatureImageList.push_back(newImData);
-
-  short* im1BufferPointer = (short*) im1->GetPointData()->GetScalars()->GetVoidPointer(0);
-  short* im2BufferPointer = (short*) im2->GetPointData()->GetScalars()->GetVoidPointer(0);
-  short* totalPhaseDiffPointer = (short*) d->TotalPhaseDifference->GetPointData()->GetScalars()->GetVoidPointer(0);
-  double* outputBufferPointer = (double*) newImData->GetPointData()->GetScalars()->GetVoidPointer(0);
-
-  if (!im1BufferPointer || !im2BufferPointer ||
-      !totalPhaseDiffPointer || !outputBufferPointer)
-    {
-    return;
-    }
-
-  int extent[6];
-  d->TotalPhaseDifference->GetExtent(extent);
-
-  vtkIdType inc[3];
-  d->TotalPhaseDifference->GetIncrements(inc);
-
-  for (int k=0; k<extent[5]+1; ++k)
-    {
-    for (int j=0; j<extent[3]+1; ++j)
-      {
-      for (int i=0; i<extent[1]+1; ++i)
-        {
-        // Compute phase difference
-        short phaseDiff = im2BufferPointer[k*inc[2]+j*inc[1]+i] - im1BufferPointer[k*inc[2]+j*inc[1]+i];
-
-        // Sum the phase difference to get the total
-        totalPhaseDiffPointer[k*inc[2]+j*inc[1]+i] += phaseDiff;
-
-        // Compute temperature using total phase difference
-	double coefficient = 1 / (d->EchoTime * 2*M_PI*d->GyromagneticRatio * d->MagneticField * d->ThermalCoefficient);
-        double temp = d->BaseTemperature + ((totalPhaseDiffPointer[k*inc[2]+j*inc[1]+i] * M_PI / d->ScaleFactor ) * coefficient);
-
-        // Set the temperature
-        outputBufferPointer[k*inc[2]+j*inc[1]+i] = temp;
-
-        // Copy value from im2 to im1 to save im2 data for next iteration
-        im1BufferPointer[k*inc[2]+j*inc[1]+i] = im2BufferPointer[k*inc[2]+j*inc[1]+i];
-        }
-      }
-    }
- 
-  this->newImageAdded();
-}
-
 //-----------------------------------------------------------------------------
 void qSlicerRTThermometryModuleWidget::
 newImageAdded()
@@ -841,20 +1440,37 @@ newImageAdded()
     d->NumberOfMarkupSample++;
     }
 
-  if (d->ViewerNode)
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  if (d->ViewerNode && rtLogic)
     {
-    vtkImageData* imData = d->TemperatureImageList[d->TemperatureImageList.size()-1];
+    vtkImageData* imData = rtLogic->GetLastTemperatureImage();
+    int map = d->DisplayedMapComboBox->currentIndex() - 1;
+    if (imData && map >= 0 && rtLogic->GetDerivedMap(map))
+      {
+      imData = rtLogic->GetDerivedMap(map);
+      }
     if (imData)
       {
+      vtkSlicerRTThermometryProfiler* profiler = this->profiler();
+      profiler->StartStage(vtkSlicerRTThermometryProfiler::RenderHandoff);
+      if (d->ShowingPreview)
+        {
+        // Refine in place: back to the geometry of the acquired images
+        d->ViewerNode->SetRASToIJKMatrix(d->RASToIJK);
+        d->ShowingPreview = false;
+        }
       d->ViewerNode->SetAndObserveImageData(imData);
+      profiler->StopStage(vtkSlicerRTThermometryProfiler::RenderHandoff);
       this->updateAllMarkups();
+      this->updateLineProfiles();
       }
     }
 }
 
 //-----------------------------------------------------------------------------
 void qSlicerRTThermometryModuleWidget::
-updateAllMarkups()
+updateAllMarkups(bool recordGraph)
 {
   Q_D(qSlicerRTThermometryModuleWidget);
 
@@ -874,7 +1490,10 @@ updateAllMarkups()
       if (updateMarkup)
         {
         this->updateMarkupInWidget(updateMarkup);
-        this->updateTemperatureGraph(i, updateMarkup);
+        if (recordGraph)
+          {
+          this->updateTemperatureGraph(i, updateMarkup);
+          }
         }
       }
     }
@@ -900,7 +1519,10 @@ updateTemperatureGraph(int position, Markup* sensor)
   double temperature = d->SensorTableWidget->item(position,2)->text().toDouble();
   std::string sensorID(d->SensorTableWidget->item(position,0)->text().toStdString());
 
+  vtkSlicerRTThermometryProfiler* profiler = this->profiler();
+  profiler->StartStage(vtkSlicerRTThermometryProfiler::GraphUpdate);
   d->TemperatureGraph->recordNewData(sensorID, sensor->Description, temperature, d->NumberOfMarkupSample);
+  profiler->StopStage(vtkSlicerRTThermometryProfiler::GraphUpdate);
 }
 
 //-----------------------------------------------------------------------------
@@ -955,3 +1577,1004 @@ void qSlicerRTThermometryModuleWidget::createViewerNode()
   
   d->ViewerNode->SetAndObserveDisplayNodeID(displayNode->GetID());
 }
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::updateLogicParameters()
+{
+  Q_D(qSlicerRTThermometryModuleWidget);
+
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  if (!rtLogic)
+    {
+    return;
+    }
+
+  rtLogic->SetEchoTime(d->EchoTimeWidget->value());
+  rtLogic->SetMagneticField(d->MagneticFieldWidget->value());
+  rtLogic->SetGyromagneticRatio(d->GyromagneticRatioWidget->value());
+  rtLogic->SetThermalCoefficient(d->ThermalCoeffWidget->value());
+  rtLogic->SetScaleFactor(d->ScaleFactorWidget->value());
+  rtLogic->SetBaseTemperature(d->BaseTemperatureWidget->value());
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::updateParameterWidgets()
+{
+  Q_D(qSlicerRTThermometryModuleWidget);
+
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  if (!rtLogic)
+    {
+    return;
+    }
+
+  // The widgets would push their intermediate values to the logic
+  QList<QWidget*> widgets;
+  widgets << d->EchoTimeWidget << d->MagneticFieldWidget << d->GyromagneticRatioWidget
+          << d->ThermalCoeffWidget << d->ScaleFactorWidget << d->BaseTemperatureWidget
+          << d->BaselineLibrarySizeWidget << d->RejectionThresholdWidget
+          << d->TemporalFilterComboBox << d->TemporalFilterWeightWidget
+          << d->KalmanProcessNoiseWidget << d->KalmanMeasurementNoiseWidget
+          << d->SpatialFilterComboBox << d->SpatialFilterRadiusWidget
+          << d->SpatialFilterThroughSlicesCheckBox << d->CheckpointIntervalWidget;
+  QList<bool> wasBlocked;
+  foreach(QWidget* widget, widgets)
+    {
+    wasBlocked << widget->blockSignals(true);
+    }
+
+  d->EchoTimeWidget->setValue(rtLogic->GetEchoTime());
+  d->MagneticFieldWidget->setValue(rtLogic->GetMagneticField());
+  d->GyromagneticRatioWidget->setValue(rtLogic->GetGyromagneticRatio());
+  d->ThermalCoeffWidget->setValue(rtLogic->GetThermalCoefficient());
+  d->ScaleFactorWidget->setValue(rtLogic->GetScaleFactor());
+  d->BaseTemperatureWidget->setValue(rtLogic->GetBaseTemperature());
+  d->BaselineLibrarySizeWidget->setValue(rtLogic->GetBaselineLibrarySize());
+  d->RejectionThresholdWidget->setValue(rtLogic->GetRejectionThreshold());
+  d->TemporalFilterComboBox->setCurrentIndex(rtLogic->GetTemporalFilter());
+  d->TemporalFilterWeightWidget->setValue(rtLogic->GetTemporalFilterWeight());
+  d->KalmanProcessNoiseWidget->setValue(rtLogic->GetKalmanProcessNoise());
+  d->KalmanMeasurementNoiseWidget->setValue(rtLogic->GetKalmanMeasurementNoise());
+  d->SpatialFilterComboBox->setCurrentIndex(rtLogic->GetSpatialFilter());
+  d->SpatialFilterRadiusWidget->setValue(rtLogic->GetSpatialFilterRadius());
+  d->SpatialFilterThroughSlicesCheckBox->setChecked(rtLogic->GetSpatialFilterThroughSlices());
+  d->CheckpointIntervalWidget->setValue(rtLogic->GetCheckpointInterval());
+
+  for (int i = 0; i < widgets.size(); ++i)
+    {
+    widgets[i]->blockSignals(wasBlocked[i]);
+    }
+
+  // Enable the filter settings in use
+  this->onTemporalFilterChanged();
+  this->onSpatialFilterChanged();
+}
+
+//-----------------------------------------------------------------------------
+vtkSlicerRTThermometryProfiler* qSlicerRTThermometryModuleWidget::profiler()
+{
+  Q_D(qSlicerRTThermometryModuleWidget);
+
+  // The logic always has a profiler
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  return rtLogic ? rtLogic->GetProfiler() : d->NoLogicProfiler;
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::onResetDiagnosticsClicked()
+{
+  this->profiler()->Reset();
+  this->updateDiagnostics();
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::onSaveDiagnosticsClicked()
+{
+  QString fileName =
+    QFileDialog::getSaveFileName(this, "Save Latency Profile", "RTThermometryProfile.csv",
+                                 "CSV files (*.csv);;All files (*)");
+  if (fileName.isEmpty())
+    {
+    return;
+    }
+
+  if (!this->profiler()->WriteToFile(fileName.toStdString().c_str()))
+    {
+    qWarning() << "Failed to write latency profile to" << fileName;
+    }
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::updateDiagnostics()
+{
+  Q_D(qSlicerRTThermometryModuleWidget);
+
+  vtkSlicerRTThermometryProfiler* profiler = this->profiler();
+  if (!d->DiagnosticsFrame || !d->DiagnosticsTableWidget ||
+      d->DiagnosticsFrame->collapsed())
+    {
+    return;
+    }
+
+  for (int stage = 0; stage < vtkSlicerRTThermometryProfiler::NumberOfStages; ++stage)
+    {
+    d->DiagnosticsTableWidget->item(stage, 0)->setText(
+      QString::number(profiler->GetNumberOfSamples(stage)));
+    d->DiagnosticsTableWidget->item(stage, 1)->setText(
+      QString::number(profiler->GetPercentile(stage, 50.0)*1000.0, 'f', 2));
+    d->DiagnosticsTableWidget->item(stage, 2)->setText(
+      QString::number(profiler->GetPercentile(stage, 95.0)*1000.0, 'f', 2));
+    d->DiagnosticsTableWidget->item(stage, 3)->setText(
+      QString::number(profiler->GetPercentile(stage, 99.0)*1000.0, 'f', 2));
+    d->DiagnosticsTableWidget->item(stage, 4)->setText(
+      QString::number(profiler->GetMaximum(stage)*1000.0, 'f', 2));
+    }
+
+  QStringList counters;
+  for (int counter = 0; counter < vtkSlicerRTThermometryProfiler::NumberOfCounters; ++counter)
+    {
+    counters << QString("%1: %2")
+      .arg(vtkSlicerRTThermometryProfiler::GetCounterName(counter))
+      .arg(profiler->GetCounter(counter));
+    }
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  if (rtLogic)
+    {
+    vtkSlicerRTThermometryFramePool* pool = rtLogic->GetFramePool();
+    counters << QString("Frame buffers: %1 allocated, %2 recycled")
+      .arg(pool->GetNumberOfAllocations())
+      .arg(pool->GetNumberOfReuses());
+    }
+  d->DiagnosticsCountersLabel->setText(counters.join(", "));
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::onAcknowledgeFramesToggled(bool vtkNotUsed(checked))
+{
+  this->updateAcknowledgeNode();
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::updateAcknowledgeNode()
+{
+  Q_D(qSlicerRTThermometryModuleWidget);
+
+  if (!d->IGTLConnector || !d->AcknowledgeFramesCheckBox || !this->mrmlScene())
+    {
+    return;
+    }
+
+  if (!d->AcknowledgeFramesCheckBox->isChecked())
+    {
+    if (d->AcknowledgeNode)
+      {
+      d->IGTLConnector->UnregisterOutgoingMRMLNode(d->AcknowledgeNode);
+      }
+    return;
+    }
+
+  if (!d->AcknowledgeNode)
+    {
+    d->AcknowledgeNode = vtkMRMLLinearTransformNode::New();
+    d->AcknowledgeNode->SetName("RTThermometryAck");
+    d->AcknowledgeNode->HideFromEditorsOn();
+    this->mrmlScene()->AddNode(d->AcknowledgeNode);
+    }
+  d->IGTLConnector->RegisterOutgoingMRMLNode(d->AcknowledgeNode);
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::sendAcknowledgment()
+{
+  Q_D(qSlicerRTThermometryModuleWidget);
+
+  if (!d->AcknowledgeNode || !d->AcknowledgeFramesCheckBox ||
+      !d->AcknowledgeFramesCheckBox->isChecked())
+    {
+    return;
+    }
+
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  if (!rtLogic)
+    {
+    return;
+    }
+
+  // Counters travel in the translation column: frames processed since the
+  // baseline, frames received, and latency of the last frame in ms
+  vtkSmartPointer<vtkMatrix4x4> ackMatrix = vtkSmartPointer<vtkMatrix4x4>::New();
+  ackMatrix->SetElement(0, 3, rtLogic->GetNumberOfTemperatureImages());
+  ackMatrix->SetElement(1, 3, d->NumberOfFramesReceived);
+  ackMatrix->SetElement(2, 3,
+    rtLogic->GetProfiler()->GetLast(vtkSlicerRTThermometryProfiler::FrameTotal) * 1000.0);
+
+  // Modifying the matrix pushes the node to the connector
+  d->AcknowledgeNode->GetMatrixTransformToParent()->DeepCopy(ackMatrix);
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::onRecordToggled(bool checked)
+{
+  Q_D(qSlicerRTThermometryModuleWidget);
+
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  if (!rtLogic)
+    {
+    return;
+    }
+
+  vtkSlicerRTThermometrySessionRecorder* recorder = rtLogic->GetRecorder();
+  if (!checked)
+    {
+    recorder->Close();
+    this->updateRecordingStatus();
+    return;
+    }
+
+  QString fileName =
+    QFileDialog::getSaveFileName(this, "Record Session", "RTThermometrySession.rtlog",
+                                 "Thermometry sessions (*.rtlog);;All files (*)");
+  if (fileName.isEmpty() || !recorder->Open(fileName.toStdString().c_str()))
+    {
+    d->RecordButton->setChecked(false);
+    return;
+    }
+
+  // Geometry of the current session, if already known
+  if (d->OpenIGTLinkBuffer)
+    {
+    vtkSmartPointer<vtkMatrix4x4> ijkToRAS = vtkSmartPointer<vtkMatrix4x4>::New();
+    d->OpenIGTLinkBuffer->GetIJKToRASMatrix(ijkToRAS);
+    recorder->SetIJKToRASMatrix(ijkToRAS);
+    }
+  this->updateRecordingStatus();
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::updateRecordingStatus()
+{
+  Q_D(qSlicerRTThermometryModuleWidget);
+
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  if (!rtLogic || !d->RecordingStatusLabel)
+    {
+    return;
+    }
+
+  vtkSlicerRTThermometrySessionRecorder* recorder = rtLogic->GetRecorder();
+  if (recorder->HasWriteError())
+    {
+    d->RecordingStatusLabel->setText(QString("Recording stopped by a write error, %1 frames recorded")
+                                     .arg(recorder->GetNumberOfRecordedFrames()));
+    return;
+    }
+  if (!recorder->IsRecording())
+    {
+    d->RecordingStatusLabel->setText("Not recording");
+    return;
+    }
+
+  d->RecordingStatusLabel->setText(QString("%1 frames recorded, %2 dropped")
+                                   .arg(recorder->GetNumberOfRecordedFrames())
+                                   .arg(recorder->GetNumberOfDroppedFrames()));
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::onCheckpointToggled(bool checked)
+{
+  Q_D(qSlicerRTThermometryModuleWidget);
+
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  if (!rtLogic)
+    {
+    return;
+    }
+
+  vtkSlicerRTThermometryCheckpointWriter* writer = rtLogic->GetCheckpointWriter();
+  if (!checked)
+    {
+    writer->Close();
+    this->updateCheckpointStatus();
+    return;
+    }
+
+  QString fileName =
+    QFileDialog::getSaveFileName(this, "Checkpoint Session", "RTThermometrySession.rtckp",
+                                 "Thermometry checkpoints (*.rtckp);;All files (*)");
+  if (fileName.isEmpty() || !writer->Open(fileName.toStdString().c_str()))
+    {
+    d->CheckpointButton->setChecked(false);
+    return;
+    }
+
+  rtLogic->SetCheckpointInterval(d->CheckpointIntervalWidget->value());
+  this->updateCheckpointSensors();
+  // Do not wait for the next interval when a session is running
+  rtLogic->SaveCheckpoint();
+  this->updateCheckpointStatus();
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::onCheckpointIntervalChanged(int interval)
+{
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  if (rtLogic)
+    {
+    rtLogic->SetCheckpointInterval(interval);
+    }
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::onResumeClicked()
+{
+  Q_D(qSlicerRTThermometryModuleWidget);
+
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  if (!rtLogic || !d->OpenIGTLinkBuffer)
+    {
+    qWarning() << "Resuming a session requires a connected stream";
+    return;
+    }
+
+  QString fileName =
+    QFileDialog::getOpenFileName(this, "Resume Session", QString(),
+                                 "Thermometry checkpoints (*.rtckp);;All files (*)");
+  if (fileName.isEmpty())
+    {
+    return;
+    }
+
+  // A refused checkpoint leaves the logic unchanged, the running session
+  // and its widgets are kept
+  if (!rtLogic->ResumeFromCheckpoint(fileName.toStdString().c_str()))
+    {
+    qWarning() << "Failed to resume the session from" << fileName;
+    return;
+    }
+
+  this->qvtkDisconnect(d->OpenIGTLinkBuffer, vtkMRMLVolumeNode::ImageDataModifiedEvent,
+                       this, SLOT(onPhaseImageModified()));
+
+  // Frames queued for the previous session are dropped
+  rtLogic->GetIngestQueue()->Clear();
+  d->RejectionLimitReached = false;
+  this->updateParameterWidgets();
+
+  // Sensors of the checkpoint replace the current ones. Editing the markups
+  // updates the sensors of the logic, so they are copied first.
+  if (d->SensorList && rtLogic->HasBaseline())
+    {
+    std::vector<std::string> names;
+    std::vector<std::vector<double> > positions;
+    for (int sensor = 0; sensor < rtLogic->GetNumberOfCheckpointSensors(); ++sensor)
+      {
+      double ras[3];
+      rtLogic->GetCheckpointSensorPosition(sensor, ras);
+      names.push_back(rtLogic->GetCheckpointSensorName(sensor));
+      positions.push_back(std::vector<double>(ras, ras + 3));
+      }
+    d->SensorList->RemoveAllMarkups();
+    for (size_t sensor = 0; sensor < names.size(); ++sensor)
+      {
+      int markup = d->SensorList->AddFiducial(positions[sensor][0], positions[sensor][1],
+                                              positions[sensor][2]);
+      d->SensorList->SetNthMarkupDescription(markup, names[sensor]);
+      }
+    }
+
+  this->updateHotSpots();
+  this->updateAblationVolume();
+  this->updateAblationSurface();
+  this->updateProtectionZones();
+
+  if (d->TemperatureGraph)
+    {
+    d->TemperatureGraph->clearData();
+    }
+  d->NumberOfMarkupSample = 0;
+  d->NumberOfFramesReceived = 0;
+
+  this->qvtkConnect(d->OpenIGTLinkBuffer, vtkMRMLVolumeNode::ImageDataModifiedEvent,
+                    this, SLOT(onPhaseImageModified()));
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::updateCheckpointStatus()
+{
+  Q_D(qSlicerRTThermometryModuleWidget);
+
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  if (!rtLogic || !d->CheckpointStatusLabel)
+    {
+    return;
+    }
+
+  vtkSlicerRTThermometryCheckpointWriter* writer = rtLogic->GetCheckpointWriter();
+  if (!writer->IsOpen())
+    {
+    d->CheckpointStatusLabel->setText("No checkpoint");
+    return;
+    }
+
+  vtkIdType checkpoints = writer->GetNumberOfCheckpoints();
+  d->CheckpointStatusLabel->setText(checkpoints == 0 ?
+                                    QString("Waiting for a baseline") :
+                                    QString("%1 checkpoints written").arg(checkpoints));
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::updateCheckpointSensors()
+{
+  Q_D(qSlicerRTThermometryModuleWidget);
+
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  if (!rtLogic || !d->SensorList)
+    {
+    return;
+    }
+
+  // Sensors are markups of the scene: a copy goes into the checkpoints
+  rtLogic->ClearCheckpointSensors();
+  for (int i = 0; i < d->SensorList->GetNumberOfMarkups(); ++i)
+    {
+    Markup* markup = d->SensorList->GetNthMarkup(i);
+    if (markup && !markup->points.empty())
+      {
+      double ras[3] = { markup->points[0].GetX(), markup->points[0].GetY(),
+                        markup->points[0].GetZ() };
+      rtLogic->AddCheckpointSensor(markup->Description.c_str(), ras);
+      }
+    }
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::onApplyMaskClicked()
+{
+  Q_D(qSlicerRTThermometryModuleWidget);
+
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  vtkMRMLScalarVolumeNode* maskNode =
+    vtkMRMLScalarVolumeNode::SafeDownCast(d->MaskVolumeSelector->currentNode());
+  if (!rtLogic || !maskNode || !maskNode->GetImageData())
+    {
+    return;
+    }
+
+  bool success = maskNode->GetLabelMap() ?
+    rtLogic->SetMaskFromLabelMap(maskNode->GetImageData()) :
+    rtLogic->SetMaskFromMagnitude(maskNode->GetImageData(), d->MaskThresholdWidget->value());
+  if (!success)
+    {
+    d->MaskStatusLabel->setText("Invalid mask");
+    return;
+    }
+
+  vtkIdType numberOfVoxels = maskNode->GetImageData()->GetNumberOfPoints();
+  d->MaskStatusLabel->setText(
+    QString("%1% of voxels, %2 runs")
+    .arg(numberOfVoxels > 0 ? 100.0 * rtLogic->GetNumberOfMaskedVoxels() / numberOfVoxels : 0.0, 0, 'f', 1)
+    .arg(rtLogic->GetNumberOfMaskRuns()));
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::onClearMaskClicked()
+{
+  Q_D(qSlicerRTThermometryModuleWidget);
+
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  if (!rtLogic)
+    {
+    return;
+    }
+
+  rtLogic->ClearMask();
+  d->MaskStatusLabel->setText("No mask");
+  d->ProcessingROISelector->setCurrentNode(NULL);
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::updateProcessingExtent()
+{
+  Q_D(qSlicerRTThermometryModuleWidget);
+
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  if (!rtLogic)
+    {
+    return;
+    }
+
+  vtkMRMLAnnotationROINode* roiNode =
+    vtkMRMLAnnotationROINode::SafeDownCast(d->ProcessingROISelector->currentNode());
+  int extent[6];
+  if (!this->roiExtent(roiNode, extent))
+    {
+    rtLogic->ClearProcessingExtent();
+    return;
+    }
+  rtLogic->SetProcessingExtent(extent);
+}
+
+//-----------------------------------------------------------------------------
+bool qSlicerRTThermometryModuleWidget::roiExtent(vtkMRMLAnnotationROINode* roiNode, int extent[6])
+{
+  Q_D(qSlicerRTThermometryModuleWidget);
+
+  if (!roiNode || !d->OpenIGTLinkBuffer)
+    {
+    return false;
+    }
+
+  // IJK bounding box of the ROI corners in the incoming image
+  double center[3], radius[3];
+  roiNode->GetXYZ(center);
+  roiNode->GetRadiusXYZ(radius);
+  vtkSmartPointer<vtkMatrix4x4> rasToIJK = vtkSmartPointer<vtkMatrix4x4>::New();
+  d->OpenIGTLinkBuffer->GetRASToIJKMatrix(rasToIJK);
+
+  extent[0] = extent[2] = extent[4] = VTK_INT_MAX;
+  extent[1] = extent[3] = extent[5] = VTK_INT_MIN;
+  for (int corner = 0; corner < 8; ++corner)
+    {
+    double ras[4] = { center[0] + ((corner & 1) ? radius[0] : -radius[0]),
+                      center[1] + ((corner & 2) ? radius[1] : -radius[1]),
+                      center[2] + ((corner & 4) ? radius[2] : -radius[2]),
+                      1.0 };
+    double ijk[4];
+    rasToIJK->MultiplyPoint(ras, ijk);
+    for (int axis = 0; axis < 3; ++axis)
+      {
+      int index = static_cast<int>(floor(ijk[axis] + 0.5));
+      extent[2*axis] = std::min(extent[2*axis], index);
+      extent[2*axis+1] = std::max(extent[2*axis+1], index);
+      }
+    }
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::onAddZoneClicked()
+{
+  Q_D(qSlicerRTThermometryModuleWidget);
+
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  if (!rtLogic)
+    {
+    return;
+    }
+
+  double limit = d->ZoneLimitWidget->value();
+  int zone = -1;
+  vtkMRMLScalarVolumeNode* zoneNode =
+    vtkMRMLScalarVolumeNode::SafeDownCast(d->ZoneVolumeSelector->currentNode());
+  vtkMRMLAnnotationROINode* roiNode =
+    vtkMRMLAnnotationROINode::SafeDownCast(d->ZoneROISelector->currentNode());
+  if (zoneNode && zoneNode->GetImageData())
+    {
+    zone = rtLogic->AddProtectionZoneFromLabelMap(zoneNode->GetImageData(), limit, zoneNode->GetName());
+    }
+  else if (roiNode && d->OpenIGTLinkBuffer && d->OpenIGTLinkBuffer->GetImageData())
+    {
+    int extent[6];
+    this->roiExtent(roiNode, extent);
+    zone = rtLogic->AddProtectionZoneFromExtent(d->OpenIGTLinkBuffer->GetImageData()->GetDimensions(),
+                                                extent, limit, roiNode->GetName());
+    }
+
+  if (zone < 0)
+    {
+    qWarning() << "Protection zone requires a label map matching the incoming images or an ROI on a connected stream";
+    return;
+    }
+  this->updateProtectionZones();
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::onClearZonesClicked()
+{
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  if (!rtLogic)
+    {
+    return;
+    }
+
+  rtLogic->ClearProtectionZones();
+  this->updateProtectionZones();
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::onAddProfileClicked()
+{
+  Q_D(qSlicerRTThermometryModuleWidget);
+
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  vtkMRMLAnnotationRulerNode* rulerNode =
+    vtkMRMLAnnotationRulerNode::SafeDownCast(d->ProfileLineSelector->currentNode());
+  double start[3], end[3];
+  if (!rtLogic || !this->rulerEnds(rulerNode, start, end))
+    {
+    qWarning() << "Line profile requires a ruler on a connected stream";
+    return;
+    }
+
+  std::string rulerID(rulerNode->GetID());
+  if (std::find(d->ProfileNodeIDs.begin(), d->ProfileNodeIDs.end(), rulerID)
+      != d->ProfileNodeIDs.end())
+    {
+    return;
+    }
+  rtLogic->AddLineProfile(start, end, d->ProfileSamplesWidget->value(), rulerNode->GetName());
+  d->ProfileNodeIDs.push_back(rulerID);
+
+  // Taps are laid out again only when the line moves, not every frame
+  this->qvtkConnect(rulerNode, vtkCommand::ModifiedEvent,
+                    this, SLOT(updateLineProfileEnds()));
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::onClearProfilesClicked()
+{
+  Q_D(qSlicerRTThermometryModuleWidget);
+
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  if (!rtLogic)
+    {
+    return;
+    }
+
+  for (size_t profile = 0; profile < d->ProfileNodeIDs.size(); ++profile)
+    {
+    vtkMRMLNode* rulerNode = this->mrmlScene() ?
+      this->mrmlScene()->GetNodeByID(d->ProfileNodeIDs[profile].c_str()) : NULL;
+    if (rulerNode)
+      {
+      this->qvtkDisconnect(rulerNode, vtkCommand::ModifiedEvent,
+                           this, SLOT(updateLineProfileEnds()));
+      }
+    }
+  d->ProfileNodeIDs.clear();
+  rtLogic->ClearLineProfiles();
+
+  if (d->TemperatureGraph)
+    {
+    d->TemperatureGraph->clearProfiles();
+    }
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::updateLineProfileEnds()
+{
+  Q_D(qSlicerRTThermometryModuleWidget);
+
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  if (!rtLogic || !this->mrmlScene())
+    {
+    return;
+    }
+
+  for (size_t profile = 0; profile < d->ProfileNodeIDs.size(); ++profile)
+    {
+    vtkMRMLAnnotationRulerNode* rulerNode = vtkMRMLAnnotationRulerNode::SafeDownCast(
+      this->mrmlScene()->GetNodeByID(d->ProfileNodeIDs[profile].c_str()));
+    double start[3], end[3];
+    if (this->rulerEnds(rulerNode, start, end))
+      {
+      rtLogic->SetLineProfile(static_cast<int>(profile), start, end,
+                              rtLogic->GetLineProfileNumberOfSamples(static_cast<int>(profile)));
+      }
+    }
+}
+
+//-----------------------------------------------------------------------------
+bool qSlicerRTThermometryModuleWidget::rulerEnds(vtkMRMLAnnotationRulerNode* rulerNode,
+                                                 double start[3], double end[3])
+{
+  Q_D(qSlicerRTThermometryModuleWidget);
+
+  if (!rulerNode || !d->OpenIGTLinkBuffer || !d->OpenIGTLinkBuffer->GetImageData())
+    {
+    return false;
+    }
+
+  vtkSmartPointer<vtkMatrix4x4> rasToIJK = vtkSmartPointer<vtkMatrix4x4>::New();
+  d->OpenIGTLinkBuffer->GetRASToIJKMatrix(rasToIJK);
+  double ras[4] = { 0.0, 0.0, 0.0, 1.0 };
+  double ijk[4];
+  rulerNode->GetPosition1(ras);
+  rasToIJK->MultiplyPoint(ras, ijk);
+  std::copy(ijk, ijk + 3, start);
+  rulerNode->GetPosition2(ras);
+  rasToIJK->MultiplyPoint(ras, ijk);
+  std::copy(ijk, ijk + 3, end);
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::updateLineProfiles()
+{
+  Q_D(qSlicerRTThermometryModuleWidget);
+
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  if (!rtLogic || !d->TemperatureGraph || !this->mrmlScene())
+    {
+    return;
+    }
+
+  vtkSlicerRTThermometryProfiler* profiler = this->profiler();
+  profiler->StartStage(vtkSlicerRTThermometryProfiler::GraphUpdate);
+  int numberOfProfiles = std::min(rtLogic->GetNumberOfLineProfiles(),
+                                  static_cast<int>(d->ProfileNodeIDs.size()));
+  for (int profile = 0; profile < numberOfProfiles; ++profile)
+    {
+    vtkMRMLAnnotationRulerNode* rulerNode = vtkMRMLAnnotationRulerNode::SafeDownCast(
+      this->mrmlScene()->GetNodeByID(d->ProfileNodeIDs[profile].c_str()));
+    const double* values = rtLogic->GetLineProfileValues(profile);
+    if (!rulerNode || !values)
+      {
+      continue;
+      }
+    double start[3], end[3];
+    rulerNode->GetPosition1(start);
+    rulerNode->GetPosition2(end);
+    double length = sqrt(vtkMath::Distance2BetweenPoints(start, end));
+    d->TemperatureGraph->recordNewProfile(d->ProfileNodeIDs[profile],
+                                          rtLogic->GetLineProfileName(profile), length,
+                                          values, rtLogic->GetLineProfileNumberOfSamples(profile),
+                                          rtLogic->GetNumberOfTemperatureImages());
+    }
+  profiler->StopStage(vtkSlicerRTThermometryProfiler::GraphUpdate);
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::onProtectionZoneAlarm(vtkObject* vtkNotUsed(caller), void* callData)
+{
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  int* zone = reinterpret_cast<int*>(callData);
+  if (rtLogic && zone)
+    {
+    qWarning() << "Protection zone" << rtLogic->GetProtectionZoneName(*zone)
+               << "reached" << rtLogic->GetProtectionZoneMaximum(*zone)
+               << "C (limit" << rtLogic->GetProtectionZoneLimit(*zone) << "C)";
+    }
+  this->updateProtectionZones();
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::onPreviewChanged()
+{
+  Q_D(qSlicerRTThermometryModuleWidget);
+
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  if (!rtLogic)
+    {
+    return;
+    }
+
+  rtLogic->SetProgressivePreview(d->PreviewCheckBox->isChecked());
+  rtLogic->SetPreviewDownsampling(d->PreviewDownsamplingComboBox->currentIndex() == 0 ? 2 : 4);
+  rtLogic->SetPreviewSafetyCheck(d->PreviewSafetyCheckBox->isChecked());
+  d->PreviewDownsamplingComboBox->setEnabled(d->PreviewCheckBox->isChecked());
+  d->PreviewSafetyCheckBox->setEnabled(d->PreviewCheckBox->isChecked());
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::onPreviewReady(vtkObject* vtkNotUsed(caller), void* callData)
+{
+  Q_D(qSlicerRTThermometryModuleWidget);
+
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  vtkImageData* preview = reinterpret_cast<vtkImageData*>(callData);
+  int origin[3];
+  int step[3];
+  if (!rtLogic || !preview || !d->ViewerNode || !rtLogic->GetPreviewSampling(origin, step))
+    {
+    return;
+    }
+
+  if (d->PreviewSafetyCheckBox->isChecked())
+    {
+    d->SensorsOnPreview = true;
+    this->updateAllMarkups(false);
+    d->SensorsOnPreview = false;
+    }
+
+  // Derived maps have no preview
+  if (d->DisplayedMapComboBox->currentIndex() > 0)
+    {
+    return;
+    }
+
+  // Preview voxel p is the voxel origin + p * step of the acquired images
+  vtkSmartPointer<vtkMatrix4x4> previewToIJK = vtkSmartPointer<vtkMatrix4x4>::New();
+  for (int axis = 0; axis < 3; ++axis)
+    {
+    previewToIJK->SetElement(axis, axis, step[axis]);
+    previewToIJK->SetElement(axis, 3, origin[axis]);
+    }
+  previewToIJK->Invert();
+  vtkSmartPointer<vtkMatrix4x4> rasToPreview = vtkSmartPointer<vtkMatrix4x4>::New();
+  vtkMatrix4x4::Multiply4x4(previewToIJK, d->RASToIJK, rasToPreview);
+
+  vtkSlicerRTThermometryProfiler* profiler = this->profiler();
+  profiler->StartStage(vtkSlicerRTThermometryProfiler::RenderHandoff);
+  d->ViewerNode->SetRASToIJKMatrix(rasToPreview);
+  d->ViewerNode->SetAndObserveImageData(preview);
+  d->ShowingPreview = true;
+
+  // The full resolution is computed before returning to the event loop:
+  // render the slice views now
+  qSlicerLayoutManager* layoutManager = qSlicerApplication::application()->layoutManager();
+  if (layoutManager)
+    {
+    foreach (QString sliceViewName, layoutManager->sliceViewNames())
+      {
+      qMRMLSliceWidget* sliceWidget = layoutManager->sliceWidget(sliceViewName);
+      if (sliceWidget)
+        {
+        sliceWidget->sliceView()->forceRender();
+        }
+      }
+    }
+  profiler->StopStage(vtkSlicerRTThermometryProfiler::RenderHandoff);
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::onHotSpotDetectionChanged()
+{
+  Q_D(qSlicerRTThermometryModuleWidget);
+
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  if (!rtLogic)
+    {
+    return;
+    }
+
+  rtLogic->SetHotSpotDetection(d->HotSpotCheckBox->isChecked());
+  rtLogic->GetHotSpotDetector()->SetThreshold(d->HotSpotThresholdWidget->value());
+  if (!rtLogic->GetHotSpotDetection())
+    {
+    rtLogic->GetHotSpotDetector()->Clear();
+    this->updateHotSpots();
+    }
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::updateHotSpots()
+{
+  Q_D(qSlicerRTThermometryModuleWidget);
+
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  if (!rtLogic || !this->mrmlScene())
+    {
+    return;
+    }
+
+  vtkSlicerRTThermometryHotSpotDetector* detector = rtLogic->GetHotSpotDetector();
+  int numberOfHotSpots = detector->GetNumberOfHotSpots();
+  d->HotSpotStatusLabel->setText(numberOfHotSpots > 0 ?
+                                 QString("%1 hot spots").arg(numberOfHotSpots) :
+                                 QString("No hot spots"));
+  if (!d->HotSpotList && numberOfHotSpots == 0)
+    {
+    return;
+    }
+
+  // Create Markup node
+  if (!d->HotSpotList)
+    {
+    d->HotSpotList = vtkMRMLMarkupsFiducialNode::New();
+    d->HotSpotList->SetName("HotSpots");
+    d->HotSpotList->SetLocked(1);
+    this->mrmlScene()->AddNode(d->HotSpotList);
+    vtkMRMLMarkupsDisplayNode* displayNode =
+      vtkMRMLMarkupsDisplayNode::New();
+    displayNode->SetGlyphType(vtkMRMLMarkupsDisplayNode::StarBurst2D);
+    displayNode->SetGlyphScale(4.0);
+    displayNode->SetSelectedColor(1.0, 0.0, 0.0);
+    this->mrmlScene()->InsertBeforeNode(d->HotSpotList, displayNode);
+    d->HotSpotList->DisableModifiedEventOn();
+    d->HotSpotList->AddAndObserveDisplayNodeID(displayNode->GetID());
+    d->HotSpotList->DisableModifiedEventOff();
+    displayNode->Delete();
+    }
+
+  // Hottest first. Noise above the threshold can make many small regions:
+  // only the hottest are published.
+  const int maximumNumberOfMarkups = 16;
+  vtkSmartPointer<vtkMatrix4x4> ijkToRAS = vtkSmartPointer<vtkMatrix4x4>::New();
+  vtkMatrix4x4::Invert(d->RASToIJK, ijkToRAS);
+  int modified = d->HotSpotList->StartModify();
+  d->HotSpotList->RemoveAllMarkups();
+  for (int hotSpot = 0; hotSpot < std::min(numberOfHotSpots, maximumNumberOfMarkups); ++hotSpot)
+    {
+    double ijk[4] = { 0.0, 0.0, 0.0, 1.0 };
+    detector->GetHotSpotCentroid(hotSpot, ijk);
+    double ras[4];
+    ijkToRAS->MultiplyPoint(ijk, ras);
+    int markup = d->HotSpotList->AddFiducial(ras[0], ras[1], ras[2]);
+    d->HotSpotList->SetNthFiducialLabel(markup, QString("%1 C, %2 mL")
+                                        .arg(detector->GetHotSpotPeak(hotSpot), 0, 'f', 1)
+                                        .arg(detector->GetHotSpotVolume(hotSpot), 0, 'f', 2)
+                                        .toStdString());
+    }
+  d->HotSpotList->EndModify(modified);
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerRTThermometryModuleWidget::updateProtectionZones()
+{
+  Q_D(qSlicerRTThermometryModuleWidget);
+
+  vtkSlicerRTThermometryLogic* rtLogic =
+    vtkSlicerRTThermometryLogic::SafeDownCast(this->logic());
+  if (!rtLogic)
+    {
+    return;
+    }
+
+  int numberOfZones = rtLogic->GetNumberOfProtectionZones();
+  d->ZoneTableWidget->setRowCount(numberOfZones);
+  bool alarm = false;
+  for (int zone = 0; zone < numberOfZones; ++zone)
+    {
+    // Zones outside of the processing extent or the mask cannot alarm
+    bool monitored = rtLogic->IsProtectionZoneMonitored(zone);
+    QString voxels = QString::number(rtLogic->GetNumberOfProtectionZoneVoxels(zone));
+    vtkIdType clipped = rtLogic->GetNumberOfProtectionZoneClippedVoxels(zone);
+    if (!monitored)
+      {
+      voxels = "Not monitored";
+      }
+    else if (clipped > 0)
+      {
+      voxels += QString(" (%1 clipped)").arg(clipped);
+      }
+
+    QStringList values;
+    values << QString(rtLogic->GetProtectionZoneName(zone))
+           << QString::number(rtLogic->GetProtectionZoneLimit(zone), 'f', 1)
+           << QString::number(rtLogic->GetProtectionZoneMaximum(zone), 'f', 1)
+           << QString::number(rtLogic->GetProtectionZoneMean(zone), 'f', 1)
+           << voxels;
+    bool zoneAlarm = rtLogic->IsProtectionZoneInAlarm(zone);
+    alarm = alarm || zoneAlarm;
+    for (int column = 0; column < values.size(); ++column)
+      {
+      QTableWidgetItem* item = d->ZoneTableWidget->item(zone, column);
+      if (!item)
+        {
+        item = new QTableWidgetItem;
+        d->ZoneTableWidget->setItem(zone, column, item);
+        }
+      item->setText(values[column]);
+      item->setBackground(zoneAlarm ? QBrush(Qt::red) :
+                          !monitored ? QBrush(Qt::yellow) : QBrush());
+      }
+    }
+  d->ProtectionFrame->setText(alarm ? "Protection Zones (ALARM)" : "Protection Zones");
+}
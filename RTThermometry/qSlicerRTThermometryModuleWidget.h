@@ -22,11 +22,16 @@
 #include "vtkImageData.h"
 #include "vtkLookupTable.h"
 #include "vtkMatrix4x4.h"
+#include "vtkMRMLAnnotationROINode.h"
+#include "vtkMRMLAnnotationRulerNode.h"
 #include "vtkMRMLColorTableNode.h"
 #include "vtkMRMLIGTLConnectorNode.h"
 #include "vtkMRMLInteractionNode.h"
+#include "vtkMRMLLinearTransformNode.h"
 #include "vtkMRMLMarkupsDisplayNode.h"
 #include "vtkMRMLMarkupsFiducialNode.h"
+#include "vtkMRMLModelDisplayNode.h"
+#include "vtkMRMLModelNode.h"
 #include "vtkMRMLScalarVolumeDisplayNode.h"
 #include "vtkMRMLScalarVolumeNode.h"
 #include "vtkMRMLSelectionNode.h"
@@ -42,6 +47,7 @@
 
 class qSlicerRTThermometryModuleWidgetPrivate;
 class vtkMRMLNode;
+class vtkSlicerRTThermometryProfiler;
 
 /// \ingroup Slicer_QtModules_ExtensionTemplate
 class Q_SLICER_QTMODULES_RTTHERMOMETRY_EXPORT qSlicerRTThermometryModuleWidget :
@@ -60,6 +66,15 @@ public slots:
   void onServerRadioToggled(bool checked);
   void onConnectClicked();
   void onSetBaselineClicked();
+  void onThermometryParametersChanged();
+  void onBaselineLibrarySizeChanged(int size);
+  void onRejectionThresholdChanged(double threshold);
+  void onTemporalFilterChanged();
+  void onSpatialFilterChanged();
+  void onDisplayedMapChanged();
+  void onIngestQueueChanged();
+  void processQueuedFrame();
+  void updateBackgroundRing();
   void onStatusConnected();
   void onStatusDisconnected();
   void onAddSensorClicked(bool pressed);
@@ -71,6 +86,34 @@ public slots:
   void onSensorChanged(int row, int column);
   void onPhaseImageModified();
   void onGraphHidden();
+  void onResetDiagnosticsClicked();
+  void onSaveDiagnosticsClicked();
+  void onAcknowledgeFramesToggled(bool checked);
+  void onRecordToggled(bool checked);
+  void onCheckpointToggled(bool checked);
+  void onCheckpointIntervalChanged(int interval);
+  void onResumeClicked();
+  void onApplyMaskClicked();
+  void onClearMaskClicked();
+  void onAddZoneClicked();
+  void onClearZonesClicked();
+  void onProtectionZoneAlarm(vtkObject* vtkNotUsed(caller), void* callData);
+  void updateProtectionZones();
+  void onAddProfileClicked();
+  void onClearProfilesClicked();
+  void updateLineProfileEnds();
+  void onPreviewChanged();
+  void onPreviewReady(vtkObject* vtkNotUsed(caller), void* callData);
+  void onRejectionLimitReached();
+  void onHotSpotDetectionChanged();
+  void onAblationCriterionChanged();
+  void onAblationThresholdChanged(double threshold);
+  void updateAblationSurface();
+  void updateRecordingStatus();
+  void updateCheckpointStatus();
+  void updateDiagnostics();
+  void updateBaselineLibraryStatus();
+  void updateRejectionStatus();
 
 protected:
   QScopedPointer<qSlicerRTThermometryModuleWidgetPrivate> d_ptr;
@@ -78,11 +121,23 @@ protected:
   virtual void setup();
   void updateMarkupInWidget(Markup* modifiedMarkup);
   int getMarkupIndexByID(const char* markupID);
-  void computePhaseDifference(vtkImageData* im1, vtkImageData* im2);
   void newImageAdded();
-  void updateAllMarkups();
+  void updateAllMarkups(bool recordGraph = true);
   void updateTemperatureGraph(int position, Markup* sensor);
   void createViewerNode();
+  void updateLogicParameters();
+  void updateParameterWidgets();
+  void updateCheckpointSensors();
+  /// Profiler of the logic, never NULL
+  vtkSlicerRTThermometryProfiler* profiler();
+  void updateAcknowledgeNode();
+  void sendAcknowledgment();
+  void updateProcessingExtent();
+  bool roiExtent(vtkMRMLAnnotationROINode* roiNode, int extent[6]);
+  bool rulerEnds(vtkMRMLAnnotationRulerNode* rulerNode, double start[3], double end[3]);
+  void updateLineProfiles();
+  void updateHotSpots();
+  void updateAblationVolume();
 
 private:
   Q_DECLARE_PRIVATE(qSlicerRTThermometryModuleWidget);